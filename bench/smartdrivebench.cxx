@@ -0,0 +1,258 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Bus cost and latency benchmark for every public SmartDrive method.
+ *
+ * Runs against the simulator on a virtual clock, through a counting transport
+ * which charges a fixed latency per transaction on top of the wire time of the
+ * emulated bus speed. For each method it reports transactions and bytes per
+ * call, host CPU time per call and bus time per call, as JSON on stdout.
+ *
+ * Build : g++ -std=c++11 -pthread -I.. smartdrivebench.cxx ../smartdrive*.cxx -lmraa
+ * Usage : smartdrivebench [-n iterations] [-l latency_us] [-s bus_hz]...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "smartdrivesim.h"
+
+using namespace upm;
+
+/**
+ * Transport decorator counting what goes on the wire
+ */
+class CountingTransport : public SmartDriveTransport {
+
+public:
+    CountingTransport(std::shared_ptr<SmartDriveTransport> inner, uint32_t latency_us):
+        m_inner(inner), m_latency(latency_us), m_transactions(0), m_bytes(0)
+    {
+    }
+
+    mraa::Result address(uint8_t address) { return m_inner->address(address); }
+    mraa::Result writeReg(uint8_t reg, uint8_t value) { charge(2); return m_inner->writeReg(reg, value); }
+    mraa::Result write(const uint8_t* data, int size) { charge(size); return m_inner->write(data, size); }
+    int readReg(uint8_t reg) { charge(2); return m_inner->readReg(reg); }
+    int readWordReg(uint8_t reg) { charge(3); return m_inner->readWordReg(reg); }
+    int readBytesReg(uint8_t reg, uint8_t* data, int size) { charge(size + 1); return m_inner->readBytesReg(reg, data, size); }
+    std::chrono::steady_clock::time_point now() { return m_inner->now(); }
+    void sleep(std::chrono::microseconds delay) { m_inner->sleep(delay); }
+    bool realTime() const { return m_inner->realTime(); }
+
+    uint64_t transactions() const { return m_transactions; }
+    uint64_t bytes() const { return m_bytes; }
+
+private:
+    void charge(int bytes) {
+        m_transactions++;
+        m_bytes += bytes;
+        m_inner->sleep(m_latency);
+    }
+
+private:
+    std::shared_ptr<SmartDriveTransport> m_inner;
+    std::chrono::microseconds m_latency;
+    uint64_t m_transactions;
+    uint64_t m_bytes;
+};
+
+struct Result {
+    std::string name;
+    unsigned calls;
+    double transactions;
+    double bytes;
+    double wall_us;
+    double bus_us;
+};
+
+class Bench {
+
+public:
+    Bench(uint32_t bus_hz, uint32_t latency_us):
+        m_sim(new SmartDriveSimulator(true, bus_hz)),
+        m_counter(new CountingTransport(m_sim, latency_us)),
+        m_bus(new SmartDriveBus(m_counter)),
+        m_drive(m_bus)
+    {
+        m_sim->AddBoard();
+    }
+
+    SmartDrive& drive() { return m_drive; }
+
+    template <typename F>
+    void measure(const std::string& name, unsigned calls, F call) {
+        uint64_t transactions = m_counter->transactions();
+        uint64_t bytes = m_counter->bytes();
+        std::chrono::steady_clock::time_point bus = m_bus->now();
+        std::chrono::steady_clock::time_point wall = std::chrono::steady_clock::now();
+
+        for (unsigned i = 0; i < calls; i++)
+            call(m_drive);
+
+        Result result;
+        result.name = name;
+        result.calls = calls;
+        result.wall_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - wall).count() / calls;
+        result.bus_us = std::chrono::duration<double, std::micro>(m_bus->now() - bus).count() / calls;
+        result.transactions = (double) (m_counter->transactions() - transactions) / calls;
+        result.bytes = (double) (m_counter->bytes() - bytes) / calls;
+        m_results.push_back(result);
+    }
+
+    const std::vector<Result>& results() const { return m_results; }
+
+private:
+    std::shared_ptr<SmartDriveSimulator> m_sim;
+    std::shared_ptr<CountingTransport> m_counter;
+    std::shared_ptr<SmartDriveBus> m_bus;
+    SmartDrive m_drive;
+    std::vector<Result> m_results;
+};
+
+
+static void
+run(Bench& bench, unsigned n) {
+    //non blocking calls
+    bench.measure("command", n, [](SmartDrive& sd) { sd.command('R'); });
+    bench.measure("GetBattVoltage", n, [](SmartDrive& sd) { sd.GetBattVoltage(); });
+    bench.measure("ReadTachometerPosition", n, [](SmartDrive& sd) { sd.ReadTachometerPosition(Motor_ID_1); });
+    bench.measure("ReadPower", n, [](SmartDrive& sd) { sd.ReadPower(); });
+    bench.measure("GetMotorStatus", n, [](SmartDrive& sd) { sd.GetMotorStatus(Motor_ID_1); });
+    bench.measure("IsTimeDone(BOTH)", n, [](SmartDrive& sd) { sd.IsTimeDone(Motor_ID_BOTH); });
+    bench.measure("IsTachoDone(BOTH)", n, [](SmartDrive& sd) { sd.IsTachoDone(Motor_ID_BOTH); });
+    bench.measure("ReadSnapshot", n, [](SmartDrive& sd) { sd.ReadSnapshot(); });
+    bench.measure("PrintMotorStatus", n, [](SmartDrive& sd) { sd.PrintMotorStatus(Motor_ID_1); });
+    bench.measure("SetPerformanceParameters", n, [](SmartDrive& sd) { sd.SetPerformanceParameters(1, 2, 3, 4, 5, 6, 7, 8); });
+    bench.measure("ApplyPerformanceParameters(same)", n, [](SmartDrive& sd) {
+        SmartDrive::PerformanceParameters params = {1, 2, 3, 4, 5, 6, 7, 8};
+        sd.ApplyPerformanceParameters(params);
+    });
+    unsigned flip = 0;
+    bench.measure("ApplyPerformanceParameters(one)", n, [&flip](SmartDrive& sd) {
+        SmartDrive::PerformanceParameters params = {1, 2, 3, 4, 5, 6, 7, (uint8_t) (8 + (flip++ & 1))};
+        sd.ApplyPerformanceParameters(params);
+    });
+    bench.measure("ApplyPerformanceParameters(all)", n, [&flip](SmartDrive& sd) {
+        uint16_t k = (flip++ & 1) ? 100 : 200;
+        SmartDrive::PerformanceParameters params = {k, k, k, k, k, k, (uint8_t) k, (uint8_t) k};
+        sd.ApplyPerformanceParameters(params);
+    });
+    bench.measure("ReadPerformanceParameters", n, [](SmartDrive& sd) { sd.ReadPerformanceParameters(); });
+    bench.measure("Run_Unlimited(1)", n, [](SmartDrive& sd) { sd.Run_Unlimited(Motor_ID_1, Dir_Forward, Speed_Medium); });
+    bench.measure("Run_Unlimited(BOTH)", n, [](SmartDrive& sd) { sd.Run_Unlimited(Motor_ID_BOTH, Dir_Forward, Speed_Medium); });
+    bench.measure("StopMotor(BOTH)", n, [](SmartDrive& sd) { sd.StopMotor(Motor_ID_BOTH, Action_Brake); });
+    bench.measure("Run_Seconds(1)", n, [](SmartDrive& sd) { sd.Run_Seconds(Motor_ID_1, Dir_Forward, Speed_Slow, 1, false, Action_Brake); });
+    bench.measure("Run_Seconds(BOTH)", n, [](SmartDrive& sd) { sd.Run_Seconds(Motor_ID_BOTH, Dir_Forward, Speed_Slow, 1, false, Action_Brake); });
+    bench.measure("Run_Degrees(1)", n, [](SmartDrive& sd) { sd.Run_Degrees(Motor_ID_1, Dir_Forward, Speed_Slow, 90, false, Action_Brake); });
+    bench.measure("Run_Degrees(BOTH)", n, [](SmartDrive& sd) { sd.Run_Degrees(Motor_ID_BOTH, Dir_Forward, Speed_Slow, 90, false, Action_Brake); });
+    bench.measure("Run_Rotations(BOTH)", n, [](SmartDrive& sd) { sd.Run_Rotations(Motor_ID_BOTH, Dir_Forward, Speed_Slow, 1, false, Action_Brake); });
+    bench.measure("Run_Tacho(BOTH)", n, [](SmartDrive& sd) { sd.Run_Tacho(Motor_ID_BOTH, Speed_Slow, 0, false, Action_Brake); });
+    bench.measure("SetTachoSetpoint(1)", n, [&flip](SmartDrive& sd) { sd.SetTachoSetpoint(Motor_ID_1, Speed_Slow, (flip++ & 1) ? 90 : 0, Action_Brake); });
+    bench.measure("SetSpeedCap(idle)", n, [&flip](SmartDrive& sd) { sd.SetSpeedCap((flip++ & 1) ? 50 : 100); });
+    bench.drive().Run_Unlimited(Motor_ID_BOTH, Dir_Forward, Speed_Medium);
+    bench.measure("SetSpeedCap(running BOTH)", n, [&flip](SmartDrive& sd) { sd.SetSpeedCap((flip++ & 1) ? 50 : 100); });
+    bench.drive().SetSpeedCap(100);
+    bench.drive().StopMotor(Motor_ID_BOTH, Action_Brake);
+
+    //blocking calls, each one is a complete move
+    unsigned moves = (n < 5) ? n : 5;
+    bench.measure("Run_Seconds(BOTH,wait)", moves, [](SmartDrive& sd) { sd.Run_Seconds(Motor_ID_BOTH, Dir_Forward, Speed_Slow, 1, true, Action_Brake); });
+    bench.measure("Run_Degrees(BOTH,wait)", moves, [](SmartDrive& sd) { sd.Run_Degrees(Motor_ID_BOTH, Dir_Forward, Speed_Medium, 360, true, Action_Brake); });
+    bench.measure("Run_Rotations(1,wait)", moves, [](SmartDrive& sd) { sd.Run_Rotations(Motor_ID_1, Dir_Reverse, Speed_Full, 2, true, Action_Brake); });
+    bench.measure("Run_Tacho(2,wait)", moves, [](SmartDrive& sd) { sd.Run_Tacho(Motor_ID_2, Speed_Full, 0, true, Action_BrakeHold); });
+    bench.measure("Run_Seconds_Async(BOTH)", moves, [](SmartDrive& sd) { sd.Run_Seconds_Async(Motor_ID_BOTH, Dir_Forward, Speed_Slow, 1, Action_Brake).get(); });
+    bench.measure("Run_Degrees_Async(BOTH)", moves, [](SmartDrive& sd) { sd.Run_Degrees_Async(Motor_ID_BOTH, Dir_Forward, Speed_Medium, 360, Action_Brake).get(); });
+    bench.measure("Run_Rotations_Async(1)", moves, [](SmartDrive& sd) { sd.Run_Rotations_Async(Motor_ID_1, Dir_Reverse, Speed_Full, 2, Action_Brake).get(); });
+    bench.measure("Run_Tacho_Async(2)", moves, [](SmartDrive& sd) { sd.Run_Tacho_Async(Motor_ID_2, Speed_Full, 0, Action_BrakeHold).get(); });
+    bench.measure("WaitUntilTimeDone(idle)", n, [](SmartDrive& sd) { sd.WaitUntilTimeDone(Motor_ID_BOTH); });
+    bench.measure("WaitUntilTachoDone(idle)", n, [](SmartDrive& sd) { sd.WaitUntilTachoDone(Motor_ID_BOTH); });
+}
+
+
+int
+main(int argc, char** argv) {
+    unsigned iterations = 100;
+    uint32_t latency_us = 0;
+    std::vector<uint32_t> speeds;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:s:")) != -1) {
+        switch (opt) {
+        case 'n': iterations = atoi(optarg); break;
+        case 'l': latency_us = atoi(optarg); break;
+        case 's': speeds.push_back(atoi(optarg)); break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-l latency_us] [-s bus_hz]...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations == 0)
+        iterations = 1;
+    if (speeds.empty()) {
+        speeds.push_back(100000);
+        speeds.push_back(400000);
+    }
+
+    //the driver still talks on stdout, keep it out of the JSON
+    fflush(stdout);
+    int json = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+
+    std::vector<std::vector<Result> > runs;
+    for (size_t i = 0; i < speeds.size(); i++) {
+        Bench bench(speeds[i], latency_us);
+        run(bench, iterations);
+        runs.push_back(bench.results());
+    }
+
+    fflush(stdout);
+    dup2(json, STDOUT_FILENO);
+    close(json);
+    close(null);
+
+    printf("{\n  \"iterations\": %u,\n  \"latency_us\": %u,\n  \"runs\": [\n", iterations, latency_us);
+    for (size_t i = 0; i < runs.size(); i++) {
+        printf("    {\n      \"bus_hz\": %u,\n      \"methods\": [\n", speeds[i]);
+        for (size_t j = 0; j < runs[i].size(); j++) {
+            const Result& r = runs[i][j];
+            printf("        {\"name\": \"%s\", \"calls\": %u, \"transactions\": %.2f, \"bytes\": %.2f, "
+                   "\"wall_us\": %.2f, \"bus_us\": %.2f}%s\n",
+                   r.name.c_str(), r.calls, r.transactions, r.bytes, r.wall_us, r.bus_us,
+                   (j + 1 < runs[i].size()) ? "," : "");
+        }
+        printf("      ]\n    }%s\n", (i + 1 < runs.size()) ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * SmartDrive daemon : discovers the boards of the given I2C buses and serves
+ * them to SmartDriveClient processes on a Unix socket until SIGINT or SIGTERM.
+ *
+ * Build : g++ -std=c++11 -pthread -I.. smartdrived.cxx ../smartdrive*.cxx -lmraa -lrt
+ * Usage : smartdrived [-s socket] [-d] [-p rate_hz] [-b bus]...
+ *         -d goes through /dev/i2c-N instead of mraa
+ *         -p also publishes the board states in shared memory, see SmartDriveStateReader
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "smartdrivediscovery.h"
+#include "smartdrivei2cdev.h"
+#include "smartdriveserver.h"
+#include "smartdriveshm.h"
+
+using namespace upm;
+
+int
+main(int argc, char** argv) {
+    std::string path = SmartDriveProto_SOCKET;
+    std::vector<int> numbers;
+    bool i2cdev = false;
+    unsigned publish_hz = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:dp:b:")) != -1) {
+        switch (opt) {
+        case 's': path = optarg; break;
+        case 'd': i2cdev = true; break;
+        case 'p': publish_hz = atoi(optarg); break;
+        case 'b': numbers.push_back(atoi(optarg)); break;
+        default:
+            fprintf(stderr, "usage: %s [-s socket] [-d] [-p rate_hz] [-b bus]...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (numbers.empty())
+        numbers.push_back(1);
+
+    //every thread started from here on inherits the mask, sigwait() gets the signals
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    std::vector<std::shared_ptr<SmartDriveBus> > buses;
+    try {
+        for (size_t i = 0; i < numbers.size(); i++) {
+            if (i2cdev)
+                buses.push_back(std::make_shared<SmartDriveBus>(std::make_shared<I2cDevTransport>(numbers[i])));
+            else
+                buses.push_back(std::make_shared<SmartDriveBus>(numbers[i]));
+        }
+    } catch (std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    SmartDriveDiscovery discovery(buses);
+    std::vector<SmartDriveDiscovery::Board> boards = discovery.Run();
+
+    SmartDriveServer server(path);
+    std::unique_ptr<SmartDriveStatePublisher> publisher;
+    if (publish_hz != 0) {
+        try {
+            publisher.reset(new SmartDriveStatePublisher());
+        } catch (std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < boards.size(); i++) {
+        const SmartDriveDiscovery::Board& board = boards[i];
+        if (board.result != mraa::SUCCESS) {
+            fprintf(stderr, "bus %d address 0x%02x: not ready (%d)\n", numbers[board.bus], board.address, board.result);
+            continue;
+        }
+        int index = server.AddBoard(board.drive, board.bus);
+        if (publisher)
+            publisher->AddBoard(board.drive, board.bus);
+        printf("board %d: bus %d address 0x%02x firmware %s, %.0f mV\n", index, numbers[board.bus], board.address,
+               board.firmware.c_str(), board.battery_mv);
+    }
+
+    if (server.Start() != mraa::SUCCESS) {
+        fprintf(stderr, "cannot listen on %s\n", path.c_str());
+        return 1;
+    }
+    if (publisher)
+        publisher->Start(publish_hz);
+    printf("serving on %s\n", path.c_str());
+    fflush(stdout);
+
+    int received;
+    sigwait(&signals, &received);
+    if (publisher)
+        publisher->Stop();
+    server.Stop();
+
+    SmartDriveServer::Stats stats = server.GetStats();
+    printf("connections %llu requests %llu failed %llu max batch %u orphan stops %llu\n",
+           (unsigned long long) stats.connections, (unsigned long long) stats.requests,
+           (unsigned long long) stats.failed_requests, stats.max_batch, (unsigned long long) stats.orphan_stops);
+    return 0;
+}
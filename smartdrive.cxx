@@ -29,15 +29,45 @@
 #include <stdexcept>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
 
 #include "smartdrive.h"
+#include "smartdriveregs.h"
+#include "smartdrivetrace.h"
 
 
 using namespace upm;
 
-SmartDrive::SmartDrive(int i2c_bus, int address): m_controlAddr(address), m_i2ControlCtx(i2c_bus)
+SmartDrive::SmartDrive(int i2c_bus, int address): m_controlAddr(address), m_bus(new SmartDriveBus(i2c_bus)), m_lastError(mraa::SUCCESS), m_snapshotMaxAge(0),
+    m_writeElision(false), m_shadowValid(0), m_elidedWrites(0),
+    m_mvPerCount(SmartDrive_VOLTAGE_MULTIPLIER), m_maPerCount(SmartDrive_CURRENT_MULTIPLIER), m_maOffset(0), m_speedCap(100),
+    m_velocityGain(0), m_waitTimeout(0), m_pollerStop(false)
 {
-    mraa::Result ret = m_i2ControlCtx.address(m_controlAddr);
+    init();
+}
+
+SmartDrive::SmartDrive(std::shared_ptr<SmartDriveBus> bus, int address): m_controlAddr(address), m_bus(bus), m_lastError(mraa::SUCCESS), m_snapshotMaxAge(0),
+    m_writeElision(false), m_shadowValid(0), m_elidedWrites(0),
+    m_mvPerCount(SmartDrive_VOLTAGE_MULTIPLIER), m_maPerCount(SmartDrive_CURRENT_MULTIPLIER), m_maOffset(0), m_speedCap(100),
+    m_velocityGain(0), m_waitTimeout(0), m_pollerStop(false)
+{
+    init();
+}
+
+void
+SmartDrive::init()
+{
+    m_snapshot = Snapshot();
+    m_snapshot.valid = false;
+    m_move[0] = m_move[1] = MoveInfo();
+    m_lastWait = WaitResult();
+    m_isRunning[0] = m_isRunning[1] = false;
+    m_preloaded[0] = m_preloaded[1] = false;
+
+    mraa::Result ret = m_bus->select(m_controlAddr);
     if (ret != mraa::SUCCESS) {
         throw std::invalid_argument(std::string(__FUNCTION__) +
                                     ": mraa_i2c_address() failed");
@@ -45,375 +75,1073 @@ SmartDrive::SmartDrive(int i2c_bus, int address): m_controlAddr(address), m_i2Co
     }
 }
 
+SmartDrive::~SmartDrive()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_asyncLock);
+        m_pollerStop = true;
+    }
+    m_asyncCond.notify_one();
+    if (m_poller.joinable())
+        m_poller.join();
+
+    //nobody will poll them anymore
+    for (std::list<AsyncMove>::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+        it->promise.set_value(it->waiter.result);
+}
+
 
-void
+static_assert(SmartDrive_SHADOW_SIZE <= 64, "shadow validity bits must fit m_shadowValid");
+
+//The bus retries failed transactions and recovers the board address itself,
+//what comes back here is final.
+
+//a GO with the time or tacho bit starts a move which ends on its own, writing it again starts another one
+static bool
+oneShot(uint8_t reg, uint8_t value) {
+	return (reg == SmartDrive_CMD_A_M1 || reg == SmartDrive_CMD_A_M2) &&
+	       (value & SmartDrive_CONTROL_GO) && (value & (SmartDrive_CONTROL_TIME | SmartDrive_CONTROL_TACHO));
+}
+
+//A write the board may have taken although the host saw it fail is retried only
+//when applying it twice does no harm : stops and encoder resets are, the sync go
+//and one shot GOs are not, e.g. a relative tacho move would run twice its distance.
+static bool
+retryable(const uint8_t* array, int size) {
+	for (int i = 1; i < size; i++) {
+		uint8_t reg = array[0] + i - 1;
+		if ((reg == SmartDrive_COMMAND && array[i] == SmartDrive_SYNC_GO) || oneShot(reg, array[i]))
+			return false;
+	}
+	return true;
+}
+
+mraa::Result
 SmartDrive::writeByte(uint8_t addr, uint8_t value) {
-	try {
-		m_i2ControlCtx.address(m_controlAddr);
-		m_i2ControlCtx.writeReg(addr, value);
-	} catch (int e) {
-		std::cout << "Failed to write " << value << " to address " << addr << " --> " << e << std::endl;
+	if (m_writeElision) {
+		uint8_t frame[2] = {addr, value};
+		return writeArray(frame, sizeof(frame));
 	}
+	InvalidateSnapshot(); //any command may change the status bits we have cached
+	SMARTDRIVE_INSTR_START();
+	uint8_t frame[2] = {addr, value};
+	mraa::Result ret = m_bus->writeReg(m_controlAddr, addr, value, retryable(frame, sizeof(frame)));
+	SMARTDRIVE_INSTR_STOP(m_instr, addr, true, ret == mraa::SUCCESS);
+	if (ret != mraa::SUCCESS)
+		SMARTDRIVE_ERROR("Failed to write %lld to address %llx --> %lld", value, addr, ret);
+	m_lastError = ret;
+	return ret;
 }
 
-uint8_t
+SmartDriveResult<uint8_t>
 SmartDrive::readByte(uint8_t addr) {
-	try {
-		m_i2ControlCtx.address(m_controlAddr);
-		return m_i2ControlCtx.readReg(addr);
-	} catch (int e) {
-		std::cout << "Failed to read byte at address " << addr << " --> " << e << std::endl;
+	SMARTDRIVE_INSTR_START();
+	int value = m_bus->readReg(m_controlAddr, addr);
+	SMARTDRIVE_INSTR_STOP(m_instr, addr, false, value >= 0);
+	if (value < 0) {
+		SMARTDRIVE_ERROR("Failed to read byte at address %llx", addr);
+		shadowLost();
+		return SmartDriveResult<uint8_t>::Failure(mraa::ERROR_UNSPECIFIED);
 	}
-	return -1;
+	return (uint8_t) value;
 }
 
-void
+mraa::Result
 SmartDrive::writeArray(uint8_t* array, int size) {
-	try {
-		m_i2ControlCtx.address(m_controlAddr); //Second : I was not resetting bus adress of device evreytime ebfore acessing it
-											   //I believe we need to do this everytime before accessing bus, because i2c bus may be used by many devices, se we need to tell which device we want to control EVERYTIME
-		m_i2ControlCtx.write(array, size); //First : Here, i was tryignt o calculate array size dynamically, but it's not supported here, so i have to pass array size statically in variable
-	} catch (int e) {
-		std::cout << "Failed to write array values to address " << array[0] << " --> " << e << std::endl;
+	if (!m_writeElision)
+		return transmit(array, size);
+
+	std::lock_guard<std::mutex> lock(m_shadowLock);
+	if (shadowMatches(array, size)) {
+		m_elidedWrites++;
+		m_lastError = mraa::SUCCESS;
+		return mraa::SUCCESS;
+	}
+	mraa::Result ret = transmit(array, size);
+	shadowStore(array, size, ret == mraa::SUCCESS);
+	return ret;
+}
+
+mraa::Result
+SmartDrive::transmit(const uint8_t* array, int size) {
+	InvalidateSnapshot();
+	SMARTDRIVE_INSTR_START();
+	//the bus re-addresses the device only when another board was used in between
+	mraa::Result ret = m_bus->write(m_controlAddr, array, size, retryable(array, size)); //array size can't be computed here, so it is passed by the caller
+	SMARTDRIVE_INSTR_STOP(m_instr, array[0], true, ret == mraa::SUCCESS);
+	if (ret != mraa::SUCCESS)
+		SMARTDRIVE_ERROR("Failed to write array values to address %llx --> %lld", array[0], ret);
+	m_lastError = ret;
+	return ret;
+}
+
+bool
+SmartDrive::shadowMatches(const uint8_t* array, int size) const {
+	int first = array[0] - SmartDrive_SHADOW_START;
+	if (first < 0 || first + size - 1 > SmartDrive_SHADOW_SIZE)
+		return false;
+	for (int i = 1; i < size; i++) {
+		uint8_t reg = array[0] + i - 1;
+		int n = first + i - 1;
+		if (reg == SmartDrive_COMMAND || oneShot(reg, array[i]) ||
+			!(m_shadowValid & (1ULL << n)) || m_shadow[n] != array[i])
+			return false;
+	}
+	return true;
+}
+
+void
+SmartDrive::shadowStore(const uint8_t* array, int size, bool written) {
+	if (!written) {
+		m_shadowValid = 0;   //a failed write may have been partly applied, or the board reset
+		return;
+	}
+	for (int i = 1; i < size; i++) {
+		uint8_t reg = array[0] + i - 1;
+		if (reg < SmartDrive_SHADOW_START || reg >= SmartDrive_SHADOW_START + SmartDrive_SHADOW_SIZE)
+			continue;
+		if (reg == SmartDrive_COMMAND) {
+			//stops and the sync go act on the motors, the same blocks must be sent again to take effect
+			for (int r = SmartDrive_SETPT_M1; r <= SmartDrive_CMD_A_M2; r++)
+				m_shadowValid &= ~(1ULL << (r - SmartDrive_SHADOW_START));
+			continue;
+		}
+		m_shadow[reg - SmartDrive_SHADOW_START] = array[i];
+		m_shadowValid |= 1ULL << (reg - SmartDrive_SHADOW_START);
 	}
 }
 
-uint16_t
+void
+SmartDrive::SetWriteElision(bool enable) {
+	std::lock_guard<std::mutex> lock(m_shadowLock);
+	m_shadowValid = 0;   //not tracked while disabled
+	m_writeElision = enable;
+}
+
+void
+SmartDrive::InvalidateShadow() {
+	std::lock_guard<std::mutex> lock(m_shadowLock);
+	m_shadowValid = 0;
+}
+
+void
+SmartDrive::shadowLost() {
+	if (m_writeElision)
+		InvalidateShadow();
+}
+
+SmartDriveResult<uint16_t>
 SmartDrive::readInteger(uint8_t addr) {
-	try {
-		m_i2ControlCtx.address(m_controlAddr);
-		return m_i2ControlCtx.readWordReg(addr);
-	} catch (int e) {
-		std::cout << "Failed to read value at address " << addr << " --> " << e << std::endl;
+	SMARTDRIVE_INSTR_START();
+	int value = m_bus->readWordReg(m_controlAddr, addr);
+	SMARTDRIVE_INSTR_STOP(m_instr, addr, false, value >= 0);
+	if (value < 0) {
+		SMARTDRIVE_ERROR("Failed to read value at address %llx", addr);
+		shadowLost();
+		return SmartDriveResult<uint16_t>::Failure(mraa::ERROR_UNSPECIFIED);
 	}
-	return -1;
+	return (uint16_t) value;
 }
 
-uint32_t
+SmartDriveResult<uint32_t>
 SmartDrive::readLongSigned(uint8_t addr) {
 	uint8_t bytes[4]={0};
 
-	try {
-		m_i2ControlCtx.address(m_controlAddr);
-		m_i2ControlCtx.readBytesReg(addr, bytes, sizeof(bytes)/sizeof(uint8_t)); 
-		return (bytes[0]|(bytes[1]<<8)|(bytes[2]<<16)|(bytes[3]<<24));
-	} catch (int e) {
-		std::cout << "Failed to read integer value at address " << addr << " --> " << e << std::endl;
+	if (readBlock(addr, bytes, sizeof(bytes)/sizeof(uint8_t)) != mraa::SUCCESS)
+		return SmartDriveResult<uint32_t>::Failure(mraa::ERROR_UNSPECIFIED);
+	return (uint32_t) SmartDriveReg::POSITION_M1::decode(bytes); //only used for the positions
+}
+
+mraa::Result
+SmartDrive::readBlock(uint8_t addr, uint8_t* data, int size) {
+	SMARTDRIVE_INSTR_START();
+	int ret = m_bus->readBytesReg(m_controlAddr, addr, data, size);
+	SMARTDRIVE_INSTR_STOP(m_instr, addr, false, ret == size);
+	if (ret != size) {
+		SMARTDRIVE_ERROR("Failed to read block at address %llx --> %lld", addr, ret);
+		shadowLost();
+		return mraa::ERROR_UNSPECIFIED;
 	}
-	return -1;
+	return mraa::SUCCESS;
+}
+
+bool
+SmartDrive::fetchSnapshot(Snapshot& snap) {
+	uint8_t block[SmartDrive_SNAPSHOT_SIZE] = {0};
+	typedef SmartDriveReg::SNAPSHOT Block;
+
+	if (readBlock(Block::start, block, Block::size) != mraa::SUCCESS) {
+		SMARTDRIVE_WARN("Failed to read snapshot block");
+		snap.valid = false;
+		return false;
+	}
+
+	snap.position[0] = Block::get<SmartDriveReg::POSITION_M1>(block);
+	snap.position[1] = Block::get<SmartDriveReg::POSITION_M2>(block);
+	snap.status[0] = Block::get<SmartDriveReg::STATUS_M1>(block);
+	snap.status[1] = Block::get<SmartDriveReg::STATUS_M2>(block);
+	snap.tasks[0] = Block::get<SmartDriveReg::TASKS_M1>(block);
+	snap.tasks[1] = Block::get<SmartDriveReg::TASKS_M2>(block);
+	snap.pid[0] = Block::get<SmartDriveReg::P_Kp>(block);
+	snap.pid[1] = Block::get<SmartDriveReg::P_Ki>(block);
+	snap.pid[2] = Block::get<SmartDriveReg::P_Kd>(block);
+	snap.pid[3] = Block::get<SmartDriveReg::S_Kp>(block);
+	snap.pid[4] = Block::get<SmartDriveReg::S_Ki>(block);
+	snap.pid[5] = Block::get<SmartDriveReg::S_Kd>(block);
+	snap.passcount = Block::get<SmartDriveReg::PASSCOUNT>(block);
+	snap.tolerance = Block::get<SmartDriveReg::PASSTOLERANCE>(block);
+	snap.checksum = Block::get<SmartDriveReg::CHKSUM>(block);
+	snap.battVoltage = Block::get<SmartDriveReg::BATT_VOLTAGE>(block);
+	snap.resetStatus = Block::get<SmartDriveReg::RESETSTATUS>(block);
+	snap.current[0] = Block::get<SmartDriveReg::CURRENT_M1>(block);
+	snap.current[1] = Block::get<SmartDriveReg::CURRENT_M2>(block);
+	if (snap.resetStatus != 0)
+		shadowLost();   //the board restarted, its registers are back to their defaults
+	snap.timestamp = m_bus->now();
+	snap.valid = true;
+	return true;
+}
+
+const SmartDrive::Snapshot&
+SmartDrive::ReadSnapshot() {
+	fetchSnapshot(m_snapshot);
+	return m_snapshot;
+}
+
+bool
+SmartDrive::ReadSnapshot(Snapshot& snap) {
+	return fetchSnapshot(snap);
+}
+
+const SmartDrive::Snapshot&
+SmartDrive::GetSnapshot() {
+	if (!m_snapshot.valid ||
+		m_bus->now() - m_snapshot.timestamp > m_snapshotMaxAge)
+		return ReadSnapshot();
+	return m_snapshot;
 }
 
 void
+SmartDrive::SetSnapshotMaxAge(uint32_t max_age_us) {
+	m_snapshotMaxAge = std::chrono::microseconds(max_age_us);
+}
+
+void
+SmartDrive::InvalidateSnapshot() {
+	m_snapshot.valid = false;
+}
+
+mraa::Result
 SmartDrive::command(uint8_t cmd) {
-    std::cout << "Running Command : " << cmd << std::endl;
-    writeByte(SmartDrive_COMMAND, cmd);
+    SMARTDRIVE_TRACE("Running Command : %llx", cmd);
+    return writeByte(SmartDrive_COMMAND, cmd);
+}
+
+
+SmartDriveResult<float>
+SmartDrive::TryGetBattVoltage() {
+	if (snapshotEnabled()) {
+		const Snapshot& snap = GetSnapshot();
+		if (!snap.valid)
+			return SmartDriveResult<float>::Failure(mraa::ERROR_UNSPECIFIED);
+		return BatteryMillivolts(snap.battVoltage);
+	}
+	SmartDriveResult<uint8_t> value = readByte(SmartDrive_BATT_VOLTAGE);
+	if (!value)
+		return SmartDriveResult<float>::Failure(value.error());
+	return BatteryMillivolts(value.value());
 }
 
 
 float
 SmartDrive::GetBattVoltage() {
-	uint8_t value = 0;
-	try {
-		value = readByte(SmartDrive_BATT_VOLTAGE);
-		return (value * SmartDrive_VOLTAGE_MULTIPLIER);
-	} catch (int e) {
-        std::cout << "Error: Could not read voltage -> " << e << std::endl;
+	return TryGetBattVoltage().value_or(-1.0f);
+}
+
+
+SmartDriveResult<SmartDrive::PowerReading>
+SmartDrive::ReadPower() {
+	typedef SmartDriveReg::POWER Block;
+	uint8_t block[Block::size];
+
+	mraa::Result ret = readBlock(Block::start, block, Block::size);
+	if (ret != mraa::SUCCESS)
+		return SmartDriveResult<PowerReading>::Failure(ret);
+
+	PowerReading reading;
+	reading.battery_mv = BatteryMillivolts(Block::get<SmartDriveReg::BATT_VOLTAGE>(block));
+	reading.current_ma[0] = CurrentMilliamps(Block::get<SmartDriveReg::CURRENT_M1>(block));
+	reading.current_ma[1] = CurrentMilliamps(Block::get<SmartDriveReg::CURRENT_M2>(block));
+	reading.resetStatus = Block::get<SmartDriveReg::RESETSTATUS>(block);
+	reading.timestamp = m_bus->now();
+	if (reading.resetStatus != 0)
+		shadowLost();
+	return reading;
+}
+
+
+void
+SmartDrive::SetPowerCalibration(float mv_per_count, float ma_per_count, float ma_offset) {
+	m_mvPerCount = mv_per_count;
+	m_maPerCount = ma_per_count;
+	m_maOffset = ma_offset;
+}
+
+
+SmartDrive::MotorCommand
+SmartDrive::capped(const MotorCommand& cmd, uint8_t cap) const {
+	MotorCommand out = cmd;
+	int speed = (int8_t) cmd.speed;
+	if (speed > cap)
+		out.speed = cap;
+	else if (speed < -cap)
+		out.speed = (uint8_t) -cap;
+	return out;
+}
+
+
+void
+SmartDrive::trackRunning(const MotorCommand* m1, const MotorCommand* m2, bool go) {
+	const MotorCommand* cmds[2] = {m1, m2};
+	std::lock_guard<std::mutex> lock(m_capLock);
+	for (int m = 0; m < 2; m++) {
+		if (cmds[m] == NULL)
+			continue;
+		//only unlimited speed commands keep running, the others end on their own
+		m_isRunning[m] = go && cmds[m]->speed != 0 &&
+		                 !(cmds[m]->cmd_a & (SmartDrive_CONTROL_TIME | SmartDrive_CONTROL_TACHO));
+		m_running[m] = *cmds[m];
+	}
+}
+
+
+void
+SmartDrive::SetSpeedCap(uint8_t cap) {
+	if (cap > 100)
+		cap = 100;
+	//no stop or other command may go out between the check and the re-send
+	std::lock_guard<std::mutex> send(m_sendLock);
+	uint8_t previous = m_speedCap.exchange(cap);
+	if (previous == cap)
+		return;
+
+	//send the running speed commands again when their effective speed changes
+	for (int m = 0; m < 2; m++) {
+		MotorCommand running;
+		bool isRunning;
+		{
+			std::lock_guard<std::mutex> lock(m_capLock);
+			running = m_running[m];
+			isRunning = m_isRunning[m];
+		}
+		int speed = abs((int8_t) running.speed);
+		if (isRunning && std::min(speed, (int) previous) != std::min(speed, (int) cap))
+			writeCommands((m == 0) ? &running : NULL, (m == 1) ? &running : NULL, true);
+	}
+}
+
+
+
+SmartDriveResult<uint32_t>
+SmartDrive::TryReadTachometerPosition(MotorID_t motor_number) {
+    if (snapshotEnabled()) {
+        const Snapshot& snap = GetSnapshot();
+        if (!snap.valid)
+            return SmartDriveResult<uint32_t>::Failure(mraa::ERROR_UNSPECIFIED);
+        return snap.position[(motor_number == 1) ? 0 : 1];
     }
-    return -1.0f;
+    if (motor_number == 1 )
+        return readLongSigned(SmartDrive_POSITION_M1);
+    else
+        return readLongSigned(SmartDrive_POSITION_M2);
 }
 
 
 uint32_t
 SmartDrive::ReadTachometerPosition(MotorID_t motor_number) {
-    try {
-        if (motor_number == 1 )
-            return readLongSigned(SmartDrive_POSITION_M1);
-        else
-            return readLongSigned(SmartDrive_POSITION_M2);
-	} catch (int e) {
-        std::cout << "Error: Could not read encoders" << std::endl;
-	}
-	return -1;
+    return TryReadTachometerPosition(motor_number).value_or(-1);
 }
 
 
-void
+mraa::Result
+SmartDrive::sendCommands(const MotorCommand* m1, const MotorCommand* m2, bool go) {
+        std::lock_guard<std::mutex> lock(m_sendLock);
+        return writeCommands(m1, m2, go);
+}
+
+
+mraa::Result
+SmartDrive::writeCommands(const MotorCommand* m1, const MotorCommand* m2, bool go) {
+        trackRunning(m1, m2, go);
+        MotorCommand limited[2];
+        uint8_t cap = m_speedCap.load();
+        if ( cap < 100 ) {
+            if ( m1 != NULL )
+                m1 = &(limited[0] = capped(*m1, cap));
+            if ( m2 != NULL )
+                m2 = &(limited[1] = capped(*m2, cap));
+        }
+        if ( m1 != NULL && m2 != NULL ) {
+            //both blocks are contiguous (SETPT_M1 up to CMD_A_M2) : one write, then the sync go
+            SmartDriveReg::MOTORS::Bytes frame = SmartDriveReg::MOTORS::build(
+                m1->setpoint, m1->speed, m1->time, m1->cmd_b, m1->cmd_a,
+                m2->setpoint, m2->speed, m2->time, m2->cmd_b, m2->cmd_a);
+            mraa::Result ret = writeArray(frame.data, sizeof(frame.data));
+            //never start the motors on a half written command
+            if ( go && ret == mraa::SUCCESS )
+                ret = writeByte(SmartDrive_COMMAND, SmartDrive_SYNC_GO);
+            return ret;
+        }
+
+        const MotorCommand* cmd = (m1 != NULL) ? m1 : m2;
+        if ( cmd == NULL )
+            return mraa::SUCCESS;
+        uint8_t cmd_a = cmd->cmd_a | (go ? SmartDrive_CONTROL_GO : 0);
+        //setpoint unused without tacho control, start at the speed register
+        if ( cmd->cmd_a & SmartDrive_CONTROL_TACHO ) {
+            if ( m1 != NULL ) {
+                SmartDriveReg::MOTOR_M1::Bytes frame = SmartDriveReg::MOTOR_M1::build(cmd->setpoint, cmd->speed, cmd->time, cmd->cmd_b, cmd_a);
+                return writeArray(frame.data, sizeof(frame.data));
+            }
+            SmartDriveReg::MOTOR_M2::Bytes frame = SmartDriveReg::MOTOR_M2::build(cmd->setpoint, cmd->speed, cmd->time, cmd->cmd_b, cmd_a);
+            return writeArray(frame.data, sizeof(frame.data));
+        }
+        if ( m1 != NULL ) {
+            SmartDriveReg::SPEED_M1_BLOCK::Bytes frame = SmartDriveReg::SPEED_M1_BLOCK::build(cmd->speed, cmd->time, cmd->cmd_b, cmd_a);
+            return writeArray(frame.data, sizeof(frame.data));
+        }
+        SmartDriveReg::SPEED_M2_BLOCK::Bytes frame = SmartDriveReg::SPEED_M2_BLOCK::build(cmd->speed, cmd->time, cmd->cmd_b, cmd_a);
+        return writeArray(frame.data, sizeof(frame.data));
+}
+
+
+mraa::Result
+SmartDrive::sendCommand(MotorID_t motor_number, const MotorCommand& cmd) {
+        return sendCommands(( motor_number != Motor_ID_2 ) ? &cmd : NULL,
+                     ( motor_number != Motor_ID_1 ) ? &cmd : NULL, true);
+}
+
+
+static uint8_t
+nextActionControl(MotorAction_t next_action) {
+        if ( next_action == Action_Brake )
+            return SmartDrive_CONTROL_BRK;
+        if ( next_action == Action_BrakeHold )
+            return SmartDrive_CONTROL_BRK | SmartDrive_CONTROL_ON;
+        return 0;
+}
+
+
+SmartDrive::MotorCommand
+SmartDrive::tachoCommand(uint32_t target, uint8_t speed, bool relative, MotorAction_t next_action) {
+        MotorCommand cmd = {target, speed, 0, 0, SmartDrive_CONTROL_SPEED | SmartDrive_CONTROL_TACHO};
+
+        if ( relative )
+            cmd.cmd_a |= SmartDrive_CONTROL_RELATIVE;
+        cmd.cmd_a |= nextActionControl(next_action);
+        return cmd;
+}
+
+
+SmartDrive::MotorCommand
+SmartDrive::timedCommand(Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action) {
+        MotorCommand cmd = {0, speed, duration, 0, SmartDrive_CONTROL_SPEED | SmartDrive_CONTROL_TIME};
+
+        cmd.cmd_a |= nextActionControl(next_action);
+        if ( direction != Dir_Forward )
+            cmd.speed = speed * -1;
+        return cmd;
+}
+
+
+mraa::Result
 SmartDrive::Run_Unlimited(MotorID_t motor_number, Direction_t direction, uint8_t speed) {
-        uint8_t ctrl = 0;
-        ctrl |= SmartDrive_CONTROL_SPEED;
-        ctrl |= SmartDrive_CONTROL_BRK;
-
-        std::cout << "Running with speed : " << (int) speed << std::endl;
-        
-        if ( motor_number != Motor_ID_BOTH )
-            ctrl |= SmartDrive_CONTROL_GO;
+        MotorCommand cmd = {0, speed, 0, 0, SmartDrive_CONTROL_SPEED | SmartDrive_CONTROL_BRK};
+
+        SMARTDRIVE_TRACE("Running with speed : %lld", speed);
+
         if ( direction != Dir_Forward )
-            speed = speed * -1;
-        if ( motor_number != Motor_ID_2) {
-            uint8_t array [5] = {SmartDrive_SPEED_M1, speed, 0, 0, ctrl};
-            writeArray(array,5);
-		}
-        if ( motor_number != Motor_ID_1) {
-            uint8_t array [5] = {SmartDrive_SPEED_M2, speed, 0, 0, ctrl};
-            writeArray(array,5); 
-		}
-        if ( motor_number == Motor_ID_BOTH )
-            writeByte(SmartDrive_COMMAND,0x53);
+            cmd.speed = speed * -1;
+        return sendCommand(motor_number, cmd);
 }
 
 
-void
+mraa::Result
 SmartDrive::StopMotor(MotorID_t motor_number, MotorAction_t next_action ) {
+        //a speed cap change cannot send the motor running again past this stop
+        std::lock_guard<std::mutex> send(m_sendLock);
+        {
+            std::lock_guard<std::mutex> lock(m_capLock);
+            for (int m = 0; m < 2; m++)
+                if ( motor_number & (1 << m) )
+                    m_isRunning[m] = false;
+        }
         if ( next_action != Action_Float )
-            writeByte(SmartDrive_COMMAND, 'A'+motor_number-1);
+            return writeByte(SmartDrive_COMMAND, 'A'+motor_number-1);
         else
-            writeByte(SmartDrive_COMMAND, 'a'+motor_number-1);
+            return writeByte(SmartDrive_COMMAND, 'a'+motor_number-1);
 }
 
 
-void
+mraa::Result
 SmartDrive::Run_Seconds(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, bool wait_for_completion, MotorAction_t next_action ) {
-        uint8_t ctrl = 0;
-        ctrl |= SmartDrive_CONTROL_SPEED;
-        ctrl |= SmartDrive_CONTROL_TIME;
+        MotorCommand cmd = timedCommand(direction, speed, duration, next_action);
 
-        if ( next_action == Action_Brake )
-            ctrl |= SmartDrive_CONTROL_BRK;
-        if ( next_action == Action_BrakeHold ) {
-            ctrl |= SmartDrive_CONTROL_BRK;
-            ctrl |= SmartDrive_CONTROL_ON;
-		}
-        if ( motor_number != Motor_ID_BOTH )
-            ctrl |= SmartDrive_CONTROL_GO;
-        if ( direction != Dir_Forward )
-            speed = speed * -1;
-        if ( (motor_number & 0x01) != 0 ) {
-            uint8_t array[5] = {SmartDrive_SPEED_M1, speed, duration, 0, ctrl};
-			printf("Motor 1 running | cmd = %2x %2x %2x %2x %2x\n", array[0] ,array[1] ,array[2] ,array[3] , array[4]);
-            writeArray(array,5);
-		}
-        if ( (motor_number & 0x02) != 0 ) {
-            uint8_t array[5] = {SmartDrive_SPEED_M2, speed, duration, 0, ctrl};
-			printf("Motor 2 running | cmd = %2x %2x %2x %2x %2x\n", array[0] ,array[1] ,array[2] ,array[3] , array[4]);
-            writeArray(array,5);
-		}
-        if ( motor_number == Motor_ID_BOTH )
-            writeByte(SmartDrive_COMMAND, 0x53);      
-		printf("Speed Motor 1 : %2x\n", readByte(SmartDrive_SPEED_M1));
-		printf("Speed Motor 2 : %2x\n", readByte(SmartDrive_SPEED_M2));
-		printf("Time Motor 1 : %2x\n", readByte(SmartDrive_TIME_M1));
-		printf("Time Motor 2 : %2x\n", readByte(SmartDrive_TIME_M2));
-        if ( wait_for_completion ) {
-            sleep(1); //this delay is required for the status byte to be available for reading.
-            WaitUntilTimeDone(motor_number);
-		}
+        if ( (motor_number & 0x01) != 0 )
+			SMARTDRIVE_TRACE("Motor 1 running | cmd = %llx %llx %llx %llx %llx", SmartDrive_SPEED_M1, cmd.speed, cmd.time, cmd.cmd_b, cmd.cmd_a);
+        if ( (motor_number & 0x02) != 0 )
+			SMARTDRIVE_TRACE("Motor 2 running | cmd = %llx %llx %llx %llx %llx", SmartDrive_SPEED_M2, cmd.speed, cmd.time, cmd.cmd_b, cmd.cmd_a);
+        mraa::Result ret = sendCommand(motor_number, cmd);
+        if ( ret != mraa::SUCCESS )
+            return ret;
+		//read back only when tracing, these four reads used to double the bus cost of every call
+		SMARTDRIVE_TRACE("Speed Motor 1 : %llx", readByte(SmartDrive_SPEED_M1).value_or(0));
+		SMARTDRIVE_TRACE("Speed Motor 2 : %llx", readByte(SmartDrive_SPEED_M2).value_or(0));
+		SMARTDRIVE_TRACE("Time Motor 1 : %llx", readByte(SmartDrive_TIME_M1).value_or(0));
+		SMARTDRIVE_TRACE("Time Motor 2 : %llx", readByte(SmartDrive_TIME_M2).value_or(0));
+        recordMove(motor_number, false, false, 0, cmd.speed, duration);
+        if ( wait_for_completion )
+            WaitUntilTimeDone(motor_number, m_waitTimeout);
+        return ret;
 }
 
 
-void
-SmartDrive::WaitUntilTimeDone(MotorID_t motor_number) {
-        while (IsTimeDone(motor_number) == false)
-            sleep(1);       
+SmartDrive::WaitResult
+SmartDrive::WaitUntilTimeDone(MotorID_t motor_number, uint32_t timeout_ms) {
+        return waitUntilDone(motor_number, SmartDrive_MOTOR_IN_TIME_MODE, timeout_ms);
 }
 
    
+SmartDriveResult<bool>
+SmartDrive::motorsIdle(MotorID_t motor_number, uint8_t busy_mask) {
+        uint8_t status[2] = {0, 0};
+        int first = (motor_number == Motor_ID_2) ? 1 : 0;
+        int last = (motor_number == Motor_ID_1) ? 0 : 1;
+
+        if ( snapshotEnabled() ) {
+            const Snapshot& snap = GetSnapshot();
+            if ( !snap.valid )
+                return SmartDriveResult<bool>::Failure(mraa::ERROR_UNSPECIFIED);
+            for (int m = first; m <= last; m++)
+                status[m] = snap.status[m];
+        } else {
+            for (int m = first; m <= last; m++) {
+                SmartDriveResult<uint8_t> value = readByte((m == 0) ? SmartDrive_STATUS_M1 : SmartDrive_STATUS_M2);
+                if ( !value )
+                    return SmartDriveResult<bool>::Failure(value.error());
+                status[m] = value.value();
+            }
+        }
+        return (((status[0] & busy_mask) == 0) && ((status[1] & busy_mask) == 0) );
+}
+
+
+SmartDriveResult<bool>
+SmartDrive::TryIsTimeDone(MotorID_t motor_number) {
+        return motorsIdle(motor_number, SmartDrive_MOTOR_IN_TIME_MODE);  //look for time bits to be zero
+}
+
+
 bool
 SmartDrive::IsTimeDone(MotorID_t motor_number) {
-		uint8_t result_1 = 0, result_2 = 0;
-        if ( motor_number != Motor_ID_2 )
-            result_1 = readByte(SmartDrive_STATUS_M1);
-		if ( motor_number != Motor_ID_1 )
-            result_2 = readByte(SmartDrive_STATUS_M2);
-        return (((result_1 & 0x40) == 0) && ((result_2 & 0x40) == 0) );  //look for time bits to be zero
+        //a failed read never reports the move as done
+        return TryIsTimeDone(motor_number).value_or(false);
 }
 
 
-void
+mraa::Result
 SmartDrive::Run_Degrees(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t degrees, bool wait_for_completion, MotorAction_t next_action) {
-        uint8_t ctrl = 0;
-        ctrl |= SmartDrive_CONTROL_SPEED;
-        ctrl |= SmartDrive_CONTROL_TACHO;
-        ctrl |= SmartDrive_CONTROL_RELATIVE;
+        MotorCommand cmd = tachoCommand(( direction != Dir_Forward ) ? degrees * -1 : degrees, speed, true, next_action);
 
-        uint32_t d = degrees;
-        if ( direction != Dir_Forward )
-            d = degrees * -1 ;
-        
-        uint8_t t4 = (d/0x1000000);
-        uint8_t t3 = ((d%0x1000000)/0x10000);
-        uint8_t t2 = (((d%0x1000000)%0x10000)/0x100);
-        uint8_t t1 = (((d%0x1000000)%0x10000)%0x100);
-        
-        if ( next_action == Action_Brake )
-            ctrl |= SmartDrive_CONTROL_BRK;
-        if ( next_action == Action_BrakeHold ) {
-            ctrl |= SmartDrive_CONTROL_BRK;
-            ctrl |= SmartDrive_CONTROL_ON;
-		}
-        if ( motor_number != Motor_ID_BOTH )
-            ctrl |= SmartDrive_CONTROL_GO;     
-        if ( motor_number != Motor_ID_2) {
-            uint8_t array[9] = {SmartDrive_SETPT_M1, t1, t2, t3, t4, speed, 0, 0, ctrl};
-            writeArray(array,9);
-		}
-        if ( motor_number != Motor_ID_1){
-            uint8_t array[9] = {SmartDrive_SETPT_M2, t1, t2, t3, t4, speed, 0, 0, ctrl};
-            writeArray(array,9);
-		}
-        if ( motor_number == Motor_ID_BOTH )
-            writeByte(SmartDrive_COMMAND, 0x53);         
-        if ( wait_for_completion ) {
-            sleep(1);//this delay is required for the status byte to be available for reading.
-            WaitUntilTachoDone(motor_number);
-        }
+        mraa::Result ret = sendCommand(motor_number, cmd);
+        if ( ret != mraa::SUCCESS )
+            return ret;
+        recordMove(motor_number, true, false, degrees, speed, 0);
+        if ( wait_for_completion )
+            WaitUntilTachoDone(motor_number, m_waitTimeout);
+        return ret;
 }
 
 
-void
+mraa::Result
 SmartDrive::Run_Rotations(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t rotations, bool wait_for_completion, MotorAction_t next_action) {
-        uint8_t ctrl = 0;
-        ctrl |= SmartDrive_CONTROL_SPEED;
-        ctrl |= SmartDrive_CONTROL_TACHO;
-        ctrl |= SmartDrive_CONTROL_RELATIVE;
-        
-        uint32_t d = rotations * 360;
-        if ( direction != Dir_Forward )
-            d = (rotations * 360) * -1;
-        
-        uint8_t t4 = (d/0x1000000);
-        uint8_t t3 = ((d%0x1000000)/0x10000);
-        uint8_t t2 = (((d%0x1000000)%0x10000)/0x100);
-        uint8_t t1 = (((d%0x1000000)%0x10000)%0x100);
-        
-        if ( next_action == Action_Brake )
-            ctrl |= SmartDrive_CONTROL_BRK;
-        if ( next_action == Action_BrakeHold ) {
-            ctrl |= SmartDrive_CONTROL_BRK;
-            ctrl |= SmartDrive_CONTROL_ON;
-		}
-        if ( motor_number != Motor_ID_BOTH )
-            ctrl |= SmartDrive_CONTROL_GO;
-        if ( motor_number != Motor_ID_2) {
-            uint8_t array[9] = {SmartDrive_SETPT_M1, t1, t2, t3, t4, speed, 0, 0, ctrl};
-            writeArray(array,9);
-		}
-        if ( motor_number != Motor_ID_1) {
-            uint8_t array[9] = {SmartDrive_SETPT_M2, t1, t2, t3, t4, speed, 0, 0, ctrl};
-            writeArray(array,9);
-		}
-        if ( motor_number == Motor_ID_BOTH )
-            writeByte(SmartDrive_COMMAND, 0x53);
-        if ( wait_for_completion) {
-            sleep(1); //this delay is required for the status byte to be available for reading.
-            WaitUntilTachoDone(motor_number);
-		}
+        MotorCommand cmd = tachoCommand(( direction != Dir_Forward ) ? (rotations * 360) * -1 : rotations * 360, speed, true, next_action);
+
+        mraa::Result ret = sendCommand(motor_number, cmd);
+        if ( ret != mraa::SUCCESS )
+            return ret;
+        recordMove(motor_number, true, false, rotations * 360, speed, 0);
+        if ( wait_for_completion )
+            WaitUntilTachoDone(motor_number, m_waitTimeout);
+        return ret;
 }
 
 
-void
+mraa::Result
 SmartDrive::Run_Tacho(MotorID_t motor_number, uint8_t speed, uint32_t tacho_count, bool wait_for_completion, MotorAction_t next_action) {
-        uint8_t ctrl = 0;
-        ctrl |= SmartDrive_CONTROL_SPEED;
-        ctrl |= SmartDrive_CONTROL_TACHO;
-        
-        uint32_t d = tacho_count;
-        
-        uint8_t t4 = (d/0x1000000);
-        uint8_t t3 = ((d%0x1000000)/0x10000);
-        uint8_t t2 = (((d%0x1000000)%0x10000)/0x100);
-        uint8_t t1 = (((d%0x1000000)%0x10000)%0x100);
-        
-        if ( next_action == Action_Brake )
-            ctrl |= SmartDrive_CONTROL_BRK;
-        if ( next_action == Action_BrakeHold ) {
-            ctrl |= SmartDrive_CONTROL_BRK;
-            ctrl |= SmartDrive_CONTROL_ON;
-		}
-        if ( motor_number != Motor_ID_BOTH )
-            ctrl |= SmartDrive_CONTROL_GO;
-        if ( motor_number != Motor_ID_2){
-            uint8_t array[9]= {SmartDrive_SETPT_M1, t1, t2, t3, t4, speed, 0, 0, ctrl};
-            writeArray(array,9);
-		}
-        if ( motor_number != Motor_ID_1){
-            uint8_t array[9]= {SmartDrive_SETPT_M2, t1, t2, t3, t4, speed, 0, 0, ctrl};
-            writeArray(array,9);
-		}
-        if ( motor_number == Motor_ID_BOTH )
-            writeByte(SmartDrive_COMMAND, 0x53);  
-        if ( wait_for_completion )
-            sleep(1); //this delay is required for the status byte to be available for reading.
-            WaitUntilTachoDone(motor_number);
+        mraa::Result ret = SetTachoSetpoint(motor_number, speed, tacho_count, next_action);
+        //a command the board never took must not be waited for, it would look completed
+        if ( ret == mraa::SUCCESS && wait_for_completion )
+            WaitUntilTachoDone(motor_number, m_waitTimeout);
+        return ret;
 }
 
 
-void
-SmartDrive::WaitUntilTachoDone(MotorID_t motor_number) {
-        while (IsTachoDone(motor_number) == false)
-            usleep(30000);
+mraa::Result
+SmartDrive::SetTachoSetpoint(MotorID_t motor_number, uint8_t speed, uint32_t tacho_count, MotorAction_t next_action) {
+        MotorCommand cmd = tachoCommand(tacho_count, speed, false, next_action);
+        mraa::Result ret = sendCommand(motor_number, cmd);
+        if ( ret == mraa::SUCCESS )
+            recordMove(motor_number, true, true, tacho_count, speed, 0);
+        return ret;
 }
 
 
-bool
-SmartDrive::IsTachoDone(MotorID_t motor_number) {
-		uint8_t result_1 = 0, result_2 = 0;
+SmartDrive::WaitResult
+SmartDrive::WaitUntilTachoDone(MotorID_t motor_number, uint32_t timeout_ms) {
+        return waitUntilDone(motor_number, SmartDrive_MOTOR_POS_CTRL_ON, timeout_ms);
+}
+
+
+void
+SmartDrive::SetCompletionTimeout(uint32_t timeout_ms) {
+        m_waitTimeout = timeout_ms;
+}
 
+
+void
+SmartDrive::recordMove(MotorID_t motor_number, bool tacho, bool absolute, uint32_t target, uint8_t speed, uint8_t duration) {
+        MoveInfo move;
+        move.tacho = tacho;
+        move.absolute = absolute;
+        move.target = target;
+        move.speed = (uint8_t) abs((int8_t) speed); //reverse speeds are sent negated
+        move.duration = duration;
+        move.issued = m_bus->now();
+        std::lock_guard<std::mutex> lock(m_moveLock);
         if ( motor_number != Motor_ID_2 )
-            result_1 = readByte(SmartDrive_STATUS_M1);     
+            m_move[0] = move;
         if ( motor_number != Motor_ID_1 )
-            result_2 = readByte(SmartDrive_STATUS_M2);
-        //look for both time bits to be zero
-        return (((result_1 & 0x08) == 0) && ((result_2 & 0x08) == 0) );
+            m_move[1] = move;
 }
 
 
 void
-SmartDrive::SetPerformanceParameters( uint16_t Kp_tacho, uint16_t Ki_tacho, uint16_t Kd_tacho, uint16_t Kp_speed, uint16_t Ki_speed, uint16_t Kd_speed, uint8_t passcount, uint8_t tolerance) {
-    uint8_t Kp_t1 = Kp_tacho%0x100;
-    uint8_t Kp_t2 = Kp_tacho/0x100;    
-    uint8_t Ki_t1 = Ki_tacho%0x100;
-    uint8_t Ki_t2 = Ki_tacho/0x100;
-    uint8_t Kd_t1 = Kd_tacho%0x100;
-    uint8_t Kd_t2 = Kd_tacho/0x100;
-    uint8_t Kp_s1 = Kp_speed%0x100;       
-    uint8_t Kp_s2 = Kp_speed/0x100;
-    uint8_t Ki_s1 = Ki_speed%0x100; 
-    uint8_t Ki_s2 = Ki_speed/0x100;
-    uint8_t Kd_s1 = Kd_speed%0x100;
-    uint8_t Kd_s2 = Kd_speed/0x100;
+SmartDrive::initWaiter(Waiter& waiter, MotorID_t motor_number, uint8_t busy_mask, uint32_t timeout_ms) {
+        waiter.first = (motor_number == Motor_ID_2) ? 1 : 0;
+        waiter.last = (motor_number == Motor_ID_1) ? 0 : 1;
+        waiter.busy_mask = busy_mask;
+        {
+            std::lock_guard<std::mutex> lock(m_moveLock);
+            waiter.move[0] = m_move[0];
+            waiter.move[1] = m_move[1];
+        }
+        waiter.issued = waiter.move[waiter.first].issued;
+        if ( waiter.move[waiter.last].issued > waiter.issued )
+            waiter.issued = waiter.move[waiter.last].issued;
+        waiter.has_deadline = (timeout_ms != 0);
+        waiter.deadline = m_bus->now() + std::chrono::milliseconds(timeout_ms);
+        waiter.prev_time = waiter.issued;
+        waiter.seen_busy = false;
+        waiter.have_prev = false;
+        waiter.start_pos[0] = waiter.start_pos[1] = 0;
+        waiter.prev_pos[0] = waiter.prev_pos[1] = 0;
+        waiter.result.completed = false;
+        waiter.result.latency_us = 0;
+        waiter.result.polls = 0;
+}
+
+
+bool
+SmartDrive::pollWaiter(Waiter& waiter, const Snapshot& snap, std::chrono::steady_clock::time_point now, int64_t& delay_us) {
+        using std::chrono::microseconds;
+        using std::chrono::duration_cast;
+
+        waiter.result.polls++;
+        waiter.result.latency_us = (uint32_t) duration_cast<microseconds>(now - waiter.issued).count();
+
+        bool busy = !snap.valid;
+        for (int m = waiter.first; m <= waiter.last && snap.valid; m++)
+            busy |= (snap.status[m] & waiter.busy_mask) != 0;
+
+        //Right after a command the status byte may not reflect it yet, so only
+        //trust an idle status once we saw the motor busy or the settle time is over.
+        if ( busy )
+            waiter.seen_busy = true;
+        else if ( waiter.seen_busy || now - waiter.issued >= microseconds(SmartDrive_WAIT_SETTLE_US) ) {
+            waiter.result.completed = true;
+            return true;
+        }
+        if ( waiter.has_deadline && now >= waiter.deadline )
+            return true;
+
+        //predict how long the slowest motor still needs, -1 if we can't tell yet
+        int64_t eta_us = 0;
+        for (int m = waiter.first; m <= waiter.last; m++) {
+            const MoveInfo& move = waiter.move[m];
+            int64_t motor_eta = -1;
 
-    uint8_t array[15] = {SmartDrive_P_Kp, Kp_t1 , Kp_t2 , Ki_t1, Ki_t2, Kd_t1, Kd_t2, Kp_s1, Kp_s2, Ki_s1, Ki_s2, Kd_s1, Kd_s2, passcount, tolerance};
-    writeArray(array,15);
+            if ( !move.tacho ) {
+                motor_eta = duration_cast<microseconds>(move.issued + std::chrono::seconds(move.duration) - now).count();
+            } else if ( snap.valid ) {
+                int32_t pos = (int32_t) snap.position[m];
+                float velocity = 0;
+
+                if ( !waiter.have_prev )
+                    waiter.start_pos[m] = pos;
+                else if ( now > waiter.prev_time ) {
+                    velocity = fabsf((float)(pos - waiter.prev_pos[m])) /
+                               (duration_cast<microseconds>(now - waiter.prev_time).count() / 1e6f);
+                    if ( velocity > 0 && move.speed > 0 ) {
+                        float gain = velocity / move.speed;
+                        float learned = m_velocityGain;
+                        m_velocityGain = (learned == 0) ? gain : (0.8f * learned + 0.2f * gain);
+                    }
+                }
+                waiter.prev_pos[m] = pos;
+
+                //not moving yet (or no second sample) : fall back to the commanded speed
+                if ( velocity <= 0 )
+                    velocity = m_velocityGain * move.speed;
+                if ( velocity > 0 ) {
+                    float remaining = move.absolute ? fabsf((float)((int32_t) move.target - pos))
+                                                    : (float) move.target - fabsf((float)(pos - waiter.start_pos[m]));
+                    if ( remaining < 0 )
+                        remaining = 0;
+                    motor_eta = (int64_t)(remaining / velocity * 1e6f);
+                }
+            }
+
+            if ( motor_eta < 0 && move.tacho ) {
+                eta_us = -1;
+                break;
+            }
+            if ( motor_eta > eta_us )
+                eta_us = motor_eta;
+        }
+        waiter.have_prev = snap.valid;
+        waiter.prev_time = now;
+
+        //poll sparsely while far away, densely near the predicted end
+        delay_us = SmartDrive_WAIT_MIN_POLL_US;
+        if ( waiter.seen_busy )
+            delay_us = (eta_us < 0) ? SmartDrive_WAIT_BLIND_POLL_US : eta_us / 2;
+        if ( delay_us < SmartDrive_WAIT_MIN_POLL_US )
+            delay_us = SmartDrive_WAIT_MIN_POLL_US;
+        if ( delay_us > SmartDrive_WAIT_MAX_POLL_US )
+            delay_us = SmartDrive_WAIT_MAX_POLL_US;
+        if ( waiter.has_deadline ) {
+            int64_t left = duration_cast<microseconds>(waiter.deadline - now).count();
+            if ( delay_us > left )
+                delay_us = (left > 0) ? left : 0;
+        }
+        return false;
+}
+
+
+SmartDrive::WaitResult
+SmartDrive::waitUntilDone(MotorID_t motor_number, uint8_t busy_mask, uint32_t timeout_ms) {
+        Waiter waiter;
+        int64_t delay_us = 0;
+
+        initWaiter(waiter, motor_number, busy_mask, timeout_ms);
+        //one burst read per poll gives us both statuses and both positions
+        while ( !pollWaiter(waiter, ReadSnapshot(), m_bus->now(), delay_us) )
+            m_bus->sleep(std::chrono::microseconds(delay_us));
+
+        m_lastWait = waiter.result;
+        return waiter.result;
+}
+
+
+std::future<SmartDrive::WaitResult>
+SmartDrive::watchMove(MotorID_t motor_number, uint8_t busy_mask, uint32_t timeout_ms) {
+        std::lock_guard<std::mutex> lock(m_asyncLock);
+
+        m_pending.push_back(AsyncMove());
+        AsyncMove& move = m_pending.back();
+        initWaiter(move.waiter, motor_number, busy_mask, timeout_ms);
+        std::future<WaitResult> result = move.promise.get_future();
+
+        if ( !m_poller.joinable() )
+            m_poller = std::thread(&SmartDrive::pollerLoop, this);
+        m_asyncCond.notify_one();
+        return result;
 }
 
 
 void
+SmartDrive::pollerLoop() {
+        std::unique_lock<std::mutex> lock(m_asyncLock);
+        Snapshot snap;
+
+        while ( !m_pollerStop ) {
+            if ( m_pending.empty() ) {
+                m_asyncCond.wait(lock);
+                continue;
+            }
+
+            //a single status read resolves every outstanding move of this board
+            lock.unlock();
+            fetchSnapshot(snap);
+            std::chrono::steady_clock::time_point now = m_bus->now();
+            lock.lock();
+
+            int64_t delay_us = SmartDrive_WAIT_MAX_POLL_US;
+            for (std::list<AsyncMove>::iterator it = m_pending.begin(); it != m_pending.end(); ) {
+                int64_t move_delay = 0;
+                if ( pollWaiter(it->waiter, snap, now, move_delay) ) {
+                    it->promise.set_value(it->waiter.result);
+                    it = m_pending.erase(it);
+                    continue;
+                }
+                if ( move_delay < delay_us )
+                    delay_us = move_delay;
+                ++it;
+            }
+            //woken up early when a new move is registered, except on a virtual clock
+            if ( m_pollerStop )
+                break;
+            if ( m_pending.empty() )
+                continue;
+            if ( m_bus->realTime() ) {
+                m_asyncCond.wait_for(lock, std::chrono::microseconds(delay_us));
+            } else {
+                lock.unlock();
+                m_bus->sleep(std::chrono::microseconds(delay_us));
+                lock.lock();
+            }
+        }
+}
+
+
+std::future<SmartDrive::WaitResult>
+SmartDrive::failedMove(mraa::Result ret) {
+        std::promise<WaitResult> failed;
+        failed.set_exception(std::make_exception_ptr(
+            std::runtime_error("SmartDrive: move not started, mraa::Result " + std::to_string((int) ret))));
+        return failed.get_future();
+}
+
+
+std::future<SmartDrive::WaitResult>
+SmartDrive::Run_Seconds_Async(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action, uint32_t timeout_ms) {
+        mraa::Result ret = Run_Seconds(motor_number, direction, speed, duration, false, next_action);
+        if ( ret != mraa::SUCCESS )
+            return failedMove(ret);
+        return watchMove(motor_number, SmartDrive_MOTOR_IN_TIME_MODE, timeout_ms);
+}
+
+
+std::future<SmartDrive::WaitResult>
+SmartDrive::Run_Degrees_Async(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t degrees, MotorAction_t next_action, uint32_t timeout_ms) {
+        mraa::Result ret = Run_Degrees(motor_number, direction, speed, degrees, false, next_action);
+        if ( ret != mraa::SUCCESS )
+            return failedMove(ret);
+        return watchMove(motor_number, SmartDrive_MOTOR_POS_CTRL_ON, timeout_ms);
+}
+
+
+std::future<SmartDrive::WaitResult>
+SmartDrive::Run_Rotations_Async(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t rotations, MotorAction_t next_action, uint32_t timeout_ms) {
+        mraa::Result ret = Run_Rotations(motor_number, direction, speed, rotations, false, next_action);
+        if ( ret != mraa::SUCCESS )
+            return failedMove(ret);
+        return watchMove(motor_number, SmartDrive_MOTOR_POS_CTRL_ON, timeout_ms);
+}
+
+
+std::future<SmartDrive::WaitResult>
+SmartDrive::Run_Tacho_Async(MotorID_t motor_number, uint8_t speed, uint32_t tacho_count, MotorAction_t next_action, uint32_t timeout_ms) {
+        mraa::Result ret = Run_Tacho(motor_number, speed, tacho_count, false, next_action);
+        if ( ret != mraa::SUCCESS )
+            return failedMove(ret);
+        return watchMove(motor_number, SmartDrive_MOTOR_POS_CTRL_ON, timeout_ms);
+}
+
+
+mraa::Result
+SmartDrive::preload(MotorID_t motor_number, const MotorCommand& cmd, const MoveInfo& move) {
+        const MotorCommand* m1 = ( motor_number != Motor_ID_2 ) ? &cmd : NULL;
+        const MotorCommand* m2 = ( motor_number != Motor_ID_1 ) ? &cmd : NULL;
+        mraa::Result ret = writeCommands(m1, m2, false);
+        if ( ret != mraa::SUCCESS )
+            return ret;
+        for (int m = 0; m < 2; m++) {
+            if ( motor_number & (1 << m) ) {
+                m_preload[m] = cmd;
+                m_preloadMove[m] = move;
+                m_preloaded[m] = true;
+            }
+        }
+        return ret;
+}
+
+
+mraa::Result
+SmartDrive::PreloadTacho(MotorID_t motor_number, uint8_t speed, int32_t tacho_count, bool relative, MotorAction_t next_action) {
+        MoveInfo move = MoveInfo();
+        move.tacho = true;
+        move.absolute = !relative;
+        move.target = relative ? (uint32_t) abs(tacho_count) : (uint32_t) tacho_count;
+        move.speed = speed;
+        return preload(motor_number, tachoCommand((uint32_t) tacho_count, speed, relative, next_action), move);
+}
+
+
+mraa::Result
+SmartDrive::PreloadSeconds(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action) {
+        MoveInfo move = MoveInfo();
+        move.speed = speed;
+        move.duration = duration;
+        return preload(motor_number, timedCommand(direction, speed, duration, next_action), move);
+}
+
+
+SmartDriveBus::BatchOp
+SmartDrive::GoOp() const {
+        //a go must never be applied twice, it is tried once
+        SmartDriveBus::BatchOp op = {(uint8_t) m_controlAddr, SmartDrive_COMMAND, SmartDrive_SYNC_GO,
+                                     NULL, 1, 0, std::chrono::steady_clock::time_point(), true};
+        if ( m_preloaded[0] != m_preloaded[1] ) {
+            int m = m_preloaded[0] ? 0 : 1;
+            op.reg = SmartDrive_CMD_A_M1 + m * SmartDrive_MOTOR_BLOCK_SIZE;
+            op.value = m_preload[m].cmd_a | SmartDrive_CONTROL_GO;
+        }
+        return op;
+}
+
+
+void
+SmartDrive::PreloadDone(bool started) {
+        if ( started ) {
+            InvalidateSnapshot();
+            InvalidateShadow();   //the go bypassed writeCommands, the motor blocks must be sent again
+            for (int m = 0; m < 2; m++) {
+                const MoveInfo& move = m_preloadMove[m];
+                if ( m_preloaded[m] )
+                    recordMove(m == 0 ? Motor_ID_1 : Motor_ID_2, move.tacho, move.absolute, move.target, move.speed, move.duration);
+            }
+        }
+        m_preloaded[0] = m_preloaded[1] = false;
+}
+
+
+SmartDriveResult<bool>
+SmartDrive::TryIsTachoDone(MotorID_t motor_number) {
+        //look for both position control bits to be zero
+        return motorsIdle(motor_number, SmartDrive_MOTOR_POS_CTRL_ON);
+}
+
+
+bool
+SmartDrive::IsTachoDone(MotorID_t motor_number) {
+        return TryIsTachoDone(motor_number).value_or(false);
+}
+
+
+mraa::Result
+SmartDrive::SetPerformanceParameters( uint16_t Kp_tacho, uint16_t Ki_tacho, uint16_t Kd_tacho, uint16_t Kp_speed, uint16_t Ki_speed, uint16_t Kd_speed, uint8_t passcount, uint8_t tolerance) {
+    SmartDriveReg::PID::Bytes frame = SmartDriveReg::PID::build(Kp_tacho, Ki_tacho, Kd_tacho, Kp_speed, Ki_speed, Kd_speed, passcount, tolerance);
+    return writeArray(frame.data, sizeof(frame.data));
+}
+
+
+SmartDriveResult<uint8_t>
+SmartDrive::ApplyPerformanceParameters(const PerformanceParameters& params) {
+    typedef SmartDriveReg::PID Block;
+    //a new transaction costs the address and register bytes, cheaper to rewrite short unchanged runs
+    const unsigned MAX_GAP = 2;
+
+    Block::Bytes frame = Block::build(params.Kp_tacho, params.Ki_tacho, params.Kd_tacho,
+                                      params.Kp_speed, params.Ki_speed, params.Kd_speed,
+                                      params.passcount, params.tolerance);
+    const uint8_t* wanted = frame.data + 1;
+    uint8_t current[Block::size];
+
+    mraa::Result ret = readBlock(Block::start, current, Block::size);
+    if (ret != mraa::SUCCESS)
+        return SmartDriveResult<uint8_t>::Failure(ret);
+
+    uint8_t written = 0;
+    unsigned i = 0;
+    while (i < Block::size) {
+        if (current[i] == wanted[i]) {
+            i++;
+            continue;
+        }
+        unsigned end = i + 1;   //one past the last changed byte of this run
+        for (unsigned j = end; j < Block::size && j <= end + MAX_GAP; j++)
+            if (current[j] != wanted[j])
+                end = j + 1;
+
+        uint8_t run[1 + Block::size];
+        run[0] = Block::start + i;
+        memcpy(run + 1, wanted + i, end - i);
+        ret = writeArray(run, 1 + end - i);
+        if (ret != mraa::SUCCESS)
+            return SmartDriveResult<uint8_t>::Failure(ret);
+        written += end - i;
+        i = end;
+    }
+    if (written == 0)
+        return written;
+
+    ret = readBlock(Block::start, current, Block::size);
+    if (ret != mraa::SUCCESS)
+        return SmartDriveResult<uint8_t>::Failure(ret);
+    if (memcmp(current, wanted, Block::size) != 0) {
+        SMARTDRIVE_ERROR("PID registers differ from the values written");
+        return SmartDriveResult<uint8_t>::Failure(mraa::ERROR_UNSPECIFIED);
+    }
+    return written;
+}
+
+
+SmartDriveResult<SmartDrive::PerformanceParameters>
 SmartDrive::ReadPerformanceParameters() {
-   try {
-        std::cout << "Pkp: " << readInteger(SmartDrive_P_Kp) << std::endl;
-        std::cout << "Pki: " << readInteger(SmartDrive_P_Ki) << std::endl;
-        std::cout << "Pkd: " << readInteger(SmartDrive_P_Kd) << std::endl;
-        std::cout << "Skp: " << readInteger(SmartDrive_S_Kp) << std::endl;
-        std::cout << "Ski: " << readInteger(SmartDrive_S_Ki) << std::endl;
-        std::cout << "Skd: " << readInteger(SmartDrive_S_Kd) << std::endl;
-        std::cout << "Passcount: " << SmartDrive_PASSCOUNT << std::endl; //ToDo : Check if these should actually be Register Reads !!
-        std::cout << "Tolerance: " << SmartDrive_PASSTOLERANCE << std::endl;
-    } catch( int e) {
-        std::cout << "Error: Could not read PID values -> " << e << std::endl;
+    typedef SmartDriveReg::PID Block;
+    uint8_t block[Block::size];
+
+    mraa::Result ret = readBlock(Block::start, block, Block::size);
+    if (ret != mraa::SUCCESS)
+        return SmartDriveResult<PerformanceParameters>::Failure(ret);
+
+    PerformanceParameters params;
+    params.Kp_tacho = Block::get<SmartDriveReg::P_Kp>(block);
+    params.Ki_tacho = Block::get<SmartDriveReg::P_Ki>(block);
+    params.Kd_tacho = Block::get<SmartDriveReg::P_Kd>(block);
+    params.Kp_speed = Block::get<SmartDriveReg::S_Kp>(block);
+    params.Ki_speed = Block::get<SmartDriveReg::S_Ki>(block);
+    params.Kd_speed = Block::get<SmartDriveReg::S_Kd>(block);
+    params.passcount = Block::get<SmartDriveReg::PASSCOUNT>(block);
+    params.tolerance = Block::get<SmartDriveReg::PASSTOLERANCE>(block);
+    return params;
+}
+
+SmartDriveResult<uint8_t>
+SmartDrive::TryGetMotorStatus(MotorID_t motor_id) {
+	if (motor_id == Motor_ID_BOTH) {
+		SMARTDRIVE_WARN("Please specifiy which motor's status you want to fetch !");
+		return SmartDriveResult<uint8_t>::Failure(mraa::ERROR_INVALID_PARAMETER);
 	}
+	if (snapshotEnabled()) {
+		const Snapshot& snap = GetSnapshot();
+		if (!snap.valid)
+			return SmartDriveResult<uint8_t>::Failure(mraa::ERROR_UNSPECIFIED);
+		return snap.status[motor_id - 1];
+	}
+	return readByte((motor_id == Motor_ID_1) ? SmartDrive_STATUS_M1 : SmartDrive_STATUS_M2);
 }
 
 uint8_t
 SmartDrive::GetMotorStatus(MotorID_t motor_id) {
-	uint8_t status=0;
-	if (motor_id == Motor_ID_1)
-		status = readByte(SmartDrive_STATUS_M1);
-	if (motor_id == Motor_ID_2)
-		status = readByte(SmartDrive_STATUS_M1);
 	if (motor_id == Motor_ID_BOTH) {
-		std::cout << "Please specifiy which motor's status you want to fetch !" << std::endl;
+		SMARTDRIVE_WARN("Please specifiy which motor's status you want to fetch !");
+		return 0;
 	}
-	return status;
+	//every flag raised on error, as the bus used to return
+	return TryGetMotorStatus(motor_id).value_or(0xFF);
 }
 
 void
@@ -25,8 +25,20 @@
  */
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <mraa/i2c.hpp>
 
+#include "smartdrivebus.h"
+#include "smartdriveinstr.h"
+#include "smartdriveresult.h"
+
 //We can use direct integer IDs, 
 //or we can use the typedef here to help limit the error cases
 //and still support extension to support more Motors in the future
@@ -49,6 +61,7 @@ enum MotorAction_t {
 
 #define DefaultAddress     0x36
 #define SmartDrive_VOLTAGE_MULTIPLIER  212.7
+#define SmartDrive_CURRENT_MULTIPLIER  1.0    //mA per count of SmartDrive_CURRENT_Mx, see SetPowerCalibration()
 
 //Commonly used speed constants, these are just convenience constants
 //You can use any value between 0 and 100.
@@ -66,6 +79,12 @@ enum MotorAction_t {
 #define    SmartDrive_CONTROL_TIME     0x40
 #define    SmartDrive_CONTROL_GO       0x80
 
+//Identification registers, SmartDrive_ID_SIZE padded characters each, not NUL terminated
+#define    SmartDrive_FIRMWARE_VERSION 0x00
+#define    SmartDrive_VENDOR_ID        0x08
+#define    SmartDrive_DEVICE_ID        0x10
+#define    SmartDrive_ID_SIZE          8
+
 #define    SmartDrive_COMMAND          0x41
 #define    SmartDrive_SETPT_M1         0x42
 #define    SmartDrive_SPEED_M1         0x46
@@ -79,6 +98,11 @@ enum MotorAction_t {
 #define    SmartDrive_CMD_B_M2         0x50
 #define    SmartDrive_CMD_A_M2         0x51
 
+//Size of one motor command block (SETPT_Mx up to CMD_A_Mx), both blocks are contiguous
+#define    SmartDrive_MOTOR_BLOCK_SIZE (SmartDrive_SETPT_M2 - SmartDrive_SETPT_M1)
+//Written to SmartDrive_COMMAND, starts both motors with their loaded command blocks
+#define    SmartDrive_SYNC_GO          0x53
+
 //Read registers.
 #define    SmartDrive_POSITION_M1      0x52
 #define    SmartDrive_POSITION_M2      0x56
@@ -105,6 +129,20 @@ enum MotorAction_t {
 #define    SmartDrive_CURRENT_M1     0x70
 #define    SmartDrive_CURRENT_M2     0x72
 
+//Contiguous read block fetched by a snapshot : POSITION_M1 up to CURRENT_M2 (inclusive)
+#define    SmartDrive_SNAPSHOT_START   SmartDrive_POSITION_M1
+#define    SmartDrive_SNAPSHOT_SIZE    (SmartDrive_CURRENT_M2 + 2 - SmartDrive_POSITION_M1)
+
+//Writable registers mirrored for write elision : COMMAND up to PASSTOLERANCE (inclusive)
+#define    SmartDrive_SHADOW_START     SmartDrive_COMMAND
+#define    SmartDrive_SHADOW_SIZE      (SmartDrive_PASSTOLERANCE + 1 - SmartDrive_COMMAND)
+
+//Completion wait tuning (microseconds)
+#define    SmartDrive_WAIT_SETTLE_US     50000  //max time for the busy bit to show up after a command
+#define    SmartDrive_WAIT_MIN_POLL_US   2000   //densest polling, used close to the predicted end
+#define    SmartDrive_WAIT_MAX_POLL_US   250000 //sparsest polling, used far from the predicted end
+#define    SmartDrive_WAIT_BLIND_POLL_US 10000  //polling used while no prediction is available
+
 //Motor Status Masks
 #define SmartDrive_MOTOR_CONTROL_ON		0x1
 #define SmartDrive_MOTOR_IS_RAMPING		0x2
@@ -145,43 +183,168 @@ namespace upm {
 class SmartDrive {
 
 public:
+    /**
+     * Decoded copy of the read registers 0x52-0x73, fetched in a single burst
+     */
+    struct Snapshot {
+        uint32_t position[2];    //tacho position of M1/M2
+        uint8_t  status[2];      //SmartDrive_STATUS_M1/M2
+        uint8_t  tasks[2];       //SmartDrive_TASKS_M1/M2
+        uint16_t pid[6];         //P_Kp, P_Ki, P_Kd, S_Kp, S_Ki, S_Kd
+        uint8_t  passcount;
+        uint8_t  tolerance;
+        uint8_t  checksum;
+        uint8_t  battVoltage;    //raw value, see GetBattVoltage()
+        uint8_t  resetStatus;
+        uint16_t current[2];     //raw SmartDrive_CURRENT_M1/M2
+        std::chrono::steady_clock::time_point timestamp;
+        bool     valid;
+    };
+
+    /**
+     * Battery voltage and motor currents, read in one burst (0x6E-0x73)
+     */
+    struct PowerReading {
+        float    battery_mv;
+        float    current_ma[2];   //M1, M2
+        uint8_t  resetStatus;     //SmartDrive_RESETSTATUS
+        std::chrono::steady_clock::time_point timestamp;
+    };
+
+    /**
+     * Outcome of a blocking wait for a timed or tacho move
+     */
+    struct WaitResult {
+        bool     completed;   //false when the timeout expired first
+        uint32_t latency_us;  //from the command being issued to completion being detected
+        uint32_t polls;       //number of status reads issued while waiting
+    };
+
+    /**
+     * Contents of the PID control registers 0x5E-0x6B
+     */
+    struct PerformanceParameters {
+        uint16_t Kp_tacho;
+        uint16_t Ki_tacho;
+        uint16_t Kd_tacho;
+        uint16_t Kp_speed;
+        uint16_t Ki_speed;
+        uint16_t Kd_speed;
+        uint8_t  passcount;
+        uint8_t  tolerance;
+    };
+
 	/**
 	 * Initialize the class with the i2c address of your SmartDrive
 	 * @param SmartDrive_address Address of your SmartDrive.
 	 */
     SmartDrive(int i2c_bus, int address = (DefaultAddress >> 1));
 
+	/**
+	 * Initialize the class on a bus shared with other SmartDrives
+	 * @param bus Bus owner shared by all the SmartDrives daisy-chained on it.
+	 * @param SmartDrive_address Address of your SmartDrive.
+	 */
+    SmartDrive(std::shared_ptr<SmartDriveBus> bus, int address = (DefaultAddress >> 1));
+
+	/**
+	 * Stops the background poller, outstanding async moves resolve as not completed
+	 */
+    ~SmartDrive();
+
 	/**
 	 * Writes a specified command on the command register of the SmartDrive
 	 * @param cmd The command you wish the SmartDrive to execute.
 	 */
-    void command(uint8_t cmd);
+    mraa::Result command(uint8_t cmd);
 
 	/**
-	 *  Reads the battery voltage. Multiplier constant not yet verified
+	 *  Reads the battery voltage, in millivolts with the default calibration
+	 *  @return Voltage, -1 if it could not be read.
 	 */
     float GetBattVoltage();
+
+	/**
+	 * Same as GetBattVoltage, reporting read errors
+	 */
+    SmartDriveResult<float> TryGetBattVoltage();
+
+	/**
+	 * Reads the battery voltage and both motor currents in a single burst
+	 */
+    SmartDriveResult<PowerReading> ReadPower();
+
+	/**
+	 * Sets the scales applied to the raw battery and current registers
+	 * @param mv_per_count Millivolts per count of SmartDrive_BATT_VOLTAGE.
+	 * @param ma_per_count Milliamps per count of SmartDrive_CURRENT_Mx.
+	 * @param ma_offset Milliamps read with the motors off, subtracted from the currents.
+	 */
+    void SetPowerCalibration(float mv_per_count = SmartDrive_VOLTAGE_MULTIPLIER,
+                             float ma_per_count = SmartDrive_CURRENT_MULTIPLIER, float ma_offset = 0);
+
+	/**
+	 * Returns the millivolts per count set by SetPowerCalibration
+	 */
+    float GetMillivoltsPerCount() const { return m_mvPerCount.load(); }
+
+	/**
+	 * Converts a raw SmartDrive_BATT_VOLTAGE value with the power calibration
+	 * @return Millivolts.
+	 */
+    float BatteryMillivolts(uint8_t raw) const { return raw * m_mvPerCount.load(); }
+
+	/**
+	 * Converts a raw SmartDrive_CURRENT_Mx value with the power calibration
+	 * @return Milliamps, never negative.
+	 */
+    float CurrentMilliamps(uint16_t raw) const {
+        float ma = raw * m_maPerCount.load() - m_maOffset.load();
+        return (ma > 0.0f) ? ma : 0.0f;
+    }
+
+	/**
+	 * Limits the speed of every command sent from now on. May be called from
+	 * another thread than the one commanding the motors, e.g. a power governor.
+	 * Running Run_Unlimited commands are sent again at the new effective speed,
+	 * never after a StopMotor of their motor; timed and tacho moves are only
+	 * limited when they start.
+	 * @param cap Highest absolute speed, 100 (default) removes the limit.
+	 */
+    void SetSpeedCap(uint8_t cap);
+
+	/**
+	 * Returns the current speed limit, 100 when there is none
+	 */
+    uint8_t GetSpeedCap() const { return m_speedCap.load(); }
    
     /**
      * Reads the tacheometer position of the specified motor
 	 * @param motor_number Number of the motor you wish to read.
+	 * @return Position, -1 if it could not be read, which is also a valid position.
 	 */
     uint32_t ReadTachometerPosition(MotorID_t motor_number);
 
+    /**
+     * Same as ReadTachometerPosition, reporting read errors
+	 * @param motor_number Number of the motor you wish to read.
+	 */
+    SmartDriveResult<uint32_t> TryReadTachometerPosition(MotorID_t motor_number);
+
 	/**
 	 * Turns the specified motor(s) forever
 	 * @param motor_number Number of the motor(s) you wish to turn.
 	 * @param direction The direction you wish to turn the motor(s).
 	 * @param speed The speed at which you wish to turn the motor(s).
 	 */
-    void Run_Unlimited(MotorID_t motor_number, Direction_t direction, uint8_t speed);
+    mraa::Result Run_Unlimited(MotorID_t motor_number, Direction_t direction, uint8_t speed);
 
 	/**
 	 * Stops the specified motor(s)
 	 * @param motor_number Number of the motor(s) you wish to turn.
 	 * @param next_action How you wish to stop the motor(s).
 	 */
-    void StopMotor(MotorID_t motor_number, MotorAction_t next_action );
+    mraa::Result StopMotor(MotorID_t motor_number, MotorAction_t next_action );
 
 	/**
 	 * Turns the specified motor(s) for a given amount of seconds
@@ -191,14 +354,17 @@ public:
 	 * @param duration The time in seconds you wish to turn the motor(s).
 	 * @param wait_for_completion Tells the program when to handle the next line of code.
 	 * @param next_action How you wish to stop the motor(s).
+	 * @return Result of the command write, nothing is waited for when it failed.
 	 */
-    void Run_Seconds(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, bool wait_for_completion, MotorAction_t next_action );
+    mraa::Result Run_Seconds(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, bool wait_for_completion, MotorAction_t next_action );
 
 	/**
-	 * Waits until the specified time for the motor(s) to run is completed
+	 * Waits until the specified time for the motor(s) to run is completed.
+	 * Polls sparsely at first and densely close to the predicted end of the move.
 	 * @param motor_number Number of the motor(s) to wait for.
+	 * @param timeout_ms Give up after this many milliseconds, 0 waits forever.
 	 */
-    void WaitUntilTimeDone(MotorID_t motor_number);
+    WaitResult WaitUntilTimeDone(MotorID_t motor_number, uint32_t timeout_ms = 0);
 
 	/**
 	 * Checks to ensure the specified time for the motor(s) to run is completed.
@@ -206,6 +372,12 @@ public:
 	 */
     bool IsTimeDone(MotorID_t motor_number);
 
+	/**
+	 * Same as IsTimeDone, reporting read errors instead of returning false
+	 * @param motor_number Number of the motor(s) to check. 
+	 */
+    SmartDriveResult<bool> TryIsTimeDone(MotorID_t motor_number);
+
 	/**
 	 * Turns the specified motor(s) for given relative tacheometer count
 	 * @param motor_number Number of the motor(s) you wish to turn.
@@ -214,8 +386,9 @@ public:
 	 * @param degrees The relative tacheometer count you wish to turn the motor(s).
 	 * @param wait_for_completion Tells the program when to handle the next line of code.
 	 * @param next_action How you wish to stop the motor(s).
+	 * @return Result of the command write, nothing is waited for when it failed.
 	 */
-    void Run_Degrees(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t degrees, bool wait_for_completion, MotorAction_t next_action);
+    mraa::Result Run_Degrees(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t degrees, bool wait_for_completion, MotorAction_t next_action);
 
 	/**
 	 * Turns the specified motor(s) for given relative tacheometer count
@@ -225,8 +398,9 @@ public:
 	 * @param rotations The relative amount of rotations you wish to turn the motor(s).
 	 * @param wait_for_completion Tells the program when to handle the next line of code.
 	 * @param next_action How you wish to stop the motor(s).
+	 * @return Result of the command write, nothing is waited for when it failed.
 	 */
-    void Run_Rotations(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t rotations, bool wait_for_completion, MotorAction_t next_action);
+    mraa::Result Run_Rotations(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t rotations, bool wait_for_completion, MotorAction_t next_action);
 
 	/**
 	 * Turns the specified motor(s) for given absolute tacheometer count
@@ -236,14 +410,27 @@ public:
 	 * @param tacho_count The absolute tacheometer count you wish to turn the motor(s).
 	 * @param wait_for_completion Tells the program when to handle the next line of code.
 	 * @param next_action How you wish to stop the motor(s).
+	 * @return Result of the command write, nothing is waited for when it failed.
 	 */
-    void Run_Tacho(MotorID_t motor_number, uint8_t speed, uint32_t tacho_count, bool wait_for_completion, MotorAction_t next_action);
+    mraa::Result Run_Tacho(MotorID_t motor_number, uint8_t speed, uint32_t tacho_count, bool wait_for_completion, MotorAction_t next_action);
+
+	/**
+	 * Writes an absolute tacheometer setpoint and starts the motor(s) towards it, without
+	 * waiting. This is the single write Run_Tacho issues, used to stream trajectories.
+	 * @param motor_number Number of the motor(s) you wish to turn.
+	 * @param speed The speed at which you wish to turn the motor(s).
+	 * @param tacho_count The absolute tacheometer count you wish to turn the motor(s).
+	 * @param next_action How you wish to stop the motor(s).
+	 */
+    mraa::Result SetTachoSetpoint(MotorID_t motor_number, uint8_t speed, uint32_t tacho_count, MotorAction_t next_action);
 
 	/**
 	 * Waits until the specified tacheomter count for the motor(s) to run is reached.
+	 * The end of the move is predicted from the commanded speed and the observed tacho velocity.
 	 * @param motor_number Number of the motor(s) to wait for.
+	 * @param timeout_ms Give up after this many milliseconds, 0 waits forever.
 	 */
-    void WaitUntilTachoDone(MotorID_t motor_number);
+    WaitResult WaitUntilTachoDone(MotorID_t motor_number, uint32_t timeout_ms = 0);
 
 	/**
 	 * Checks to ensure the specified tacheomter count for the motor(s) to run is reached.
@@ -251,6 +438,12 @@ public:
 	 */
     bool IsTachoDone(MotorID_t motor_number);
 
+	/**
+	 * Same as IsTachoDone, reporting read errors instead of returning false
+	 * @param motor_number Number of the motor(s) to check. 
+	 */
+    SmartDriveResult<bool> TryIsTachoDone(MotorID_t motor_number);
+
 	/**
 	 * Writes user specified values to the PID control registers
 	 * @param Kp_tacho Proportional-gain of the tacheometer position of the motor.
@@ -259,37 +452,307 @@ public:
 	 * @param Kp_speed Proportional-gain of the speed of the motor.
 	 * @param Ki_speed Integral-gain of the speed of the motor.
 	 * @param Kd_speed Derivative-gain of the speed of the motor.
+	 * @param passcount Number of times the position has to be within tolerance to complete a move.
+	 * @param tolerance Tacho counts accepted around the target position.
 	 */
-    void SetPerformanceParameters( uint16_t Kp_tacho, uint16_t Ki_tacho, uint16_t Kd_tacho, uint16_t Kp_speed, uint16_t Ki_speed, uint16_t Kd_speed, uint8_t passcount, uint8_t tolerance);
+    mraa::Result SetPerformanceParameters( uint16_t Kp_tacho, uint16_t Ki_tacho, uint16_t Kd_tacho, uint16_t Kp_speed, uint16_t Ki_speed, uint16_t Kd_speed, uint8_t passcount, uint8_t tolerance);
+
+	/**
+	 * Writes the PID control registers which differ from the given values only
+	 *
+	 * The whole block is read back in one burst, the changed bytes are written in
+	 * as few transactions as possible, and the block is read again to verify them.
+	 * Nothing is written when the board already holds these values.
+	 * @param params Values to apply.
+	 * @return Number of register bytes written, or the error of the failed transfer;
+	 *         mraa::ERROR_UNSPECIFIED if the verification read differs.
+	 */
+    SmartDriveResult<uint8_t> ApplyPerformanceParameters(const PerformanceParameters& params);
 
     /**
-     * Reads the values of the PID control registers
+     * Reads the values of the PID control registers in one burst
      */
-    void ReadPerformanceParameters();
+    SmartDriveResult<PerformanceParameters> ReadPerformanceParameters();
 
     /**
      * Read the status of a motor, and return it in a uint8_t
      * param motor_id Number fo the motor to check
+     * @return Status, 0xFF if it could not be read.
      */
 	uint8_t GetMotorStatus(MotorID_t motor_id);
 
+    /**
+     * Same as GetMotorStatus, reporting read errors
+     * param motor_id Number fo the motor to check
+     */
+	SmartDriveResult<uint8_t> TryGetMotorStatus(MotorID_t motor_id);
+
+	/**
+	 * Result of the last write to the board, e.g. of a Run_* command
+	 */
+	mraa::Result GetLastError() const { return (mraa::Result) m_lastError.load(); }
+
 	/**
 	 * Print the detailed status of the motor
 	 * @param motor_id Number fo the motor to check
 	 */
 	void PrintMotorStatus(MotorID_t motor_id);
 
+	/**
+	 * Reads the whole register block 0x52-0x73 in one transaction and decodes it.
+	 * The result also refreshes the cache used by the getters.
+	 */
+	const Snapshot& ReadSnapshot();
+
+	/**
+	 * Same as ReadSnapshot(), but decodes into the caller's struct and leaves the
+	 * cache alone, so it can be used from another thread.
+	 * @return false if the burst read failed.
+	 */
+	bool ReadSnapshot(Snapshot& snap);
+
+	/**
+	 * Returns the bus this SmartDrive talks through, e.g. to read its utilization
+	 */
+	std::shared_ptr<SmartDriveBus> GetBus() const { return m_bus; }
+
+	/**
+	 * Returns the 7 bit address of the board
+	 */
+	int GetAddress() const { return m_controlAddr; }
+
+#ifdef SMARTDRIVE_INSTRUMENTATION
+	/**
+	 * Per-register bus counters and latency histograms of this SmartDrive
+	 */
+	SmartDriveInstrumentation& GetInstrumentation() { return m_instr; }
+#endif
+
+	/**
+	 * Returns the cached snapshot, refreshing it from the bus when it is older
+	 * than the configured staleness window.
+	 */
+	const Snapshot& GetSnapshot();
+
+	/**
+	 * Sets how long a snapshot may serve ReadTachometerPosition, GetMotorStatus,
+	 * IsTachoDone, IsTimeDone and GetBattVoltage before being read again.
+	 * @param max_age_us Staleness window in microseconds, 0 (default) disables the cache.
+	 */
+	void SetSnapshotMaxAge(uint32_t max_age_us);
+
+	/**
+	 * Drops the cached snapshot, the next getter will go to the bus.
+	 */
+	void InvalidateSnapshot();
+
+	/**
+	 * Skips register writes which would not change the board state, e.g. a
+	 * Run_Unlimited repeating the running speed and direction, or PID values
+	 * already written. A shadow copy of registers 0x41-0x6B keeps the last
+	 * acknowledged values. COMMAND writes, timed and tacho moves always go out.
+	 * @param enable false (default) writes everything.
+	 */
+	void SetWriteElision(bool enable);
+
+	/**
+	 * Forgets the shadow copy, the next writes all go out. Done automatically on
+	 * COMMAND writes (motor blocks only), on bus errors and when a snapshot shows
+	 * a non zero SmartDrive_RESETSTATUS; call it when the board state was changed
+	 * behind this driver's back.
+	 */
+	void InvalidateShadow();
+
+	/**
+	 * Returns the number of writes skipped by write elision
+	 */
+	uint64_t GetElidedWrites() const { return m_elidedWrites.load(); }
+
+	/**
+	 * Sets the timeout used by the Run_* methods when wait_for_completion is true
+	 * @param timeout_ms Timeout in milliseconds, 0 (default) waits forever.
+	 */
+	void SetCompletionTimeout(uint32_t timeout_ms);
+
+	/**
+	 * Returns the result of the last completion wait, including the ones done inside Run_*
+	 */
+	const WaitResult& GetLastWaitResult() const { return m_lastWait; }
+
+	/**
+	 * Same as Run_Seconds, but returns immediately. The returned future is resolved
+	 * by the background poller once the time is done. When the command could not be
+	 * written it is returned failed, get() throws std::runtime_error.
+	 */
+    std::future<WaitResult> Run_Seconds_Async(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action, uint32_t timeout_ms = 0);
+
+	/**
+	 * Same as Run_Degrees, but returns immediately. The returned future is resolved
+	 * by the background poller once the tacho count is reached. When the command could not be
+	 * written it is returned failed, get() throws std::runtime_error.
+	 */
+    std::future<WaitResult> Run_Degrees_Async(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t degrees, MotorAction_t next_action, uint32_t timeout_ms = 0);
+
+	/**
+	 * Same as Run_Rotations, but returns immediately. The returned future is resolved
+	 * by the background poller once the tacho count is reached. When the command could not be
+	 * written it is returned failed, get() throws std::runtime_error.
+	 */
+    std::future<WaitResult> Run_Rotations_Async(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t rotations, MotorAction_t next_action, uint32_t timeout_ms = 0);
+
+	/**
+	 * Same as Run_Tacho, but returns immediately. The returned future is resolved
+	 * by the background poller once the tacho count is reached. When the command could not be
+	 * written it is returned failed, get() throws std::runtime_error.
+	 */
+    std::future<WaitResult> Run_Tacho_Async(MotorID_t motor_number, uint8_t speed, uint32_t tacho_count, MotorAction_t next_action, uint32_t timeout_ms = 0);
+
+	/**
+	 * Holds back every other motor command and stop of this SmartDrive until the
+	 * returned lock is released. Hold it from the first Preload* call through
+	 * PreloadDone(), so that nothing lands between the preload and the go.
+	 */
+    std::unique_lock<std::mutex> LockCommands() { return std::unique_lock<std::mutex>(m_sendLock); }
+
+	/**
+	 * Writes a tacho move without starting it, the write of GoOp() starts it.
+	 * Call with LockCommands() held.
+	 * @param motor_number Motor(s) of the move, both are written at once with Motor_ID_BOTH.
+	 * @param speed The speed at which you wish to turn the motor(s).
+	 * @param tacho_count Absolute count, or signed distance when relative.
+	 * @param relative Whether tacho_count is relative to the current position.
+	 * @param next_action How you wish to stop the motor(s).
+	 */
+    mraa::Result PreloadTacho(MotorID_t motor_number, uint8_t speed, int32_t tacho_count, bool relative, MotorAction_t next_action);
+
+	/**
+	 * Writes a timed move without starting it, see PreloadTacho()
+	 */
+    mraa::Result PreloadSeconds(MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action);
+
+	/**
+	 * Returns the single write starting the preloaded moves : the sync go when
+	 * both motors are preloaded, else the GO bit of the preloaded motor. Meant
+	 * for SmartDriveBus::batch(), e.g. together with the go of other boards.
+	 */
+    SmartDriveBus::BatchOp GoOp() const;
+
+	/**
+	 * Forgets the preloaded moves, call with LockCommands() still held
+	 * @param started true once the GoOp() write was sent, the moves are then
+	 *        recorded for the completion waits. false drops them unstarted.
+	 */
+    void PreloadDone(bool started);
+
 private:
-	void writeByte(uint8_t addr, uint8_t value);
-	void writeArray(uint8_t* array, int size);
-	uint8_t readByte(uint8_t addr);
-	uint16_t readInteger(uint8_t addr);
-	uint32_t readLongSigned(uint8_t addr);
+	static std::future<WaitResult> failedMove(mraa::Result ret);
+
+	//What the last command asked a motor to do, used to predict its completion
+	struct MoveInfo {
+		bool     tacho;       //tacho move (true) or timed move (false)
+		bool     absolute;    //target is an absolute tacho count, otherwise a relative distance
+		uint32_t target;
+		uint8_t  speed;
+		uint8_t  duration;    //seconds, timed moves only
+		std::chrono::steady_clock::time_point issued;
+	};
+
+	//Content of one motor command block, SETPT_Mx up to CMD_A_Mx
+	struct MotorCommand {
+		uint32_t setpoint;
+		uint8_t  speed;
+		uint8_t  time;
+		uint8_t  cmd_b;
+		uint8_t  cmd_a;       //SmartDrive_CONTROL_* bits, GO is added when sending
+	};
+
+	//One outstanding completion wait : detection of the end of the move and its prediction
+	struct Waiter {
+		int      first, last;   //motor indexes to watch
+		uint8_t  busy_mask;
+		MoveInfo move[2];
+		std::chrono::steady_clock::time_point issued, deadline, prev_time;
+		bool     has_deadline, seen_busy, have_prev;
+		int32_t  start_pos[2], prev_pos[2];
+		WaitResult result;
+	};
+
+	//An async move, resolved by the poller thread
+	struct AsyncMove {
+		Waiter waiter;
+		std::promise<WaitResult> promise;
+	};
+
+	mraa::Result writeByte(uint8_t addr, uint8_t value);
+	mraa::Result writeArray(uint8_t* array, int size);
+	mraa::Result transmit(const uint8_t* array, int size);
+	bool shadowMatches(const uint8_t* array, int size) const;
+	void shadowStore(const uint8_t* array, int size, bool written);
+	void shadowLost();
+	SmartDriveResult<uint8_t> readByte(uint8_t addr);
+	SmartDriveResult<uint16_t> readInteger(uint8_t addr);
+	SmartDriveResult<uint32_t> readLongSigned(uint8_t addr);
+	mraa::Result readBlock(uint8_t addr, uint8_t* data, int size);
+	bool snapshotEnabled() const { return m_snapshotMaxAge.count() != 0; }
+	void recordMove(MotorID_t motor_number, bool tacho, bool absolute, uint32_t target, uint8_t speed, uint8_t duration);
+	bool fetchSnapshot(Snapshot& snap);
+	static MotorCommand tachoCommand(uint32_t target, uint8_t speed, bool relative, MotorAction_t next_action);
+	static MotorCommand timedCommand(Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action);
+	mraa::Result sendCommands(const MotorCommand* m1, const MotorCommand* m2, bool go);
+	mraa::Result writeCommands(const MotorCommand* m1, const MotorCommand* m2, bool go);
+	mraa::Result preload(MotorID_t motor_number, const MotorCommand& cmd, const MoveInfo& move);
+	MotorCommand capped(const MotorCommand& cmd, uint8_t cap) const;
+	void trackRunning(const MotorCommand* m1, const MotorCommand* m2, bool go);
+	mraa::Result sendCommand(MotorID_t motor_number, const MotorCommand& cmd);
+	SmartDriveResult<bool> motorsIdle(MotorID_t motor_number, uint8_t busy_mask);
+	void initWaiter(Waiter& waiter, MotorID_t motor_number, uint8_t busy_mask, uint32_t timeout_ms);
+	bool pollWaiter(Waiter& waiter, const Snapshot& snap, std::chrono::steady_clock::time_point now, int64_t& delay_us);
+	WaitResult waitUntilDone(MotorID_t motor_number, uint8_t busy_mask, uint32_t timeout_ms);
+	std::future<WaitResult> watchMove(MotorID_t motor_number, uint8_t busy_mask, uint32_t timeout_ms);
+	void pollerLoop();
+	void init();
 
 private:
     int m_controlAddr;
-    mraa::I2c m_i2ControlCtx;
+    std::shared_ptr<SmartDriveBus> m_bus;  //serializes the poller thread, the caller and other boards
+    std::atomic<int> m_lastError;          //mraa::Result of the last write
+#ifdef SMARTDRIVE_INSTRUMENTATION
+    SmartDriveInstrumentation m_instr;
+#endif
+
+    Snapshot m_snapshot;
+    std::chrono::microseconds m_snapshotMaxAge;
+
+    std::atomic<bool> m_writeElision;
+    std::mutex m_shadowLock;               //held across the write, so the shadow follows the wire order
+    uint8_t m_shadow[SmartDrive_SHADOW_SIZE];
+    uint64_t m_shadowValid;                //bit n set when m_shadow[n] holds the acknowledged value
+    std::atomic<uint64_t> m_elidedWrites;
+
+    std::atomic<float> m_mvPerCount;
+    std::atomic<float> m_maPerCount;
+    std::atomic<float> m_maOffset;
+    std::atomic<uint8_t> m_speedCap;
+    std::mutex m_capLock;
+    std::mutex m_sendLock;                 //held while motor commands and stops are written
+    MotorCommand m_running[2];             //uncapped Run_Unlimited command of each motor, if running
+    bool m_isRunning[2];
+    MotorCommand m_preload[2];             //moves written by Preload*, under m_sendLock
+    MoveInfo m_preloadMove[2];
+    bool m_preloaded[2];
+
+    MoveInfo m_move[2];                    //last move of each motor, under m_moveLock
+    std::mutex m_moveLock;                 //e.g. a SmartDriveStreamer records moves from its own thread
+    std::atomic<float> m_velocityGain; //learned tacho counts per second per unit of speed, 0 if unknown
+    uint32_t m_waitTimeout;
+    WaitResult m_lastWait;
+
+    std::list<AsyncMove> m_pending;
+    std::mutex m_asyncLock;
+    std::condition_variable m_asyncCond;
+    std::thread m_poller;
+    bool m_pollerStop;
 
-}
+};
 
 }
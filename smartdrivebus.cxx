@@ -0,0 +1,416 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <exception>
+
+#include "smartdrivebus.h"
+
+using namespace upm;
+
+SmartDriveBus::SmartDriveBus(int i2c_bus): m_transport(new MraaTransport(i2c_bus)),
+    m_queueHead(NULL), m_queueTail(NULL), m_queueSize(0),
+    m_draining(false), m_currentAddress(-1), m_reorderRun(0), m_errorStreak(0)
+{
+    RetryPolicy policy = {SmartDriveBus_RETRY_ATTEMPTS, SmartDriveBus_RETRY_BACKOFF_US,
+                          SmartDriveBus_RETRY_MAX_BACKOFF_US, SmartDriveBus_REOPEN_AFTER};
+    m_retry = policy;
+    ResetStats();
+}
+
+SmartDriveBus::SmartDriveBus(std::shared_ptr<SmartDriveTransport> transport): m_transport(transport),
+    m_queueHead(NULL), m_queueTail(NULL), m_queueSize(0),
+    m_draining(false), m_currentAddress(-1), m_reorderRun(0), m_errorStreak(0)
+{
+    RetryPolicy policy = {SmartDriveBus_RETRY_ATTEMPTS, SmartDriveBus_RETRY_BACKOFF_US,
+                          SmartDriveBus_RETRY_MAX_BACKOFF_US, SmartDriveBus_REOPEN_AFTER};
+    m_retry = policy;
+    ResetStats();
+}
+
+
+mraa::Result
+SmartDriveBus::select(uint8_t address) {
+    Transaction tr = {Select, address, 0, NULL, NULL, 0, 0, false, NULL};
+    return (mraa::Result) submit(tr);
+}
+
+mraa::Result
+SmartDriveBus::writeReg(uint8_t address, uint8_t reg, uint8_t value, bool retry) {
+    Transaction tr = {WriteReg, address, reg, &value, NULL, 1, 0, false, NULL};
+    return (mraa::Result) submit(tr, retry);
+}
+
+mraa::Result
+SmartDriveBus::write(uint8_t address, const uint8_t* data, int size, bool retry) {
+    Transaction tr = {Write, address, data[0], data, NULL, size, 0, false, NULL};
+    return (mraa::Result) submit(tr, retry);
+}
+
+int
+SmartDriveBus::readReg(uint8_t address, uint8_t reg) {
+    Transaction tr = {ReadReg, address, reg, NULL, NULL, 1, 0, false, NULL};
+    return submit(tr);
+}
+
+int
+SmartDriveBus::readWordReg(uint8_t address, uint8_t reg) {
+    Transaction tr = {ReadWordReg, address, reg, NULL, NULL, 2, 0, false, NULL};
+    return submit(tr);
+}
+
+int
+SmartDriveBus::readBytesReg(uint8_t address, uint8_t reg, uint8_t* data, int size) {
+    Transaction tr = {ReadBytesReg, address, reg, NULL, data, size, 0, false, NULL};
+    return submit(tr);
+}
+
+
+bool
+SmartDriveBus::failed(const Transaction& tr) {
+    if (tr.kind <= Write)
+        return tr.result != mraa::SUCCESS;
+    if (tr.kind == ReadBytesReg)
+        return tr.result != tr.size; //a short burst is as bad as no burst
+    return tr.result < 0;
+}
+
+
+int
+SmartDriveBus::submit(Transaction& tr, bool retry) {
+    RetryPolicy policy = GetRetryPolicy();
+    if (!retry)
+        policy.attempts = 1;
+    uint32_t backoff_us = policy.backoff_us;
+
+    for (int attempt = 1; ; attempt++) {
+        tr.done = false;
+        run(tr);
+        if (!failed(tr)) {
+            if (attempt > 1) {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_stats.recovered++;
+            }
+            return tr.result;
+        }
+        if (attempt >= policy.attempts) {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_stats.failed_calls++;
+            return tr.result;
+        }
+
+        //back off without holding the bus, the other callers keep going meanwhile
+        m_transport->sleep(std::chrono::microseconds(backoff_us));
+        backoff_us = (backoff_us * 2 < policy.max_backoff_us) ? backoff_us * 2 : policy.max_backoff_us;
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stats.retries++;
+    }
+}
+
+
+void
+SmartDriveBus::run(Transaction& tr) {
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    tr.next = NULL;
+    if (m_queueTail != NULL)
+        m_queueTail->next = &tr;
+    else
+        m_queueHead = &tr;
+    m_queueTail = &tr;
+    if (++m_queueSize > m_stats.max_queue_depth)
+        m_stats.max_queue_depth = m_queueSize;
+
+    while (!tr.done) {
+        if (m_draining) {
+            m_cond.wait(lock);
+            continue;
+        }
+
+        //nobody is using the bus : run the queue until our own transaction is done,
+        //then hand over to whoever is still waiting
+        m_draining = true;
+        while (!tr.done && m_queueHead != NULL) {
+            Transaction* cur = next();
+            perform(*cur, lock);
+            cur->done = true;
+            m_cond.notify_all();
+        }
+        m_draining = false;
+        m_cond.notify_all();
+    }
+}
+
+
+void
+SmartDriveBus::perform(Transaction& tr, std::unique_lock<std::mutex>& lock) {
+    //called by the draining thread with the lock held, the transfer itself runs unlocked
+    int previous = m_currentAddress;
+    int reopen_after = m_retry.reopen_after;
+    lock.unlock();
+
+    std::chrono::steady_clock::time_point start = m_transport->now();
+    execute(tr);
+    bool error = failed(tr);
+    bool reopened = false;
+    //nobody else uses the transport while we drain, so it can be re-opened right here
+    m_errorStreak = error ? m_errorStreak + 1 : 0;
+    if (reopen_after != 0 && m_errorStreak >= reopen_after) {
+        m_transport->reopen();
+        m_currentAddress = -1;
+        m_errorStreak = 0;
+        reopened = true;
+    }
+    std::chrono::steady_clock::duration spent = m_transport->now() - start;
+
+    lock.lock();
+    m_stats.transactions++;
+    m_stats.busy_us += std::chrono::duration_cast<std::chrono::microseconds>(spent).count();
+    if (error)
+        m_stats.errors++;
+    if (reopened)
+        m_stats.reopens++;
+    if (previous == tr.address)
+        m_stats.address_skipped++;
+    else
+        m_stats.address_switches++;
+}
+
+
+void
+SmartDriveBus::batch(BatchOp* ops, int count) {
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    //take the bus over from the queue for the whole batch
+    while (m_draining)
+        m_cond.wait(lock);
+    m_draining = true;
+
+    int merge = m_transport->maxCombinedReads();
+    if (merge > SmartDriveBus_MAX_MERGED_READS)
+        merge = SmartDriveBus_MAX_MERGED_READS;
+
+    for (int i = 0; i < count; ) {
+        int reads = 0;
+        while (reads < merge && i + reads < count && ops[i + reads].data != NULL)
+            reads++;
+        if (reads < 2) {
+            batchOne(ops[i++], 1, lock);
+            continue;
+        }
+
+        //a merged read which failed is always read again on its own, whatever the
+        //retry budget : one absent board must not fail the boards merged with it
+        performReads(ops + i, reads, lock);
+        for (int j = i; j < i + reads; j++) {
+            if (ops[j].result == ops[j].size)
+                continue;
+            m_stats.retries++;
+            batchOne(ops[j], 2, lock);
+        }
+        i += reads;
+    }
+
+    m_draining = false;
+    m_cond.notify_all();
+}
+
+
+void
+SmartDriveBus::batchOne(BatchOp& op, int attempt, std::unique_lock<std::mutex>& lock) {
+    Transaction tr = {WriteReg, op.address, op.reg, &op.value, NULL, 1, 0, false, NULL};
+    if (op.data != NULL) {
+        tr.kind = ReadBytesReg;
+        tr.rdata = op.data;
+        tr.size = op.size;
+    }
+    int attempts = op.once ? 1 : m_retry.attempts;
+    for (perform(tr, lock); failed(tr) && attempt < attempts; attempt++) {
+        m_stats.retries++;
+        perform(tr, lock);
+    }
+    if (failed(tr))
+        m_stats.failed_calls++;
+    else if (attempt > 1)
+        m_stats.recovered++;
+    op.result = tr.result;
+    op.done = m_transport->now();
+}
+
+
+void
+SmartDriveBus::performReads(BatchOp* ops, int count, std::unique_lock<std::mutex>& lock) {
+    //same contract as perform(), for reads the transport combines in one transfer
+    SmartDriveTransport::ReadSegment segments[SmartDriveBus_MAX_MERGED_READS];
+    for (int i = 0; i < count; i++) {
+        SmartDriveTransport::ReadSegment seg = {ops[i].address, ops[i].reg, ops[i].data, ops[i].size, -1};
+        segments[i] = seg;
+    }
+    int reopen_after = m_retry.reopen_after;
+    lock.unlock();
+
+    std::chrono::steady_clock::time_point start = m_transport->now();
+    int complete = -1;
+    try {
+        complete = m_transport->readMany(segments, count);
+    } catch (std::exception& e) {
+        for (int i = 0; i < count; i++)
+            segments[i].result = -1;
+    }
+    //the transport may have left any board selected
+    m_currentAddress = -1;
+    bool error = complete != count;
+    bool reopened = false;
+    m_errorStreak = error ? m_errorStreak + 1 : 0;
+    if (reopen_after != 0 && m_errorStreak >= reopen_after) {
+        m_transport->reopen();
+        m_errorStreak = 0;
+        reopened = true;
+    }
+    std::chrono::steady_clock::time_point end = m_transport->now();
+
+    lock.lock();
+    for (int i = 0; i < count; i++) {
+        ops[i].result = segments[i].result;
+        ops[i].done = end;
+        if (segments[i].result != segments[i].size)
+            m_stats.errors++;
+    }
+    m_stats.transactions += count;
+    m_stats.merged_reads += count;
+    m_stats.busy_us += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    if (reopened)
+        m_stats.reopens++;
+}
+
+
+SmartDriveBus::Transaction*
+SmartDriveBus::next() {
+    Transaction* prev = NULL;
+    Transaction* tr = m_queueHead;
+
+    //prefer the board which is already selected, within the fairness limit
+    if (m_currentAddress >= 0 && tr->address != m_currentAddress && m_reorderRun < SmartDriveBus_MAX_REORDER) {
+        for (Transaction* it = tr; it->next != NULL; it = it->next) {
+            if (it->next->address == m_currentAddress) {
+                prev = it;
+                tr = it->next;
+                m_reorderRun++;
+                m_stats.reordered++;
+                break;
+            }
+        }
+    }
+    if (prev == NULL)
+        m_reorderRun = 0;
+
+    //unlink
+    if (prev != NULL)
+        prev->next = tr->next;
+    else
+        m_queueHead = tr->next;
+    if (m_queueTail == tr)
+        m_queueTail = prev;
+    m_queueSize--;
+    return tr;
+}
+
+
+void
+SmartDriveBus::execute(Transaction& tr) {
+    //only the draining thread gets here, so m_transport and m_currentAddress need no lock
+    try {
+        if (tr.address != m_currentAddress) {
+            if (m_transport->address(tr.address) != mraa::SUCCESS) {
+                m_currentAddress = -1;
+                tr.result = -1;
+                return;
+            }
+            m_currentAddress = tr.address;
+        }
+
+        switch (tr.kind) {
+        case Select:
+            tr.result = mraa::SUCCESS;
+            break;
+        case WriteReg:
+            tr.result = m_transport->writeReg(tr.reg, tr.wdata[0]);
+            break;
+        case Write:
+            tr.result = m_transport->write(tr.wdata, tr.size);
+            break;
+        case ReadReg:
+            tr.result = m_transport->readReg(tr.reg);
+            break;
+        case ReadWordReg:
+            tr.result = m_transport->readWordReg(tr.reg);
+            break;
+        case ReadBytesReg:
+            tr.result = m_transport->readBytesReg(tr.reg, tr.rdata, tr.size);
+            break;
+        }
+    } catch (std::exception& e) {
+        m_currentAddress = -1;
+        tr.result = -1;
+    }
+    //after an error re-address the board on the next transaction
+    if (failed(tr))
+        m_currentAddress = -1;
+}
+
+
+SmartDriveBus::Stats
+SmartDriveBus::GetStats() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    Stats stats = m_stats;
+
+    stats.wall_us = std::chrono::duration_cast<std::chrono::microseconds>(m_transport->now() - m_statsStart).count();
+    stats.utilization = (stats.wall_us != 0) ? (float) stats.busy_us / stats.wall_us : 0;
+    stats.error_rate = (stats.transactions != 0) ? (float) stats.errors / stats.transactions : 0;
+    return stats;
+}
+
+void
+SmartDriveBus::ResetStats() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stats = Stats();
+    m_statsStart = m_transport->now();
+}
+
+
+void
+SmartDriveBus::SetRetryPolicy(const RetryPolicy& policy) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_retry = policy;
+    if (m_retry.attempts == 0)
+        m_retry.attempts = 1;
+}
+
+SmartDriveBus::RetryPolicy
+SmartDriveBus::GetRetryPolicy() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_retry;
+}
@@ -0,0 +1,253 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <mraa/i2c.hpp>
+
+#include "smartdrivetransport.h"
+
+//How many transactions of the currently selected board may jump ahead of
+//older transactions of other boards before we switch address anyway
+#define SmartDriveBus_MAX_REORDER   8
+
+//Default retry policy, see SmartDriveBus::RetryPolicy
+#define SmartDriveBus_RETRY_ATTEMPTS        3
+#define SmartDriveBus_RETRY_BACKOFF_US      100
+#define SmartDriveBus_RETRY_MAX_BACKOFF_US  2000
+#define SmartDriveBus_REOPEN_AFTER          8
+
+//Most consecutive reads of a batch() handed to the transport as one transfer
+#define SmartDriveBus_MAX_MERGED_READS      16
+
+namespace upm {
+
+/**
+ * @brief Shared owner of an I2C bus used by several SmartDrives
+ *
+ * Daisy-chained SmartDrives sit at different addresses on the same bus. All of
+ * them hand their transactions to one SmartDriveBus, which runs them one at a
+ * time, groups transactions of the same board together and only re-addresses
+ * the bus when the target board actually changes.
+ *
+ * There is no dedicated thread : the first caller finding the bus idle drains
+ * the queue on behalf of everybody else waiting on it.
+ *
+ * A failed transaction is retried by its caller after a short backoff, during
+ * which the bus keeps serving the other callers. The board is re-addressed
+ * after any error, and the transport is re-opened when several transactions
+ * in a row failed.
+ */
+class SmartDriveBus {
+
+public:
+    /**
+     * Bus usage counters since creation or the last ResetStats()
+     */
+    struct Stats {
+        uint64_t transactions;
+        uint64_t errors;             //failed transactions, retries included
+        uint64_t retries;            //transactions issued again after a failure
+        uint64_t recovered;          //calls which succeeded after at least one retry
+        uint64_t failed_calls;       //calls still failing once the retry budget was spent
+        uint64_t reopens;            //transport re-opened after consecutive errors
+        uint64_t address_switches;   //address() calls actually issued
+        uint64_t address_skipped;    //address() calls saved because the board was already selected
+        uint64_t reordered;          //transactions served ahead of older ones of another board
+        uint64_t merged_reads;       //batch reads served by a combined transfer of the transport
+        uint64_t busy_us;            //time spent inside mraa calls
+        uint64_t wall_us;            //time since the counters were reset
+        uint32_t max_queue_depth;
+        float    utilization;        //busy_us / wall_us
+        float    error_rate;         //errors / transactions
+    };
+
+    /**
+     * How failed transactions are retried and recovered
+     */
+    struct RetryPolicy {
+        uint8_t  attempts;           //tries per call, 1 disables retrying
+        uint32_t backoff_us;         //wait before the first retry, doubled for each next one
+        uint32_t max_backoff_us;
+        uint8_t  reopen_after;       //consecutive failed transactions before re-opening the transport, 0 never
+    };
+
+    /**
+     * One register write or burst read of a batch()
+     */
+    struct BatchOp {
+        uint8_t  address;
+        uint8_t  reg;
+        uint8_t  value;              //written when data is NULL
+        uint8_t* data;               //otherwise size registers are read into it
+        int      size;
+        int      result;             //mraa::Result of a write, bytes read for a read
+        std::chrono::steady_clock::time_point done;   //transport clock, when the transaction ended
+        bool     once;               //write tried only once, e.g. a go which would start the move again
+    };
+
+	/**
+	 * Opens the bus through mraa
+	 * @param i2c_bus Number of the I2C bus
+	 */
+    SmartDriveBus(int i2c_bus);
+
+	/**
+	 * Runs the bus on another transport, e.g. a SmartDriveSimulator
+	 * @param transport Transport used for every transaction
+	 */
+    SmartDriveBus(std::shared_ptr<SmartDriveTransport> transport);
+
+	/**
+	 * Selects a board without any data transfer, used to validate an address
+	 * @param address 7 bit address of the board
+	 */
+    mraa::Result select(uint8_t address);
+
+	/**
+	 * Writes one register of a board
+	 * @param retry false for a write which must not be applied twice, it is
+	 * then tried once : the board may have taken it although the bus failed.
+	 */
+    mraa::Result writeReg(uint8_t address, uint8_t reg, uint8_t value, bool retry = true);
+
+	/**
+	 * Writes a raw buffer to a board, the first byte being the register
+	 * @param retry false for a write which must not be applied twice, see writeReg().
+	 */
+    mraa::Result write(uint8_t address, const uint8_t* data, int size, bool retry = true);
+
+	/**
+	 * Reads one register of a board
+	 * @return Register value, -1 on error.
+	 */
+    int readReg(uint8_t address, uint8_t reg);
+
+	/**
+	 * Reads a 16 bit register of a board
+	 * @return Register value, -1 on error.
+	 */
+    int readWordReg(uint8_t address, uint8_t reg);
+
+	/**
+	 * Reads size consecutive registers of a board
+	 * @return Number of bytes read, -1 on error
+	 */
+    int readBytesReg(uint8_t address, uint8_t reg, uint8_t* data, int size);
+
+	/**
+	 * Runs transactions back to back, with no transaction of another caller in
+	 * between. A failed transaction is retried immediately, without backoff, so
+	 * the batch stays tight; writes flagged once are not. Consecutive reads are combined into one transfer
+	 * when the transport supports it.
+	 * @param ops Transactions, in order.
+	 * @param count Number of transactions.
+	 */
+    void batch(BatchOp* ops, int count);
+
+	/**
+	 * Current time on the transport clock
+	 */
+    std::chrono::steady_clock::time_point now() { return m_transport->now(); }
+
+	/**
+	 * Waits on the transport clock
+	 */
+    void sleep(std::chrono::microseconds delay) { m_transport->sleep(delay); }
+
+	/**
+	 * False when the transport runs on a virtual clock
+	 */
+    bool realTime() const { return m_transport->realTime(); }
+
+	/**
+	 * Changes the retry policy of every transaction on this bus
+	 */
+    void SetRetryPolicy(const RetryPolicy& policy);
+
+	/**
+	 * Returns the retry policy in use
+	 */
+    RetryPolicy GetRetryPolicy();
+
+	/**
+	 * Returns the usage counters of the bus
+	 */
+    Stats GetStats();
+
+	/**
+	 * Clears the usage counters
+	 */
+    void ResetStats();
+
+private:
+    enum Kind { Select, WriteReg, Write, ReadReg, ReadWordReg, ReadBytesReg };
+
+    struct Transaction {
+        Kind kind;
+        uint8_t address;
+        uint8_t reg;
+        const uint8_t* wdata;
+        uint8_t* rdata;
+        int size;
+        int result;
+        bool done;
+        Transaction* next;   //queue link, the queue never allocates
+    };
+
+    static bool failed(const Transaction& tr);
+    int submit(Transaction& tr, bool retry = true);
+    void run(Transaction& tr);
+    void perform(Transaction& tr, std::unique_lock<std::mutex>& lock);
+    void performReads(BatchOp* ops, int count, std::unique_lock<std::mutex>& lock);
+    void batchOne(BatchOp& op, int attempt, std::unique_lock<std::mutex>& lock);
+    Transaction* next();
+    void execute(Transaction& tr);
+
+private:
+    std::shared_ptr<SmartDriveTransport> m_transport;
+
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    Transaction* m_queueHead;  //oldest waiting transaction, each one lives on its caller's stack
+    Transaction* m_queueTail;
+    uint32_t m_queueSize;
+    bool m_draining;
+    int m_currentAddress;      //-1 when unknown
+    int m_reorderRun;
+    int m_errorStreak;         //consecutive failed transactions, draining thread only
+    RetryPolicy m_retry;
+
+    Stats m_stats;
+    std::chrono::steady_clock::time_point m_statsStart;
+};
+
+}
@@ -0,0 +1,337 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdexcept>
+
+#include "smartdriveclient.h"
+
+using namespace upm;
+
+typedef SmartDriveProtocol Proto;
+
+SmartDriveClient::SmartDriveClient(const std::string& path): m_fd(-1), m_nextId(1), m_batching(false),
+    m_connected(false)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": socket path too long");
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0 || connect(m_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        std::string reason = strerror(errno);
+        if (m_fd >= 0)
+            close(m_fd);
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": cannot connect to " + path + ": " + reason);
+    }
+    m_connected = true;
+    m_receiver = std::thread(&SmartDriveClient::receive, this);
+
+    std::shared_ptr<Pending> hello = post(Proto::Op_Hello, 0, NULL, 0, true);
+    Proto::Hello info = {0, 0};
+    if (wait(*hello) == mraa::SUCCESS && hello->length >= sizeof(info))
+        memcpy(&info, hello->payload, sizeof(info));
+    if (info.version != SmartDriveProto_VERSION || hello->length != sizeof(info) + info.boards * sizeof(Proto::BoardInfo)) {
+        shutdown(m_fd, SHUT_RDWR);
+        m_receiver.join();
+        close(m_fd);
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": no SmartDriveServer of this version on " + path);
+    }
+    m_boards.resize(info.boards);
+    if (info.boards != 0)
+        memcpy(&m_boards[0], hello->payload + sizeof(info), info.boards * sizeof(Proto::BoardInfo));
+}
+
+SmartDriveClient::~SmartDriveClient() {
+    shutdown(m_fd, SHUT_RDWR);
+    m_receiver.join();
+    close(m_fd);
+}
+
+
+bool
+SmartDriveClient::IsConnected() {
+    std::lock_guard<std::mutex> guard(m_pendingLock);
+    return m_connected;
+}
+
+
+std::shared_ptr<SmartDriveClient::Pending>
+SmartDriveClient::post(uint8_t op, int board, const void* args, uint8_t length, bool wait) {
+    std::shared_ptr<Pending> pending(new Pending());
+    pending->done = false;
+    pending->length = 0;
+
+    std::lock_guard<std::mutex> guard(m_sendLock);
+    uint32_t id = m_nextId++;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingLock);
+        if (!m_connected) {
+            pending->done = true;
+            pending->result = mraa::ERROR_UNSPECIFIED;
+            return pending;
+        }
+        m_pending[id] = pending;
+    }
+
+    Proto::Header header = {id, op, (uint8_t) board, 0, length};
+    m_out.insert(m_out.end(), (const uint8_t*) &header, (const uint8_t*) &header + sizeof(header));
+    m_out.insert(m_out.end(), (const uint8_t*) args, (const uint8_t*) args + length);
+    if (m_batching && !wait) {
+        m_batch.push_back(pending);
+        return std::shared_ptr<Pending>();
+    }
+    flush();
+    return pending;
+}
+
+
+mraa::Result
+SmartDriveClient::flush() {
+    //called with m_sendLock held
+    size_t offset = 0;
+    while (offset < m_out.size()) {
+        ssize_t sent = send(m_fd, &m_out[offset], m_out.size() - offset, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0) {
+            //the receiver sees the connection end and fails every pending request
+            shutdown(m_fd, SHUT_RDWR);
+            m_out.clear();
+            return mraa::ERROR_UNSPECIFIED;
+        }
+        offset += sent;
+    }
+    m_out.clear();
+    return mraa::SUCCESS;
+}
+
+
+mraa::Result
+SmartDriveClient::wait(Pending& pending) {
+    std::unique_lock<std::mutex> lock(m_pendingLock);
+    while (!pending.done)
+        m_replied.wait(lock);
+    return pending.result;
+}
+
+
+void
+SmartDriveClient::receive() {
+    std::vector<uint8_t> in;
+    uint8_t buffer[4096];
+
+    for (;;) {
+        ssize_t got = read(m_fd, buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        in.insert(in.end(), buffer, buffer + got);
+
+        size_t offset = 0;
+        std::lock_guard<std::mutex> lock(m_pendingLock);
+        while (in.size() - offset >= sizeof(Proto::Header)) {
+            Proto::Header response;
+            memcpy(&response, &in[offset], sizeof(response));
+            if (in.size() - offset < sizeof(response) + response.length)
+                break;
+            std::map<uint32_t, std::shared_ptr<Pending> >::iterator it = m_pending.find(response.id);
+            if (it != m_pending.end()) {
+                Pending& pending = *it->second;
+                pending.result = (mraa::Result) response.result;
+                pending.length = response.length;
+                memcpy(pending.payload, &in[offset + sizeof(response)], response.length);
+                pending.done = true;
+                m_pending.erase(it);
+            }
+            offset += sizeof(response) + response.length;
+        }
+        in.erase(in.begin(), in.begin() + offset);
+        m_replied.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(m_pendingLock);
+    m_connected = false;
+    for (std::map<uint32_t, std::shared_ptr<Pending> >::iterator it = m_pending.begin(); it != m_pending.end(); ++it) {
+        it->second->result = mraa::ERROR_UNSPECIFIED;
+        it->second->done = true;
+    }
+    m_pending.clear();
+    m_replied.notify_all();
+}
+
+
+mraa::Result
+SmartDriveClient::request(uint8_t op, int board, const void* args, uint8_t length, void* reply, uint8_t reply_length) {
+    if (board < 0 || board >= (int) m_boards.size())
+        return mraa::ERROR_INVALID_PARAMETER;
+
+    std::shared_ptr<Pending> pending = post(op, board, args, length, reply != NULL);
+    if (!pending)
+        return mraa::SUCCESS;   //queued in a batch
+    mraa::Result result = wait(*pending);
+    if (result == mraa::SUCCESS && reply != NULL) {
+        if (pending->length != reply_length)
+            return mraa::ERROR_UNSPECIFIED;
+        memcpy(reply, pending->payload, reply_length);
+    }
+    return result;
+}
+
+
+mraa::Result
+SmartDriveClient::motorRequest(uint8_t op, int board, MotorID_t motor, Direction_t direction, uint8_t speed,
+                               MotorAction_t action, uint32_t amount, void* reply, uint8_t reply_length) {
+    Proto::MotorArgs args = {(uint8_t) motor, (uint8_t) direction, speed, (uint8_t) action, amount};
+    return request(op, board, &args, sizeof(args), reply, reply_length);
+}
+
+
+void
+SmartDriveClient::BeginBatch() {
+    std::lock_guard<std::mutex> guard(m_sendLock);
+    m_batching = true;
+}
+
+
+mraa::Result
+SmartDriveClient::EndBatch() {
+    std::vector<std::shared_ptr<Pending> > batch;
+    {
+        std::lock_guard<std::mutex> guard(m_sendLock);
+        m_batching = false;
+        flush();
+        batch.swap(m_batch);
+    }
+
+    mraa::Result result = mraa::SUCCESS;
+    for (size_t i = 0; i < batch.size(); i++) {
+        mraa::Result ret = wait(*batch[i]);
+        if (result == mraa::SUCCESS)
+            result = ret;
+    }
+    return result;
+}
+
+
+mraa::Result
+SmartDriveClient::Run_Unlimited(int board, MotorID_t motor_number, Direction_t direction, uint8_t speed) {
+    return motorRequest(Proto::Op_RunUnlimited, board, motor_number, direction, speed, Action_Float, 0);
+}
+
+mraa::Result
+SmartDriveClient::Run_Seconds(int board, MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action) {
+    return motorRequest(Proto::Op_RunSeconds, board, motor_number, direction, speed, next_action, duration);
+}
+
+mraa::Result
+SmartDriveClient::Run_Degrees(int board, MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t degrees, MotorAction_t next_action) {
+    return motorRequest(Proto::Op_RunDegrees, board, motor_number, direction, speed, next_action, degrees);
+}
+
+mraa::Result
+SmartDriveClient::Run_Rotations(int board, MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t rotations, MotorAction_t next_action) {
+    return motorRequest(Proto::Op_RunRotations, board, motor_number, direction, speed, next_action, rotations);
+}
+
+mraa::Result
+SmartDriveClient::Run_Tacho(int board, MotorID_t motor_number, uint8_t speed, uint32_t tacho_count, MotorAction_t next_action) {
+    return motorRequest(Proto::Op_RunTacho, board, motor_number, Dir_Forward, speed, next_action, tacho_count);
+}
+
+mraa::Result
+SmartDriveClient::StopMotor(int board, MotorID_t motor_number, MotorAction_t next_action) {
+    return motorRequest(Proto::Op_StopMotor, board, motor_number, Dir_Forward, 0, next_action, 0);
+}
+
+mraa::Result
+SmartDriveClient::SetPerformanceParameters(int board, const SmartDrive::PerformanceParameters& params) {
+    return request(Proto::Op_SetPerformance, board, &params, sizeof(params), NULL, 0);
+}
+
+
+SmartDriveResult<uint8_t>
+SmartDriveClient::GetMotorStatus(int board, MotorID_t motor_id) {
+    uint8_t status;
+    mraa::Result ret = motorRequest(Proto::Op_GetMotorStatus, board, motor_id, Dir_Forward, 0, Action_Float, 0, &status, sizeof(status));
+    if (ret != mraa::SUCCESS)
+        return SmartDriveResult<uint8_t>::Failure(ret);
+    return status;
+}
+
+SmartDriveResult<uint32_t>
+SmartDriveClient::ReadTachometerPosition(int board, MotorID_t motor_number) {
+    uint32_t position;
+    mraa::Result ret = motorRequest(Proto::Op_ReadTachometerPosition, board, motor_number, Dir_Forward, 0, Action_Float, 0, &position, sizeof(position));
+    if (ret != mraa::SUCCESS)
+        return SmartDriveResult<uint32_t>::Failure(ret);
+    return position;
+}
+
+SmartDriveResult<float>
+SmartDriveClient::GetBattVoltage(int board) {
+    float mv;
+    mraa::Result ret = request(Proto::Op_GetBattVoltage, board, NULL, 0, &mv, sizeof(mv));
+    if (ret != mraa::SUCCESS)
+        return SmartDriveResult<float>::Failure(ret);
+    return mv;
+}
+
+SmartDriveResult<bool>
+SmartDriveClient::IsTachoDone(int board, MotorID_t motor_number) {
+    uint8_t done;
+    mraa::Result ret = motorRequest(Proto::Op_IsTachoDone, board, motor_number, Dir_Forward, 0, Action_Float, 0, &done, sizeof(done));
+    if (ret != mraa::SUCCESS)
+        return SmartDriveResult<bool>::Failure(ret);
+    return done != 0;
+}
+
+SmartDriveResult<bool>
+SmartDriveClient::IsTimeDone(int board, MotorID_t motor_number) {
+    uint8_t done;
+    mraa::Result ret = motorRequest(Proto::Op_IsTimeDone, board, motor_number, Dir_Forward, 0, Action_Float, 0, &done, sizeof(done));
+    if (ret != mraa::SUCCESS)
+        return SmartDriveResult<bool>::Failure(ret);
+    return done != 0;
+}
+
+SmartDriveResult<SmartDriveProtocol::State>
+SmartDriveClient::ReadState(int board) {
+    Proto::State state;
+    mraa::Result ret = request(Proto::Op_ReadState, board, NULL, 0, &state, sizeof(state));
+    if (ret != mraa::SUCCESS)
+        return SmartDriveResult<SmartDriveProtocol::State>::Failure(ret);
+    return state;
+}
@@ -0,0 +1,142 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "smartdrive.h"
+#include "smartdriveprotocol.h"
+
+namespace upm {
+
+/**
+ * @brief Access to the SmartDrives of a SmartDriveServer
+ *
+ * Mirrors the SmartDrive API, each method taking the index of the board in
+ * GetBoards() first. Any number of threads may share a client : their
+ * requests are pipelined on the one connection, a receiver thread hands each
+ * response to the caller waiting for it.
+ *
+ * Commands issued between BeginBatch() and EndBatch() do not wait for their
+ * response and leave in a single write at EndBatch(), so the server runs them
+ * back to back. A status read inside a batch sends the batch so far along.
+ */
+class SmartDriveClient {
+
+public:
+	/**
+	 * Connects to a server, throws std::invalid_argument when it cannot
+	 * @param path Path of the server socket.
+	 */
+    SmartDriveClient(const std::string& path = SmartDriveProto_SOCKET);
+
+	/**
+	 * Disconnects, the server brakes the motors this client started
+	 */
+    ~SmartDriveClient();
+
+	/**
+	 * Boards of the server, in the order of their index
+	 */
+    const std::vector<SmartDriveProtocol::BoardInfo>& GetBoards() const { return m_boards; }
+
+	/**
+	 * False once the server closed the connection, every request then fails
+	 */
+    bool IsConnected();
+
+    mraa::Result Run_Unlimited(int board, MotorID_t motor_number, Direction_t direction, uint8_t speed);
+    mraa::Result Run_Seconds(int board, MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action);
+    mraa::Result Run_Degrees(int board, MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t degrees, MotorAction_t next_action);
+    mraa::Result Run_Rotations(int board, MotorID_t motor_number, Direction_t direction, uint8_t speed, uint32_t rotations, MotorAction_t next_action);
+    mraa::Result Run_Tacho(int board, MotorID_t motor_number, uint8_t speed, uint32_t tacho_count, MotorAction_t next_action);
+    mraa::Result StopMotor(int board, MotorID_t motor_number, MotorAction_t next_action);
+    mraa::Result SetPerformanceParameters(int board, const SmartDrive::PerformanceParameters& params);
+
+    SmartDriveResult<uint8_t> GetMotorStatus(int board, MotorID_t motor_id);
+    SmartDriveResult<uint32_t> ReadTachometerPosition(int board, MotorID_t motor_number);
+    SmartDriveResult<float> GetBattVoltage(int board);
+    SmartDriveResult<bool> IsTachoDone(int board, MotorID_t motor_number);
+    SmartDriveResult<bool> IsTimeDone(int board, MotorID_t motor_number);
+
+	/**
+	 * Positions, statuses, battery and currents of a board, from one burst read
+	 */
+    SmartDriveResult<SmartDriveProtocol::State> ReadState(int board);
+
+	/**
+	 * Starts queueing commands, they return mraa::SUCCESS without waiting
+	 */
+    void BeginBatch();
+
+	/**
+	 * Sends the queued commands and waits for their responses
+	 * @return First error of the batch, mraa::SUCCESS if all of them succeeded.
+	 */
+    mraa::Result EndBatch();
+
+private:
+    struct Pending {
+        bool done;
+        mraa::Result result;
+        uint8_t length;
+        uint8_t payload[SmartDriveProto_MAX_PAYLOAD];
+    };
+
+    std::shared_ptr<Pending> post(uint8_t op, int board, const void* args, uint8_t length, bool wait);
+    mraa::Result request(uint8_t op, int board, const void* args, uint8_t length, void* reply, uint8_t reply_length);
+    mraa::Result motorRequest(uint8_t op, int board, MotorID_t motor, Direction_t direction, uint8_t speed,
+                              MotorAction_t action, uint32_t amount, void* reply = NULL, uint8_t reply_length = 0);
+    mraa::Result wait(Pending& pending);
+    mraa::Result flush();
+    void receive();
+
+private:
+    int m_fd;
+    std::vector<SmartDriveProtocol::BoardInfo> m_boards;
+    std::thread m_receiver;
+
+    std::mutex m_sendLock;
+    std::vector<uint8_t> m_out;     //requests not written yet
+    uint32_t m_nextId;
+    bool m_batching;
+    std::vector<std::shared_ptr<Pending> > m_batch;
+
+    std::mutex m_pendingLock;
+    std::condition_variable m_replied;
+    std::map<uint32_t, std::shared_ptr<Pending> > m_pending;
+    bool m_connected;
+};
+
+}
@@ -0,0 +1,263 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <vector>
+
+#include "smartdrivecommander.h"
+
+using namespace upm;
+
+SmartDriveCommander::SmartDriveCommander(SmartDrive& drive): m_drive(drive), m_head(&m_stub), m_tail(&m_stub), m_stub(),
+    m_sleeping(false), m_running(true), m_posted(0), m_stats()
+{
+    m_stub.next.store(NULL);
+    m_thread = std::thread(&SmartDriveCommander::run, this);
+}
+
+SmartDriveCommander::~SmartDriveCommander()
+{
+    m_running = false;
+    {
+        std::lock_guard<std::mutex> lock(m_wakeLock);
+        m_wake.notify_one();
+    }
+    m_thread.join();
+}
+
+void
+SmartDriveCommander::push(Node* node) {
+    node->next.store(NULL, std::memory_order_relaxed);
+    Node* prev = m_head.exchange(node);
+    prev->next.store(node, std::memory_order_release);
+    m_posted++;
+
+    if (m_sleeping.load()) {
+        std::lock_guard<std::mutex> lock(m_wakeLock);
+        m_wake.notify_one();
+    }
+}
+
+SmartDriveCommander::Node*
+SmartDriveCommander::pop() {
+    Node* tail = m_tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &m_stub) {
+        if (next == NULL)
+            return NULL;
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != NULL) {
+        m_tail = next;
+        return tail;
+    }
+    if (tail != m_head.load())
+        return NULL;   //a producer is between its exchange and its link, try again later
+
+    //tail is the last node, put the stub behind it so it can be handed out
+    m_stub.next.store(NULL, std::memory_order_relaxed);
+    Node* prev = m_head.exchange(&m_stub);
+    prev->next.store(&m_stub, std::memory_order_release);
+
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != NULL) {
+        m_tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+void
+SmartDriveCommander::Run_Unlimited(MotorID_t motor_number, Direction_t direction, uint8_t speed) {
+    Node* node = new Node();
+    node->kind = Setpoint;
+    node->motors = motor_number;
+    node->direction = direction;
+    node->speed = speed;
+    push(node);
+}
+
+void
+SmartDriveCommander::StopMotor(MotorID_t motor_number, MotorAction_t next_action) {
+    Node* node = new Node();
+    node->kind = Stop;
+    node->motors = motor_number;
+    node->action = next_action;
+    push(node);
+}
+
+std::future<mraa::Result>
+SmartDriveCommander::Execute(std::function<mraa::Result(SmartDrive&)> call) {
+    Node* node = new Node();
+    node->kind = Call;
+    node->motors = 0;
+    node->task = new Task();
+    node->task->call = call;
+    std::future<mraa::Result> result = node->task->result.get_future();
+    push(node);
+    return result;
+}
+
+void
+SmartDriveCommander::Flush() {
+    Execute([](SmartDrive&) { return mraa::SUCCESS; }).wait();
+}
+
+SmartDriveCommander::Stats
+SmartDriveCommander::GetStats() {
+    std::lock_guard<std::mutex> lock(m_statsLock);
+    Stats stats = m_stats;
+    stats.posted = m_posted.load();
+    return stats;
+}
+
+void
+SmartDriveCommander::run() {
+    std::vector<Node*> batch;
+
+    for (;;) {
+        batch.clear();
+        for (Node* node = pop(); node != NULL; node = pop())
+            batch.push_back(node);
+
+        if (!batch.empty()) {
+            issue(batch.data(), batch.size());
+            for (size_t i = 0; i < batch.size(); i++) {
+                delete batch[i]->task;
+                delete batch[i];
+            }
+            continue;
+        }
+        if (!m_running)
+            break;
+
+        std::unique_lock<std::mutex> lock(m_wakeLock);
+        m_sleeping = true;
+        //the queue is empty once the stub is both its head and its tail
+        m_wake.wait(lock, [this] { return m_head.load() != m_tail || !m_running; });
+        m_sleeping = false;
+    }
+}
+
+void
+SmartDriveCommander::count(Stats& stats, mraa::Result result) {
+    stats.issued++;
+    if (result != mraa::SUCCESS)
+        stats.errors++;
+}
+
+void
+SmartDriveCommander::coalesce(Node** nodes, size_t size, Stats& stats) {
+    //position of the last stop and of the last setpoint of each motor, -1 if none
+    long lastStop[2] = {-1, -1};
+    long lastSetpoint[2] = {-1, -1};
+    for (size_t i = 0; i < size; i++) {
+        for (int m = 0; m < 2; m++) {
+            if (!(nodes[i]->motors & (1 << m)))
+                continue;
+            if (nodes[i]->kind == Stop)
+                lastStop[m] = i;
+            else
+                lastSetpoint[m] = i;
+        }
+    }
+
+    //stops first, a stop overridden by a later stop of the same motors is skipped
+    for (size_t i = 0; i < size; i++) {
+        Node* node = nodes[i];
+        if (node->kind != Stop)
+            continue;
+        bool latest = false;
+        for (int m = 0; m < 2; m++)
+            latest |= (node->motors & (1 << m)) && lastStop[m] == (long) i;
+        if (latest)
+            count(stats, m_drive.StopMotor((MotorID_t) node->motors, node->action));
+    }
+
+    //then the newest setpoint of each motor, unless a stop came after it
+    Node* wanted[2] = {NULL, NULL};
+    for (int m = 0; m < 2; m++)
+        if (lastSetpoint[m] > lastStop[m])
+            wanted[m] = nodes[lastSetpoint[m]];
+    for (size_t i = 0; i < size; i++) {
+        Node* node = nodes[i];
+        if (node->kind != Setpoint || node == wanted[0] || node == wanted[1])
+            continue;
+        bool stopped = true;
+        for (int m = 0; m < 2; m++)
+            if ((node->motors & (1 << m)) && lastStop[m] < (long) i)
+                stopped = false;
+        if (stopped)
+            stats.cancelled++;
+        else
+            stats.coalesced++;
+    }
+    if (wanted[0] != NULL && wanted[1] != NULL &&
+        wanted[0]->direction == wanted[1]->direction && wanted[0]->speed == wanted[1]->speed) {
+        //same speed on both motors, one write of both blocks
+        count(stats, m_drive.Run_Unlimited(Motor_ID_BOTH, wanted[0]->direction, wanted[0]->speed));
+    } else {
+        for (int m = 0; m < 2; m++)
+            if (wanted[m] != NULL)
+                count(stats, m_drive.Run_Unlimited((MotorID_t) (m + 1), wanted[m]->direction, wanted[m]->speed));
+    }
+}
+
+void
+SmartDriveCommander::issue(Node** batch, size_t size) {
+    Stats stats = Stats();
+
+    //calls split the batch, the stops and setpoints posted before a call are
+    //issued before it, the ones posted after it never move ahead of it
+    size_t start = 0;
+    for (size_t i = 0; i < size; i++) {
+        Node* node = batch[i];
+        if (node->kind != Call)
+            continue;
+        coalesce(batch + start, i - start, stats);
+        start = i + 1;
+        try {
+            mraa::Result result = node->task->call(m_drive);
+            count(stats, result);
+            node->task->result.set_value(result);
+        } catch (...) {
+            node->task->result.set_exception(std::current_exception());
+        }
+    }
+    coalesce(batch + start, size - start, stats);
+
+    std::lock_guard<std::mutex> lock(m_statsLock);
+    m_stats.issued += stats.issued;
+    m_stats.coalesced += stats.coalesced;
+    m_stats.cancelled += stats.cancelled;
+    m_stats.errors += stats.errors;
+    m_stats.batches++;
+    if (size > m_stats.max_batch)
+        m_stats.max_batch = size;
+}
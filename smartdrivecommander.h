@@ -0,0 +1,159 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "smartdrive.h"
+
+namespace upm {
+
+/**
+ * @brief Thread-safe command front end of a SmartDrive
+ *
+ * Any thread may post commands, they are pushed on a lock-free multi-producer
+ * queue and a single bus thread is the only one calling the SmartDrive. Each
+ * time it wakes up, the bus thread takes everything queued. The other commands
+ * run in the order they were posted, and between two of them it issues the
+ * stops and setpoints posted there as :
+ *
+ *  - stops first, a stop also drops the setpoints of its motor posted before it,
+ *  - then the newest speed setpoint of each motor, older ones are stale and skipped.
+ *
+ * Stops and setpoints never move ahead of an other command posted before them.
+ *
+ * Under bursty load the bus only carries the commands which still matter.
+ */
+class SmartDriveCommander {
+
+public:
+    /**
+     * Commander counters
+     */
+    struct Stats {
+        uint64_t posted;        //commands pushed by the producers
+        uint64_t issued;        //SmartDrive calls made by the bus thread
+        uint64_t coalesced;     //setpoints skipped because a newer one of the same motor followed
+        uint64_t cancelled;     //setpoints dropped by a later stop of their motor
+        uint64_t batches;       //bus thread wake-ups which found commands
+        uint32_t max_batch;     //most commands taken at once
+        uint64_t errors;        //calls which did not return mraa::SUCCESS
+    };
+
+	/**
+	 * Starts the bus thread
+	 * @param drive SmartDrive to command, must outlive the commander. Other
+	 *        threads should not call it directly any more, use Execute().
+	 */
+    SmartDriveCommander(SmartDrive& drive);
+
+	/**
+	 * Issues the commands still queued, then stops the bus thread
+	 */
+    ~SmartDriveCommander();
+
+	/**
+	 * Posts a speed setpoint, see SmartDrive::Run_Unlimited. Replaces a setpoint
+	 * of the same motor not issued yet.
+	 */
+    void Run_Unlimited(MotorID_t motor_number, Direction_t direction, uint8_t speed);
+
+	/**
+	 * Posts a stop, issued ahead of the setpoints queued with it but after the
+	 * other commands posted before it, see SmartDrive::StopMotor
+	 */
+    void StopMotor(MotorID_t motor_number, MotorAction_t next_action);
+
+	/**
+	 * Posts any other call, run on the bus thread in posting order
+	 * @param call Called with the SmartDrive.
+	 * @return Result of the call, or the exception it threw.
+	 */
+    std::future<mraa::Result> Execute(std::function<mraa::Result(SmartDrive&)> call);
+
+	/**
+	 * Waits until everything posted before was issued
+	 */
+    void Flush();
+
+	/**
+	 * Returns the commander counters
+	 */
+    Stats GetStats();
+
+private:
+    enum Kind { Setpoint, Stop, Call };
+
+    //body of a Call, allocated by Execute() only : setpoints and stops stay one small allocation
+    struct Task {
+        std::function<mraa::Result(SmartDrive&)> call;
+        std::promise<mraa::Result> result;
+    };
+
+    struct Node {
+        std::atomic<Node*> next;
+        Kind kind;
+        int motors;              //bit 0 for M1, bit 1 for M2
+        Direction_t direction;
+        uint8_t speed;
+        MotorAction_t action;
+        Task* task;              //Call only, owned by the node
+    };
+
+    void push(Node* node);
+    Node* pop();
+    void run();
+    void issue(Node** batch, size_t count);
+    void coalesce(Node** nodes, size_t size, Stats& stats);
+    static void count(Stats& stats, mraa::Result result);
+
+private:
+    SmartDrive& m_drive;
+
+    //Vyukov intrusive MPSC queue, producers only exchange the head
+    alignas(64) std::atomic<Node*> m_head;
+    alignas(64) Node* m_tail;                //bus thread only
+    Node m_stub;
+
+    std::atomic<bool> m_sleeping;            //set by the bus thread before it waits
+    std::atomic<bool> m_running;
+    std::mutex m_wakeLock;
+    std::condition_variable m_wake;
+
+    std::atomic<uint64_t> m_posted;
+    std::mutex m_statsLock;                  //held briefly at the end of each batch and by GetStats()
+    Stats m_stats;
+    std::thread m_thread;
+};
+
+}
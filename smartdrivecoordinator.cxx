@@ -0,0 +1,275 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <algorithm>
+#include <mutex>
+
+#include "smartdrivecoordinator.h"
+
+using namespace upm;
+
+//Runs ops[i] on buses[i], one batch per bus, keeping the order inside each bus
+static void
+runBatches(std::vector<SmartDriveBus::BatchOp>& ops, const std::vector<std::shared_ptr<SmartDriveBus> >& buses) {
+    std::vector<bool> sent(ops.size(), false);
+
+    for (size_t first = 0; first < ops.size(); first++) {
+        if (sent[first])
+            continue;
+        std::vector<SmartDriveBus::BatchOp> group;
+        std::vector<size_t> index;
+        for (size_t i = first; i < ops.size(); i++) {
+            if (!sent[i] && buses[i] == buses[first]) {
+                group.push_back(ops[i]);
+                index.push_back(i);
+                sent[i] = true;
+            }
+        }
+        buses[first]->batch(&group[0], group.size());
+        for (size_t i = 0; i < index.size(); i++)
+            ops[index[i]] = group[i];
+    }
+}
+
+
+SmartDriveCoordinator::SmartDriveCoordinator()
+{
+    m_stats = Stats();
+}
+
+
+SmartDriveCoordinator::Board&
+SmartDriveCoordinator::board(SmartDrive& drive) {
+    for (size_t i = 0; i < m_boards.size(); i++)
+        if (m_boards[i].drive == &drive)
+            return m_boards[i];
+
+    Board board;
+    board.drive = &drive;
+    board.axis[0].used = board.axis[1].used = false;
+    board.both = false;
+    board.seen_busy = false;
+    board.done = true;
+    m_boards.push_back(board);
+    return m_boards.back();
+}
+
+void
+SmartDriveCoordinator::add(SmartDrive& drive, MotorID_t motor_number, const Axis& axis) {
+    Board& b = board(drive);
+    if (motor_number != Motor_ID_2)
+        b.axis[0] = axis;
+    if (motor_number != Motor_ID_1)
+        b.axis[1] = axis;
+    b.both = (motor_number == Motor_ID_BOTH);
+}
+
+mraa::Result
+SmartDriveCoordinator::preload(SmartDrive& drive, MotorID_t motor_number, const Axis& axis) {
+    if (axis.tacho)
+        return drive.PreloadTacho(motor_number, axis.speed, axis.tacho_count, axis.relative, axis.next_action);
+    return drive.PreloadSeconds(motor_number, axis.direction, axis.speed, axis.duration, axis.next_action);
+}
+
+void
+SmartDriveCoordinator::AddTacho(SmartDrive& drive, MotorID_t motor_number, uint8_t speed, int32_t tacho_count, bool relative, MotorAction_t next_action) {
+    Axis axis;
+    axis.used = true;
+    axis.tacho = true;
+    axis.relative = relative;
+    axis.tacho_count = tacho_count;
+    axis.direction = Dir_Forward;
+    axis.speed = speed;
+    axis.duration = 0;
+    axis.next_action = next_action;
+    add(drive, motor_number, axis);
+}
+
+void
+SmartDriveCoordinator::AddSeconds(SmartDrive& drive, MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action) {
+    Axis axis;
+    axis.used = true;
+    axis.tacho = false;
+    axis.relative = false;
+    axis.tacho_count = 0;
+    axis.direction = direction;
+    axis.speed = speed;
+    axis.duration = duration;
+    axis.next_action = next_action;
+    add(drive, motor_number, axis);
+}
+
+void
+SmartDriveCoordinator::Clear() {
+    m_boards.clear();
+}
+
+
+mraa::Result
+SmartDriveCoordinator::Start(uint32_t delay_us) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    m_stats = Stats();
+    m_stats.boards = m_boards.size();
+    if (m_boards.empty())
+        return mraa::SUCCESS;
+
+    //no other command of these boards may land between their preload and their go,
+    //the locks are taken in address order so two coordinators cannot deadlock
+    std::vector<Board*> order;
+    for (size_t i = 0; i < m_boards.size(); i++)
+        order.push_back(&m_boards[i]);
+    std::sort(order.begin(), order.end(), [](const Board* a, const Board* b) { return a->drive < b->drive; });
+    std::vector<std::unique_lock<std::mutex> > locks;
+    for (size_t i = 0; i < order.size(); i++)
+        locks.push_back(order[i]->drive->LockCommands());
+
+    //every setpoint is in place before the first board starts
+    std::shared_ptr<SmartDriveBus> clock = m_boards[0].drive->GetBus();
+    std::chrono::steady_clock::time_point begin = clock->now();
+    for (size_t i = 0; i < m_boards.size(); i++) {
+        Board& b = m_boards[i];
+        mraa::Result ret = mraa::SUCCESS;
+        if (b.both) {
+            ret = preload(*b.drive, Motor_ID_BOTH, b.axis[0]);
+        } else {
+            for (int m = 0; m < 2 && ret == mraa::SUCCESS; m++)
+                if (b.axis[m].used)
+                    ret = preload(*b.drive, m == 0 ? Motor_ID_1 : Motor_ID_2, b.axis[m]);
+        }
+        if (ret != mraa::SUCCESS) {
+            for (size_t j = 0; j < m_boards.size(); j++)
+                m_boards[j].drive->PreloadDone(false);
+            return ret;
+        }
+    }
+    m_stats.preload_us = duration_cast<microseconds>(clock->now() - begin).count();
+    if (delay_us != 0)
+        clock->sleep(microseconds(delay_us));
+
+    //one single byte write per board : the sync go for both motors, else the GO bit of the motor
+    std::vector<SmartDriveBus::BatchOp> ops;
+    std::vector<std::shared_ptr<SmartDriveBus> > buses;
+    for (size_t i = 0; i < m_boards.size(); i++) {
+        ops.push_back(m_boards[i].drive->GoOp());
+        buses.push_back(m_boards[i].drive->GetBus());
+    }
+    runBatches(ops, buses);
+
+    mraa::Result result = mraa::SUCCESS;
+    std::chrono::steady_clock::time_point first = ops[0].done, last = ops[0].done;
+    for (size_t i = 0; i < ops.size(); i++) {
+        Board& b = m_boards[i];
+        if (ops[i].result != mraa::SUCCESS && result == mraa::SUCCESS)
+            result = (mraa::Result) ops[i].result;
+        if (ops[i].done < first)
+            first = ops[i].done;
+        if (ops[i].done > last)
+            last = ops[i].done;
+        //a failed go may still have been taken by the board, its move is watched anyway
+        b.drive->PreloadDone(true);
+        b.seen_busy = false;
+        b.done = false;
+    }
+    m_started = first;
+    m_stats.start_skew_us = duration_cast<microseconds>(last - first).count();
+    if (ops.size() > 1)
+        m_stats.transaction_us = m_stats.start_skew_us / (ops.size() - 1);
+    return result;
+}
+
+
+bool
+SmartDriveCoordinator::Sweep() {
+    std::vector<uint8_t> status(2 * m_boards.size(), 0);
+    std::vector<SmartDriveBus::BatchOp> ops;
+    std::vector<std::shared_ptr<SmartDriveBus> > buses;
+    std::vector<size_t> owner;
+
+    //both status registers of every board still moving, one burst each
+    for (size_t i = 0; i < m_boards.size(); i++) {
+        Board& b = m_boards[i];
+        if (b.done)
+            continue;
+        SmartDriveBus::BatchOp op = {(uint8_t) b.drive->GetAddress(), SmartDrive_STATUS_M1, 0,
+                                     &status[2 * i], 2, 0, std::chrono::steady_clock::time_point(), false};
+        ops.push_back(op);
+        buses.push_back(b.drive->GetBus());
+        owner.push_back(i);
+    }
+    if (ops.empty())
+        return true;
+    runBatches(ops, buses);
+    m_stats.sweeps++;
+
+    //right after the go the status may not show the move yet, same rule as SmartDrive::WaitUntil*
+    bool all_done = true;
+    std::chrono::steady_clock::time_point last = ops[0].done;
+    for (size_t k = 0; k < ops.size(); k++) {
+        Board& b = m_boards[owner[k]];
+        //the buses run one after the other in the order of their first board,
+        //the last op of the array is not always the latest
+        if (ops[k].done > last)
+            last = ops[k].done;
+        if (ops[k].result != 2) {
+            all_done = false;
+            continue;
+        }
+        bool busy = false;
+        for (int m = 0; m < 2; m++) {
+            if (b.axis[m].used)
+                busy |= (status[2 * owner[k] + m] &
+                         (b.axis[m].tacho ? SmartDrive_MOTOR_POS_CTRL_ON : SmartDrive_MOTOR_IN_TIME_MODE)) != 0;
+        }
+        if (busy)
+            b.seen_busy = true;
+        else if (b.seen_busy || ops[k].done - m_started >= std::chrono::microseconds(SmartDrive_WAIT_SETTLE_US))
+            b.done = true;
+        all_done &= b.done;
+    }
+    if (all_done)
+        m_stats.completion_us = std::chrono::duration_cast<std::chrono::microseconds>(last - m_started).count();
+    return all_done;
+}
+
+
+bool
+SmartDriveCoordinator::WaitUntilDone(uint32_t timeout_ms) {
+    if (m_boards.empty())
+        return true;
+    std::shared_ptr<SmartDriveBus> clock = m_boards[0].drive->GetBus();
+    std::chrono::steady_clock::time_point deadline = clock->now() + std::chrono::milliseconds(timeout_ms);
+
+    while (!Sweep()) {
+        if (timeout_ms != 0 && clock->now() >= deadline)
+            return false;
+        clock->sleep(std::chrono::microseconds(SmartDriveCoord_POLL_US));
+    }
+    return true;
+}
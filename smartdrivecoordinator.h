@@ -0,0 +1,151 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "smartdrive.h"
+
+#define SmartDriveCoord_POLL_US   5000   //period of the completion sweeps
+
+namespace upm {
+
+/**
+ * @brief Starts moves on several SmartDrives together
+ *
+ * The sync go command only starts the two motors of one board. The coordinator
+ * first writes every participating board's setpoints without starting them,
+ * then fires one go write per board back to back in a single bus batch, so the
+ * start of two consecutive boards is at most one transaction apart. Completion
+ * of every axis is detected with one batched status read per board. Other
+ * commands of the boards, e.g. a StopMotor from another thread, wait from the
+ * preload until the go was sent.
+ *
+ * Boards on different buses are started one bus after the other, the batches
+ * of the buses do not run concurrently.
+ */
+class SmartDriveCoordinator {
+
+public:
+    /**
+     * Timings of the last Start() and wait
+     */
+    struct Stats {
+        uint32_t boards;
+        uint32_t preload_us;       //writing every setpoint
+        uint32_t start_skew_us;    //first to last go write completed, buses one after the other
+        uint32_t transaction_us;   //start_skew_us / (boards - 1), the skew between consecutive boards of one bus
+        uint32_t sweeps;           //batched status sweeps until completion
+        uint32_t completion_us;    //from the first go to completion detected
+    };
+
+    SmartDriveCoordinator();
+
+	/**
+	 * Adds a tacho move, started by the next Start()
+	 * @param drive Board of the axis, must outlive the coordinator.
+	 * @param motor_number Motor(s) of the board.
+	 * @param speed The speed at which you wish to turn the motor(s).
+	 * @param tacho_count Absolute count, or signed distance when relative.
+	 * @param relative Whether tacho_count is relative to the current position.
+	 * @param next_action How you wish to stop the motor(s).
+	 */
+    void AddTacho(SmartDrive& drive, MotorID_t motor_number, uint8_t speed, int32_t tacho_count, bool relative, MotorAction_t next_action);
+
+	/**
+	 * Adds a timed move, started by the next Start()
+	 * @param drive Board of the axis, must outlive the coordinator.
+	 * @param motor_number Motor(s) of the board.
+	 * @param direction The direction you wish to turn the motor(s).
+	 * @param speed The speed at which you wish to turn the motor(s).
+	 * @param duration The time in seconds you wish to turn the motor(s).
+	 * @param next_action How you wish to stop the motor(s).
+	 */
+    void AddSeconds(SmartDrive& drive, MotorID_t motor_number, Direction_t direction, uint8_t speed, uint8_t duration, MotorAction_t next_action);
+
+	/**
+	 * Removes every axis
+	 */
+    void Clear();
+
+	/**
+	 * Preloads every axis, then starts them all in one burst
+	 * @param delay_us Extra delay between the end of the preload and the burst.
+	 * @return First error met, nothing is started if a preload failed.
+	 */
+    mraa::Result Start(uint32_t delay_us = 0);
+
+	/**
+	 * Reads the status of every board once
+	 * @return true when every axis is done.
+	 */
+    bool Sweep();
+
+	/**
+	 * Sweeps until every axis is done
+	 * @param timeout_ms Give up after this many milliseconds, 0 waits forever.
+	 * @return false when the timeout expired first.
+	 */
+    bool WaitUntilDone(uint32_t timeout_ms = 0);
+
+	/**
+	 * Returns the timings of the last Start() and wait
+	 */
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    struct Axis {
+        bool          used;
+        bool          tacho;
+        bool          relative;
+        int32_t       tacho_count;
+        Direction_t   direction;
+        uint8_t       speed;
+        uint8_t       duration;
+        MotorAction_t next_action;
+    };
+
+    struct Board {
+        SmartDrive* drive;
+        Axis        axis[2];
+        bool        both;        //both axes added by one call, preloaded in one write
+        bool        seen_busy;
+        bool        done;
+    };
+
+    Board& board(SmartDrive& drive);
+    void add(SmartDrive& drive, MotorID_t motor_number, const Axis& axis);
+    static mraa::Result preload(SmartDrive& drive, MotorID_t motor_number, const Axis& axis);
+
+private:
+    std::vector<Board> m_boards;
+    std::chrono::steady_clock::time_point m_started;
+    Stats m_stats;
+};
+
+}
@@ -0,0 +1,221 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdexcept>
+#include <thread>
+
+#include "smartdrivediscovery.h"
+#include "smartdrivetrace.h"
+
+using namespace upm;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+
+namespace {
+
+//identification text, without padding
+std::string
+idString(const uint8_t* data) {
+    std::string text;
+    for (int i = 0; i < SmartDrive_ID_SIZE && data[i] != 0; i++)
+        text += (data[i] >= 0x20 && data[i] < 0x7F) ? (char) data[i] : '?';
+    size_t end = text.find_last_not_of(' ');
+    return (end == std::string::npos) ? std::string() : text.substr(0, end + 1);
+}
+
+uint32_t
+elapsedUs(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+    return duration_cast<microseconds>(end - begin).count();
+}
+
+}
+
+SmartDriveDiscovery::SmartDriveDiscovery(const std::vector<int>& buses):
+    m_busNumbers(buses), m_buses(buses.size()), m_options(DefaultOptions()), m_stats()
+{
+}
+
+SmartDriveDiscovery::SmartDriveDiscovery(const std::vector<std::shared_ptr<SmartDriveBus> >& buses):
+    m_buses(buses), m_options(DefaultOptions()), m_stats()
+{
+    for (size_t i = 0; i < buses.size(); i++)
+        if (!buses[i])
+            throw std::invalid_argument(std::string(__FUNCTION__) + ": null bus");
+}
+
+SmartDriveDiscovery::Options
+SmartDriveDiscovery::DefaultOptions() {
+    Options options;
+    options.first_address = SmartDriveDisc_FIRST_ADDRESS;
+    options.last_address = SmartDriveDisc_LAST_ADDRESS;
+    options.device_id = SmartDriveDisc_DEVICE_ID;
+    options.min_battery_mv = 0;
+    options.apply_pid = false;
+    options.pid = SmartDrive::PerformanceParameters();
+    return options;
+}
+
+std::vector<SmartDriveDiscovery::Board>
+SmartDriveDiscovery::Run() {
+    size_t count = m_buses.size();
+    std::vector<std::vector<Board> > found(count);
+
+    m_stats = Stats();
+    m_stats.buses = count;
+    m_stats.bus.assign(count, BusStats());
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < count; i++)
+        workers.push_back(std::thread(&SmartDriveDiscovery::scan, this, i, std::ref(found[i]), std::ref(m_stats.bus[i])));
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    std::vector<Board> boards;
+    for (size_t i = 0; i < count; i++) {
+        const BusStats& bus = m_stats.bus[i];
+        uint32_t total = bus.open_us + bus.probe_us + bus.init_us;
+        if (total > m_stats.elapsed_us)
+            m_stats.elapsed_us = total;
+        m_stats.serial_us += total;
+        for (size_t b = 0; b < found[i].size(); b++) {
+            if (found[i][b].result == mraa::SUCCESS)
+                m_stats.ready++;
+            boards.push_back(found[i][b]);
+        }
+    }
+    m_stats.boards = boards.size();
+    return boards;
+}
+
+void
+SmartDriveDiscovery::scan(size_t index, std::vector<Board>& boards, BusStats& stats) {
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+    stats.result = mraa::SUCCESS;
+    if (!m_buses[index]) {
+        try {
+            m_buses[index].reset(new SmartDriveBus(m_busNumbers[index]));
+        } catch (std::exception&) {
+            SMARTDRIVE_ERROR("Cannot open I2C bus %lld", (long long) m_busNumbers[index]);
+            stats.result = mraa::ERROR_INVALID_RESOURCE;
+            return;
+        }
+        stats.open_us = elapsedUs(begin, std::chrono::steady_clock::now());
+    }
+
+    std::shared_ptr<SmartDriveBus> bus = m_buses[index];
+    std::chrono::steady_clock::time_point probed = bus->now();
+    probe(index, bus, boards, stats);
+    std::chrono::steady_clock::time_point initialized = bus->now();
+    stats.probe_us = elapsedUs(probed, initialized);
+
+    //the bus serializes the boards of one bus, initializing them from one thread costs the same
+    for (size_t i = 0; i < boards.size(); i++)
+        initialize(boards[i]);
+    stats.init_us = elapsedUs(initialized, bus->now());
+}
+
+void
+SmartDriveDiscovery::probe(size_t index, std::shared_ptr<SmartDriveBus> bus, std::vector<Board>& boards, BusStats& stats) {
+    const int ID_BLOCK = SmartDrive_DEVICE_ID + SmartDrive_ID_SIZE - SmartDrive_FIRMWARE_VERSION;
+
+    if (m_options.last_address < m_options.first_address)
+        return;
+    size_t count = m_options.last_address - m_options.first_address + 1;
+    std::vector<SmartDriveBus::BatchOp> ops(count);
+    std::vector<uint8_t> ids(count * ID_BLOCK);
+    for (size_t i = 0; i < count; i++) {
+        ops[i] = SmartDriveBus::BatchOp();
+        ops[i].address = m_options.first_address + i;
+        ops[i].reg = SmartDrive_FIRMWARE_VERSION;
+        ops[i].data = &ids[i * ID_BLOCK];
+        ops[i].size = ID_BLOCK;
+    }
+
+    //a missing board does not ack its address, retrying it would only slow the scan down
+    SmartDriveBus::RetryPolicy policy = bus->GetRetryPolicy();
+    SmartDriveBus::RetryPolicy once = policy;
+    once.attempts = 1;
+    once.reopen_after = 0;
+    bus->SetRetryPolicy(once);
+    bus->batch(ops.data(), count);
+    bus->SetRetryPolicy(policy);
+    stats.probed = count;
+
+    for (size_t i = 0; i < count; i++) {
+        if (ops[i].result != ID_BLOCK)
+            continue;
+        const uint8_t* id = ops[i].data;
+        Board board;
+        board.bus = index;
+        board.address = ops[i].address;
+        board.firmware = idString(id + SmartDrive_FIRMWARE_VERSION);
+        board.vendor = idString(id + SmartDrive_VENDOR_ID);
+        board.device = idString(id + SmartDrive_DEVICE_ID);
+        if (board.device.compare(0, m_options.device_id.size(), m_options.device_id) != 0) {
+            SMARTDRIVE_INFO("Skipping the device at %llx, not a SmartDrive", board.address);
+            continue;
+        }
+        board.battery_mv = -1;
+        board.pid_written = 0;
+        board.result = mraa::SUCCESS;
+        try {
+            board.drive = std::make_shared<SmartDrive>(bus, board.address);
+        } catch (std::exception&) {
+            board.result = mraa::ERROR_INVALID_RESOURCE;
+        }
+        boards.push_back(board);
+    }
+    stats.found = boards.size();
+}
+
+void
+SmartDriveDiscovery::initialize(Board& board) {
+    if (!board.drive)
+        return;
+    SmartDriveResult<float> battery = board.drive->TryGetBattVoltage();
+    if (!battery) {
+        board.result = battery.error();
+        return;
+    }
+    board.battery_mv = battery.value();
+    if (m_options.min_battery_mv > 0 && board.battery_mv < m_options.min_battery_mv) {
+        SMARTDRIVE_WARN("Battery of the SmartDrive at %llx is low : %lld mV", board.address,
+                        (long long) board.battery_mv);
+        board.result = mraa::ERROR_INVALID_RESOURCE;
+        return;
+    }
+
+    if (m_options.apply_pid) {
+        SmartDriveResult<uint8_t> written = board.drive->ApplyPerformanceParameters(m_options.pid);
+        if (!written) {
+            board.result = written.error();
+            return;
+        }
+        board.pid_written = written.value();
+    }
+}
@@ -0,0 +1,150 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "smartdrive.h"
+
+//Default probe range, 7 bit addresses of the 8 bit 0x30-0x3E range the boards can be set to
+#define SmartDriveDisc_FIRST_ADDRESS   (0x30 >> 1)
+#define SmartDriveDisc_LAST_ADDRESS    (0x3E >> 1)
+#define SmartDriveDisc_DEVICE_ID       "SmartD"   //prefix of the device id register accepted as a SmartDrive
+
+namespace upm {
+
+/**
+ * @brief Finds and initializes the SmartDrives of several buses concurrently
+ *
+ * One worker per bus opens the bus, reads the identification registers of every
+ * address of the probe range in a single batch, keeps the addresses whose
+ * device id matches, and initializes these boards : battery check and optional
+ * PID parameters, written only where they differ. Buses are independent, so
+ * the cold start costs the slowest bus instead of the sum of all of them.
+ */
+class SmartDriveDiscovery {
+
+public:
+    /**
+     * What to probe and how to initialize the boards found
+     */
+    struct Options {
+        uint8_t     first_address;    //7 bit
+        uint8_t     last_address;
+        std::string device_id;        //required prefix of the device id
+        float       min_battery_mv;   //boards below are reported with mraa::ERROR_INVALID_RESOURCE, 0 disables the check
+        bool        apply_pid;        //apply pid with SmartDrive::ApplyPerformanceParameters
+        SmartDrive::PerformanceParameters pid;
+    };
+
+    /**
+     * One board found
+     */
+    struct Board {
+        int         bus;              //index in the list of buses given to the constructor
+        uint8_t     address;
+        std::string firmware;         //identification registers, padding removed
+        std::string vendor;
+        std::string device;
+        float       battery_mv;       //-1 if it could not be read
+        uint8_t     pid_written;      //PID register bytes written by the initialization
+        mraa::Result result;          //mraa::SUCCESS when the board is ready
+        std::shared_ptr<SmartDrive> drive;
+    };
+
+    /**
+     * Phase timings of one bus, on the clock of the bus
+     */
+    struct BusStats {
+        mraa::Result result;          //error opening the bus, the other fields are then 0
+        uint32_t open_us;
+        uint32_t probe_us;            //one identification read per address
+        uint32_t init_us;
+        uint32_t probed;
+        uint32_t found;
+    };
+
+    /**
+     * Timings of the last Run()
+     */
+    struct Stats {
+        uint32_t buses;
+        uint32_t boards;
+        uint32_t ready;
+        uint32_t elapsed_us;          //slowest bus, the buses run concurrently
+        uint32_t serial_us;           //sum of all the buses, the cost of a serial scan
+        std::vector<BusStats> bus;
+    };
+
+	/**
+	 * Scans I2C buses opened through mraa
+	 * @param buses Numbers of the I2C buses.
+	 */
+    SmartDriveDiscovery(const std::vector<int>& buses);
+
+	/**
+	 * Scans buses already opened, e.g. on SmartDriveSimulator transports
+	 */
+    SmartDriveDiscovery(const std::vector<std::shared_ptr<SmartDriveBus> >& buses);
+
+	/**
+	 * Returns Options with the SmartDriveDisc_ defaults, no battery check and no PID
+	 */
+    static Options DefaultOptions();
+
+    void SetOptions(const Options& options) { m_options = options; }
+
+	/**
+	 * Scans every bus and initializes the boards found, blocks until all the buses are done
+	 *
+	 * Each bus is probed without retries, a missing board only costs one failed
+	 * transaction; its retry policy is restored before the initialization.
+	 * @return Boards found, by bus then address, with their initialization result.
+	 */
+    std::vector<Board> Run();
+
+	/**
+	 * Returns the timings of the last Run()
+	 */
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    void scan(size_t index, std::vector<Board>& boards, BusStats& stats);
+    void probe(size_t index, std::shared_ptr<SmartDriveBus> bus, std::vector<Board>& boards, BusStats& stats);
+    void initialize(Board& board);
+
+private:
+    std::vector<int> m_busNumbers;   //empty when the buses were given opened
+    std::vector<std::shared_ptr<SmartDriveBus> > m_buses;
+    Options m_options;
+    Stats m_stats;
+};
+
+}
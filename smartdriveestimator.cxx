@@ -0,0 +1,235 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <string>
+#include <stdexcept>
+
+#include "smartdriveestimator.h"
+
+using namespace upm;
+
+SmartDriveEstimator::SmartDriveEstimator(MotorID_t motor, float ticks_per_speed_unit):
+    m_index((motor == Motor_ID_2) ? 1 : 0), m_ticksPerSpeed(ticks_per_speed_unit)
+{
+    if (motor != Motor_ID_1 && motor != Motor_ID_2)
+        throw std::invalid_argument(std::string(__FUNCTION__) +
+                                    ": one estimator per motor, Motor_ID_BOTH is not supported");
+    if (ticks_per_speed_unit <= 0)
+        throw std::invalid_argument(std::string(__FUNCTION__) +
+                                    ": ticks_per_speed_unit must be positive");
+    SetConfig(DefaultConfig());
+    m_estimate.expected_velocity = 0;
+    Reset();
+}
+
+SmartDriveEstimator::Config
+SmartDriveEstimator::DefaultConfig() {
+    Config config;
+    config.smoothing = SmartDriveEst_SMOOTHING;
+    config.horizon_ms = SmartDriveEst_HORIZON_MS;
+    config.stall_ratio = SmartDriveEst_STALL_RATIO;
+    config.spin_up_ms = SmartDriveEst_SPIN_UP_MS;
+    config.stall_current = 0;
+    config.overload_current = 0;
+    config.confirm_samples = SmartDriveEst_CONFIRM_SAMPLES;
+    config.max_gap_ms = SmartDriveEst_MAX_GAP_MS;
+    return config;
+}
+
+void
+SmartDriveEstimator::SetConfig(const Config& config) {
+    m_config = config;
+    if (m_config.confirm_samples == 0)
+        m_config.confirm_samples = 1;
+
+    //critically damped gains, all the filter poles sit at the smoothing
+    float theta = fminf(fmaxf(config.smoothing, 0.0f), 0.99f);
+    m_alpha = 1 - theta * theta * theta;
+    m_beta = 1.5f * (1 - theta * theta) * (1 - theta);
+    m_gamma = 0.5f * (1 - theta) * (1 - theta) * (1 - theta);
+    m_currentAlpha = 1 - theta * theta;
+    m_currentBeta = (1 - theta) * (1 - theta);
+}
+
+void
+SmartDriveEstimator::SetCommand(uint8_t speed, Direction_t direction) {
+    float expected = speed * m_ticksPerSpeed;
+    if (direction == Dir_Reverse)
+        expected = -expected;
+    if (expected != m_estimate.expected_velocity)
+        m_commandChanged = true;
+    m_estimate.expected_velocity = expected;
+}
+
+void
+SmartDriveEstimator::Reset() {
+    m_started = false;
+    m_lastTimestamp = 0;
+    m_commandTimestamp = 0;
+    m_commandChanged = true;
+    m_lastPosition = 0;
+    m_position = 0;
+    m_origin = 0;
+    m_stallCount = 0;
+    m_overloadCount = 0;
+
+    float expected = m_estimate.expected_velocity;
+    m_estimate = Estimate();
+    m_estimate.expected_velocity = expected;
+    m_estimate.time_to_stall_ms = -1;
+}
+
+void
+SmartDriveEstimator::start(uint64_t timestamp_ns, uint32_t position, uint16_t current) {
+    m_started = true;
+    m_lastTimestamp = timestamp_ns;
+    m_lastPosition = position;
+    m_origin = (int32_t) position;
+    m_position = 0;
+    m_estimate.position = m_origin;
+    m_estimate.velocity = 0;
+    m_estimate.acceleration = 0;
+    m_estimate.current = current;
+    m_estimate.current_slope = 0;
+    m_estimate.time_to_stall_ms = -1;
+}
+
+uint8_t
+SmartDriveEstimator::confirm(bool condition, uint8_t& count, uint8_t event) {
+    //counts up to raise the event and back down to clear it, so it does not flicker
+    if (!condition) {
+        if (count > 0)
+            count--;
+        if (count == 0)
+            m_estimate.events &= ~event;
+        return 0;
+    }
+    if (count < m_config.confirm_samples)
+        count++;
+    if (count < m_config.confirm_samples || (m_estimate.events & event))
+        return 0;
+    m_estimate.events |= event;
+    return event;
+}
+
+uint8_t
+SmartDriveEstimator::Update(uint64_t timestamp_ns, uint32_t position, uint16_t current, uint8_t status) {
+    if (m_commandChanged) {
+        m_commandChanged = false;
+        m_commandTimestamp = timestamp_ns;
+        m_stallCount = 0;
+        m_estimate.events &= ~Est_StallPredicted;
+    }
+
+    if (m_started && timestamp_ns <= m_lastTimestamp)
+        return 0;   //duplicate or out of order sample
+
+    if (!m_started || timestamp_ns - m_lastTimestamp > m_config.max_gap_ms * 1000000ULL) {
+        start(timestamp_ns, position, current);
+    } else {
+        float dt = (timestamp_ns - m_lastTimestamp) * 1e-9f;
+        //signed difference, so the tacho may wrap around
+        int32_t delta = (int32_t) (position - m_lastPosition);
+
+        float& x = m_position;
+        float& v = m_estimate.velocity;
+        float& a = m_estimate.acceleration;
+        float predicted = x + v * dt + a * dt * dt / 2;
+        float residual = delta - predicted;
+        x = predicted + m_alpha * residual;
+        v += a * dt + m_beta * residual / dt;
+        a += 2 * m_gamma * residual / (dt * dt);
+
+        //keep the filter relative to the last sample, the float keeps its precision
+        x -= delta;
+        m_origin += delta;
+        m_estimate.position = m_origin + (int64_t) lroundf(x);
+
+        float& c = m_estimate.current;
+        float& slope = m_estimate.current_slope;
+        float currentPredicted = c + slope * dt;
+        float currentResidual = current - currentPredicted;
+        c = currentPredicted + m_currentAlpha * currentResidual;
+        slope += m_currentBeta * currentResidual / dt;
+
+        m_lastTimestamp = timestamp_ns;
+        m_lastPosition = position;
+    }
+
+    float horizon = m_config.horizon_ms * 1e-3f;
+    float expected = m_estimate.expected_velocity;
+    float sign = (expected < 0) ? -1.0f : 1.0f;
+    float threshold = m_config.stall_ratio * fabsf(expected);
+    float velocity = sign * m_estimate.velocity;       //along the commanded direction
+    float acceleration = sign * m_estimate.acceleration;
+
+    if (velocity <= threshold)
+        m_estimate.time_to_stall_ms = 0;
+    else if (acceleration < 0)
+        m_estimate.time_to_stall_ms = (velocity - threshold) / -acceleration * 1000;
+    else
+        m_estimate.time_to_stall_ms = -1;
+
+    bool spinningUp = timestamp_ns - m_commandTimestamp < m_config.spin_up_ms * 1000000ULL;
+    float currentAhead = m_estimate.current + m_estimate.current_slope * horizon;
+    bool loaded = m_config.stall_current ? currentAhead >= m_config.stall_current
+                                         : m_estimate.current_slope > 0;
+    //the current only has to rise to raise the prediction, not to hold it
+    bool stalling = expected != 0 && !spinningUp && velocity + acceleration * horizon < threshold &&
+                    (loaded || (m_estimate.events & Est_StallPredicted));
+
+    uint8_t raised = confirm(stalling, m_stallCount, Est_StallPredicted);
+    raised |= confirm(m_config.overload_current && currentAhead >= m_config.overload_current,
+                      m_overloadCount, Est_Overload);
+
+    if (status & SmartDrive_MOTOR_IS_STALLED) {
+        if (!(m_estimate.events & Est_Stalled))
+            raised |= Est_Stalled;
+        m_estimate.events |= Est_Stalled;
+    } else {
+        m_estimate.events &= ~Est_Stalled;
+    }
+    return raised;
+}
+
+uint8_t
+SmartDriveEstimator::Update(const SmartDriveSample& sample) {
+    if (!sample.valid)
+        return 0;
+    return Update(sample.timestamp_ns, (uint32_t) sample.position[m_index],
+                  sample.current[m_index], sample.status[m_index]);
+}
+
+uint8_t
+SmartDriveEstimator::Update(const SmartDrive::Snapshot& snap) {
+    if (!snap.valid)
+        return 0;
+    uint64_t timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        snap.timestamp.time_since_epoch()).count();
+    return Update(timestamp_ns, snap.position[m_index], snap.current[m_index], snap.status[m_index]);
+}
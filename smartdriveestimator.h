@@ -0,0 +1,173 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "smartdrive.h"
+#include "smartdrivesampler.h"
+
+//Default estimator settings, see SmartDriveEstimator::Config
+#define SmartDriveEst_SMOOTHING          0.8f   //0 follows the raw samples, towards 1 smooths harder
+#define SmartDriveEst_HORIZON_MS         30     //look ahead of the stall prediction
+#define SmartDriveEst_STALL_RATIO        0.3f   //fraction of the commanded velocity below which the motor stalls
+#define SmartDriveEst_SPIN_UP_MS         150    //no prediction right after a speed change
+#define SmartDriveEst_CONFIRM_SAMPLES    3      //consecutive samples needed to raise or clear an event
+#define SmartDriveEst_MAX_GAP_MS         100    //longer gaps between samples restart the filter
+
+namespace upm {
+
+enum SmartDriveEstEvent {
+    Est_StallPredicted = 0x01,   //velocity heading below the stall ratio while the current rises
+    Est_Overload       = 0x02,   //current heading above the overload threshold
+    Est_Stalled        = 0x04    //SmartDrive_MOTOR_IS_STALLED set by the firmware
+};
+
+/**
+ * @brief Velocity / acceleration estimator with early stall detection for one motor
+ *
+ * Fits position, velocity and acceleration from successive tacho positions with
+ * a critically damped alpha-beta-gamma filter, and the level and slope of the
+ * motor current with an alpha-beta filter. Both are extrapolated over a short
+ * horizon and compared with the commanded speed, which raises a predicted stall
+ * well before the firmware flags SmartDrive_MOTOR_IS_STALLED.
+ *
+ * Each Update() is O(1) and does not touch the bus, feed it from a
+ * SmartDriveSampler or from ReadSnapshot().
+ */
+class SmartDriveEstimator {
+
+public:
+    /**
+     * Estimator settings
+     */
+    struct Config {
+        float    smoothing;           //filter root, 0 to below 1
+        uint32_t horizon_ms;
+        float    stall_ratio;
+        uint32_t spin_up_ms;
+        uint16_t stall_current;       //raw current needed for a stall prediction, 0 only requires a rising current
+        uint16_t overload_current;    //raw current raising Est_Overload, 0 disables it
+        uint8_t  confirm_samples;
+        uint32_t max_gap_ms;
+    };
+
+    /**
+     * Filter state after the last sample
+     */
+    struct Estimate {
+        int64_t  position;            //tacho counts, unwrapped
+        float    velocity;            //tacho counts per second
+        float    acceleration;        //tacho counts per second squared
+        float    current;             //raw current units
+        float    current_slope;       //raw current units per second
+        float    expected_velocity;   //from the commanded speed
+        float    time_to_stall_ms;    //until the velocity falls below the stall ratio, negative if not heading there
+        uint8_t  events;              //SmartDriveEstEvent flags currently raised
+    };
+
+	/**
+	 * Creates an estimator
+	 * @param motor Motor_ID_1 or Motor_ID_2, use one estimator per motor.
+	 * @param ticks_per_speed_unit Tacho counts per second at speed 1.
+	 */
+    SmartDriveEstimator(MotorID_t motor, float ticks_per_speed_unit);
+
+	/**
+	 * Returns a Config filled with the SmartDriveEst_ defaults
+	 */
+    static Config DefaultConfig();
+
+    void SetConfig(const Config& config);
+    Config GetConfig() const { return m_config; }
+
+	/**
+	 * Sets the speed commanded to the motor, call it with every new speed or stop
+	 * @param speed Speed as sent to the SmartDrive, 0 when stopped.
+	 * @param direction Dir_Forward or Dir_Reverse.
+	 */
+    void SetCommand(uint8_t speed, Direction_t direction);
+
+	/**
+	 * Adds one sample
+	 * @param timestamp_ns Monotonic time of the sample.
+	 * @param position Tacho position, as read from the SmartDrive.
+	 * @param current Raw SmartDrive_CURRENT_Mx.
+	 * @param status SmartDrive_STATUS_Mx.
+	 * @return SmartDriveEstEvent flags raised by this sample, 0 if none.
+	 */
+    uint8_t Update(uint64_t timestamp_ns, uint32_t position, uint16_t current, uint8_t status);
+
+	/**
+	 * Adds the sample of this estimator's motor, invalid samples are skipped
+	 */
+    uint8_t Update(const SmartDriveSample& sample);
+
+	/**
+	 * Adds the sample of this estimator's motor, invalid snapshots are skipped
+	 */
+    uint8_t Update(const SmartDrive::Snapshot& snap);
+
+	/**
+	 * Returns the filter state after the last sample
+	 */
+    const Estimate& GetEstimate() const { return m_estimate; }
+
+	/**
+	 * Forgets the filter state, the next sample restarts the filter
+	 */
+    void Reset();
+
+private:
+    void start(uint64_t timestamp_ns, uint32_t position, uint16_t current);
+    uint8_t confirm(bool condition, uint8_t& count, uint8_t event);
+
+private:
+    int m_index;               //0 for M1, 1 for M2
+    float m_ticksPerSpeed;
+    Config m_config;
+
+    //filter gains, derived from the smoothing
+    float m_alpha;
+    float m_beta;
+    float m_gamma;
+    float m_currentAlpha;
+    float m_currentBeta;
+
+    bool m_started;
+    uint64_t m_lastTimestamp;
+    uint64_t m_commandTimestamp;   //0 until the next sample after SetCommand()
+    bool m_commandChanged;
+    uint32_t m_lastPosition;
+    float m_position;               //relative to m_origin, keeps the float precision
+    int64_t m_origin;
+    uint8_t m_stallCount;
+    uint8_t m_overloadCount;
+    Estimate m_estimate;
+};
+
+}
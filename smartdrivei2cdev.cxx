@@ -0,0 +1,251 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <stdexcept>
+#include <string>
+
+#include "smartdrivei2cdev.h"
+#include "smartdrivetrace.h"
+
+using namespace upm;
+
+I2cDevTransport::I2cDevTransport(int i2c_bus, bool force_smbus): m_busNumber(i2c_bus),
+    m_forceSmbus(force_smbus), m_fd(-1), m_combined(false), m_address(-1), m_slaveSet(false)
+{
+    if (openBus() != mraa::SUCCESS)
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": cannot open /dev/i2c-" +
+                                    std::to_string(i2c_bus) + ": " + strerror(errno));
+}
+
+I2cDevTransport::~I2cDevTransport() {
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+
+mraa::Result
+I2cDevTransport::openBus() {
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/i2c-%d", m_busNumber);
+    m_fd = ::open(path, O_RDWR | O_CLOEXEC);
+    if (m_fd < 0)
+        return mraa::ERROR_INVALID_RESOURCE;
+
+    unsigned long funcs = 0;
+    if (ioctl(m_fd, I2C_FUNCS, &funcs) < 0)
+        funcs = 0;
+    m_combined = !m_forceSmbus && (funcs & I2C_FUNC_I2C) != 0;
+    m_slaveSet = false;
+    return mraa::SUCCESS;
+}
+
+
+mraa::Result
+I2cDevTransport::address(uint8_t address) {
+    if (address != m_address) {
+        m_address = address;
+        m_slaveSet = false;
+    }
+    //I2C_RDWR carries the address in every message, SMBus needs it bound to the file
+    if (m_combined || m_slaveSet)
+        return mraa::SUCCESS;
+    if (ioctl(m_fd, I2C_SLAVE, (unsigned long) address) < 0) {
+        SMARTDRIVE_DEBUG("I2C_SLAVE 0x%llx failed, errno %lld", (long long) address, (long long) errno);
+        return mraa::ERROR_UNSPECIFIED;
+    }
+    m_slaveSet = true;
+    return mraa::SUCCESS;
+}
+
+
+int
+I2cDevTransport::transfer(uint8_t address, uint8_t reg, uint8_t* data, int size) {
+    //register pointer write, repeated start, read
+    struct i2c_msg msgs[2];
+    msgs[0].addr = address;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &reg;
+    msgs[1].addr = address;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = size;
+    msgs[1].buf = data;
+    struct i2c_rdwr_ioctl_data rdwr = {msgs, 2};
+    if (ioctl(m_fd, I2C_RDWR, &rdwr) != 2)
+        return -1;
+    return size;
+}
+
+
+int
+I2cDevTransport::smbus(char read_write, uint8_t command, int size, void* data) {
+    struct i2c_smbus_ioctl_data args;
+    args.read_write = read_write;
+    args.command = command;
+    args.size = size;
+    args.data = (union i2c_smbus_data*) data;
+    return ioctl(m_fd, I2C_SMBUS, &args);
+}
+
+
+mraa::Result
+I2cDevTransport::writeReg(uint8_t reg, uint8_t value) {
+    uint8_t data[2] = {reg, value};
+    return write(data, 2);
+}
+
+
+mraa::Result
+I2cDevTransport::write(const uint8_t* data, int size) {
+    if (m_address < 0 || size < 1)
+        return mraa::ERROR_INVALID_PARAMETER;
+
+    if (m_combined) {
+        struct i2c_msg msg;
+        msg.addr = m_address;
+        msg.flags = 0;
+        msg.len = size;
+        msg.buf = (uint8_t*) data;
+        struct i2c_rdwr_ioctl_data rdwr = {&msg, 1};
+        return ioctl(m_fd, I2C_RDWR, &rdwr) == 1 ? mraa::SUCCESS : mraa::ERROR_UNSPECIFIED;
+    }
+
+    union i2c_smbus_data block;
+    if (size == 1)
+        return smbus(I2C_SMBUS_WRITE, data[0], I2C_SMBUS_BYTE, NULL) == 0 ? mraa::SUCCESS : mraa::ERROR_UNSPECIFIED;
+    if (size == 2) {
+        block.byte = data[1];
+        return smbus(I2C_SMBUS_WRITE, data[0], I2C_SMBUS_BYTE_DATA, &block) == 0 ? mraa::SUCCESS : mraa::ERROR_UNSPECIFIED;
+    }
+    //longer writes go in blocks, the register advancing with the data
+    for (int offset = 1; offset < size; offset += SmartDriveI2cDev_SMBUS_BLOCK) {
+        int len = size - offset < SmartDriveI2cDev_SMBUS_BLOCK ? size - offset : SmartDriveI2cDev_SMBUS_BLOCK;
+        block.block[0] = len;
+        memcpy(block.block + 1, data + offset, len);
+        if (smbus(I2C_SMBUS_WRITE, data[0] + offset - 1, I2C_SMBUS_I2C_BLOCK_DATA, &block) != 0)
+            return mraa::ERROR_UNSPECIFIED;
+    }
+    return mraa::SUCCESS;
+}
+
+
+int
+I2cDevTransport::readReg(uint8_t reg) {
+    uint8_t value;
+    if (readBytesReg(reg, &value, 1) != 1)
+        return -1;
+    return value;
+}
+
+
+int
+I2cDevTransport::readWordReg(uint8_t reg) {
+    uint8_t value[2];
+    if (readBytesReg(reg, value, 2) != 2)
+        return -1;
+    return value[0] | (value[1] << 8);
+}
+
+
+int
+I2cDevTransport::readBytesReg(uint8_t reg, uint8_t* data, int size) {
+    if (m_address < 0 || size < 1)
+        return -1;
+    if (m_combined)
+        return transfer(m_address, reg, data, size);
+
+    union i2c_smbus_data block;
+    if (size == 1) {
+        if (smbus(I2C_SMBUS_READ, reg, I2C_SMBUS_BYTE_DATA, &block) != 0)
+            return -1;
+        data[0] = block.byte;
+        return 1;
+    }
+    for (int offset = 0; offset < size; offset += SmartDriveI2cDev_SMBUS_BLOCK) {
+        int len = size - offset < SmartDriveI2cDev_SMBUS_BLOCK ? size - offset : SmartDriveI2cDev_SMBUS_BLOCK;
+        block.block[0] = len;
+        if (smbus(I2C_SMBUS_READ, reg + offset, I2C_SMBUS_I2C_BLOCK_DATA, &block) != 0 || block.block[0] != len)
+            return -1;
+        memcpy(data + offset, block.block + 1, len);
+    }
+    return size;
+}
+
+
+int
+I2cDevTransport::readMany(ReadSegment* segments, int count) {
+    if (!m_combined)
+        return SmartDriveTransport::readMany(segments, count);
+
+    struct i2c_msg msgs[2 * SmartDriveI2cDev_MAX_SEGMENTS];
+    int complete = 0;
+    for (int first = 0; first < count; first += SmartDriveI2cDev_MAX_SEGMENTS) {
+        int n = count - first < SmartDriveI2cDev_MAX_SEGMENTS ? count - first : SmartDriveI2cDev_MAX_SEGMENTS;
+        for (int i = 0; i < n; i++) {
+            ReadSegment& seg = segments[first + i];
+            msgs[2 * i].addr = seg.address;
+            msgs[2 * i].flags = 0;
+            msgs[2 * i].len = 1;
+            msgs[2 * i].buf = &seg.reg;
+            msgs[2 * i + 1].addr = seg.address;
+            msgs[2 * i + 1].flags = I2C_M_RD;
+            msgs[2 * i + 1].len = seg.size;
+            msgs[2 * i + 1].buf = seg.data;
+        }
+        //the adapter runs the whole set with repeated starts, it succeeds or fails as one
+        struct i2c_rdwr_ioctl_data rdwr = {msgs, (uint32_t) (2 * n)};
+        bool ok = ioctl(m_fd, I2C_RDWR, &rdwr) == 2 * n;
+        for (int i = 0; i < n; i++)
+            segments[first + i].result = ok ? segments[first + i].size : -1;
+        if (ok)
+            complete += n;
+    }
+    return complete;
+}
+
+
+int
+I2cDevTransport::maxCombinedReads() const {
+    return m_combined ? SmartDriveI2cDev_MAX_SEGMENTS : 1;
+}
+
+
+mraa::Result
+I2cDevTransport::reopen() {
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+    return openBus();
+}
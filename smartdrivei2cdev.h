@@ -0,0 +1,91 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "smartdrivetransport.h"
+
+//Bursts per I2C_RDWR ioctl : I2C_RDWR_IOCTL_MAX_MSGS / 2, a register write and a read each
+#define SmartDriveI2cDev_MAX_SEGMENTS  21
+#define SmartDriveI2cDev_SMBUS_BLOCK   32   //largest SMBus I2C block transfer
+
+namespace upm {
+
+/**
+ * @brief Transport going straight to /dev/i2c-N
+ *
+ * Bypasses mraa. When the adapter handles plain I2C messages, every register
+ * access is a single I2C_RDWR ioctl : the register pointer write and the data
+ * read go out as one combined transfer with a repeated start, selecting a board
+ * costs no syscall at all, and readMany() packs up to SmartDriveI2cDev_MAX_SEGMENTS
+ * bursts of any boards into one ioctl.
+ *
+ * Adapters limited to SMBus, such as the i2c-stub test module, are served
+ * through I2C_SMBUS ioctls instead, bursts being split in SMBus I2C blocks.
+ */
+class I2cDevTransport : public SmartDriveTransport {
+
+public:
+	/**
+	 * Opens /dev/i2c-N, throws std::invalid_argument when it cannot be opened
+	 * @param i2c_bus Number of the I2C bus
+	 * @param force_smbus Uses SMBus transfers even if the adapter handles I2C_RDWR.
+	 */
+    I2cDevTransport(int i2c_bus, bool force_smbus = false);
+    ~I2cDevTransport();
+
+    mraa::Result address(uint8_t address);
+    mraa::Result writeReg(uint8_t reg, uint8_t value);
+    mraa::Result write(const uint8_t* data, int size);
+    int readReg(uint8_t reg);
+    int readWordReg(uint8_t reg);
+    int readBytesReg(uint8_t reg, uint8_t* data, int size);
+    int readMany(ReadSegment* segments, int count);
+    int maxCombinedReads() const;
+    mraa::Result reopen();
+
+	/**
+	 * True when transfers use I2C_RDWR, false when they fall back to SMBus
+	 */
+    bool combined() const { return m_combined; }
+
+private:
+    mraa::Result openBus();
+    int transfer(uint8_t address, uint8_t reg, uint8_t* data, int size);
+    int smbus(char read_write, uint8_t command, int size, void* data);
+
+private:
+    int m_busNumber;
+    bool m_forceSmbus;
+    int m_fd;
+    bool m_combined;
+    int m_address;     //board selected, -1 when none
+    bool m_slaveSet;   //SMBus only, I2C_SLAVE issued for m_address
+};
+
+}
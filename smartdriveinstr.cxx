@@ -0,0 +1,159 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "smartdriveinstr.h"
+
+#ifdef SMARTDRIVE_INSTRUMENTATION
+
+#include <stdio.h>
+
+using namespace upm;
+
+SmartDriveInstrumentation::SmartDriveInstrumentation()
+{
+    Reset();
+}
+
+
+void
+SmartDriveInstrumentation::record(uint8_t reg, bool is_write, bool ok, std::chrono::steady_clock::duration elapsed) {
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    AtomicRegister& counters = m_regs[reg];
+    AtomicHistogram& histogram = is_write ? m_write : m_read;
+
+    (is_write ? counters.writes : counters.reads).fetch_add(1, std::memory_order_relaxed);
+    if (!ok)
+        counters.errors.fetch_add(1, std::memory_order_relaxed);
+    counters.total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    //bucket i holds latencies below 2^(i+1) us
+    unsigned bucket = 0;
+    for (uint64_t us = ns / 1000; us > 1 && bucket < SmartDriveInstr_BUCKETS; us >>= 1)
+        bucket++;
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+
+void
+SmartDriveInstrumentation::copy(const AtomicHistogram& from, Histogram& to) {
+    for (int i = 0; i <= SmartDriveInstr_BUCKETS; i++)
+        to.buckets[i] = from.buckets[i].load(std::memory_order_relaxed);
+    to.count = from.count.load(std::memory_order_relaxed);
+    to.sum_ns = from.sum_ns.load(std::memory_order_relaxed);
+}
+
+void
+SmartDriveInstrumentation::GetSnapshot(Snapshot& snap) const {
+    for (int i = 0; i < 256; i++) {
+        snap.regs[i].reads = m_regs[i].reads.load(std::memory_order_relaxed);
+        snap.regs[i].writes = m_regs[i].writes.load(std::memory_order_relaxed);
+        snap.regs[i].errors = m_regs[i].errors.load(std::memory_order_relaxed);
+        snap.regs[i].total_ns = m_regs[i].total_ns.load(std::memory_order_relaxed);
+    }
+    copy(m_read, snap.read);
+    copy(m_write, snap.write);
+}
+
+void
+SmartDriveInstrumentation::Reset() {
+    for (int i = 0; i < 256; i++) {
+        m_regs[i].reads = 0;
+        m_regs[i].writes = 0;
+        m_regs[i].errors = 0;
+        m_regs[i].total_ns = 0;
+    }
+    AtomicHistogram* histograms[2] = {&m_read, &m_write};
+    for (int h = 0; h < 2; h++) {
+        for (int i = 0; i <= SmartDriveInstr_BUCKETS; i++)
+            histograms[h]->buckets[i] = 0;
+        histograms[h]->count = 0;
+        histograms[h]->sum_ns = 0;
+    }
+}
+
+
+bool
+SmartDriveInstrumentation::DumpPrometheus(const std::string& path, const std::string& board) const {
+    static const char* counters[4][2] = {
+        {"smartdrive_register_reads_total", "Register read transactions"},
+        {"smartdrive_register_writes_total", "Register write transactions"},
+        {"smartdrive_register_errors_total", "Failed register transactions"},
+        {"smartdrive_register_seconds_total", "Bus time spent on the register"},
+    };
+    Snapshot* snap = new Snapshot;
+    std::string tmp = path + ".tmp";
+    FILE* file = fopen(tmp.c_str(), "w");
+
+    if (file == NULL) {
+        delete snap;
+        return false;
+    }
+    GetSnapshot(*snap);
+
+    for (int c = 0; c < 4; c++) {
+        fprintf(file, "# HELP %s %s\n# TYPE %s counter\n", counters[c][0], counters[c][1], counters[c][0]);
+        for (int i = 0; i < 256; i++) {
+            const Register& reg = snap->regs[i];
+            if (reg.reads == 0 && reg.writes == 0)
+                continue;
+            fprintf(file, "%s{board=\"%s\",register=\"0x%02x\"} ", counters[c][0], board.c_str(), i);
+            switch (c) {
+            case 0: fprintf(file, "%llu\n", (unsigned long long) reg.reads); break;
+            case 1: fprintf(file, "%llu\n", (unsigned long long) reg.writes); break;
+            case 2: fprintf(file, "%llu\n", (unsigned long long) reg.errors); break;
+            case 3: fprintf(file, "%.9f\n", reg.total_ns / 1e9); break;
+            }
+        }
+    }
+
+    fprintf(file, "# HELP smartdrive_transaction_seconds Bus transaction latency\n"
+                  "# TYPE smartdrive_transaction_seconds histogram\n");
+    const Histogram* histograms[2] = {&snap->read, &snap->write};
+    for (int h = 0; h < 2; h++) {
+        const char* op = h ? "write" : "read";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < SmartDriveInstr_BUCKETS; i++) {
+            cumulative += histograms[h]->buckets[i];
+            fprintf(file, "smartdrive_transaction_seconds_bucket{board=\"%s\",op=\"%s\",le=\"%g\"} %llu\n",
+                    board.c_str(), op, (double) (2ULL << i) / 1e6, (unsigned long long) cumulative);
+        }
+        fprintf(file, "smartdrive_transaction_seconds_bucket{board=\"%s\",op=\"%s\",le=\"+Inf\"} %llu\n",
+                board.c_str(), op, (unsigned long long) histograms[h]->count);
+        fprintf(file, "smartdrive_transaction_seconds_sum{board=\"%s\",op=\"%s\"} %.9f\n",
+                board.c_str(), op, histograms[h]->sum_ns / 1e9);
+        fprintf(file, "smartdrive_transaction_seconds_count{board=\"%s\",op=\"%s\"} %llu\n",
+                board.c_str(), op, (unsigned long long) histograms[h]->count);
+    }
+    delete snap;
+
+    bool ok = (fclose(file) == 0);
+    return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Bus instrumentation, only built with -DSMARTDRIVE_INSTRUMENTATION.
+ * Without it the SMARTDRIVE_INSTR_* macros expand to nothing and SmartDrive
+ * carries no counters at all.
+ */
+
+#ifdef SMARTDRIVE_INSTRUMENTATION
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+//latency buckets are powers of 2 microseconds : <2us, <4us ... <2^BUCKETS us, then +Inf
+#define SmartDriveInstr_BUCKETS  20
+
+//Starts timing a bus transaction in the current scope
+#define SMARTDRIVE_INSTR_START() \
+    std::chrono::steady_clock::time_point sd_instr_start = std::chrono::steady_clock::now()
+//Records the transaction started by SMARTDRIVE_INSTR_START()
+#define SMARTDRIVE_INSTR_STOP(instr, reg, is_write, ok) \
+    (instr).record((reg), (is_write), (ok), std::chrono::steady_clock::now() - sd_instr_start)
+
+namespace upm {
+
+/**
+ * @brief Per-register bus counters and latency histograms of one SmartDrive
+ *
+ * Recording is lock-free (relaxed atomics), so it can stay enabled in the
+ * control loop. Block transfers are accounted to their first register.
+ */
+class SmartDriveInstrumentation {
+
+public:
+    /**
+     * Counters of one register
+     */
+    struct Register {
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t errors;
+        uint64_t total_ns;
+    };
+
+    /**
+     * Latency distribution of one kind of transaction
+     */
+    struct Histogram {
+        uint64_t buckets[SmartDriveInstr_BUCKETS + 1];   //last one is +Inf
+        uint64_t count;
+        uint64_t sum_ns;
+    };
+
+    /**
+     * Copy of every counter
+     */
+    struct Snapshot {
+        Register regs[256];
+        Histogram read;
+        Histogram write;
+    };
+
+    SmartDriveInstrumentation();
+
+	/**
+	 * Accounts one transaction
+	 */
+    void record(uint8_t reg, bool is_write, bool ok, std::chrono::steady_clock::duration elapsed);
+
+	/**
+	 * Copies the counters, each one is read atomically but not all at the same time
+	 */
+    void GetSnapshot(Snapshot& snap) const;
+
+	/**
+	 * Clears every counter
+	 */
+    void Reset();
+
+	/**
+	 * Writes the counters in Prometheus text format. The file is replaced atomically.
+	 * @param path File to write, e.g. for the node_exporter textfile collector.
+	 * @param board Value of the board label.
+	 * @return false if the file could not be written.
+	 */
+    bool DumpPrometheus(const std::string& path, const std::string& board) const;
+
+private:
+    struct AtomicRegister {
+        std::atomic<uint64_t> reads;
+        std::atomic<uint64_t> writes;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> total_ns;
+    };
+
+    struct AtomicHistogram {
+        std::atomic<uint64_t> buckets[SmartDriveInstr_BUCKETS + 1];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum_ns;
+    };
+
+    static void copy(const AtomicHistogram& from, Histogram& to);
+
+private:
+    AtomicRegister m_regs[256];
+    AtomicHistogram m_read;
+    AtomicHistogram m_write;
+};
+
+}
+
+#else
+
+#define SMARTDRIVE_INSTR_START()                         do {} while (0)
+#define SMARTDRIVE_INSTR_STOP(instr, reg, is_write, ok)  do { (void) sizeof(ok); } while (0)
+
+#endif
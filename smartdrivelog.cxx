@@ -0,0 +1,349 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+
+#include "smartdrivelog.h"
+
+using namespace upm;
+
+static_assert(sizeof(SmartDriveLogHeader) <= SmartDriveLog_HEADER_SIZE, "log header doesn't fit its page");
+static_assert(sizeof(SmartDriveLogIndex) == 64, "log index must keep the records aligned");
+
+static uint32_t
+blockSize(uint32_t records_per_block) {
+    uint32_t page = sysconf(_SC_PAGESIZE);
+    uint32_t size = sizeof(SmartDriveLogIndex) + records_per_block * sizeof(SmartDriveSample);
+    return ((size + page - 1) / page) * page;
+}
+
+static void
+describe(SmartDriveLogField& field, const char* name, uint8_t reg, size_t offset, uint8_t width, bool is_signed, uint8_t count) {
+    memset(&field, 0, sizeof(field));
+    strncpy(field.name, name, sizeof(field.name) - 1);
+    field.reg = reg;
+    field.offset = offset;
+    field.width = width;
+    field.is_signed = is_signed;
+    field.count = count;
+}
+
+
+SmartDriveLogWriter::SmartDriveLogWriter(const std::string& path, uint32_t records_per_block):
+    m_fd(-1), m_header(NULL), m_block(NULL), m_blockCount(0)
+{
+    create(path, records_per_block, SmartDrive_VOLTAGE_MULTIPLIER);
+}
+
+SmartDriveLogWriter::SmartDriveLogWriter(const std::string& path, const SmartDrive& drive, uint32_t records_per_block):
+    m_fd(-1), m_header(NULL), m_block(NULL), m_blockCount(0)
+{
+    create(path, records_per_block, drive.GetMillivoltsPerCount());
+}
+
+
+void
+SmartDriveLogWriter::create(const std::string& path, uint32_t records_per_block, float mv_per_count) {
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0 || ftruncate(m_fd, SmartDriveLog_HEADER_SIZE) != 0) {
+        throw std::runtime_error(std::string(__FUNCTION__) +
+                                 ": could not create " + path);
+    }
+    void* header = mmap(NULL, SmartDriveLog_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (header == MAP_FAILED) {
+        close(m_fd);
+        throw std::runtime_error(std::string(__FUNCTION__) +
+                                 ": mmap() failed");
+    }
+    m_header = (SmartDriveLogHeader*) header;
+
+    memset(m_header, 0, sizeof(*m_header));
+    memcpy(m_header->magic, SmartDriveLog_MAGIC, sizeof(m_header->magic));
+    m_header->version = SmartDriveLog_VERSION;
+    m_header->header_size = SmartDriveLog_HEADER_SIZE;
+    m_header->record_size = sizeof(SmartDriveSample);
+    m_header->records_per_block = records_per_block ? records_per_block : 1;
+    m_header->block_size = blockSize(m_header->records_per_block);
+    m_header->voltage_multiplier = mv_per_count;
+    describe(m_header->fields[0], "timestamp_ns", 0, offsetof(SmartDriveSample, timestamp_ns), 8, false, 1);
+    describe(m_header->fields[1], "position", SmartDrive_POSITION_M1, offsetof(SmartDriveSample, position), 4, true, 2);
+    describe(m_header->fields[2], "current", SmartDrive_CURRENT_M1, offsetof(SmartDriveSample, current), 2, false, 2);
+    describe(m_header->fields[3], "status", SmartDrive_STATUS_M1, offsetof(SmartDriveSample, status), 1, false, 2);
+    describe(m_header->fields[4], "batt_voltage", SmartDrive_BATT_VOLTAGE, offsetof(SmartDriveSample, battVoltage), 1, false, 1);
+    describe(m_header->fields[5], "valid", 0, offsetof(SmartDriveSample, valid), 1, false, 1);
+    m_header->field_count = 6;
+}
+
+SmartDriveLogWriter::~SmartDriveLogWriter()
+{
+    Close();
+}
+
+
+void
+SmartDriveLogWriter::openBlock() {
+    uint64_t offset = SmartDriveLog_HEADER_SIZE + m_blockCount * m_header->block_size;
+
+    closeBlock();
+    if (ftruncate(m_fd, offset + m_header->block_size) != 0) {
+        throw std::runtime_error(std::string(__FUNCTION__) +
+                                 ": could not grow the log file");
+    }
+    void* block = mmap(NULL, m_header->block_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+    if (block == MAP_FAILED) {
+        throw std::runtime_error(std::string(__FUNCTION__) +
+                                 ": mmap() failed");
+    }
+    m_block = (uint8_t*) block;
+
+    SmartDriveLogIndex* index = (SmartDriveLogIndex*) m_block;
+    memcpy(index->magic, SmartDriveLog_INDEX_MAGIC, sizeof(index->magic));
+    index->first_record = m_header->record_count;
+    index->count = 0;
+    m_blockCount++;
+}
+
+void
+SmartDriveLogWriter::closeBlock() {
+    if (m_block != NULL) {
+        munmap(m_block, m_header->block_size);
+        m_block = NULL;
+    }
+}
+
+
+void
+SmartDriveLogWriter::Append(const SmartDriveSample& sample) {
+    if (m_header == NULL)
+        return;
+
+    SmartDriveLogIndex* index = (SmartDriveLogIndex*) m_block;
+    if (m_block == NULL || index->count == m_header->records_per_block) {
+        openBlock();
+        index = (SmartDriveLogIndex*) m_block;
+    }
+
+    SmartDriveSample* records = (SmartDriveSample*) (m_block + sizeof(SmartDriveLogIndex));
+    records[index->count] = sample;
+    if (index->count == 0)
+        index->first_ns = sample.timestamp_ns;
+    index->last_ns = sample.timestamp_ns;
+    index->count++;
+    //published last, a reader never sees a record which isn't fully written
+    m_header->record_count++;
+}
+
+size_t
+SmartDriveLogWriter::AppendFrom(SmartDriveSampler& sampler) {
+    size_t total = 0;
+
+    for (SmartDriveSampler::Span span = sampler.Peek(); span.size != 0; span = sampler.Peek()) {
+        for (size_t i = 0; i < span.size; i++)
+            Append(span.data[i]);
+        sampler.Release(span.size);
+        total += span.size;
+    }
+    return total;
+}
+
+
+void
+SmartDriveLogWriter::Close() {
+    if (m_header == NULL)
+        return;
+
+    closeBlock();
+    msync(m_header, SmartDriveLog_HEADER_SIZE, MS_SYNC);
+    munmap(m_header, SmartDriveLog_HEADER_SIZE);
+    m_header = NULL;
+    close(m_fd);
+    m_fd = -1;
+}
+
+uint64_t
+SmartDriveLogWriter::GetRecordCount() const {
+    return (m_header != NULL) ? m_header->record_count : 0;
+}
+
+
+SmartDriveLogReader::SmartDriveLogReader(const std::string& path): m_data(NULL), m_size(0), m_header(NULL)
+{
+    struct stat info;
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < SmartDriveLog_HEADER_SIZE) {
+        if (fd >= 0)
+            close(fd);
+        throw std::invalid_argument(std::string(__FUNCTION__) +
+                                    ": could not open " + path);
+    }
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error(std::string(__FUNCTION__) +
+                                 ": mmap() failed");
+    }
+    m_data = (const uint8_t*) data;
+    m_size = info.st_size;
+    m_header = (const SmartDriveLogHeader*) m_data;
+
+    if (memcmp(m_header->magic, SmartDriveLog_MAGIC, sizeof(m_header->magic)) != 0 ||
+        m_header->version != SmartDriveLog_VERSION ||
+        m_header->record_size != sizeof(SmartDriveSample) ||
+        m_header->records_per_block == 0 ||
+        m_header->header_size + ((m_header->record_count + m_header->records_per_block - 1) /
+                                 m_header->records_per_block) * (uint64_t) m_header->block_size > m_size) {
+        munmap((void*) m_data, m_size);
+        throw std::invalid_argument(std::string(__FUNCTION__) +
+                                    ": " + path + " is not a SmartDrive log");
+    }
+}
+
+SmartDriveLogReader::~SmartDriveLogReader()
+{
+    munmap((void*) m_data, m_size);
+}
+
+
+const SmartDriveLogIndex&
+SmartDriveLogReader::index(uint64_t block) const {
+    return *(const SmartDriveLogIndex*) (m_data + m_header->header_size + block * m_header->block_size);
+}
+
+const SmartDriveSample&
+SmartDriveLogReader::GetRecord(uint64_t record) const {
+    uint64_t block = record / m_header->records_per_block;
+    const SmartDriveSample* records = (const SmartDriveSample*) ((const uint8_t*) &index(block) + sizeof(SmartDriveLogIndex));
+    return records[record % m_header->records_per_block];
+}
+
+uint64_t
+SmartDriveLogReader::Seek(uint64_t timestamp_ns) const {
+    uint64_t count = GetRecordCount();
+    uint64_t blocks = (count + m_header->records_per_block - 1) / m_header->records_per_block;
+
+    //binary search on the index blocks first, then inside the block
+    uint64_t low = 0, high = blocks;
+    while (low < high) {
+        uint64_t mid = (low + high) / 2;
+        if (index(mid).last_ns < timestamp_ns)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == blocks)
+        return count;
+
+    uint64_t first = low * m_header->records_per_block;
+    uint64_t last = first + index(low).count;
+    while (first < last) {
+        uint64_t mid = (first + last) / 2;
+        if (GetRecord(mid).timestamp_ns < timestamp_ns)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+    return first;
+}
+
+
+SmartDriveReplay::SmartDriveReplay(const SmartDriveLogReader& reader): m_reader(reader), m_position(0)
+{
+    memset(&m_empty, 0, sizeof(m_empty));
+    m_current = &m_empty;
+}
+
+bool
+SmartDriveReplay::Next() {
+    if (m_current != &m_empty)
+        m_position++;
+    if (m_position >= m_reader.GetRecordCount())
+        return false;
+    m_current = &m_reader.GetRecord(m_position);
+    return true;
+}
+
+bool
+SmartDriveReplay::SeekTime(uint64_t timestamp_ns) {
+    m_position = m_reader.Seek(timestamp_ns);
+    if (m_position >= m_reader.GetRecordCount())
+        return false;
+    m_current = &m_reader.GetRecord(m_position);
+    return true;
+}
+
+
+uint32_t
+SmartDriveReplay::ReadTachometerPosition(MotorID_t motor_number) const {
+    if (!m_current->valid)
+        return -1;
+    return m_current->position[(motor_number == Motor_ID_1) ? 0 : 1];
+}
+
+uint8_t
+SmartDriveReplay::GetMotorStatus(MotorID_t motor_id) const {
+    if (motor_id == Motor_ID_BOTH)
+        return 0;
+    if (!m_current->valid)
+        return 0xFF;
+    return m_current->status[motor_id - 1];
+}
+
+float
+SmartDriveReplay::GetBattVoltage() const {
+    if (!m_current->valid)
+        return -1.0f;
+    return m_current->battVoltage * m_reader.GetHeader().voltage_multiplier;
+}
+
+bool
+SmartDriveReplay::statusClear(MotorID_t motor_number, uint8_t mask) const {
+    //a failed read never reports the move as done
+    if (!m_current->valid)
+        return false;
+    bool clear = true;
+    if (motor_number != Motor_ID_2)
+        clear &= (m_current->status[0] & mask) == 0;
+    if (motor_number != Motor_ID_1)
+        clear &= (m_current->status[1] & mask) == 0;
+    return clear;
+}
+
+bool
+SmartDriveReplay::IsTimeDone(MotorID_t motor_number) const {
+    return statusClear(motor_number, SmartDrive_MOTOR_IN_TIME_MODE);
+}
+
+bool
+SmartDriveReplay::IsTachoDone(MotorID_t motor_number) const {
+    return statusClear(motor_number, SmartDrive_MOTOR_POS_CTRL_ON);
+}
@@ -0,0 +1,264 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "smartdrivesampler.h"
+
+#define SmartDriveLog_MAGIC          "SDRVLOG1"
+#define SmartDriveLog_INDEX_MAGIC    "SDRVIDX1"
+#define SmartDriveLog_VERSION        1
+#define SmartDriveLog_HEADER_SIZE    4096
+#define SmartDriveLog_MAX_FIELDS     8
+
+namespace upm {
+
+/**
+ * Describes one field of the log records and the register it comes from
+ */
+struct SmartDriveLogField {
+    char    name[16];
+    uint8_t reg;          //first register of the field, 0 if not a register
+    uint8_t offset;       //offset of the field in the record
+    uint8_t width;        //bytes per element, little endian
+    uint8_t is_signed;
+    uint8_t count;        //elements, one per motor for per motor registers
+    uint8_t reserved[3];
+};
+
+/**
+ * First page of a log file
+ */
+struct SmartDriveLogHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t records_per_block;
+    uint32_t block_size;        //index header + records, page aligned
+    uint32_t field_count;
+    uint64_t record_count;
+    double   voltage_multiplier;
+    SmartDriveLogField fields[SmartDriveLog_MAX_FIELDS];
+};
+
+/**
+ * Starts every block of records, lets a reader find a timestamp without scanning the records
+ */
+struct SmartDriveLogIndex {
+    char     magic[8];
+    uint64_t first_record;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint32_t count;
+    uint8_t  reserved[28];
+};
+
+class SmartDriveSampler;
+
+/**
+ * @brief Append-only memory-mapped telemetry log
+ *
+ * Records are fixed-width SmartDriveSample structs, stored in page aligned
+ * blocks, each block starting with a SmartDriveLogIndex. The file grows one
+ * block at a time and only the block being filled is mapped.
+ */
+class SmartDriveLogWriter {
+
+public:
+	/**
+	 * Creates (or truncates) a log file
+	 * @param path Path of the log file.
+	 * @param records_per_block Number of records between two index blocks.
+	 */
+    SmartDriveLogWriter(const std::string& path, uint32_t records_per_block = 4096);
+
+	/**
+	 * Creates (or truncates) a log file recording the power calibration of a drive
+	 * @param path Path of the log file.
+	 * @param drive Drive whose samples are logged, see SmartDrive::SetPowerCalibration.
+	 * @param records_per_block Number of records between two index blocks.
+	 */
+    SmartDriveLogWriter(const std::string& path, const SmartDrive& drive, uint32_t records_per_block = 4096);
+
+    ~SmartDriveLogWriter();
+
+    //owns a file and its mappings
+    SmartDriveLogWriter(const SmartDriveLogWriter&) = delete;
+    SmartDriveLogWriter& operator=(const SmartDriveLogWriter&) = delete;
+
+	/**
+	 * Appends one record
+	 */
+    void Append(const SmartDriveSample& sample);
+
+	/**
+	 * Moves every sample available in a sampler ring into the log
+	 * @return Number of records appended.
+	 */
+    size_t AppendFrom(SmartDriveSampler& sampler);
+
+	/**
+	 * Flushes and closes the file, called by the destructor
+	 */
+    void Close();
+
+	/**
+	 * Returns the number of records written so far
+	 */
+    uint64_t GetRecordCount() const;
+
+private:
+    void create(const std::string& path, uint32_t records_per_block, float mv_per_count);
+    void openBlock();
+    void closeBlock();
+
+private:
+    int m_fd;
+    SmartDriveLogHeader* m_header;
+    uint8_t* m_block;
+    uint64_t m_blockCount;
+};
+
+/**
+ * @brief Read-only access to a log file written by SmartDriveLogWriter
+ */
+class SmartDriveLogReader {
+
+public:
+	/**
+	 * Maps a log file
+	 * @param path Path of the log file.
+	 */
+    SmartDriveLogReader(const std::string& path);
+
+    ~SmartDriveLogReader();
+
+    //owns a mapping
+    SmartDriveLogReader(const SmartDriveLogReader&) = delete;
+    SmartDriveLogReader& operator=(const SmartDriveLogReader&) = delete;
+
+	/**
+	 * Returns the file header, including the record layout
+	 */
+    const SmartDriveLogHeader& GetHeader() const { return *m_header; }
+
+	/**
+	 * Returns the number of records in the file
+	 */
+    uint64_t GetRecordCount() const { return m_header->record_count; }
+
+	/**
+	 * Returns one record
+	 * @param index Record number, lower than GetRecordCount().
+	 */
+    const SmartDriveSample& GetRecord(uint64_t index) const;
+
+	/**
+	 * Finds the first record taken at or after a time, using the index blocks
+	 * @return Record number, GetRecordCount() if there is none.
+	 */
+    uint64_t Seek(uint64_t timestamp_ns) const;
+
+private:
+    const SmartDriveLogIndex& index(uint64_t block) const;
+
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    const SmartDriveLogHeader* m_header;
+};
+
+/**
+ * @brief Feeds recorded telemetry back through the SmartDrive getters
+ */
+class SmartDriveReplay {
+
+public:
+	/**
+	 * Starts before the first record, call Next() to load it
+	 */
+    SmartDriveReplay(const SmartDriveLogReader& reader);
+
+	/**
+	 * Loads the next record
+	 * @return false at the end of the log.
+	 */
+    bool Next();
+
+	/**
+	 * Loads the first record taken at or after a time
+	 * @return false if there is none.
+	 */
+    bool SeekTime(uint64_t timestamp_ns);
+
+	/**
+	 * Returns the timestamp of the current record
+	 */
+    uint64_t GetTimestamp() const { return m_current->timestamp_ns; }
+
+	/**
+	 * Same as SmartDrive::ReadTachometerPosition, for the current record.
+	 * Like the getters below, reports a failed read for a record whose sample
+	 * failed, or before the first record.
+	 */
+    uint32_t ReadTachometerPosition(MotorID_t motor_number) const;
+
+	/**
+	 * Same as SmartDrive::GetMotorStatus, for the current record
+	 */
+    uint8_t GetMotorStatus(MotorID_t motor_id) const;
+
+	/**
+	 * Same as SmartDrive::GetBattVoltage, for the current record
+	 */
+    float GetBattVoltage() const;
+
+	/**
+	 * Same as SmartDrive::IsTimeDone, for the current record
+	 */
+    bool IsTimeDone(MotorID_t motor_number) const;
+
+	/**
+	 * Same as SmartDrive::IsTachoDone, for the current record
+	 */
+    bool IsTachoDone(MotorID_t motor_number) const;
+
+private:
+    bool statusClear(MotorID_t motor_number, uint8_t mask) const;
+
+private:
+    const SmartDriveLogReader& m_reader;
+    uint64_t m_position;
+    const SmartDriveSample* m_current;
+    SmartDriveSample m_empty;
+};
+
+}
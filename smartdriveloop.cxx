@@ -0,0 +1,225 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <string>
+#include <stdexcept>
+
+#include "smartdriveloop.h"
+#include "smartdrivetrace.h"
+
+using namespace upm;
+
+
+SmartDriveLoop::SmartDriveLoop(SmartDrive& drive, unsigned rate_hz, Step step): m_drive(drive),
+    m_periodNs(0), m_step(step), m_priority(SmartDriveLoop_PRIORITY), m_cpu(-1), m_lockMemory(false),
+    m_realtime(false), m_memoryLocked(false), m_running(false)
+{
+    if (rate_hz == 0)
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": rate_hz must be positive");
+    if (!step)
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": step function is required");
+    m_periodNs = 1000000000LL / rate_hz;
+    m_bus = drive.GetBus();
+    m_realClock = m_bus->realTime();
+    m_snapshot = SmartDrive::Snapshot();
+    ResetStats();
+}
+
+SmartDriveLoop::~SmartDriveLoop()
+{
+    Stop();
+}
+
+
+mraa::Result
+SmartDriveLoop::Start() {
+    if (m_running.exchange(true))
+        return mraa::ERROR_INVALID_RESOURCE;
+    m_thread = std::thread(&SmartDriveLoop::run, this);
+    return mraa::SUCCESS;
+}
+
+void
+SmartDriveLoop::Stop() {
+    m_running = false;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+
+void
+SmartDriveLoop::setup() {
+    //MCL_CURRENT only : the loop allocates nothing, and MCL_FUTURE would lock every
+    //later mapping of the process, e.g. log files and shared memory segments
+    if (m_lockMemory)
+        m_memoryLocked = (mlockall(MCL_CURRENT) == 0);
+    if (m_lockMemory && !m_memoryLocked)
+        SMARTDRIVE_WARN("mlockall failed (%lld), loop memory may page fault", (long long) errno);
+
+    if (m_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(m_cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+            SMARTDRIVE_WARN("Cannot pin the loop to CPU %lld", (long long) m_cpu);
+    }
+
+    if (m_priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = m_priority;
+        int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        m_realtime = (ret == 0);
+        if (ret != 0)
+            SMARTDRIVE_WARN("SCHED_FIFO refused (%lld), loop runs with the default scheduler", (long long) ret);
+    }
+
+    //touch the stack the step may use, so its pages are mapped (and locked) before the first cycle
+    volatile uint8_t stack[SmartDriveLoop_STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 256)
+        stack[i] = 0;
+}
+
+int64_t
+SmartDriveLoop::nowNs() {
+    if (m_realClock) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(m_bus->now().time_since_epoch()).count();
+}
+
+void
+SmartDriveLoop::sleepUntil(int64_t deadline_ns) {
+    if (m_realClock) {
+        struct timespec ts;
+        ts.tv_sec = deadline_ns / 1000000000LL;
+        ts.tv_nsec = deadline_ns % 1000000000LL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        return;
+    }
+    //a virtual clock only moves forward
+    int64_t now = nowNs();
+    if (deadline_ns > now)
+        m_bus->sleep(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(deadline_ns - now)));
+}
+
+void
+SmartDriveLoop::run() {
+    setup();
+
+    uint64_t cycle = 0;
+    int64_t deadline = nowNs();
+    while (m_running.load(std::memory_order_relaxed)) {
+        deadline += m_periodNs;
+        sleepUntil(deadline);
+        record(m_jitter, nowNs() - deadline);
+
+        if (!m_drive.ReadSnapshot(m_snapshot))
+            m_readErrors.fetch_add(1, std::memory_order_relaxed);
+        m_step(m_snapshot, cycle++);
+        m_cycles.fetch_add(1, std::memory_order_relaxed);
+
+        int64_t end = nowNs();
+        record(m_latency, end - deadline);
+
+        //absolute deadlines so the rate doesn't drift, drop the ones we are already late for
+        if (end > deadline + m_periodNs) {
+            int64_t late = (end - deadline) / m_periodNs;
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+            m_skipped.fetch_add(late, std::memory_order_relaxed);
+            deadline += late * m_periodNs;
+        }
+    }
+}
+
+
+void
+SmartDriveLoop::record(AtomicHistogram& histogram, int64_t ns) {
+    if (ns < 0)
+        ns = 0;
+    //bucket i holds times below 2^(i+1) us
+    unsigned bucket = 0;
+    for (uint64_t us = ns / 1000; us > 1 && bucket < SmartDriveLoop_BUCKETS; us >>= 1)
+        bucket++;
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    if ((uint64_t) ns > histogram.max_ns.load(std::memory_order_relaxed))
+        histogram.max_ns.store(ns, std::memory_order_relaxed);   //only the loop thread writes
+}
+
+void
+SmartDriveLoop::copy(const AtomicHistogram& from, Histogram& to) {
+    for (int i = 0; i <= SmartDriveLoop_BUCKETS; i++)
+        to.buckets[i] = from.buckets[i].load(std::memory_order_relaxed);
+    to.count = from.count.load(std::memory_order_relaxed);
+    to.sum_ns = from.sum_ns.load(std::memory_order_relaxed);
+    to.max_ns = from.max_ns.load(std::memory_order_relaxed);
+}
+
+void
+SmartDriveLoop::clear(AtomicHistogram& histogram) {
+    for (int i = 0; i <= SmartDriveLoop_BUCKETS; i++)
+        histogram.buckets[i] = 0;
+    histogram.count = 0;
+    histogram.sum_ns = 0;
+    histogram.max_ns = 0;
+}
+
+
+SmartDriveLoop::Stats
+SmartDriveLoop::GetStats() const {
+    Stats stats;
+    stats.cycles = m_cycles.load(std::memory_order_relaxed);
+    stats.deadline_misses = m_misses.load(std::memory_order_relaxed);
+    stats.skipped = m_skipped.load(std::memory_order_relaxed);
+    stats.read_errors = m_readErrors.load(std::memory_order_relaxed);
+    copy(m_jitter, stats.jitter);
+    copy(m_latency, stats.latency);
+    stats.realtime = m_realtime;
+    stats.memory_locked = m_memoryLocked;
+    return stats;
+}
+
+void
+SmartDriveLoop::ResetStats() {
+    m_cycles = 0;
+    m_misses = 0;
+    m_skipped = 0;
+    m_readErrors = 0;
+    clear(m_jitter);
+    clear(m_latency);
+}
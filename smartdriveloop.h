@@ -0,0 +1,185 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "smartdrive.h"
+
+//cycle timing buckets are powers of 2 microseconds : <2us, <4us ... <2^BUCKETS us, then +Inf
+#define SmartDriveLoop_BUCKETS         16
+#define SmartDriveLoop_PRIORITY        80            //SCHED_FIFO priority, 0 keeps the default scheduler
+#define SmartDriveLoop_STACK_PREFAULT  (64 * 1024)   //stack bytes touched before the first cycle
+
+namespace upm {
+
+/**
+ * @brief Fixed-rate control loop runner
+ *
+ * Runs a user step function at a fixed rate on a dedicated thread : SCHED_FIFO
+ * priority, optional CPU pinning, absolute CLOCK_MONOTONIC deadlines with
+ * clock_nanosleep, optionally locked memory and the stack pre-faulted before
+ * the first cycle. On a bus with a virtual clock, e.g. a SmartDriveSimulator,
+ * the deadlines follow the bus clock instead. Each cycle reads a fresh snapshot into storage owned by the
+ * runner and calls the step with it, nothing is allocated in the loop.
+ *
+ * Wake-up jitter (actual wake-up minus deadline) and cycle latency (deadline to
+ * end of the step) are recorded in histograms, along with deadline misses.
+ * Real-time settings the process is not allowed to use are skipped and
+ * reported in the Stats, the loop then runs with the default scheduler.
+ */
+class SmartDriveLoop {
+
+public:
+	/**
+	 * Called once per cycle with the snapshot read for it; snap.valid is false
+	 * when the read failed. The step must not block nor allocate.
+	 */
+    typedef std::function<void(const SmartDrive::Snapshot& snap, uint64_t cycle)> Step;
+
+    /**
+     * Timing distribution, in nanoseconds
+     */
+    struct Histogram {
+        uint64_t buckets[SmartDriveLoop_BUCKETS + 1];   //last one is +Inf
+        uint64_t count;
+        uint64_t sum_ns;
+        uint64_t max_ns;
+    };
+
+    /**
+     * Loop counters
+     */
+    struct Stats {
+        uint64_t  cycles;
+        uint64_t  deadline_misses;   //cycles which ended after the next deadline
+        uint64_t  skipped;           //deadlines dropped to catch up after a miss
+        uint64_t  read_errors;
+        Histogram jitter;            //wake-up minus deadline
+        Histogram latency;           //deadline to end of the step
+        bool      realtime;          //running with SCHED_FIFO
+        bool      memory_locked;     //mlockall succeeded
+    };
+
+	/**
+	 * Creates a loop, started with Start()
+	 * @param drive SmartDrive read every cycle, must outlive the loop.
+	 * @param rate_hz Cycles per second.
+	 * @param step Step function.
+	 */
+    SmartDriveLoop(SmartDrive& drive, unsigned rate_hz, Step step);
+
+	/**
+	 * Stops the loop
+	 */
+    ~SmartDriveLoop();
+
+	/**
+	 * Sets the SCHED_FIFO priority, 0 keeps the default scheduler. Used by the next Start().
+	 */
+    void SetPriority(int priority) { m_priority = priority; }
+
+	/**
+	 * Pins the loop thread to a CPU, -1 (default) lets it run anywhere. Used by the next Start().
+	 */
+    void SetCpu(int cpu) { m_cpu = cpu; }
+
+	/**
+	 * Locks the memory mapped so far with mlockall(MCL_CURRENT), false by default.
+	 * Used by the next Start(). This applies to the whole process and is not
+	 * undone by Stop(), the locked pages count against RLIMIT_MEMLOCK.
+	 */
+    void SetLockMemory(bool lock) { m_lockMemory = lock; }
+
+	/**
+	 * Starts the loop thread, the first cycle runs one period later
+	 * @return mraa::ERROR_INVALID_RESOURCE if the loop is already running.
+	 */
+    mraa::Result Start();
+
+	/**
+	 * Stops the loop thread after its current cycle
+	 */
+    void Stop();
+
+	/**
+	 * Returns the loop counters, each one is read atomically but not all at the same time
+	 */
+    Stats GetStats() const;
+
+	/**
+	 * Clears the counters
+	 */
+    void ResetStats();
+
+private:
+    struct AtomicHistogram {
+        std::atomic<uint64_t> buckets[SmartDriveLoop_BUCKETS + 1];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum_ns;
+        std::atomic<uint64_t> max_ns;
+    };
+
+    void run();
+    void setup();
+    int64_t nowNs();
+    void sleepUntil(int64_t deadline_ns);
+    static void record(AtomicHistogram& histogram, int64_t ns);
+    static void copy(const AtomicHistogram& from, Histogram& to);
+    static void clear(AtomicHistogram& histogram);
+
+private:
+    SmartDrive& m_drive;
+    std::shared_ptr<SmartDriveBus> m_bus;
+    bool m_realClock;                  //CLOCK_MONOTONIC deadlines, else the bus clock
+    int64_t m_periodNs;
+    Step m_step;
+    int m_priority;
+    int m_cpu;
+    bool m_lockMemory;
+
+    SmartDrive::Snapshot m_snapshot;   //loop thread only
+
+    std::atomic<uint64_t> m_cycles;
+    std::atomic<uint64_t> m_misses;
+    std::atomic<uint64_t> m_skipped;
+    std::atomic<uint64_t> m_readErrors;
+    AtomicHistogram m_jitter;
+    AtomicHistogram m_latency;
+    std::atomic<bool> m_realtime;
+    std::atomic<bool> m_memoryLocked;
+
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+
+}
@@ -0,0 +1,138 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <fstream>
+#include <sstream>
+
+#include "smartdrivepid.h"
+#include "smartdrivetrace.h"
+
+using namespace upm;
+
+mraa::Result
+SmartDrivePidProfiles::Set(const std::string& name, const SmartDrive::PerformanceParameters& params) {
+    if (name.empty() || name.find_first_of(" \t\r\n") != std::string::npos || name[0] == '#')
+        return mraa::ERROR_INVALID_PARAMETER;
+    m_profiles[name] = params;
+    return mraa::SUCCESS;
+}
+
+bool
+SmartDrivePidProfiles::Get(const std::string& name, SmartDrive::PerformanceParameters& params) const {
+    std::map<std::string, SmartDrive::PerformanceParameters>::const_iterator it = m_profiles.find(name);
+    if (it == m_profiles.end())
+        return false;
+    params = it->second;
+    return true;
+}
+
+void
+SmartDrivePidProfiles::Remove(const std::string& name) {
+    m_profiles.erase(name);
+}
+
+std::vector<std::string>
+SmartDrivePidProfiles::GetNames() const {
+    std::vector<std::string> names;
+    for (std::map<std::string, SmartDrive::PerformanceParameters>::const_iterator it = m_profiles.begin(); it != m_profiles.end(); ++it)
+        names.push_back(it->first);
+    return names;
+}
+
+mraa::Result
+SmartDrivePidProfiles::Load(const std::string& path) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        SMARTDRIVE_ERROR("Cannot open the PID profiles file");
+        return mraa::ERROR_INVALID_RESOURCE;
+    }
+
+    std::map<std::string, SmartDrive::PerformanceParameters> loaded;
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name) || name[0] == '#')
+            continue;
+
+        //read as unsigned, uint8_t fields would be parsed as characters
+        unsigned values[8];
+        bool ok = true;
+        for (unsigned i = 0; i < 8 && ok; i++)
+            ok = (fields >> values[i]) && values[i] <= ((i < 6) ? 0xFFFFu : 0xFFu);
+        std::string extra;
+        if (!ok || (fields >> extra)) {
+            SMARTDRIVE_ERROR("Malformed PID profile at line %lld", (long long) number);
+            return mraa::ERROR_INVALID_PARAMETER;
+        }
+
+        SmartDrive::PerformanceParameters& params = loaded[name];
+        params.Kp_tacho = values[0];
+        params.Ki_tacho = values[1];
+        params.Kd_tacho = values[2];
+        params.Kp_speed = values[3];
+        params.Ki_speed = values[4];
+        params.Kd_speed = values[5];
+        params.passcount = values[6];
+        params.tolerance = values[7];
+    }
+    if (file.bad())
+        return mraa::ERROR_INVALID_RESOURCE;
+
+    for (std::map<std::string, SmartDrive::PerformanceParameters>::const_iterator it = loaded.begin(); it != loaded.end(); ++it)
+        m_profiles[it->first] = it->second;
+    return mraa::SUCCESS;
+}
+
+mraa::Result
+SmartDrivePidProfiles::Save(const std::string& path) const {
+    std::ofstream file(path.c_str());
+    if (!file) {
+        SMARTDRIVE_ERROR("Cannot write the PID profiles file");
+        return mraa::ERROR_INVALID_RESOURCE;
+    }
+
+    file << "# name Kp_tacho Ki_tacho Kd_tacho Kp_speed Ki_speed Kd_speed passcount tolerance" << std::endl;
+    for (std::map<std::string, SmartDrive::PerformanceParameters>::const_iterator it = m_profiles.begin(); it != m_profiles.end(); ++it) {
+        const SmartDrive::PerformanceParameters& params = it->second;
+        file << it->first << ' ' << params.Kp_tacho << ' ' << params.Ki_tacho << ' ' << params.Kd_tacho
+             << ' ' << params.Kp_speed << ' ' << params.Ki_speed << ' ' << params.Kd_speed
+             << ' ' << (unsigned) params.passcount << ' ' << (unsigned) params.tolerance << std::endl;
+    }
+    file.close();
+    return file ? mraa::SUCCESS : mraa::ERROR_INVALID_RESOURCE;
+}
+
+SmartDriveResult<uint8_t>
+SmartDrivePidProfiles::Apply(SmartDrive& drive, const std::string& name) const {
+    SmartDrive::PerformanceParameters params;
+    if (!Get(name, params)) {
+        SMARTDRIVE_ERROR("Unknown PID profile");
+        return SmartDriveResult<uint8_t>::Failure(mraa::ERROR_INVALID_PARAMETER);
+    }
+    return drive.ApplyPerformanceParameters(params);
+}
@@ -0,0 +1,94 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "smartdrive.h"
+
+namespace upm {
+
+/**
+ * @brief Named sets of PID parameters, kept in a text file
+ *
+ * One profile per line : name Kp_tacho Ki_tacho Kd_tacho Kp_speed Ki_speed Kd_speed passcount tolerance.
+ * Blank lines and lines starting with '#' are ignored. Profiles are applied with
+ * SmartDrive::ApplyPerformanceParameters, so a board already holding a profile
+ * is not written again.
+ */
+class SmartDrivePidProfiles {
+
+public:
+	/**
+	 * Adds or replaces a profile
+	 * @param name Profile name, without whitespace.
+	 * @param params PID parameters of the profile.
+	 * @return mraa::ERROR_INVALID_PARAMETER if the name is empty or contains whitespace.
+	 */
+    mraa::Result Set(const std::string& name, const SmartDrive::PerformanceParameters& params);
+
+	/**
+	 * Looks a profile up
+	 * @return false if there is no profile with this name.
+	 */
+    bool Get(const std::string& name, SmartDrive::PerformanceParameters& params) const;
+
+    void Remove(const std::string& name);
+
+	/**
+	 * Returns the profile names, sorted
+	 */
+    std::vector<std::string> GetNames() const;
+
+	/**
+	 * Adds the profiles of a file, replacing the ones with the same name
+	 * @param path File to read.
+	 * @return mraa::ERROR_INVALID_RESOURCE if the file cannot be read, mraa::ERROR_INVALID_PARAMETER
+	 *         on a malformed line, in which case no profile of the file is kept.
+	 */
+    mraa::Result Load(const std::string& path);
+
+	/**
+	 * Writes all the profiles to a file
+	 * @return mraa::ERROR_INVALID_RESOURCE if the file cannot be written.
+	 */
+    mraa::Result Save(const std::string& path) const;
+
+	/**
+	 * Applies a profile to a board, writing only the registers which differ
+	 * @return Number of register bytes written, mraa::ERROR_INVALID_PARAMETER for an unknown profile.
+	 */
+    SmartDriveResult<uint8_t> Apply(SmartDrive& drive, const std::string& name) const;
+
+private:
+    std::map<std::string, SmartDrive::PerformanceParameters> m_profiles;
+};
+
+}
@@ -0,0 +1,183 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "smartdrivepower.h"
+#include "smartdrivetrace.h"
+
+using namespace upm;
+
+SmartDrivePowerMonitor::SmartDrivePowerMonitor(SmartDrive& drive) :
+	m_drive(drive), m_config(DefaultConfig()), m_cap(100.0f), m_hasLast(false) {
+	ResetStats();
+}
+
+
+SmartDrivePowerMonitor::Config
+SmartDrivePowerMonitor::DefaultConfig() {
+	Config config;
+	config.sag_mv = SmartDrivePower_SAG_MV;
+	config.brownout_mv = SmartDrivePower_BROWNOUT_MV;
+	config.current_limit_ma = SmartDrivePower_CURRENT_LIMIT_MA;
+	config.min_cap = SmartDrivePower_MIN_CAP;
+	config.recovery_per_s = SmartDrivePower_RECOVERY_PER_S;
+	config.govern = true;
+	return config;
+}
+
+
+void
+SmartDrivePowerMonitor::SetConfig(const Config& config) {
+	bool release;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		release = m_config.govern && !config.govern;
+		m_config = config;
+		if (release)
+			m_cap = 100.0f;
+	}
+	if (release)
+		m_drive.SetSpeedCap(100);
+}
+
+
+SmartDrivePowerMonitor::Config
+SmartDrivePowerMonitor::GetConfig() {
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_config;
+}
+
+
+mraa::Result
+SmartDrivePowerMonitor::Update() {
+	SmartDriveResult<SmartDrive::PowerReading> reading = m_drive.ReadPower();
+	if (!reading) {
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_stats.read_errors++;
+		return reading.error();
+	}
+	Update(reading.value());
+	return mraa::SUCCESS;
+}
+
+
+uint8_t
+SmartDrivePowerMonitor::target(const SmartDrive::PowerReading& reading) const {
+	float cap = 100.0f;
+
+	//Linear from full speed at the sag threshold down to the floor at brownout
+	if (reading.battery_mv < m_config.sag_mv) {
+		float span = m_config.sag_mv - m_config.brownout_mv;
+		float fraction = span > 0.0f ? (reading.battery_mv - m_config.brownout_mv) / span : 0.0f;
+		cap = std::min(cap, m_config.min_cap + fmaxf(fraction, 0.0f) * (100.0f - m_config.min_cap));
+	}
+
+	//The current scales roughly with the speed, shrink the cap by the overshoot
+	float total = reading.current_ma[0] + reading.current_ma[1];
+	if (m_config.current_limit_ma > 0.0f && total > m_config.current_limit_ma)
+		cap = std::min(cap, m_cap * m_config.current_limit_ma / total);
+
+	return (uint8_t) std::max(cap, (float) m_config.min_cap);
+}
+
+
+void
+SmartDrivePowerMonitor::Update(const SmartDrive::PowerReading& reading) {
+	int apply = -1;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+
+		float total = reading.current_ma[0] + reading.current_ma[1];
+		double dt = 0.0;
+		if (m_hasLast) {
+			dt = std::chrono::duration<double>(reading.timestamp - m_last.timestamp).count();
+			if (dt < 0.0)
+				dt = 0.0;
+			//Trapezoidal integration of the motor power
+			double p0 = m_last.battery_mv * (m_last.current_ma[0] + m_last.current_ma[1]) * 1e-6;
+			double p1 = reading.battery_mv * total * 1e-6;
+			m_stats.energy_j += (p0 + p1) * 0.5 * dt;
+			m_stats.charge_mah += (m_last.current_ma[0] + m_last.current_ma[1] + total) * 0.5 * dt / 3600.0;
+			m_elapsedS += dt;
+		}
+		m_last = reading;
+		m_hasLast = true;
+
+		m_stats.samples++;
+		if (reading.resetStatus != 0)
+			m_stats.resets++;
+		m_stats.battery_mv = reading.battery_mv;
+		if (m_stats.samples == 1 || reading.battery_mv < m_stats.min_battery_mv)
+			m_stats.min_battery_mv = reading.battery_mv;
+		for (int i = 0; i < 2; i++) {
+			m_stats.current_ma[i] = reading.current_ma[i];
+			m_stats.peak_current_ma[i] = fmaxf(m_stats.peak_current_ma[i], reading.current_ma[i]);
+		}
+		m_stats.peak_total_ma = fmaxf(m_stats.peak_total_ma, total);
+		m_stats.mean_power_w = m_elapsedS > 0.0 ? (float) (m_stats.energy_j / m_elapsedS) : 0.0f;
+
+		//Drop at once, recover at a bounded rate
+		float wanted = target(reading);
+		float previous = m_cap;
+		if (wanted <= m_cap)
+			m_cap = wanted;
+		else
+			m_cap = std::min(wanted, m_cap + (float) (m_config.recovery_per_s * dt));
+
+		uint8_t cap = (uint8_t) m_cap;
+		m_stats.cap = cap;
+		if (cap < 100)
+			m_stats.limited_samples++;
+		if (m_config.govern && cap != (uint8_t) previous)
+			apply = cap;
+	}
+
+	//Outside the lock, SetSpeedCap may re-send running commands
+	if (apply >= 0) {
+		if (apply < 100)
+			SMARTDRIVE_WARN("Power: speed capped to %lld at %lld mV", (long long) apply, (long long) reading.battery_mv);
+		m_drive.SetSpeedCap((uint8_t) apply);
+	}
+}
+
+
+SmartDrivePowerMonitor::Stats
+SmartDrivePowerMonitor::GetStats() {
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_stats;
+}
+
+
+void
+SmartDrivePowerMonitor::ResetStats() {
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_stats = Stats();
+	m_stats.cap = (uint8_t) m_cap;
+	m_elapsedS = 0.0;
+	m_hasLast = false;
+}
@@ -0,0 +1,129 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+
+#include "smartdrive.h"
+
+//Default governor settings, see SmartDrivePowerMonitor::Config
+#define SmartDrivePower_SAG_MV            10500.0f   //battery voltage below which the speed is limited
+#define SmartDrivePower_BROWNOUT_MV       9000.0f    //battery voltage at which the speed reaches the floor
+#define SmartDrivePower_CURRENT_LIMIT_MA  4000.0f    //total motor current above which the speed is limited
+#define SmartDrivePower_MIN_CAP           20         //speed floor of the governor
+#define SmartDrivePower_RECOVERY_PER_S    25.0f      //speed units regained per second once the supply recovers
+
+namespace upm {
+
+/**
+ * @brief Power telemetry and brownout governor of one SmartDrive
+ *
+ * Each Update() reads the battery voltage and both motor currents in one burst,
+ * integrates the energy drawn by the motors and tracks peaks. The governor
+ * derives a speed cap from the battery sag and the total current and applies it
+ * with SmartDrive::SetSpeedCap() : it drops at once when the supply sags or the
+ * current spikes, and recovers at a bounded rate, so a sag costs some speed
+ * instead of a controller reset.
+ */
+class SmartDrivePowerMonitor {
+
+public:
+    /**
+     * Governor settings
+     */
+    struct Config {
+        float   sag_mv;
+        float   brownout_mv;
+        float   current_limit_ma;   //0 disables the current limit
+        uint8_t min_cap;
+        float   recovery_per_s;
+        bool    govern;             //false only measures, the cap is computed but not applied
+    };
+
+    /**
+     * Power counters since the last ResetStats()
+     */
+    struct Stats {
+        uint64_t samples;
+        uint64_t read_errors;
+        uint64_t resets;              //readings with a non zero SmartDrive_RESETSTATUS
+        double   energy_j;            //drawn by both motors
+        double   charge_mah;
+        float    battery_mv;          //last reading
+        float    min_battery_mv;
+        float    current_ma[2];       //last reading
+        float    peak_current_ma[2];
+        float    peak_total_ma;
+        float    mean_power_w;
+        uint64_t limited_samples;     //readings which left the speed capped
+        uint8_t  cap;                 //speed cap computed from the last reading
+    };
+
+	/**
+	 * Creates a monitor
+	 * @param drive SmartDrive to measure and govern, must outlive the monitor.
+	 */
+    SmartDrivePowerMonitor(SmartDrive& drive);
+
+	/**
+	 * Returns a Config with the SmartDrivePower_ defaults
+	 */
+    static Config DefaultConfig();
+
+    void SetConfig(const Config& config);
+    Config GetConfig();
+
+	/**
+	 * Reads the power registers in one burst, accounts and governs
+	 * @return Error of the burst read.
+	 */
+    mraa::Result Update();
+
+	/**
+	 * Accounts and governs a reading obtained elsewhere
+	 */
+    void Update(const SmartDrive::PowerReading& reading);
+
+    Stats GetStats();
+    void ResetStats();
+
+private:
+    uint8_t target(const SmartDrive::PowerReading& reading) const;
+
+private:
+    SmartDrive& m_drive;
+    std::mutex m_lock;
+    Config m_config;
+    Stats m_stats;
+    float m_cap;                  //fractional, recovers smoothly
+    bool m_hasLast;
+    SmartDrive::PowerReading m_last;
+    double m_elapsedS;
+};
+
+}
@@ -0,0 +1,296 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <string>
+#include <stdexcept>
+
+#include "smartdriveprofile.h"
+
+using namespace upm;
+
+SmartDriveProfile::SmartDriveProfile(SmartDriveProfileShape shape, int32_t distance, float max_velocity, float max_accel):
+    m_shape(shape), m_sign((distance < 0) ? -1.0f : 1.0f), m_distance(fabsf((float) distance)),
+    m_velocity(0), m_rampTime(0), m_cruiseTime(0)
+{
+    if (m_distance == 0 || max_velocity <= 0 || max_accel <= 0)
+        return;
+
+    //ramp time per unit of velocity, the ramp covers velocity * ramp time / 2 in both shapes
+    float k = ((shape == Profile_SCurve) ? (float) M_PI / 2 : 1.0f) / max_accel;
+
+    m_velocity = max_velocity;
+    if (m_velocity * m_velocity * k > m_distance)
+        m_velocity = sqrtf(m_distance / k);   //too short to cruise
+    m_rampTime = k * m_velocity;
+    m_cruiseTime = (m_distance - m_velocity * m_rampTime) / m_velocity;
+    if (m_cruiseTime < 0)
+        m_cruiseTime = 0;
+}
+
+void
+SmartDriveProfile::ramp(float t, float& position, float& velocity) const {
+    if (m_shape == Profile_SCurve) {
+        float phase = (float) M_PI * t / m_rampTime;
+        velocity = m_velocity / 2 * (1 - cosf(phase));
+        position = m_velocity / 2 * (t - m_rampTime / (float) M_PI * sinf(phase));
+    } else {
+        velocity = m_velocity * t / m_rampTime;
+        position = velocity * t / 2;
+    }
+}
+
+void
+SmartDriveProfile::Sample(float t, float& position, float& velocity) const {
+    float duration = GetDuration();
+
+    if (t <= 0 || duration == 0) {
+        position = (t <= 0) ? 0 : m_sign * m_distance;
+        velocity = 0;
+        return;
+    }
+    if (t >= duration) {
+        position = m_sign * m_distance;
+        velocity = 0;
+        return;
+    }
+
+    if (t < m_rampTime) {
+        ramp(t, position, velocity);
+    } else if (t < m_rampTime + m_cruiseTime) {
+        velocity = m_velocity;
+        position = m_velocity * m_rampTime / 2 + m_velocity * (t - m_rampTime);
+    } else {
+        //deceleration mirrors the acceleration
+        ramp(duration - t, position, velocity);
+        position = m_distance - position;
+    }
+    position *= m_sign;
+    velocity *= m_sign;
+}
+
+
+SmartDriveStreamer::SmartDriveStreamer(SmartDrive& drive, MotorID_t motor, unsigned rate_hz, float ticks_per_speed_unit, uint8_t min_speed):
+    m_drive(drive), m_motor(motor), m_period(1000000000ULL / (rate_hz ? rate_hz : 1)),
+    m_ticksPerSpeed(ticks_per_speed_unit), m_minSpeed(min_speed), m_nextAction(Action_Brake),
+    m_origin(0), m_frameCount(0), m_nextFrame(0), m_prevPosition(0),
+    m_head(0), m_tail(0), m_frames(0), m_writeErrors(0), m_lateTicks(0), m_underruns(0),
+    m_running(false), m_done(true)
+{
+    if (motor != Motor_ID_1 && motor != Motor_ID_2)
+        throw std::invalid_argument(std::string(__FUNCTION__) +
+                                    ": one streamer drives a single motor");
+    if (ticks_per_speed_unit <= 0)
+        throw std::invalid_argument(std::string(__FUNCTION__) +
+                                    ": ticks_per_speed_unit must be positive");
+}
+
+SmartDriveStreamer::~SmartDriveStreamer()
+{
+    Stop();
+}
+
+
+mraa::Result
+SmartDriveStreamer::Start(const SmartDriveProfile& profile, MotorAction_t next_action) {
+    if (!m_done)
+        return mraa::ERROR_INVALID_RESOURCE;
+    join();
+
+    SmartDriveResult<uint32_t> origin = m_drive.TryReadTachometerPosition(m_motor);
+    if (!origin)
+        return origin.error();
+
+    float period_s = std::chrono::duration<float>(m_period).count();
+    m_profile = profile;
+    m_nextAction = next_action;
+    m_origin = (int32_t) origin.value();
+    m_frameCount = (uint64_t) ceilf(profile.GetDuration() / period_s);
+    if (m_frameCount == 0)
+        m_frameCount = 1;
+    m_nextFrame = 1;
+    m_prevPosition = 0;
+    m_head = m_tail = 0;
+    m_frames = m_writeErrors = m_lateTicks = m_underruns = 0;
+    m_done = false;
+    m_running = true;
+
+    //fill the pipeline before the first deadline, then keep it full in the background
+    for (int i = 0; i < SmartDriveStream_PIPELINE_DEPTH && produce(); i++)
+        ;
+    m_generator = std::thread(&SmartDriveStreamer::generate, this);
+    m_writer = std::thread(&SmartDriveStreamer::write, this);
+    return mraa::SUCCESS;
+}
+
+
+bool
+SmartDriveStreamer::produce() {
+    if (m_nextFrame > m_frameCount)
+        return false;
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) >= SmartDriveStream_PIPELINE_DEPTH)
+        return false;
+
+    float period_s = std::chrono::duration<float>(m_period).count();
+    bool last = (m_nextFrame == m_frameCount);
+    float position, velocity;
+    m_profile.Sample(last ? m_profile.GetDuration() : m_nextFrame * period_s, position, velocity);
+
+    //speed needed to be at the setpoint by the next tick
+    float speed = ceilf(fabsf(position - m_prevPosition) / period_s / m_ticksPerSpeed);
+    if (speed < m_minSpeed)
+        speed = m_minSpeed;
+    if (speed > 100)
+        speed = 100;
+
+    Frame& frame = m_ring[head & (SmartDriveStream_PIPELINE_DEPTH - 1)];
+    frame.setpoint = (uint32_t) (m_origin + (int32_t) lroundf(position));
+    frame.speed = (uint8_t) speed;
+    frame.last = last;
+    m_head.store(head + 1, std::memory_order_release);
+
+    m_prevPosition = position;
+    m_nextFrame++;
+    return true;
+}
+
+void
+SmartDriveStreamer::generate() {
+    while (m_running.load(std::memory_order_relaxed) && m_nextFrame <= m_frameCount) {
+        if (produce()) {
+            if (!m_drive.GetBus()->realTime()) {
+                std::lock_guard<std::mutex> lock(m_spaceLock);
+                m_dataCond.notify_one();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_spaceLock);
+        m_spaceCond.wait(lock, [this]() {
+            return !m_running.load() ||
+                   m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire) < SmartDriveStream_PIPELINE_DEPTH;
+        });
+    }
+}
+
+void
+SmartDriveStreamer::write() {
+    typedef std::chrono::steady_clock clock;
+    std::shared_ptr<SmartDriveBus> bus = m_drive.GetBus();
+    clock::time_point next = bus->now();
+
+    while (m_running.load(std::memory_order_relaxed)) {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+
+        if (tail == m_head.load(std::memory_order_acquire)) {
+            //a virtual clock doesn't move while we wait, so block until the generator catches up
+            if (!bus->realTime()) {
+                std::unique_lock<std::mutex> lock(m_spaceLock);
+                m_dataCond.wait(lock, [this, tail]() {
+                    return !m_running.load() || m_head.load(std::memory_order_acquire) != tail;
+                });
+                continue;
+            }
+            m_underruns.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            Frame frame = m_ring[tail & (SmartDriveStream_PIPELINE_DEPTH - 1)];
+            m_tail.store(tail + 1, std::memory_order_release);
+            {
+                std::lock_guard<std::mutex> lock(m_spaceLock);
+            }
+            m_spaceCond.notify_one();
+
+            //hold each intermediate setpoint if the motor gets there early
+            if (m_drive.SetTachoSetpoint(m_motor, frame.speed, frame.setpoint,
+                                         frame.last ? m_nextAction : Action_BrakeHold) != mraa::SUCCESS)
+                m_writeErrors.fetch_add(1, std::memory_order_relaxed);
+            m_frames.fetch_add(1, std::memory_order_relaxed);
+            if (frame.last)
+                break;
+        }
+
+        //absolute deadlines on the bus clock, skip the ticks we are late for
+        next += m_period;
+        clock::time_point now = bus->now();
+        if (now > next) {
+            //the tick in progress is missed too, the next deadline is always ahead of now
+            uint64_t late = (now - next) / m_period + 1;
+            m_lateTicks.fetch_add(late, std::memory_order_relaxed);
+            next += m_period * late;
+        }
+        //a negative delay would move a virtual clock backwards
+        if (next > now)
+            bus->sleep(std::chrono::duration_cast<std::chrono::microseconds>(next - now));
+    }
+    m_done = true;
+}
+
+
+void
+SmartDriveStreamer::join() {
+    if (m_writer.joinable())
+        m_writer.join();
+    {
+        std::lock_guard<std::mutex> lock(m_spaceLock);
+        m_running = false;
+    }
+    m_spaceCond.notify_one();
+    m_dataCond.notify_one();
+    if (m_generator.joinable())
+        m_generator.join();
+}
+
+void
+SmartDriveStreamer::Wait() {
+    join();
+}
+
+void
+SmartDriveStreamer::Stop() {
+    bool aborted = !m_done;
+    {
+        std::lock_guard<std::mutex> lock(m_spaceLock);
+        m_running = false;
+    }
+    m_spaceCond.notify_one();
+    m_dataCond.notify_one();
+    join();
+    if (aborted)
+        m_drive.StopMotor(m_motor, m_nextAction);
+    m_done = true;
+}
+
+
+SmartDriveStreamer::Stats
+SmartDriveStreamer::GetStats() const {
+    Stats stats;
+    stats.frames = m_frames.load(std::memory_order_relaxed);
+    stats.write_errors = m_writeErrors.load(std::memory_order_relaxed);
+    stats.late_ticks = m_lateTicks.load(std::memory_order_relaxed);
+    stats.underruns = m_underruns.load(std::memory_order_relaxed);
+    return stats;
+}
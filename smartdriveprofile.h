@@ -0,0 +1,209 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "smartdrive.h"
+
+#define SmartDriveStream_PIPELINE_DEPTH  16   //setpoints computed ahead of the bus, power of 2
+#define SmartDriveStream_MIN_SPEED       5    //lowest speed sent, lets the onboard loop close small errors
+
+namespace upm {
+
+enum SmartDriveProfileShape {
+    Profile_Trapezoid = 0,   //constant acceleration ramps
+    Profile_SCurve    = 1    //sine shaped acceleration ramps, no acceleration step
+};
+
+/**
+ * @brief Point to point motion profile computed on the host
+ *
+ * Both shapes ramp up to a cruise velocity, cruise and ramp down symmetrically,
+ * or never reach the cruise velocity on short moves. The S-curve uses sine shaped
+ * ramps, so the acceleration starts and ends at 0 and never exceeds max_accel;
+ * its ramps last pi/2 longer than the trapezoid ones. Sampling is O(1).
+ */
+class SmartDriveProfile {
+
+public:
+	/**
+	 * Plans a move
+	 * @param shape Profile_Trapezoid or Profile_SCurve.
+	 * @param distance Signed distance in tacho counts.
+	 * @param max_velocity Cruise velocity in tacho counts per second.
+	 * @param max_accel Peak acceleration in tacho counts per second squared.
+	 */
+    SmartDriveProfile(SmartDriveProfileShape shape = Profile_Trapezoid, int32_t distance = 0,
+                      float max_velocity = 0, float max_accel = 0);
+
+	/**
+	 * Length of the move in seconds
+	 */
+    float GetDuration() const { return 2 * m_rampTime + m_cruiseTime; }
+
+	/**
+	 * Velocity actually reached, lower than max_velocity on short moves
+	 */
+    float GetPeakVelocity() const { return m_velocity; }
+
+	/**
+	 * Position and velocity at a given time of the move
+	 * @param t Seconds since the start of the move, clamped to the move.
+	 * @param position Signed distance from the start, in tacho counts.
+	 * @param velocity Signed velocity, in tacho counts per second.
+	 */
+    void Sample(float t, float& position, float& velocity) const;
+
+private:
+    void ramp(float t, float& position, float& velocity) const;
+
+private:
+    SmartDriveProfileShape m_shape;
+    float m_sign;
+    float m_distance;     //absolute
+    float m_velocity;
+    float m_rampTime;
+    float m_cruiseTime;
+};
+
+/**
+ * @brief Streams a SmartDriveProfile to one motor at a fixed rate
+ *
+ * Every tick an absolute tacho setpoint is written together with the speed
+ * needed to reach it by the next tick, so the onboard position loop follows the
+ * profile instead of starting and stopping at full speed.
+ *
+ * Setpoints are computed by a generator thread into a small lock-free ring, and
+ * written by a second thread on absolute deadlines of the bus clock, so the
+ * computation of the next setpoints overlaps the current bus transfer.
+ */
+class SmartDriveStreamer {
+
+public:
+    /**
+     * Streamer counters for the current or last move
+     */
+    struct Stats {
+        uint64_t frames;         //setpoints written
+        uint64_t write_errors;   //setpoint writes which failed
+        uint64_t late_ticks;     //ticks skipped because a write overran its period
+        uint64_t underruns;      //ticks without a setpoint ready
+    };
+
+	/**
+	 * Creates a streamer for one motor
+	 * @param drive SmartDrive to drive, must outlive the streamer.
+	 * @param motor Motor_ID_1 or Motor_ID_2, use one streamer per motor.
+	 * @param rate_hz Setpoints per second, e.g. 50-200 Hz.
+	 * @param ticks_per_speed_unit Tacho counts per second at speed 1.
+	 * @param min_speed Lowest speed written.
+	 */
+    SmartDriveStreamer(SmartDrive& drive, MotorID_t motor, unsigned rate_hz, float ticks_per_speed_unit,
+                       uint8_t min_speed = SmartDriveStream_MIN_SPEED);
+
+    ~SmartDriveStreamer();
+
+	/**
+	 * Starts streaming a profile from the current motor position
+	 * @param profile Move to execute.
+	 * @param next_action How the motor stops at the end of the move.
+	 * @return mraa::ERROR_INVALID_RESOURCE while a move is streaming, or the error of the position read.
+	 */
+    mraa::Result Start(const SmartDriveProfile& profile, MotorAction_t next_action);
+
+	/**
+	 * Waits until the last setpoint was written. Use WaitUntilTachoDone to wait for the motor itself.
+	 */
+    void Wait();
+
+	/**
+	 * True once the last setpoint was written
+	 */
+    bool IsDone() const { return m_done.load(); }
+
+	/**
+	 * Aborts the move, the motor is stopped with the next_action given to Start()
+	 */
+    void Stop();
+
+	/**
+	 * Returns the streamer counters
+	 */
+    Stats GetStats() const;
+
+private:
+    struct Frame {
+        uint32_t setpoint;
+        uint8_t  speed;
+        bool     last;
+    };
+
+    bool produce();
+    void generate();
+    void write();
+    void join();
+
+private:
+    SmartDrive& m_drive;
+    MotorID_t m_motor;
+    std::chrono::nanoseconds m_period;
+    float m_ticksPerSpeed;
+    uint8_t m_minSpeed;
+
+    //move being streamed, set by Start()
+    SmartDriveProfile m_profile;
+    MotorAction_t m_nextAction;
+    int32_t m_origin;
+    uint64_t m_frameCount;
+    uint64_t m_nextFrame;    //generator only
+    float m_prevPosition;    //generator only
+
+    Frame m_ring[SmartDriveStream_PIPELINE_DEPTH];
+    alignas(64) std::atomic<uint64_t> m_head;   //next frame computed by the generator
+    alignas(64) std::atomic<uint64_t> m_tail;   //next frame written to the bus
+    std::mutex m_spaceLock;                     //only used to sleep on a full ring, or an empty one on a virtual clock
+    std::condition_variable m_spaceCond;
+    std::condition_variable m_dataCond;
+
+    alignas(64) std::atomic<uint64_t> m_frames;
+    std::atomic<uint64_t> m_writeErrors;
+    std::atomic<uint64_t> m_lateTicks;
+    std::atomic<uint64_t> m_underruns;
+
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_done;
+    std::thread m_generator;
+    std::thread m_writer;
+};
+
+}
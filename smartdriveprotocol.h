@@ -0,0 +1,123 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "smartdrive.h"
+
+#define SmartDriveProto_VERSION      1
+#define SmartDriveProto_SOCKET       "/var/run/smartdrived.sock"
+#define SmartDriveProto_MAX_PAYLOAD  255
+#define SmartDriveProto_MAX_BOARDS   64
+
+namespace upm {
+
+/**
+ * @brief Wire format between SmartDriveServer and SmartDriveClient
+ *
+ * Both ends run on the same host, so fields are in host byte order. Every
+ * request and every response is a Header followed by length payload bytes.
+ * A response carries the id of its request; requests of one connection are
+ * executed and answered in order, and a client may send any number of them
+ * before reading the responses.
+ */
+struct SmartDriveProtocol {
+
+    enum Op {
+        Op_Hello                  = 0,   //-> Hello, then one BoardInfo per board
+        Op_RunUnlimited           = 1,   //MotorArgs
+        Op_RunSeconds             = 2,   //MotorArgs, amount in seconds
+        Op_RunDegrees             = 3,   //MotorArgs, amount in degrees
+        Op_RunRotations           = 4,   //MotorArgs, amount in rotations
+        Op_RunTacho               = 5,   //MotorArgs, amount in tacho counts
+        Op_StopMotor              = 6,   //MotorArgs
+        Op_SetPerformance         = 7,   //SmartDrive::PerformanceParameters
+        Op_GetMotorStatus         = 8,   //MotorArgs -> uint8_t
+        Op_ReadTachometerPosition = 9,   //MotorArgs -> uint32_t
+        Op_GetBattVoltage         = 10,  //-> float, millivolts
+        Op_IsTachoDone            = 11,  //MotorArgs -> uint8_t
+        Op_IsTimeDone             = 12,  //MotorArgs -> uint8_t
+        Op_ReadState              = 13,  //-> State
+        Op_Count
+    };
+
+    /**
+     * Leads every request and response
+     */
+    struct Header {
+        uint32_t id;       //chosen by the client, echoed in the response
+        uint8_t  op;
+        uint8_t  board;    //index in the board list of Op_Hello
+        uint8_t  result;   //mraa::Result, responses only
+        uint8_t  length;   //payload bytes following the header
+    };
+
+    /**
+     * Payload of the motor requests, unused fields are ignored
+     */
+    struct MotorArgs {
+        uint8_t  motor;       //MotorID_t
+        uint8_t  direction;   //Direction_t
+        uint8_t  speed;
+        uint8_t  action;      //MotorAction_t
+        uint32_t amount;      //seconds (up to 255), degrees, rotations or tacho counts
+    };
+
+    /**
+     * Response of Op_Hello, followed by boards BoardInfo
+     */
+    struct Hello {
+        uint8_t version;
+        uint8_t boards;
+    };
+
+    struct BoardInfo {
+        uint8_t bus;       //index of the bus in the daemon
+        uint8_t address;   //7 bit
+    };
+
+    /**
+     * Response of Op_ReadState, decoded from one snapshot burst
+     */
+    struct State {
+        uint32_t position[2];
+        uint8_t  status[2];
+        uint8_t  tasks[2];
+        uint16_t battery_mv;
+        uint16_t current[2];   //raw SmartDrive_CURRENT_M1/M2
+        uint8_t  reset_status;
+        uint8_t  reserved;
+    };
+};
+
+static_assert(sizeof(SmartDriveProtocol::Header) == 8, "SmartDriveProtocol::Header must stay packed");
+static_assert(sizeof(SmartDriveProtocol::MotorArgs) == 8, "SmartDriveProtocol::MotorArgs must stay packed");
+static_assert(sizeof(SmartDriveProtocol::State) == 20, "SmartDriveProtocol::State must stay packed");
+static_assert(sizeof(SmartDrive::PerformanceParameters) == 14, "SmartDrive::PerformanceParameters is sent as is");
+
+}
@@ -0,0 +1,226 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "smartdrive.h"
+
+/*
+ * Typed view of the SmartDrive register map.
+ *
+ * Each register is a type carrying its address, width and signedness, with
+ * little endian encode/decode generated from it. A SmartDriveFrame is a run of
+ * registers written (or read) in one transaction : it only compiles when the
+ * registers are contiguous, and its build() is constexpr, so a frame whose
+ * arguments are constants is laid out entirely at compile time, e.g.
+ *
+ *     static constexpr SmartDriveReg::PID::Bytes defaults = SmartDriveReg::PID::build(...);
+ */
+
+namespace upm {
+
+template <unsigned Width, bool Signed> struct SmartDriveRegisterType;
+template <> struct SmartDriveRegisterType<1, false> { typedef uint8_t  type; };
+template <> struct SmartDriveRegisterType<1, true>  { typedef int8_t   type; };
+template <> struct SmartDriveRegisterType<2, false> { typedef uint16_t type; };
+template <> struct SmartDriveRegisterType<2, true>  { typedef int16_t  type; };
+template <> struct SmartDriveRegisterType<4, false> { typedef uint32_t type; };
+template <> struct SmartDriveRegisterType<4, true>  { typedef int32_t  type; };
+
+/**
+ * Little endian value held by Width consecutive registers starting at Reg
+ */
+template <uint8_t Reg, unsigned Width, bool Signed = false>
+struct SmartDriveRegister {
+    typedef typename SmartDriveRegisterType<Width, Signed>::type type;
+
+    static constexpr uint8_t  reg = Reg;
+    static constexpr unsigned width = Width;
+    static constexpr bool     is_signed = Signed;
+
+	/**
+	 * Byte of an encoded value found at register address r
+	 */
+    static constexpr uint8_t byteAt(unsigned r, type value) {
+        return (uint8_t) ((uint32_t) value >> (8 * (r - Reg)));
+    }
+
+	/**
+	 * Value read from the register bytes, sign extended for signed registers
+	 */
+    static constexpr type decode(const uint8_t* bytes) {
+        return (type) raw(bytes, Width);
+    }
+
+	/**
+	 * Stores a value as register bytes
+	 */
+    static void encode(uint8_t* bytes, type value) {
+        for (unsigned n = 0; n < Width; n++)
+            bytes[n] = byteAt(Reg + n, value);
+    }
+
+private:
+    static constexpr uint32_t raw(const uint8_t* bytes, unsigned n) {
+        return (n == 0) ? 0 : ((uint32_t) bytes[n - 1] << (8 * (n - 1))) | raw(bytes, n - 1);
+    }
+};
+
+//Compile time 0..N-1 sequence (std::index_sequence is C++14)
+template <size_t... I> struct SmartDriveIndices {};
+template <size_t N, size_t... I> struct SmartDriveMakeIndices : SmartDriveMakeIndices<N - 1, N - 1, I...> {};
+template <size_t... I> struct SmartDriveMakeIndices<0, I...> { typedef SmartDriveIndices<I...> type; };
+
+//Byte at register address r of a run of registers given their values
+template <typename... Fields> struct SmartDriveFrameByte;
+template <> struct SmartDriveFrameByte<> {
+    static constexpr uint8_t at(unsigned) { return 0; }
+};
+template <typename F, typename... Rest> struct SmartDriveFrameByte<F, Rest...> {
+    static constexpr uint8_t at(unsigned r, typename F::type value, typename Rest::type... rest) {
+        return (r >= F::reg && r < F::reg + F::width) ? F::byteAt(r, value)
+                                                      : SmartDriveFrameByte<Rest...>::at(r, rest...);
+    }
+};
+
+//Whether registers follow each other without gap, and their total width
+template <typename... Fields> struct SmartDriveContiguous;
+template <typename F> struct SmartDriveContiguous<F> {
+    static constexpr bool value = true;
+    static constexpr unsigned size = F::width;
+};
+template <typename F, typename G, typename... Rest> struct SmartDriveContiguous<F, G, Rest...> {
+    static constexpr bool value = (F::reg + F::width == G::reg) && SmartDriveContiguous<G, Rest...>::value;
+    static constexpr unsigned size = F::width + SmartDriveContiguous<G, Rest...>::size;
+};
+
+/**
+ * @brief Registers transferred in one transaction
+ */
+template <typename First, typename... Rest>
+struct SmartDriveFrame {
+    static_assert(SmartDriveContiguous<First, Rest...>::value, "frame registers must be contiguous");
+
+    static constexpr uint8_t  start = First::reg;
+    static constexpr unsigned size = SmartDriveContiguous<First, Rest...>::size;   //without the register byte
+
+    /**
+     * Frame as written on the bus : start register, then the register values
+     */
+    struct Bytes {
+        uint8_t data[1 + size];
+    };
+
+	/**
+	 * Lays out a frame, one argument per register in order
+	 */
+    static constexpr Bytes build(typename First::type first, typename Rest::type... rest) {
+        return layout(typename SmartDriveMakeIndices<size>::type(), first, rest...);
+    }
+
+	/**
+	 * Decodes one register out of the payload of a frame read in one burst
+	 */
+    template <typename F>
+    static constexpr typename F::type get(const uint8_t* payload) {
+        return F::decode(payload + (F::reg - start));
+    }
+
+private:
+    template <size_t... I>
+    static constexpr Bytes layout(SmartDriveIndices<I...>, typename First::type first, typename Rest::type... rest) {
+        return Bytes{{start, SmartDriveFrameByte<First, Rest...>::at(start + I, first, rest...)...}};
+    }
+};
+
+namespace SmartDriveReg {
+
+typedef SmartDriveRegister<SmartDrive_COMMAND, 1>           COMMAND;
+
+typedef SmartDriveRegister<SmartDrive_SETPT_M1, 4, true>    SETPT_M1;
+typedef SmartDriveRegister<SmartDrive_SPEED_M1, 1, true>    SPEED_M1;
+typedef SmartDriveRegister<SmartDrive_TIME_M1, 1>           TIME_M1;
+typedef SmartDriveRegister<SmartDrive_CMD_B_M1, 1>          CMD_B_M1;
+typedef SmartDriveRegister<SmartDrive_CMD_A_M1, 1>          CMD_A_M1;
+typedef SmartDriveRegister<SmartDrive_SETPT_M2, 4, true>    SETPT_M2;
+typedef SmartDriveRegister<SmartDrive_SPEED_M2, 1, true>    SPEED_M2;
+typedef SmartDriveRegister<SmartDrive_TIME_M2, 1>           TIME_M2;
+typedef SmartDriveRegister<SmartDrive_CMD_B_M2, 1>          CMD_B_M2;
+typedef SmartDriveRegister<SmartDrive_CMD_A_M2, 1>          CMD_A_M2;
+
+typedef SmartDriveRegister<SmartDrive_POSITION_M1, 4, true> POSITION_M1;
+typedef SmartDriveRegister<SmartDrive_POSITION_M2, 4, true> POSITION_M2;
+typedef SmartDriveRegister<SmartDrive_STATUS_M1, 1>         STATUS_M1;
+typedef SmartDriveRegister<SmartDrive_STATUS_M2, 1>         STATUS_M2;
+typedef SmartDriveRegister<SmartDrive_TASKS_M1, 1>          TASKS_M1;
+typedef SmartDriveRegister<SmartDrive_TASKS_M2, 1>          TASKS_M2;
+typedef SmartDriveRegister<SmartDrive_P_Kp, 2>              P_Kp;
+typedef SmartDriveRegister<SmartDrive_P_Ki, 2>              P_Ki;
+typedef SmartDriveRegister<SmartDrive_P_Kd, 2>              P_Kd;
+typedef SmartDriveRegister<SmartDrive_S_Kp, 2>              S_Kp;
+typedef SmartDriveRegister<SmartDrive_S_Ki, 2>              S_Ki;
+typedef SmartDriveRegister<SmartDrive_S_Kd, 2>              S_Kd;
+typedef SmartDriveRegister<SmartDrive_PASSCOUNT, 1>         PASSCOUNT;
+typedef SmartDriveRegister<SmartDrive_PASSTOLERANCE, 1>     PASSTOLERANCE;
+typedef SmartDriveRegister<SmartDrive_CHKSUM, 1>            CHKSUM;
+typedef SmartDriveRegister<SmartDrive_CHKSUM + 1, 1>        RESERVED_6D;
+typedef SmartDriveRegister<SmartDrive_BATT_VOLTAGE, 1>      BATT_VOLTAGE;
+typedef SmartDriveRegister<SmartDrive_RESETSTATUS, 1>       RESETSTATUS;
+typedef SmartDriveRegister<SmartDrive_CURRENT_M1, 2>        CURRENT_M1;
+typedef SmartDriveRegister<SmartDrive_CURRENT_M2, 2>        CURRENT_M2;
+
+//Command block of one motor, and its tail used when the setpoint is unused
+typedef SmartDriveFrame<SETPT_M1, SPEED_M1, TIME_M1, CMD_B_M1, CMD_A_M1> MOTOR_M1;
+typedef SmartDriveFrame<SETPT_M2, SPEED_M2, TIME_M2, CMD_B_M2, CMD_A_M2> MOTOR_M2;
+typedef SmartDriveFrame<SPEED_M1, TIME_M1, CMD_B_M1, CMD_A_M1>           SPEED_M1_BLOCK;
+typedef SmartDriveFrame<SPEED_M2, TIME_M2, CMD_B_M2, CMD_A_M2>           SPEED_M2_BLOCK;
+
+//Both command blocks in one write
+typedef SmartDriveFrame<SETPT_M1, SPEED_M1, TIME_M1, CMD_B_M1, CMD_A_M1,
+                        SETPT_M2, SPEED_M2, TIME_M2, CMD_B_M2, CMD_A_M2> MOTORS;
+
+//PID gains, pass count and tolerance
+typedef SmartDriveFrame<P_Kp, P_Ki, P_Kd, S_Kp, S_Ki, S_Kd, PASSCOUNT, PASSTOLERANCE> PID;
+
+//Battery voltage and motor currents
+typedef SmartDriveFrame<BATT_VOLTAGE, RESETSTATUS, CURRENT_M1, CURRENT_M2> POWER;
+
+//Everything a snapshot reads in one burst
+typedef SmartDriveFrame<POSITION_M1, POSITION_M2, STATUS_M1, STATUS_M2, TASKS_M1, TASKS_M2,
+                        P_Kp, P_Ki, P_Kd, S_Kp, S_Ki, S_Kd, PASSCOUNT, PASSTOLERANCE,
+                        CHKSUM, RESERVED_6D, BATT_VOLTAGE, RESETSTATUS, CURRENT_M1, CURRENT_M2> SNAPSHOT;
+
+static_assert(MOTOR_M1::size == SmartDrive_MOTOR_BLOCK_SIZE, "motor command block size");
+static_assert(MOTORS::size == 2 * SmartDrive_MOTOR_BLOCK_SIZE, "both motor blocks must be contiguous");
+static_assert(SNAPSHOT::start == SmartDrive_SNAPSHOT_START && SNAPSHOT::size == SmartDrive_SNAPSHOT_SIZE,
+              "snapshot block layout");
+
+}
+
+}
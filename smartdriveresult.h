@@ -0,0 +1,92 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <stdexcept>
+#include <mraa/i2c.hpp>
+
+namespace upm {
+
+/**
+ * @brief Value read from a SmartDrive, or the reason it could not be read
+ *
+ * Returned by the Try* getters, so a failed transfer can no longer be mistaken
+ * for a register value (e.g. -1 for a tacho position). Writes simply return a
+ * mraa::Result.
+ */
+template <typename T>
+class SmartDriveResult {
+
+public:
+	/**
+	 * Successful read
+	 */
+    SmartDriveResult(T value): m_value(value), m_error(mraa::SUCCESS) {}
+
+	/**
+	 * Failed read
+	 * @param error Reason of the failure, anything but mraa::SUCCESS.
+	 */
+    static SmartDriveResult Failure(mraa::Result error) {
+        SmartDriveResult result = SmartDriveResult(T());
+        result.m_error = (error != mraa::SUCCESS) ? error : mraa::ERROR_UNSPECIFIED;
+        return result;
+    }
+
+	/**
+	 * True when the value could be read
+	 */
+    bool ok() const { return m_error == mraa::SUCCESS; }
+    explicit operator bool() const { return ok(); }
+
+	/**
+	 * Returns the value read, throws std::runtime_error if the read failed
+	 */
+    T value() const {
+        if (!ok())
+            throw std::runtime_error(std::string(__FUNCTION__) +
+                                     ": SmartDrive read failed");
+        return m_value;
+    }
+
+	/**
+	 * Returns the value read, or fallback if the read failed
+	 */
+    T value_or(T fallback) const { return ok() ? m_value : fallback; }
+
+	/**
+	 * Reason of the failure, mraa::SUCCESS if the read succeeded
+	 */
+    mraa::Result error() const { return m_error; }
+
+private:
+    T m_value;
+    mraa::Result m_error;
+};
+
+}
@@ -0,0 +1,136 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "smartdrivesampler.h"
+
+using namespace upm;
+
+SmartDriveSampler::SmartDriveSampler(SmartDrive& drive, unsigned rate_hz, size_t capacity):
+    m_drive(drive), m_period(1000000000ULL / (rate_hz ? rate_hz : 1)),
+    m_head(0), m_tail(0), m_samples(0), m_overruns(0), m_readErrors(0), m_lateTicks(0), m_running(false)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    m_ring.resize(size);
+    m_mask = size - 1;
+}
+
+SmartDriveSampler::~SmartDriveSampler()
+{
+    Stop();
+}
+
+
+void
+SmartDriveSampler::Start() {
+    if (m_running.exchange(true))
+        return;
+    m_thread = std::thread(&SmartDriveSampler::run, this);
+}
+
+void
+SmartDriveSampler::Stop() {
+    m_running = false;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+
+void
+SmartDriveSampler::run() {
+    //the bus clock times both the samples and the pacing, it is virtual on a simulator
+    std::shared_ptr<SmartDriveBus> bus = m_drive.GetBus();
+    SmartDrive::Snapshot snap = SmartDrive::Snapshot();
+    std::chrono::steady_clock::time_point next = bus->now();
+
+    while (m_running.load(std::memory_order_relaxed)) {
+        bool ok = m_drive.ReadSnapshot(snap);
+        if (!ok)
+            m_readErrors.fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) > m_mask) {
+            m_overruns.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            SmartDriveSample& sample = m_ring[head & m_mask];
+            sample.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                (ok ? snap.timestamp : bus->now()).time_since_epoch()).count();
+            sample.position[0] = (int32_t) snap.position[0];
+            sample.position[1] = (int32_t) snap.position[1];
+            sample.current[0] = snap.current[0];
+            sample.current[1] = snap.current[1];
+            sample.status[0] = snap.status[0];
+            sample.status[1] = snap.status[1];
+            sample.battVoltage = snap.battVoltage;
+            sample.valid = ok;
+            m_head.store(head + 1, std::memory_order_release);
+            m_samples.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        //absolute deadlines so the rate doesn't drift, skip the ticks we are late for
+        next += m_period;
+        std::chrono::steady_clock::time_point now = bus->now();
+        if (now > next) {
+            uint64_t late = (now - next) / m_period;
+            m_lateTicks.fetch_add(late, std::memory_order_relaxed);
+            next += m_period * late;
+        }
+        if (next > now)
+            bus->sleep(std::chrono::duration_cast<std::chrono::microseconds>(next - now));
+    }
+}
+
+
+SmartDriveSampler::Span
+SmartDriveSampler::Peek() const {
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    size_t start = tail & m_mask;
+    size_t available = head - tail;
+
+    Span span;
+    span.data = &m_ring[start];
+    span.size = (available < m_ring.size() - start) ? available : m_ring.size() - start;
+    return span;
+}
+
+void
+SmartDriveSampler::Release(size_t count) {
+    m_tail.fetch_add(count, std::memory_order_release);
+}
+
+
+SmartDriveSampler::Stats
+SmartDriveSampler::GetStats() const {
+    Stats stats;
+    stats.samples = m_samples.load(std::memory_order_relaxed);
+    stats.overruns = m_overruns.load(std::memory_order_relaxed);
+    stats.read_errors = m_readErrors.load(std::memory_order_relaxed);
+    stats.late_ticks = m_lateTicks.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,140 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "smartdrive.h"
+
+namespace upm {
+
+/**
+ * One telemetry record, fixed size so the ring can be handed out as plain arrays
+ */
+struct SmartDriveSample {
+    uint64_t timestamp_ns;   //bus clock (SmartDriveBus::now), monotonic
+    int32_t  position[2];    //tacho position of M1/M2
+    uint16_t current[2];     //raw SmartDrive_CURRENT_M1/M2
+    uint8_t  status[2];      //SmartDrive_STATUS_M1/M2
+    uint8_t  battVoltage;    //raw SmartDrive_BATT_VOLTAGE
+    uint8_t  valid;          //0 if the read failed, the other fields are then stale
+};
+
+/**
+ * @brief Fixed-rate telemetry sampler for a SmartDrive
+ *
+ * A sampler thread reads positions, statuses, currents and battery voltage at a
+ * fixed rate with one snapshot burst read per tick and stores them in a
+ * single-producer/single-consumer lock-free ring. The consumer reads the samples
+ * in place, without ever touching the bus. When the consumer falls behind, new
+ * samples are dropped and counted as overruns.
+ */
+class SmartDriveSampler {
+
+public:
+    /**
+     * Contiguous run of samples owned by the consumer until Release()
+     */
+    struct Span {
+        const SmartDriveSample* data;
+        size_t size;
+    };
+
+    /**
+     * Sampler counters
+     */
+    struct Stats {
+        uint64_t samples;       //samples pushed in the ring
+        uint64_t overruns;      //samples dropped because the ring was full
+        uint64_t read_errors;   //burst reads which failed
+        uint64_t late_ticks;    //ticks skipped because a read overran its period
+    };
+
+	/**
+	 * Creates a sampler, the thread is started by Start()
+	 * @param drive SmartDrive to sample, must outlive the sampler.
+	 * @param rate_hz Sampling rate, e.g. 200-500 Hz.
+	 * @param capacity Number of samples in the ring, rounded up to a power of 2.
+	 */
+    SmartDriveSampler(SmartDrive& drive, unsigned rate_hz, size_t capacity = 4096);
+
+    ~SmartDriveSampler();
+
+	/**
+	 * Starts the sampler thread
+	 */
+    void Start();
+
+	/**
+	 * Stops the sampler thread, samples already in the ring stay readable
+	 */
+    void Stop();
+
+	/**
+	 * Returns the oldest unread samples, without copying them. Only the part up to
+	 * the end of the ring is returned, call again after Release() for the rest.
+	 */
+    Span Peek() const;
+
+	/**
+	 * Gives consumed samples back to the sampler
+	 * @param count Number of samples consumed, at most the size of the last Peek().
+	 */
+    void Release(size_t count);
+
+	/**
+	 * Returns the sampler counters
+	 */
+    Stats GetStats() const;
+
+private:
+    void run();
+
+private:
+    SmartDrive& m_drive;
+    std::chrono::nanoseconds m_period;
+    std::vector<SmartDriveSample> m_ring;
+    size_t m_mask;
+
+    //producer and consumer indexes on their own cache lines
+    alignas(64) std::atomic<uint64_t> m_head;   //next slot written by the sampler
+    alignas(64) std::atomic<uint64_t> m_tail;   //next slot read by the consumer
+
+    alignas(64) std::atomic<uint64_t> m_samples;
+    std::atomic<uint64_t> m_overruns;
+    std::atomic<uint64_t> m_readErrors;
+    std::atomic<uint64_t> m_lateTicks;
+
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+
+}
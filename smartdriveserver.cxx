@@ -0,0 +1,417 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "smartdriveserver.h"
+#include "smartdrivetrace.h"
+
+using namespace upm;
+
+typedef SmartDriveProtocol Proto;
+
+SmartDriveServer::SmartDriveServer(const std::string& path): m_path(path), m_stopOnDisconnect(true),
+    m_listenFd(-1), m_nextSerial(1), m_stats()
+{
+    m_wakeFds[0] = m_wakeFds[1] = -1;
+}
+
+SmartDriveServer::~SmartDriveServer() {
+    Stop();
+}
+
+
+int
+SmartDriveServer::AddBoard(std::shared_ptr<SmartDrive> drive, uint8_t bus) {
+    if (m_thread.joinable() || m_boards.size() >= SmartDriveProto_MAX_BOARDS)
+        return -1;
+    Board board = {drive, bus, (uint8_t) drive->GetAddress(), {0, 0}};
+    m_boards.push_back(board);
+    return m_boards.size() - 1;
+}
+
+
+mraa::Result
+SmartDriveServer::Start() {
+    if (m_thread.joinable())
+        return mraa::ERROR_INVALID_RESOURCE;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (m_path.size() >= sizeof(addr.sun_path))
+        return mraa::ERROR_INVALID_PARAMETER;
+    memcpy(addr.sun_path, m_path.c_str(), m_path.size());
+
+    m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listenFd < 0)
+        return mraa::ERROR_INVALID_RESOURCE;
+    unlink(m_path.c_str());
+    if (bind(m_listenFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(m_listenFd, 16) < 0 ||
+        pipe2(m_wakeFds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        SMARTDRIVE_ERROR("Server: cannot bind its socket, errno %lld", (long long) errno);
+        close(m_listenFd);
+        m_listenFd = -1;
+        return mraa::ERROR_INVALID_RESOURCE;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stats = Stats();
+    }
+    m_thread = std::thread(&SmartDriveServer::serve, this);
+    return mraa::SUCCESS;
+}
+
+
+void
+SmartDriveServer::Stop() {
+    if (!m_thread.joinable())
+        return;
+    char wake = 0;
+    if (::write(m_wakeFds[1], &wake, 1) < 0)
+        SMARTDRIVE_WARN("Server: cannot wake its thread, errno %lld", (long long) errno);
+    m_thread.join();
+
+    while (!m_clients.empty())
+        disconnect(m_clients.back());
+    close(m_listenFd);
+    close(m_wakeFds[0]);
+    close(m_wakeFds[1]);
+    m_listenFd = m_wakeFds[0] = m_wakeFds[1] = -1;
+    unlink(m_path.c_str());
+}
+
+
+SmartDriveServer::Stats
+SmartDriveServer::GetStats() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_stats;
+}
+
+
+void
+SmartDriveServer::serve() {
+    std::vector<struct pollfd> fds;
+
+    for (;;) {
+        fds.resize(2 + m_clients.size());
+        fds[0].fd = m_wakeFds[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = m_listenFd;
+        fds[1].events = POLLIN;
+        for (size_t i = 0; i < m_clients.size(); i++) {
+            Client& client = m_clients[i];
+            fds[2 + i].fd = client.fd;
+            //a client which does not read its responses is not read either
+            fds[2 + i].events = (client.out.size() < SmartDriveServer_MAX_PENDING) ? POLLIN : 0;
+            if (!client.out.empty())
+                fds[2 + i].events |= POLLOUT;
+        }
+
+        if (poll(&fds[0], fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            SMARTDRIVE_ERROR("Server: poll failed, errno %lld", (long long) errno);
+            return;
+        }
+        if (fds[0].revents != 0)
+            return;
+
+        //walk backwards, disconnect() swaps the last client into the freed slot
+        for (size_t i = m_clients.size(); i-- > 0; ) {
+            short revents = fds[2 + i].revents;
+            Client& client = m_clients[i];
+            bool alive = true;
+            if (revents & (POLLIN | POLLHUP | POLLERR))
+                alive = receive(client);
+            if (alive && !client.out.empty())
+                alive = transmit(client);
+            if (!alive)
+                disconnect(client);
+        }
+        if (fds[1].revents & POLLIN)
+            accept();
+    }
+}
+
+
+void
+SmartDriveServer::accept() {
+    for (;;) {
+        int fd = accept4(m_listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        if (m_clients.size() >= SmartDriveServer_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        Client client;
+        client.fd = fd;
+        client.serial = m_nextSerial++;
+        m_clients.push_back(client);
+
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stats.connections++;
+        m_stats.clients = m_clients.size();
+    }
+}
+
+
+bool
+SmartDriveServer::receive(Client& client) {
+    size_t used = client.in.size();
+    client.in.resize(used + SmartDriveServer_READ_SIZE);
+    ssize_t got = read(client.fd, &client.in[used], SmartDriveServer_READ_SIZE);
+    if (got <= 0) {
+        client.in.resize(used);
+        return got < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+    client.in.resize(used + got);
+
+    //execute every complete request, the responses leave together
+    uint8_t reply[SmartDriveProto_MAX_PAYLOAD];
+    size_t offset = 0;
+    uint32_t served = 0, failed = 0;
+    while (client.in.size() - offset >= sizeof(Proto::Header)) {
+        Proto::Header request;
+        memcpy(&request, &client.in[offset], sizeof(request));
+        if (client.in.size() - offset < sizeof(request) + request.length)
+            break;
+
+        uint8_t reply_length = 0;
+        mraa::Result result = execute(client, request, &client.in[offset + sizeof(request)], reply, reply_length);
+        offset += sizeof(request) + request.length;
+
+        Proto::Header response = {request.id, request.op, request.board, (uint8_t) result, reply_length};
+        const uint8_t* header = (const uint8_t*) &response;
+        client.out.insert(client.out.end(), header, header + sizeof(response));
+        client.out.insert(client.out.end(), reply, reply + reply_length);
+        served++;
+        if (result != mraa::SUCCESS)
+            failed++;
+    }
+    client.in.erase(client.in.begin(), client.in.begin() + offset);
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (served != 0) {
+        m_stats.reads++;
+        m_stats.requests += served;
+        m_stats.failed_requests += failed;
+        if (served > m_stats.max_batch)
+            m_stats.max_batch = served;
+    }
+    return true;
+}
+
+
+bool
+SmartDriveServer::transmit(Client& client) {
+    ssize_t sent = send(client.fd, &client.out[0], client.out.size(), MSG_NOSIGNAL);
+    if (sent < 0)
+        return errno == EAGAIN || errno == EINTR;
+    client.out.erase(client.out.begin(), client.out.begin() + sent);
+    return true;
+}
+
+
+void
+SmartDriveServer::disconnect(Client& client) {
+    if (m_stopOnDisconnect) {
+        for (size_t i = 0; i < m_boards.size(); i++) {
+            Board& board = m_boards[i];
+            bool m1 = board.owner[0] == client.serial, m2 = board.owner[1] == client.serial;
+            if (!m1 && !m2)
+                continue;
+            MotorID_t motor = (m1 && m2) ? Motor_ID_BOTH : (m1 ? Motor_ID_1 : Motor_ID_2);
+            board.drive->StopMotor(motor, Action_Brake);
+            own(board, motor, 0);
+
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_stats.orphan_stops += (m1 && m2) ? 2 : 1;
+        }
+    }
+    close(client.fd);
+
+    //swap with the last one, serve() walks the clients backwards
+    client = m_clients.back();
+    m_clients.pop_back();
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_stats.clients = m_clients.size();
+}
+
+
+void
+SmartDriveServer::own(Board& board, uint8_t motor, uint64_t serial) {
+    if (motor & Motor_ID_1)
+        board.owner[0] = serial;
+    if (motor & Motor_ID_2)
+        board.owner[1] = serial;
+}
+
+
+mraa::Result
+SmartDriveServer::execute(Client& client, const Proto::Header& request, const uint8_t* payload,
+                          uint8_t* reply, uint8_t& reply_length) {
+    if (request.op >= Proto::Op_Count)
+        return mraa::ERROR_INVALID_PARAMETER;
+
+    if (request.op == Proto::Op_Hello) {
+        Proto::Hello hello = {SmartDriveProto_VERSION, (uint8_t) m_boards.size()};
+        memcpy(reply, &hello, sizeof(hello));
+        reply_length = sizeof(hello);
+        for (size_t i = 0; i < m_boards.size(); i++) {
+            Proto::BoardInfo info = {m_boards[i].bus, m_boards[i].address};
+            memcpy(reply + reply_length, &info, sizeof(info));
+            reply_length += sizeof(info);
+        }
+        return mraa::SUCCESS;
+    }
+
+    if (request.board >= m_boards.size())
+        return mraa::ERROR_INVALID_PARAMETER;
+    Board& board = m_boards[request.board];
+    SmartDrive& drive = *board.drive;
+
+    if (request.op == Proto::Op_SetPerformance) {
+        SmartDrive::PerformanceParameters pid;
+        if (request.length != sizeof(pid))
+            return mraa::ERROR_INVALID_PARAMETER;
+        memcpy(&pid, payload, sizeof(pid));
+        return drive.SetPerformanceParameters(pid.Kp_tacho, pid.Ki_tacho, pid.Kd_tacho,
+                                              pid.Kp_speed, pid.Ki_speed, pid.Kd_speed,
+                                              pid.passcount, pid.tolerance);
+    }
+
+    if (request.op == Proto::Op_GetBattVoltage) {
+        SmartDriveResult<float> voltage = drive.TryGetBattVoltage();
+        float mv = voltage.value_or(0.0f);
+        memcpy(reply, &mv, sizeof(mv));
+        reply_length = sizeof(mv);
+        return voltage.error();
+    }
+
+    if (request.op == Proto::Op_ReadState) {
+        SmartDrive::Snapshot snap;
+        if (!drive.ReadSnapshot(snap))
+            return mraa::ERROR_UNSPECIFIED;
+        Proto::State state;
+        memset(&state, 0, sizeof(state));
+        for (int i = 0; i < 2; i++) {
+            state.position[i] = snap.position[i];
+            state.status[i] = snap.status[i];
+            state.tasks[i] = snap.tasks[i];
+            state.current[i] = snap.current[i];
+        }
+        state.battery_mv = (uint16_t) drive.BatteryMillivolts(snap.battVoltage);
+        state.reset_status = snap.resetStatus;
+        memcpy(reply, &state, sizeof(state));
+        reply_length = sizeof(state);
+        return mraa::SUCCESS;
+    }
+
+    //everything else takes MotorArgs
+    Proto::MotorArgs args;
+    if (request.length != sizeof(args))
+        return mraa::ERROR_INVALID_PARAMETER;
+    memcpy(&args, payload, sizeof(args));
+    if (args.motor < Motor_ID_1 || args.motor > Motor_ID_BOTH)
+        return mraa::ERROR_INVALID_PARAMETER;
+    MotorID_t motor = (MotorID_t) args.motor;
+    Direction_t direction = (Direction_t) args.direction;
+    MotorAction_t action = (MotorAction_t) args.action;
+
+    mraa::Result result = mraa::SUCCESS;
+    switch (request.op) {
+    case Proto::Op_RunUnlimited:
+        result = drive.Run_Unlimited(motor, direction, args.speed);
+        break;
+    case Proto::Op_RunSeconds:
+        //the duration register is one byte, do not let it wrap
+        if (args.amount > 255)
+            return mraa::ERROR_INVALID_PARAMETER;
+        result = drive.Run_Seconds(motor, direction, args.speed, args.amount, false, action);
+        break;
+    case Proto::Op_RunDegrees:
+        result = drive.Run_Degrees(motor, direction, args.speed, args.amount, false, action);
+        break;
+    case Proto::Op_RunRotations:
+        result = drive.Run_Rotations(motor, direction, args.speed, args.amount, false, action);
+        break;
+    case Proto::Op_RunTacho:
+        result = drive.Run_Tacho(motor, args.speed, args.amount, false, action);
+        break;
+    case Proto::Op_StopMotor:
+        result = drive.StopMotor(motor, action);
+        if (result == mraa::SUCCESS)
+            own(board, motor, 0);
+        return result;
+    default:
+        break;
+    }
+    if (request.op <= Proto::Op_RunTacho) {
+        if (result == mraa::SUCCESS)
+            own(board, motor, client.serial);
+        return result;
+    }
+
+    //status reads, of one motor
+    if (motor == Motor_ID_BOTH)
+        return mraa::ERROR_INVALID_PARAMETER;
+    SmartDriveResult<uint8_t> flag((uint8_t) 0);
+    switch (request.op) {
+    case Proto::Op_GetMotorStatus:
+        flag = drive.TryGetMotorStatus(motor);
+        break;
+    case Proto::Op_IsTachoDone: {
+        SmartDriveResult<bool> done = drive.TryIsTachoDone(motor);
+        flag = done ? SmartDriveResult<uint8_t>(done.value()) : SmartDriveResult<uint8_t>::Failure(done.error());
+        break;
+    }
+    case Proto::Op_IsTimeDone: {
+        SmartDriveResult<bool> done = drive.TryIsTimeDone(motor);
+        flag = done ? SmartDriveResult<uint8_t>(done.value()) : SmartDriveResult<uint8_t>::Failure(done.error());
+        break;
+    }
+    default: {
+        SmartDriveResult<uint32_t> position = drive.TryReadTachometerPosition(motor);
+        uint32_t value = position.value_or(0);
+        memcpy(reply, &value, sizeof(value));
+        reply_length = sizeof(value);
+        return position.error();
+    }
+    }
+    reply[0] = flag.value_or(0);
+    reply_length = 1;
+    return flag.error();
+}
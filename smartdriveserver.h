@@ -0,0 +1,149 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "smartdrive.h"
+#include "smartdriveprotocol.h"
+
+#define SmartDriveServer_MAX_CLIENTS  32
+#define SmartDriveServer_READ_SIZE    4096          //bytes read from a client at once
+#define SmartDriveServer_MAX_PENDING  (64 * 1024)   //unsent response bytes before a client is no longer read
+
+namespace upm {
+
+/**
+ * @brief Owner of the SmartDrives of a host, serving them on a Unix socket
+ *
+ * Processes sharing the boards talk to one server through SmartDriveClient
+ * instead of opening the buses themselves, so a single owner arbitrates the
+ * buses and the boards are discovered once. One thread serves every client :
+ * all the requests which arrived in one read of a connection are executed back
+ * to back and answered with one write, which lets a client batch commands.
+ *
+ * When a client goes away, the motors it was the last one to start are
+ * braked, so a crashed process does not leave a robot running.
+ */
+class SmartDriveServer {
+
+public:
+    /**
+     * Server counters since Start()
+     */
+    struct Stats {
+        uint64_t connections;
+        uint32_t clients;            //currently connected
+        uint64_t requests;
+        uint64_t failed_requests;    //answered with another result than mraa::SUCCESS
+        uint64_t reads;              //reads returning at least one request
+        uint32_t max_batch;          //most requests served from one read
+        uint64_t orphan_stops;       //motors braked after their client went away
+    };
+
+	/**
+	 * Creates a server, started with Start()
+	 * @param path Path of the Unix socket, replaced if it exists.
+	 */
+    SmartDriveServer(const std::string& path = SmartDriveProto_SOCKET);
+
+	/**
+	 * Stops the server
+	 */
+    ~SmartDriveServer();
+
+	/**
+	 * Adds a board, only while the server is stopped
+	 * @param drive Board served.
+	 * @param bus Bus index reported to the clients, e.g. SmartDriveDiscovery::Board::bus.
+	 * @return Index of the board in the requests, -1 when running or full.
+	 */
+    int AddBoard(std::shared_ptr<SmartDrive> drive, uint8_t bus = 0);
+
+	/**
+	 * Brakes the motors of a client which disconnects, true by default
+	 */
+    void SetStopOnDisconnect(bool enable) { m_stopOnDisconnect = enable; }
+
+	/**
+	 * Binds the socket and starts the server thread
+	 * @return mraa::ERROR_INVALID_RESOURCE if running or the socket cannot be bound.
+	 */
+    mraa::Result Start();
+
+	/**
+	 * Disconnects every client, stops the server thread and removes the socket
+	 */
+    void Stop();
+
+    Stats GetStats();
+
+private:
+    struct Board {
+        std::shared_ptr<SmartDrive> drive;
+        uint8_t bus;
+        uint8_t address;
+        uint64_t owner[2];   //connection which last started M1/M2, 0 when stopped
+    };
+
+    struct Client {
+        int fd;
+        uint64_t serial;
+        std::vector<uint8_t> in;
+        std::vector<uint8_t> out;
+    };
+
+    void serve();
+    void accept();
+    bool receive(Client& client);
+    bool transmit(Client& client);
+    void disconnect(Client& client);
+    mraa::Result execute(Client& client, const SmartDriveProtocol::Header& request, const uint8_t* payload,
+                         uint8_t* reply, uint8_t& reply_length);
+    void own(Board& board, uint8_t motor, uint64_t serial);
+
+private:
+    std::string m_path;
+    std::vector<Board> m_boards;
+    bool m_stopOnDisconnect;
+
+    int m_listenFd;
+    int m_wakeFds[2];   //written by Stop()
+    std::thread m_thread;
+    std::vector<Client> m_clients;   //server thread only
+    uint64_t m_nextSerial;
+
+    std::mutex m_lock;
+    Stats m_stats;
+};
+
+}
@@ -0,0 +1,266 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <stdexcept>
+
+#include "smartdriveshm.h"
+
+using namespace upm;
+
+#define SmartDriveShm_WORDS  (sizeof(SmartDriveSharedState) / sizeof(uint32_t))
+
+static_assert(sizeof(SmartDriveSharedState) % sizeof(uint32_t) == 0, "SmartDriveSharedState is copied by words");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the seqlock needs address free atomics to work across processes");
+
+//The state is copied word by word through relaxed atomics, so a reader racing
+//the writer reads torn data it then throws away instead of a data race
+
+struct SmartDriveStatePublisher::Segment {
+    struct alignas(64) Board {
+        std::atomic<uint32_t> seq;   //odd while the writer is copying
+        std::atomic<uint32_t> words[SmartDriveShm_WORDS];
+    };
+
+    std::atomic<uint32_t> magic;     //written last, once the header is valid
+    uint32_t version;
+    uint32_t max_boards;
+    std::atomic<uint32_t> boards;
+    Board board[SmartDriveShm_MAX_BOARDS];
+};
+
+
+SmartDriveStatePublisher::SmartDriveStatePublisher(const std::string& name): m_name(name), m_segment(NULL),
+    m_running(false), m_publications(0), m_readErrors(0)
+{
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(Segment)) < 0) {
+        std::string reason = strerror(errno);
+        if (fd >= 0)
+            close(fd);
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": cannot create " + name + ": " + reason);
+    }
+    void* mem = mmap(NULL, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": cannot map " + name + ": " + strerror(errno));
+
+    //a segment left by a previous writer is reset, its readers see the sequences restart
+    m_segment = (Segment*) mem;
+    m_segment->magic.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < SmartDriveShm_MAX_BOARDS; i++) {
+        m_segment->board[i].seq.store(0, std::memory_order_relaxed);
+        for (size_t j = 0; j < SmartDriveShm_WORDS; j++)
+            m_segment->board[i].words[j].store(0, std::memory_order_relaxed);
+    }
+    m_segment->version = SmartDriveShm_VERSION;
+    m_segment->max_boards = SmartDriveShm_MAX_BOARDS;
+    m_segment->boards.store(0, std::memory_order_relaxed);
+    m_segment->magic.store(SmartDriveShm_MAGIC, std::memory_order_release);
+}
+
+SmartDriveStatePublisher::~SmartDriveStatePublisher() {
+    Stop();
+    munmap(m_segment, sizeof(Segment));
+    shm_unlink(m_name.c_str());
+}
+
+
+int
+SmartDriveStatePublisher::AddBoard(std::shared_ptr<SmartDrive> drive, uint8_t bus) {
+    if (m_running.load() || m_slots.size() >= SmartDriveShm_MAX_BOARDS)
+        return -1;
+    Slot slot = {drive, bus, 0};
+    m_slots.push_back(slot);
+    m_segment->boards.store(m_slots.size(), std::memory_order_release);
+    return m_slots.size() - 1;
+}
+
+
+bool
+SmartDriveStatePublisher::Publish(int index, const SmartDrive::Snapshot& snap) {
+    if (index < 0 || index >= (int) m_slots.size() || !snap.valid)
+        return false;
+    Slot& slot = m_slots[index];
+
+    SmartDriveSharedState state;
+    memset(&state, 0, sizeof(state));
+    state.sequence = ++slot.sequence;
+    state.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(snap.timestamp.time_since_epoch()).count();
+    for (int i = 0; i < 2; i++) {
+        state.position[i] = snap.position[i];
+        state.status[i] = snap.status[i];
+        state.tasks[i] = snap.tasks[i];
+        state.current_ma[i] = slot.drive->CurrentMilliamps(snap.current[i]);
+    }
+    state.bus = slot.bus;
+    state.address = slot.drive->GetAddress();
+    state.reset_status = snap.resetStatus;
+    state.battery_mv = slot.drive->BatteryMillivolts(snap.battVoltage);
+
+    uint32_t words[SmartDriveShm_WORDS];
+    memcpy(words, &state, sizeof(words));
+
+    Segment::Board& board = m_segment->board[index];
+    uint32_t seq = board.seq.load(std::memory_order_relaxed);
+    board.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < SmartDriveShm_WORDS; i++)
+        board.words[i].store(words[i], std::memory_order_relaxed);
+    board.seq.store(seq + 2, std::memory_order_release);
+
+    m_publications++;
+    return true;
+}
+
+
+mraa::Result
+SmartDriveStatePublisher::Start(unsigned rate_hz) {
+    if (rate_hz == 0)
+        return mraa::ERROR_INVALID_PARAMETER;
+    if (m_running.exchange(true))
+        return mraa::ERROR_INVALID_RESOURCE;
+    m_thread = std::thread(&SmartDriveStatePublisher::run, this, rate_hz);
+    return mraa::SUCCESS;
+}
+
+
+void
+SmartDriveStatePublisher::Stop() {
+    m_running = false;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+
+SmartDriveStatePublisher::Stats
+SmartDriveStatePublisher::GetStats() const {
+    Stats stats = {m_publications.load(), m_readErrors.load()};
+    return stats;
+}
+
+
+void
+SmartDriveStatePublisher::run(unsigned rate_hz) {
+    std::chrono::nanoseconds period(1000000000ull / rate_hz);
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
+    SmartDrive::Snapshot snap;
+
+    while (m_running.load()) {
+        for (size_t i = 0; i < m_slots.size(); i++) {
+            //ReadSnapshot(snap) leaves the drive's own cache to its owner
+            if (m_slots[i].drive->ReadSnapshot(snap))
+                Publish(i, snap);
+            else
+                m_readErrors++;
+        }
+
+        deadline += period;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (deadline < now)
+            deadline = now;   //late, do not try to catch up
+        std::this_thread::sleep_until(deadline);
+    }
+}
+
+
+SmartDriveStateReader::SmartDriveStateReader(const std::string& name): m_segment(NULL), m_size(0), m_retries(0)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(SmartDriveStatePublisher::Segment)) {
+        std::string reason = (fd < 0) ? strerror(errno) : "not a state segment";
+        if (fd >= 0)
+            close(fd);
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": cannot open " + name + ": " + reason);
+    }
+    m_size = sizeof(SmartDriveStatePublisher::Segment);
+    void* mem = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": cannot map " + name + ": " + strerror(errno));
+
+    m_segment = (SmartDriveStatePublisher::Segment*) mem;
+    if (m_segment->magic.load(std::memory_order_acquire) != SmartDriveShm_MAGIC ||
+        m_segment->version != SmartDriveShm_VERSION || m_segment->max_boards != SmartDriveShm_MAX_BOARDS) {
+        munmap(mem, m_size);
+        throw std::invalid_argument(std::string(__FUNCTION__) + ": " + name + " is not a state segment of this version");
+    }
+}
+
+SmartDriveStateReader::~SmartDriveStateReader() {
+    munmap(m_segment, m_size);
+}
+
+
+int
+SmartDriveStateReader::GetBoardCount() const {
+    return m_segment->boards.load(std::memory_order_acquire);
+}
+
+
+uint64_t
+SmartDriveStateReader::GetSequence(int slot) const {
+    if (slot < 0 || slot >= SmartDriveShm_MAX_BOARDS)
+        return 0;
+    //each publication moves the seqlock by 2
+    return m_segment->board[slot].seq.load(std::memory_order_acquire) / 2;
+}
+
+
+bool
+SmartDriveStateReader::Read(int slot, SmartDriveSharedState& state) const {
+    if (slot < 0 || slot >= GetBoardCount())
+        return false;
+    const SmartDriveStatePublisher::Segment::Board& board = m_segment->board[slot];
+    uint32_t words[SmartDriveShm_WORDS];
+
+    for (int attempt = 0; attempt < SmartDriveShm_READ_TRIES; attempt++) {
+        uint32_t before = board.seq.load(std::memory_order_acquire);
+        if (before == 0)
+            return false;
+        if (before & 1) {
+            m_retries++;
+            continue;
+        }
+        for (size_t i = 0; i < SmartDriveShm_WORDS; i++)
+            words[i] = board.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (board.seq.load(std::memory_order_relaxed) == before) {
+            memcpy(&state, words, sizeof(state));
+            return true;
+        }
+        m_retries++;
+    }
+    return false;
+}
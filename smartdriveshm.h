@@ -0,0 +1,189 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "smartdrive.h"
+
+#define SmartDriveShm_NAME         "/smartdrive-state"
+#define SmartDriveShm_MAGIC        0x53445354   //"SDST"
+#define SmartDriveShm_VERSION      1
+#define SmartDriveShm_MAX_BOARDS   16
+#define SmartDriveShm_READ_TRIES   1000         //attempts of a reader racing the writer before giving up
+
+namespace upm {
+
+/**
+ * Decoded state of one board, as published in shared memory
+ */
+struct SmartDriveSharedState {
+    uint64_t sequence;       //publications of this board so far, 0 when never published
+    uint64_t timestamp_ns;   //bus clock of the read, CLOCK_MONOTONIC on real hardware
+    uint32_t position[2];    //tacho position of M1/M2
+    uint8_t  status[2];      //SmartDrive_STATUS_M1/M2
+    uint8_t  tasks[2];
+    uint8_t  bus;
+    uint8_t  address;
+    uint8_t  reset_status;
+    uint8_t  reserved;
+    float    battery_mv;
+    float    current_ma[2];
+    uint32_t reserved2;
+};
+
+/**
+ * @brief Publishes the state of SmartDrives in a POSIX shared memory segment
+ *
+ * One writer process reads each board with one snapshot burst and publishes
+ * the decoded state under a per-board seqlock; any number of
+ * SmartDriveStateReader processes take consistent copies without a syscall
+ * nor a bus transaction, so observers cost nothing on the bus however many
+ * there are. The writer never waits for the readers.
+ */
+class SmartDriveStatePublisher {
+
+public:
+    /**
+     * Publisher counters
+     */
+    struct Stats {
+        uint64_t publications;
+        uint64_t read_errors;    //snapshot reads which failed, nothing was published for them
+    };
+
+	/**
+	 * Creates or reuses the segment, throws std::invalid_argument when it cannot
+	 * @param name Name of the segment, as given to shm_open.
+	 */
+    SmartDriveStatePublisher(const std::string& name = SmartDriveShm_NAME);
+
+	/**
+	 * Stops publishing and removes the segment name, mapped readers keep the last states
+	 */
+    ~SmartDriveStatePublisher();
+
+	/**
+	 * Adds a board, only while the publisher thread is stopped
+	 * @param bus Bus index published with the state.
+	 * @return Slot of the board in the segment, -1 when running or full.
+	 */
+    int AddBoard(std::shared_ptr<SmartDrive> drive, uint8_t bus = 0);
+
+	/**
+	 * Publishes a snapshot read by the caller, e.g. in a SmartDriveLoop step.
+	 * Only one thread may publish a given slot.
+	 * @param slot Slot returned by AddBoard().
+	 * @return false if the slot does not exist or the snapshot is not valid.
+	 */
+    bool Publish(int slot, const SmartDrive::Snapshot& snap);
+
+	/**
+	 * Starts a thread reading and publishing every board at a fixed rate
+	 * @return mraa::ERROR_INVALID_RESOURCE if it is already running.
+	 */
+    mraa::Result Start(unsigned rate_hz);
+
+	/**
+	 * Stops the publisher thread
+	 */
+    void Stop();
+
+    Stats GetStats() const;
+
+    struct Segment;   //layout of the mapped memory, shared with SmartDriveStateReader
+
+private:
+    void run(unsigned rate_hz);
+
+private:
+    std::string m_name;
+    Segment* m_segment;
+    struct Slot {
+        std::shared_ptr<SmartDrive> drive;
+        uint8_t bus;
+        uint64_t sequence;
+    };
+    std::vector<Slot> m_slots;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+    std::atomic<uint64_t> m_publications;
+    std::atomic<uint64_t> m_readErrors;
+};
+
+/**
+ * @brief Reads the states published by a SmartDriveStatePublisher
+ *
+ * Maps the segment read only. Read() only touches the mapped memory : it takes
+ * the board's seqlock optimistically and copies again when the writer
+ * published meanwhile.
+ */
+class SmartDriveStateReader {
+
+public:
+	/**
+	 * Maps the segment, throws std::invalid_argument when it does not exist or is not a state segment
+	 * @param name Name of the segment, as given to shm_open.
+	 */
+    SmartDriveStateReader(const std::string& name = SmartDriveShm_NAME);
+    ~SmartDriveStateReader();
+
+	/**
+	 * Number of board slots in use
+	 */
+    int GetBoardCount() const;
+
+	/**
+	 * Sequence number of a board, cheap check for a new publication
+	 */
+    uint64_t GetSequence(int slot) const;
+
+	/**
+	 * Takes a consistent copy of the state of a board
+	 * @return false if the slot was never published, or the writer kept it
+	 * busy for SmartDriveShm_READ_TRIES attempts.
+	 */
+    bool Read(int slot, SmartDriveSharedState& state) const;
+
+	/**
+	 * Number of copies thrown away because the writer published meanwhile
+	 */
+    uint64_t GetRetries() const { return m_retries.load(); }
+
+private:
+    SmartDriveStatePublisher::Segment* m_segment;
+    size_t m_size;
+    mutable std::atomic<uint64_t> m_retries;
+};
+
+}
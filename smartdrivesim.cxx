@@ -0,0 +1,396 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include "smartdrivesim.h"
+#include "smartdriveregs.h"
+
+using namespace upm;
+
+SmartDriveSimulator::SmartDriveSimulator(bool virtual_clock, uint32_t bus_hz): m_selected(NULL),
+    m_virtual(virtual_clock), m_busHz(bus_hz ? bus_hz : 100000), m_virtualNow(std::chrono::steady_clock::now()),
+    m_maxSpeed(SmartDriveSim_MAX_SPEED_TPS), m_timeConstant(SmartDriveSim_TIME_CONSTANT_S), m_errors(0)
+{
+}
+
+
+void
+SmartDriveSimulator::AddBoard(uint8_t address) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    powerOn(m_boards[address]);
+}
+
+void
+SmartDriveSimulator::ResetBoard(uint8_t address) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_boards.count(address)) {
+        powerOn(m_boards[address]);
+        m_boards[address].regs[SmartDrive_RESETSTATUS] = 1;
+    }
+}
+
+void
+SmartDriveSimulator::powerOn(Board& board) {
+    memset(board.regs, 0, sizeof(board.regs));
+    //space padded to SmartDrive_ID_SIZE, without terminating NUL
+    memset(board.regs + SmartDrive_FIRMWARE_VERSION, ' ', 3 * SmartDrive_ID_SIZE);
+    memcpy(board.regs + SmartDrive_FIRMWARE_VERSION, SmartDriveSim_FIRMWARE, strlen(SmartDriveSim_FIRMWARE));
+    memcpy(board.regs + SmartDrive_VENDOR_ID, SmartDriveSim_VENDOR, strlen(SmartDriveSim_VENDOR));
+    memcpy(board.regs + SmartDrive_DEVICE_ID, SmartDriveSim_DEVICE, strlen(SmartDriveSim_DEVICE));
+    for (int m = 0; m < 2; m++) {
+        Motor& motor = board.motor[m];
+        motor.mode = Idle;
+        motor.position = motor.velocity = motor.command = 0;
+        motor.target = 0;
+        motor.control = 0;
+        motor.brake = false;
+        motor.stalled = false;
+    }
+    board.batteryMv = SmartDriveSim_BATTERY_MV;
+    board.updated = clock();
+    publish(board);
+}
+
+void
+SmartDriveSimulator::SetBatteryVoltage(uint8_t address, float millivolts) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_boards.count(address))
+        m_boards[address].batteryMv = millivolts;
+}
+
+void
+SmartDriveSimulator::SetStalled(uint8_t address, MotorID_t motor, bool stalled) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_boards.count(address) && motor != Motor_ID_BOTH) {
+        update(m_boards[address], clock());
+        m_boards[address].motor[motor - 1].stalled = stalled;
+    }
+}
+
+void
+SmartDriveSimulator::SetMotorModel(float max_speed_tps, float time_constant_s) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_maxSpeed = max_speed_tps;
+    m_timeConstant = time_constant_s;
+}
+
+void
+SmartDriveSimulator::InjectErrors(unsigned count) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_errors = count;
+}
+
+uint8_t
+SmartDriveSimulator::PeekRegister(uint8_t address, uint8_t reg) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_boards.count(address))
+        return 0;
+    Board& board = m_boards[address];
+    update(board, clock());
+    publish(board);
+    return board.regs[reg];
+}
+
+void
+SmartDriveSimulator::Advance(std::chrono::microseconds delay) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_virtual)
+        m_virtualNow += delay;
+}
+
+
+std::chrono::steady_clock::time_point
+SmartDriveSimulator::clock() {
+    return m_virtual ? m_virtualNow : std::chrono::steady_clock::now();
+}
+
+std::chrono::steady_clock::time_point
+SmartDriveSimulator::now() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return clock();
+}
+
+void
+SmartDriveSimulator::sleep(std::chrono::microseconds delay) {
+    if (m_virtual)
+        Advance(delay);
+    else
+        SmartDriveTransport::sleep(delay);
+}
+
+bool
+SmartDriveSimulator::transaction(int bytes) {
+    //address byte + payload, 9 bits each with the ack, an address nobody acks ends the transfer
+    if (m_virtual)
+        m_virtualNow += std::chrono::microseconds((uint64_t) ((m_selected != NULL) ? bytes + 1 : 1) * 9 * 1000000 / m_busHz);
+    if (m_errors != 0) {
+        m_errors--;
+        return false;
+    }
+    if (m_selected == NULL)
+        return false;   //nobody acknowledges this address
+    update(*m_selected, clock());
+    return true;
+}
+
+
+mraa::Result
+SmartDriveSimulator::address(uint8_t address) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::map<uint8_t, Board>::iterator it = m_boards.find(address);
+    m_selected = (it != m_boards.end()) ? &it->second : NULL;
+    return mraa::SUCCESS;
+}
+
+mraa::Result
+SmartDriveSimulator::writeReg(uint8_t reg, uint8_t value) {
+    uint8_t data[2] = {reg, value};
+    return write(data, 2);
+}
+
+mraa::Result
+SmartDriveSimulator::write(const uint8_t* data, int size) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!transaction(size))
+        return mraa::ERROR_UNSPECIFIED;
+    //registers are stored in order, a trailing command sees the blocks written before it
+    for (int i = 1; i < size; i++)
+        store(*m_selected, data[0] + i - 1, data[i]);
+    return mraa::SUCCESS;
+}
+
+int
+SmartDriveSimulator::readReg(uint8_t reg) {
+    uint8_t value;
+    if (readBytesReg(reg, &value, 1) != 1)
+        return -1;
+    return value;
+}
+
+int
+SmartDriveSimulator::readWordReg(uint8_t reg) {
+    uint8_t value[2];
+    if (readBytesReg(reg, value, 2) != 2)
+        return -1;
+    return value[0] | (value[1] << 8);
+}
+
+int
+SmartDriveSimulator::readBytesReg(uint8_t reg, uint8_t* data, int size) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!transaction(size + 1))
+        return -1;
+    publish(*m_selected);
+    for (int i = 0; i < size; i++)
+        data[i] = m_selected->regs[(uint8_t) (reg + i)];
+    return size;
+}
+
+
+void
+SmartDriveSimulator::store(Board& board, uint8_t reg, uint8_t value) {
+    board.regs[reg] = value;
+
+    if (reg == SmartDrive_CMD_A_M1 && (value & SmartDrive_CONTROL_GO))
+        start(board, 0);
+    if (reg == SmartDrive_CMD_A_M2 && (value & SmartDrive_CONTROL_GO))
+        start(board, 1);
+    if (reg != SmartDrive_COMMAND)
+        return;
+
+    switch (value) {
+    case SmartDrive_SYNC_GO:
+        start(board, 0);
+        start(board, 1);
+        break;
+    case 'A': case 'B': case 'C':
+        if (value != 'B')
+            stop(board.motor[0], true);
+        if (value != 'A')
+            stop(board.motor[1], true);
+        break;
+    case 'a': case 'b': case 'c':
+        if (value != 'b')
+            stop(board.motor[0], false);
+        if (value != 'a')
+            stop(board.motor[1], false);
+        break;
+    case 'R':
+        board.motor[0].position = board.motor[1].position = 0;
+        break;
+    }
+}
+
+void
+SmartDriveSimulator::start(Board& board, int m) {
+    const uint8_t* block = &board.regs[SmartDrive_SETPT_M1 + m * SmartDrive_MOTOR_BLOCK_SIZE];
+    int32_t setpoint = SmartDriveReg::SETPT_M1::decode(block);
+    int8_t speed = (int8_t) block[SmartDrive_SPEED_M1 - SmartDrive_SETPT_M1];
+    uint8_t time = block[SmartDrive_TIME_M1 - SmartDrive_SETPT_M1];
+    uint8_t control = block[SmartDrive_CMD_A_M1 - SmartDrive_SETPT_M1] & ~SmartDrive_CONTROL_GO;
+    Motor& motor = board.motor[m];
+
+    //the firmware clears GO once the command is taken
+    board.regs[SmartDrive_CMD_A_M1 + m * SmartDrive_MOTOR_BLOCK_SIZE] = control;
+
+    motor.control = control;
+    motor.brake = (control & SmartDrive_CONTROL_BRK) != 0;
+    motor.command = speed / 100.0f * m_maxSpeed;
+    motor.visible = board.updated + std::chrono::microseconds(SmartDriveSim_STATUS_DELAY_US);
+    if (control & SmartDrive_CONTROL_TACHO) {
+        motor.mode = Tacho;
+        motor.target = (control & SmartDrive_CONTROL_RELATIVE) ? (int32_t) lroundf(motor.position) + setpoint : setpoint;
+        motor.command = fabsf(motor.command);
+    } else if (control & SmartDrive_CONTROL_TIME) {
+        motor.mode = Timed;
+        motor.end = board.updated + std::chrono::seconds(time);
+    } else {
+        motor.mode = Speed;
+    }
+}
+
+void
+SmartDriveSimulator::stop(Motor& motor, bool brake) {
+    motor.mode = Idle;
+    motor.brake = brake;
+    motor.command = 0;
+    if (brake)
+        motor.velocity = 0;
+}
+
+
+void
+SmartDriveSimulator::update(Board& board, std::chrono::steady_clock::time_point now) {
+    const std::chrono::microseconds max_step(SmartDriveSim_STEP_US);
+
+    while (board.updated < now) {
+        //nothing moves : jump straight to now
+        if (board.motor[0].mode == Idle && board.motor[1].mode == Idle &&
+            fabsf(board.motor[0].velocity) < 0.01f && fabsf(board.motor[1].velocity) < 0.01f) {
+            board.motor[0].velocity = board.motor[1].velocity = 0;
+            board.updated = now;
+            break;
+        }
+
+        std::chrono::steady_clock::time_point next = (now - board.updated > max_step) ? board.updated + max_step : now;
+        float dt = std::chrono::duration<float>(next - board.updated).count();
+
+        for (int m = 0; m < 2; m++) {
+            Motor& motor = board.motor[m];
+            if (motor.mode == Timed && next >= motor.end)
+                stop(motor, motor.brake);
+            step(motor, dt);
+        }
+        board.updated = next;
+    }
+}
+
+void
+SmartDriveSimulator::step(Motor& motor, float dt) {
+    float target = 0;
+
+    if (motor.stalled) {
+        motor.velocity = 0;
+        return;
+    }
+    if (motor.mode == Speed || motor.mode == Timed)
+        target = motor.command;
+    if (motor.mode == Tacho) {
+        //slow down when getting close, like the firmware position loop
+        float remaining = motor.target - motor.position;
+        float approach = fminf(motor.command, 10.0f * fabsf(remaining) + 20.0f);
+        target = (remaining >= 0) ? approach : -approach;
+    }
+
+    //a floating motor coasts down slower than a driven one
+    float tau = (motor.mode == Idle && !motor.brake) ? 4 * m_timeConstant : m_timeConstant;
+    motor.velocity += (target - motor.velocity) * fminf(1.0f, dt / tau);
+    if (motor.mode == Idle && motor.brake)
+        motor.velocity = 0;
+
+    float before = motor.target - motor.position;
+    motor.position += motor.velocity * dt;
+    if (motor.mode == Tacho) {
+        float after = motor.target - motor.position;
+        if (fabsf(after) < 0.5f || (before > 0) != (after > 0)) {
+            motor.position = motor.target;
+            stop(motor, motor.brake);
+        }
+    }
+}
+
+
+uint16_t
+SmartDriveSimulator::current(const Motor& motor) {
+    if (motor.mode == Idle)
+        return SmartDriveSim_IDLE_MA;
+    if (motor.stalled)
+        return SmartDriveSim_STALL_MA;
+    float load = (fabsf(motor.velocity) + fabsf(motor.command - motor.velocity)) / m_maxSpeed;
+    return SmartDriveSim_IDLE_MA + (uint16_t) ((SmartDriveSim_FULL_SPEED_MA - SmartDriveSim_IDLE_MA) * load);
+}
+
+uint8_t
+SmartDriveSimulator::status(const Board& board, int m) {
+    const Motor& motor = board.motor[m];
+    uint8_t status = 0;
+
+    if (motor.mode != Idle && board.updated >= motor.visible) {
+        status |= SmartDrive_MOTOR_IS_POWERED;
+        if (motor.control & SmartDrive_CONTROL_SPEED)
+            status |= SmartDrive_MOTOR_CONTROL_ON;
+        if (motor.mode != Tacho && fabsf(motor.command - motor.velocity) > 0.05f * m_maxSpeed)
+            status |= SmartDrive_MOTOR_IS_RAMPING;
+        if (motor.mode == Tacho)
+            status |= SmartDrive_MOTOR_POS_CTRL_ON;
+        if (motor.mode == Timed)
+            status |= SmartDrive_MOTOR_IN_TIME_MODE;
+        if (motor.stalled)
+            status |= SmartDrive_MOTOR_IS_STALLED;
+    }
+    if (motor.mode == Idle && motor.brake)
+        status |= SmartDrive_MOTOR_IN_BRAKE_MODE;
+    if (current(motor) > SmartDriveSim_OVERLOAD_MA)
+        status |= SmartDrive_MOTOR_OVERLOADED;
+    return status;
+}
+
+void
+SmartDriveSimulator::publish(Board& board) {
+    for (int m = 0; m < 2; m++) {
+        uint16_t milliamps = current(board.motor[m]);
+
+        SmartDriveReg::POSITION_M1::encode(&board.regs[SmartDrive_POSITION_M1 + 4 * m], (int32_t) lroundf(board.motor[m].position));
+        board.regs[SmartDrive_STATUS_M1 + m] = status(board, m);
+        board.regs[SmartDrive_TASKS_M1 + m] = 0;
+        SmartDriveReg::CURRENT_M1::encode(&board.regs[SmartDrive_CURRENT_M1 + 2 * m], milliamps);
+    }
+    float raw = board.batteryMv / SmartDrive_VOLTAGE_MULTIPLIER;
+    board.regs[SmartDrive_BATT_VOLTAGE] = (raw > 255) ? 255 : (uint8_t) raw;
+}
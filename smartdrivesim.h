@@ -0,0 +1,178 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include "smartdrive.h"
+#include "smartdrivetransport.h"
+
+//Default motor model
+#define SmartDriveSim_MAX_SPEED_TPS    1000.0f  //tacho counts per second at speed 100
+#define SmartDriveSim_TIME_CONSTANT_S  0.05f    //first order speed response
+#define SmartDriveSim_STATUS_DELAY_US  5000     //time before a new command shows in the status byte
+#define SmartDriveSim_STEP_US          1000     //integration step
+#define SmartDriveSim_BATTERY_MV       12000.0f
+#define SmartDriveSim_IDLE_MA          20
+#define SmartDriveSim_FULL_SPEED_MA    600
+#define SmartDriveSim_STALL_MA         2500
+#define SmartDriveSim_OVERLOAD_MA      2000
+
+//Identification registers of every simulated board
+#define SmartDriveSim_FIRMWARE         "V2.10"
+#define SmartDriveSim_VENDOR           "OpenElec"
+#define SmartDriveSim_DEVICE           "SmartDrv"
+
+namespace upm {
+
+/**
+ * @brief In-process SmartDrive simulator
+ *
+ * Models the register map of smartdrive.h for any number of boards on one bus :
+ * identification registers, command blocks with the GO bit, the COMMAND register
+ * (sync go, brake and float stops, encoder reset), status bits, currents,
+ * battery voltage, and tacho integration under a first order motor model.
+ *
+ * With a virtual clock, time only moves when the driver sleeps or when a
+ * transaction takes its wire time, so long motion sequences run much faster
+ * than real time. Several threads sleeping at once all advance the same clock.
+ */
+class SmartDriveSimulator : public SmartDriveTransport {
+
+public:
+	/**
+	 * Creates an empty bus, add boards with AddBoard()
+	 * @param virtual_clock Run on a virtual clock instead of the real one.
+	 * @param bus_hz Bus speed used to charge wire time on the virtual clock.
+	 */
+    SmartDriveSimulator(bool virtual_clock = true, uint32_t bus_hz = 100000);
+
+	/**
+	 * Adds a board answering at an address
+	 */
+    void AddBoard(uint8_t address = (DefaultAddress >> 1));
+
+	/**
+	 * Restarts a board: its registers go back to their power on values and
+	 * SmartDrive_RESETSTATUS reads non zero until the host writes it back to 0
+	 */
+    void ResetBoard(uint8_t address);
+
+	/**
+	 * Sets the battery voltage reported by a board, in millivolts
+	 */
+    void SetBatteryVoltage(uint8_t address, float millivolts);
+
+	/**
+	 * Blocks (or releases) a motor shaft, the firmware then reports a stall
+	 * @param motor Motor_ID_1 or Motor_ID_2.
+	 */
+    void SetStalled(uint8_t address, MotorID_t motor, bool stalled);
+
+	/**
+	 * Changes the motor model of every board
+	 * @param max_speed_tps Tacho counts per second at speed 100.
+	 * @param time_constant_s Time constant of the speed response.
+	 */
+    void SetMotorModel(float max_speed_tps, float time_constant_s);
+
+	/**
+	 * Makes the next transactions fail, to exercise error paths
+	 * @param count Number of transactions to fail.
+	 */
+    void InjectErrors(unsigned count);
+
+	/**
+	 * Reads a register without going through the bus or charging time
+	 */
+    uint8_t PeekRegister(uint8_t address, uint8_t reg);
+
+	/**
+	 * Moves the virtual clock forward, does nothing on the real clock
+	 */
+    void Advance(std::chrono::microseconds delay);
+
+    mraa::Result address(uint8_t address);
+    mraa::Result writeReg(uint8_t reg, uint8_t value);
+    mraa::Result write(const uint8_t* data, int size);
+    int readReg(uint8_t reg);
+    int readWordReg(uint8_t reg);
+    int readBytesReg(uint8_t reg, uint8_t* data, int size);
+    std::chrono::steady_clock::time_point now();
+    void sleep(std::chrono::microseconds delay);
+    bool realTime() const { return !m_virtual; }
+
+private:
+    enum Mode { Idle, Speed, Timed, Tacho };
+
+    struct Motor {
+        Mode    mode;
+        float   position;
+        float   velocity;      //tacho counts per second
+        float   command;       //commanded velocity
+        int32_t target;
+        uint8_t control;       //SmartDrive_CONTROL_* bits of the running command
+        bool    brake;
+        bool    stalled;
+        std::chrono::steady_clock::time_point end, visible;
+    };
+
+    struct Board {
+        uint8_t regs[256];
+        Motor   motor[2];
+        float   batteryMv;
+        std::chrono::steady_clock::time_point updated;
+    };
+
+    std::chrono::steady_clock::time_point clock();
+    bool transaction(int bytes);
+    void powerOn(Board& board);
+    void update(Board& board, std::chrono::steady_clock::time_point now);
+    void step(Motor& motor, float dt);
+    void start(Board& board, int m);
+    void stop(Motor& motor, bool brake);
+    void store(Board& board, uint8_t reg, uint8_t value);
+    void publish(Board& board);
+    uint8_t status(const Board& board, int m);
+    uint16_t current(const Motor& motor);
+
+private:
+    std::mutex m_lock;
+    std::map<uint8_t, Board> m_boards;
+    Board* m_selected;
+    bool m_virtual;
+    uint32_t m_busHz;
+    std::chrono::steady_clock::time_point m_virtualNow;
+    float m_maxSpeed;
+    float m_timeConstant;
+    unsigned m_errors;
+};
+
+}
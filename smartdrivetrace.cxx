@@ -0,0 +1,180 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "smartdrivetrace.h"
+
+using namespace upm;
+
+std::atomic<int> SmartDriveTrace::s_level(SMARTDRIVE_LOG_LEVEL);
+
+namespace {
+
+//Bounded multi-producer ring, each cell carries the sequence number it expects next
+struct Cell {
+    std::atomic<uint64_t> sequence;
+    SmartDriveTrace::Record record;
+};
+
+struct Ring {
+    Cell cells[SmartDriveTrace_RING_SIZE];
+    std::atomic<uint64_t> enqueue;
+    uint64_t dequeue;               //protected by drainLock
+    std::atomic<uint64_t> dropped;
+    std::mutex drainLock;
+
+    std::thread formatter;
+    std::atomic<bool> formatting;
+    std::mutex formatterLock;
+
+    Ring(): enqueue(0), dequeue(0), dropped(0), formatting(false) {
+        for (uint64_t i = 0; i < SmartDriveTrace_RING_SIZE; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    //a program may exit without StopFormatter(), destroying a joinable thread would terminate it
+    ~Ring() {
+        std::lock_guard<std::mutex> lock(formatterLock);
+        formatting = false;
+        if (formatter.joinable())
+            formatter.join();
+    }
+};
+
+Ring&
+ring() {
+    static Ring instance;
+    return instance;
+}
+
+const char*
+levelName(int level) {
+    static const char* names[] = {"", "ERROR", "WARN", "INFO", "DEBUG", "TRACE"};
+    return (level > 0 && level <= SMARTDRIVE_LEVEL_TRACE) ? names[level] : "?";
+}
+
+}
+
+
+void
+SmartDriveTrace::push(int level, const char* format, int argc, const long long* args) {
+    Ring& r = ring();
+    uint64_t pos = r.enqueue.load(std::memory_order_relaxed);
+    Cell* cell;
+
+    for (;;) {
+        cell = &r.cells[pos & (SmartDriveTrace_RING_SIZE - 1)];
+        int64_t diff = (int64_t) cell->sequence.load(std::memory_order_acquire) - (int64_t) pos;
+        if (diff == 0) {
+            if (r.enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            r.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = r.enqueue.load(std::memory_order_relaxed);
+        }
+    }
+
+    Record& record = cell->record;
+    record.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    record.format = format;
+    record.level = level;
+    record.argc = (argc < SmartDriveTrace_MAX_ARGS) ? argc : SmartDriveTrace_MAX_ARGS;
+    for (int i = 0; i < SmartDriveTrace_MAX_ARGS; i++)
+        record.args[i] = (i < record.argc) ? args[i] : 0;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+}
+
+
+size_t
+SmartDriveTrace::Drain(FILE* out) {
+    Ring& r = ring();
+    std::lock_guard<std::mutex> lock(r.drainLock);
+    size_t count = 0;
+    char line[256];
+
+    for (;;) {
+        Cell& cell = r.cells[r.dequeue & (SmartDriveTrace_RING_SIZE - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != r.dequeue + 1)
+            break;
+        Record record = cell.record;
+        cell.sequence.store(r.dequeue + SmartDriveTrace_RING_SIZE, std::memory_order_release);
+        r.dequeue++;
+
+        //unused arguments are ignored by snprintf
+        snprintf(line, sizeof(line), record.format,
+                 record.args[0], record.args[1], record.args[2], record.args[3], record.args[4]);
+        fprintf(out, "[%llu.%06llu] %s smartdrive: %s\n",
+                (unsigned long long) (record.timestamp_ns / 1000000000ULL),
+                (unsigned long long) (record.timestamp_ns / 1000ULL % 1000000ULL),
+                levelName(record.level), line);
+        count++;
+    }
+    if (count != 0)
+        fflush(out);
+    return count;
+}
+
+
+void
+SmartDriveTrace::StartFormatter(FILE* out, unsigned period_ms) {
+    Ring& r = ring();
+    std::lock_guard<std::mutex> lock(r.formatterLock);
+
+    if (r.formatting.exchange(true))
+        return;
+    r.formatter = std::thread([out, period_ms]() {
+        Ring& r = ring();
+        while (r.formatting.load(std::memory_order_relaxed)) {
+            Drain(out);
+            std::this_thread::sleep_for(std::chrono::milliseconds(period_ms));
+        }
+        Drain(out);
+    });
+}
+
+void
+SmartDriveTrace::StopFormatter() {
+    Ring& r = ring();
+    std::lock_guard<std::mutex> lock(r.formatterLock);
+
+    r.formatting = false;
+    if (r.formatter.joinable())
+        r.formatter.join();
+}
+
+
+uint64_t
+SmartDriveTrace::GetDropped() {
+    return ring().dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,163 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+
+/*
+ * Driver logging with compile-time levels.
+ *
+ * Messages above SMARTDRIVE_LOG_LEVEL are removed by the preprocessor, their
+ * arguments included, so e.g. the register reads done for a trace message cost
+ * nothing in a release build. Messages which are kept are stored as binary
+ * records (format string pointer + integer arguments) in a lock-free ring and
+ * only formatted when the application drains it, off the control path.
+ */
+
+#define SMARTDRIVE_LEVEL_NONE   0
+#define SMARTDRIVE_LEVEL_ERROR  1
+#define SMARTDRIVE_LEVEL_WARN   2
+#define SMARTDRIVE_LEVEL_INFO   3
+#define SMARTDRIVE_LEVEL_DEBUG  4
+#define SMARTDRIVE_LEVEL_TRACE  5
+
+#ifndef SMARTDRIVE_LOG_LEVEL
+#ifdef NDEBUG
+#define SMARTDRIVE_LOG_LEVEL    SMARTDRIVE_LEVEL_WARN
+#else
+#define SMARTDRIVE_LOG_LEVEL    SMARTDRIVE_LEVEL_DEBUG
+#endif
+#endif
+
+#define SmartDriveTrace_RING_SIZE  1024   //records, power of 2
+#define SmartDriveTrace_MAX_ARGS   5
+
+//Arguments are integers only, formats must use %lld / %llx
+#define SMARTDRIVE_LOG_AT(level, ...) \
+    do { if (upm::SmartDriveTrace::enabled(level)) upm::SmartDriveTrace::write(level, __VA_ARGS__); } while (0)
+
+#if SMARTDRIVE_LOG_LEVEL >= SMARTDRIVE_LEVEL_ERROR
+#define SMARTDRIVE_ERROR(...)  SMARTDRIVE_LOG_AT(SMARTDRIVE_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define SMARTDRIVE_ERROR(...)  do {} while (0)
+#endif
+#if SMARTDRIVE_LOG_LEVEL >= SMARTDRIVE_LEVEL_WARN
+#define SMARTDRIVE_WARN(...)   SMARTDRIVE_LOG_AT(SMARTDRIVE_LEVEL_WARN, __VA_ARGS__)
+#else
+#define SMARTDRIVE_WARN(...)   do {} while (0)
+#endif
+#if SMARTDRIVE_LOG_LEVEL >= SMARTDRIVE_LEVEL_INFO
+#define SMARTDRIVE_INFO(...)   SMARTDRIVE_LOG_AT(SMARTDRIVE_LEVEL_INFO, __VA_ARGS__)
+#else
+#define SMARTDRIVE_INFO(...)   do {} while (0)
+#endif
+#if SMARTDRIVE_LOG_LEVEL >= SMARTDRIVE_LEVEL_DEBUG
+#define SMARTDRIVE_DEBUG(...)  SMARTDRIVE_LOG_AT(SMARTDRIVE_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define SMARTDRIVE_DEBUG(...)  do {} while (0)
+#endif
+#if SMARTDRIVE_LOG_LEVEL >= SMARTDRIVE_LEVEL_TRACE
+#define SMARTDRIVE_TRACE(...)  SMARTDRIVE_LOG_AT(SMARTDRIVE_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define SMARTDRIVE_TRACE(...)  do {} while (0)
+#endif
+
+namespace upm {
+
+/**
+ * @brief Process wide binary log ring of the SmartDrive driver
+ *
+ * Any thread may write (bounded multi-producer ring, records are dropped and
+ * counted when it is full). Formatting happens in Drain(), called by the
+ * application or by the formatter thread started with StartFormatter().
+ */
+class SmartDriveTrace {
+
+public:
+    /**
+     * One log record, as stored in the ring
+     */
+    struct Record {
+        uint64_t    timestamp_ns;   //steady clock
+        const char* format;         //string literal, never copied
+        int         level;
+        int         argc;
+        long long   args[SmartDriveTrace_MAX_ARGS];
+    };
+
+	/**
+	 * True when a message of this level is kept at run time
+	 */
+    static bool enabled(int level) { return level <= s_level.load(std::memory_order_relaxed); }
+
+	/**
+	 * Lowers (or raises back, up to SMARTDRIVE_LOG_LEVEL) the run time level
+	 */
+    static void SetLevel(int level) { s_level = (level < SMARTDRIVE_LOG_LEVEL) ? level : SMARTDRIVE_LOG_LEVEL; }
+
+	/**
+	 * Stores one record, use the SMARTDRIVE_* macros instead
+	 */
+    template <typename... Args>
+    static void write(int level, const char* format, Args... args) {
+        long long values[] = {0, (long long) args...};
+        push(level, format, sizeof...(Args), values + 1);
+    }
+
+	/**
+	 * Formats and removes every pending record
+	 * @param out Stream the lines go to.
+	 * @return Number of records formatted.
+	 */
+    static size_t Drain(FILE* out);
+
+	/**
+	 * Starts a thread draining the ring to a stream periodically
+	 * @param out Stream the lines go to.
+	 * @param period_ms Time between two drains.
+	 */
+    static void StartFormatter(FILE* out = stderr, unsigned period_ms = 100);
+
+	/**
+	 * Stops the formatter thread after a last drain
+	 */
+    static void StopFormatter();
+
+	/**
+	 * Number of records lost because the ring was full
+	 */
+    static uint64_t GetDropped();
+
+private:
+    static void push(int level, const char* format, int argc, const long long* args);
+
+    static std::atomic<int> s_level;
+};
+
+}
@@ -0,0 +1,124 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <unistd.h>
+#include <exception>
+
+#include "smartdrivetransport.h"
+
+using namespace upm;
+
+void
+SmartDriveTransport::sleep(std::chrono::microseconds delay) {
+    if (delay.count() > 0)
+        usleep(delay.count());
+}
+
+int
+SmartDriveTransport::readMany(ReadSegment* segments, int count) {
+    int complete = 0;
+    for (int i = 0; i < count; i++) {
+        ReadSegment& seg = segments[i];
+        seg.result = -1;
+        if (address(seg.address) == mraa::SUCCESS)
+            seg.result = readBytesReg(seg.reg, seg.data, seg.size);
+        if (seg.result == seg.size)
+            complete++;
+    }
+    return complete;
+}
+
+
+MraaTransport::MraaTransport(int i2c_bus): m_busNumber(i2c_bus), m_i2c(new mraa::I2c(i2c_bus))
+{
+}
+
+//Depending on its version mraa reports I/O errors with a return code or an exception
+
+mraa::Result
+MraaTransport::address(uint8_t address) {
+    try {
+        return m_i2c->address(address);
+    } catch (std::exception& e) {
+        return mraa::ERROR_UNSPECIFIED;
+    }
+}
+
+mraa::Result
+MraaTransport::writeReg(uint8_t reg, uint8_t value) {
+    try {
+        return m_i2c->writeReg(reg, value);
+    } catch (std::exception& e) {
+        return mraa::ERROR_UNSPECIFIED;
+    }
+}
+
+mraa::Result
+MraaTransport::write(const uint8_t* data, int size) {
+    try {
+        return m_i2c->write(data, size);
+    } catch (std::exception& e) {
+        return mraa::ERROR_UNSPECIFIED;
+    }
+}
+
+int
+MraaTransport::readReg(uint8_t reg) {
+    try {
+        return m_i2c->readReg(reg);
+    } catch (std::exception& e) {
+        return -1;
+    }
+}
+
+int
+MraaTransport::readWordReg(uint8_t reg) {
+    try {
+        return m_i2c->readWordReg(reg);
+    } catch (std::exception& e) {
+        return -1;
+    }
+}
+
+int
+MraaTransport::readBytesReg(uint8_t reg, uint8_t* data, int size) {
+    try {
+        return m_i2c->readBytesReg(reg, data, size);
+    } catch (std::exception& e) {
+        return -1;
+    }
+}
+
+mraa::Result
+MraaTransport::reopen() {
+    try {
+        m_i2c.reset(new mraa::I2c(m_busNumber));
+        return mraa::SUCCESS;
+    } catch (std::exception& e) {
+        return mraa::ERROR_UNSPECIFIED;
+    }
+}
@@ -0,0 +1,152 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <mraa/i2c.hpp>
+
+namespace upm {
+
+/**
+ * @brief Raw register access used by SmartDriveBus
+ *
+ * Everything the driver sends to a SmartDrive goes through a transport, so the
+ * hardware can be swapped for a simulator. Reads return a negative value on
+ * error. The transport also provides the clock the driver uses to time moves,
+ * which lets a simulator run faster than real time.
+ */
+class SmartDriveTransport {
+
+public:
+    /**
+     * One burst read of a readMany()
+     */
+    struct ReadSegment {
+        uint8_t  address;
+        uint8_t  reg;
+        uint8_t* data;
+        int      size;
+        int      result;   //bytes read, negative on error
+    };
+
+    virtual ~SmartDriveTransport() {}
+
+	/**
+	 * Selects the board the next transactions go to
+	 */
+    virtual mraa::Result address(uint8_t address) = 0;
+
+	/**
+	 * Writes one register
+	 */
+    virtual mraa::Result writeReg(uint8_t reg, uint8_t value) = 0;
+
+	/**
+	 * Writes a raw buffer, the first byte being the register
+	 */
+    virtual mraa::Result write(const uint8_t* data, int size) = 0;
+
+	/**
+	 * Reads one register
+	 * @return Register value, negative on error.
+	 */
+    virtual int readReg(uint8_t reg) = 0;
+
+	/**
+	 * Reads a 16 bit little endian register
+	 * @return Register value, negative on error.
+	 */
+    virtual int readWordReg(uint8_t reg) = 0;
+
+	/**
+	 * Reads size consecutive registers
+	 * @return Number of bytes read, negative on error.
+	 */
+    virtual int readBytesReg(uint8_t reg, uint8_t* data, int size) = 0;
+
+	/**
+	 * Reads several bursts, possibly of different boards. The default runs them
+	 * one by one, a transport able to combine them in one transfer overrides it
+	 * together with maxCombinedReads(). Leaves any board selected.
+	 * @return Number of segments read in full.
+	 */
+    virtual int readMany(ReadSegment* segments, int count);
+
+	/**
+	 * Largest count readMany() serves in one transfer, 1 when it cannot combine
+	 */
+    virtual int maxCombinedReads() const { return 1; }
+
+	/**
+	 * Closes and opens the bus again, used by SmartDriveBus after repeated errors
+	 */
+    virtual mraa::Result reopen() { return mraa::SUCCESS; }
+
+	/**
+	 * Current time as seen by the devices behind this transport
+	 */
+    virtual std::chrono::steady_clock::time_point now() { return std::chrono::steady_clock::now(); }
+
+	/**
+	 * Waits on the transport clock
+	 */
+    virtual void sleep(std::chrono::microseconds delay);
+
+	/**
+	 * False when now() and sleep() follow a virtual clock
+	 */
+    virtual bool realTime() const { return true; }
+};
+
+/**
+ * @brief Transport going to real hardware through mraa
+ */
+class MraaTransport : public SmartDriveTransport {
+
+public:
+	/**
+	 * Opens an I2C bus
+	 * @param i2c_bus Number of the I2C bus
+	 */
+    MraaTransport(int i2c_bus);
+
+    mraa::Result address(uint8_t address);
+    mraa::Result writeReg(uint8_t reg, uint8_t value);
+    mraa::Result write(const uint8_t* data, int size);
+    int readReg(uint8_t reg);
+    int readWordReg(uint8_t reg);
+    int readBytesReg(uint8_t reg, uint8_t* data, int size);
+    mraa::Result reopen();
+
+private:
+    int m_busNumber;
+    std::unique_ptr<mraa::I2c> m_i2c;
+};
+
+}
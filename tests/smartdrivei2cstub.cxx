@@ -0,0 +1,201 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+/*
+ * Round trip of the register blocks through the i2c-dev transport, on the
+ * kernel's i2c-stub module standing in for a SmartDrive.
+ *
+ * The stub only speaks SMBus, so the transport runs with force_smbus : bursts
+ * go out as SMBus I2C block transfers, split at SmartDriveI2cDev_SMBUS_BLOCK
+ * bytes. The combined I2C_RDWR path, and readMany() packing several bursts in
+ * one ioctl, need a real I2C adapter and are not exercised here.
+ *
+ * Build : g++ -std=c++11 -pthread -I.. smartdrivei2cstub.cxx ../smartdrive*.cxx -lmraa
+ * Usage : modprobe i2c-stub chip_addr=0x1b
+ *         smartdrivei2cstub [i2c_bus]
+ *
+ * Without a bus number the adapter named "SMBus stub driver" is looked up in
+ * sysfs. Exits with 77 (skipped) when there is none, else with the number of
+ * failed checks. The stub registers are overwritten.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "smartdrive.h"
+#include "smartdrivebus.h"
+#include "smartdrivei2cdev.h"
+
+using namespace upm;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __FUNCTION__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static const uint8_t Board = 0x1B;
+static const int PID_SIZE = SmartDrive_PASSTOLERANCE + 1 - SmartDrive_P_Kp;
+
+//bus number of the i2c-stub adapter, -1 when it is not loaded
+static int
+findStub() {
+    DIR* dir = opendir("/sys/class/i2c-adapter");
+    if (dir == NULL)
+        return -1;
+
+    int found = -1;
+    struct dirent* entry;
+    while (found < 0 && (entry = readdir(dir)) != NULL) {
+        int number;
+        if (sscanf(entry->d_name, "i2c-%d", &number) != 1)
+            continue;
+        std::string path = std::string("/sys/class/i2c-adapter/") + entry->d_name + "/name";
+        FILE* file = fopen(path.c_str(), "r");
+        if (file == NULL)
+            continue;
+        char name[64] = {0};
+        if (fgets(name, sizeof(name), file) != NULL && strncmp(name, "SMBus stub driver", 17) == 0)
+            found = number;
+        fclose(file);
+    }
+    closedir(dir);
+    return found;
+}
+
+static void
+testRawBlocks(I2cDevTransport& transport) {
+    //one burst longer than an SMBus block, written and read in two pieces
+    uint8_t frame[1 + SmartDrive_SNAPSHOT_SIZE];
+    frame[0] = SmartDrive_SNAPSHOT_START;
+    for (int i = 0; i < SmartDrive_SNAPSHOT_SIZE; i++)
+        frame[1 + i] = 0x80 + i * 3;
+
+    CHECK(transport.address(Board) == mraa::SUCCESS);
+    CHECK(transport.write(frame, sizeof(frame)) == mraa::SUCCESS);
+
+    uint8_t block[SmartDrive_SNAPSHOT_SIZE] = {0};
+    CHECK(transport.readBytesReg(SmartDrive_SNAPSHOT_START, block, sizeof(block)) == (int) sizeof(block));
+    CHECK(memcmp(block, frame + 1, sizeof(block)) == 0);
+
+    CHECK(transport.writeReg(SmartDrive_BATT_VOLTAGE, 0x2A) == mraa::SUCCESS);
+    CHECK(transport.readReg(SmartDrive_BATT_VOLTAGE) == 0x2A);
+    CHECK(transport.readWordReg(SmartDrive_POSITION_M1) == (frame[1] | (frame[2] << 8)));
+}
+
+static void
+testReadMany(I2cDevTransport& transport) {
+    uint8_t snapshot[SmartDrive_SNAPSHOT_SIZE] = {0};
+    uint8_t pid[PID_SIZE] = {0};
+    uint8_t expected[SmartDrive_SNAPSHOT_SIZE];
+    CHECK(transport.address(Board) == mraa::SUCCESS);
+    CHECK(transport.readBytesReg(SmartDrive_SNAPSHOT_START, expected, sizeof(expected)) == (int) sizeof(expected));
+
+    SmartDriveTransport::ReadSegment segments[2] = {
+        {Board, SmartDrive_SNAPSHOT_START, snapshot, (int) sizeof(snapshot), 0},
+        {Board, SmartDrive_P_Kp, pid, (int) sizeof(pid), 0},
+    };
+    CHECK(transport.readMany(segments, 2) == 2);
+    CHECK(segments[0].result == (int) sizeof(snapshot));
+    CHECK(segments[1].result == (int) sizeof(pid));
+    CHECK(memcmp(snapshot, expected, sizeof(snapshot)) == 0);
+    CHECK(memcmp(pid, expected + (SmartDrive_P_Kp - SmartDrive_SNAPSHOT_START), sizeof(pid)) == 0);
+}
+
+static void
+testDriver(std::shared_ptr<I2cDevTransport> transport) {
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(transport));
+    SmartDrive drive(bus, Board);
+
+    SmartDrive::PerformanceParameters params = {0x1234, 0x5678, 0x9ABC, 0x0102, 0x0304, 0x0506, 7, 8};
+    SmartDriveResult<uint8_t> written = drive.ApplyPerformanceParameters(params);
+    CHECK(written.ok());
+
+    SmartDriveResult<SmartDrive::PerformanceParameters> read = drive.ReadPerformanceParameters();
+    CHECK(read.ok());
+    if (read.ok()) {
+        SmartDrive::PerformanceParameters got = read.value();
+        CHECK(got.Kp_tacho == params.Kp_tacho && got.Ki_tacho == params.Ki_tacho && got.Kd_tacho == params.Kd_tacho);
+        CHECK(got.Kp_speed == params.Kp_speed && got.Ki_speed == params.Ki_speed && got.Kd_speed == params.Kd_speed);
+        CHECK(got.passcount == params.passcount && got.tolerance == params.tolerance);
+    }
+
+    //read back equal, nothing left to write
+    written = drive.ApplyPerformanceParameters(params);
+    CHECK(written.ok() && written.value() == 0);
+    params.tolerance = 9;
+    written = drive.ApplyPerformanceParameters(params);
+    CHECK(written.ok() && written.value() == 1);
+
+    uint8_t position[] = {SmartDrive_POSITION_M2, 0x78, 0x56, 0x34, 0x12};
+    CHECK(transport->address(Board) == mraa::SUCCESS);
+    CHECK(transport->write(position, sizeof(position)) == mraa::SUCCESS);
+
+    SmartDrive::Snapshot snap;
+    CHECK(drive.ReadSnapshot(snap));
+    CHECK(snap.valid);
+    CHECK(snap.position[1] == 0x12345678);
+    CHECK(snap.pid[0] == params.Kp_tacho && snap.pid[5] == params.Kd_speed);
+    CHECK(snap.passcount == params.passcount && snap.tolerance == 9);
+}
+
+int
+main(int argc, char** argv) {
+    int number = (argc > 1) ? atoi(argv[1]) : findStub();
+    if (number < 0) {
+        printf("i2c-stub not loaded, skipped (modprobe i2c-stub chip_addr=0x1b)\n");
+        return 77;
+    }
+
+    std::shared_ptr<I2cDevTransport> transport;
+    try {
+        transport.reset(new I2cDevTransport(number, true));
+    } catch (const std::invalid_argument& e) {
+        printf("%s, skipped\n", e.what());
+        return 77;
+    }
+    CHECK(!transport->combined());
+
+    testRawBlocks(*transport);
+    testReadMany(*transport);
+    testDriver(transport);
+    if (failures == 0)
+        printf("all tests passed on /dev/i2c-%d\n", number);
+    else
+        printf("%d checks failed\n", failures);
+    return failures;
+}
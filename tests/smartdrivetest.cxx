@@ -0,0 +1,1609 @@
+/*
+ * Author: Neuber Sousa <neuberfran@gmail.com>
+ * Below are the terms of usage of this file
+ *
+ * This is an upm implementation for SmartDrive from OpenElectrons.Com
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Regression tests of the driver and its helper classes against the simulator.
+ *
+ * Each test builds its own simulated bus. Most of them run on the virtual
+ * clock, the few checking thread interleavings run on the real one; the whole
+ * run takes about a second. Prints one line per failed check and exits with
+ * the number of failures.
+ *
+ * Build : g++ -std=c++11 -pthread -I.. smartdrivetest.cxx ../smartdrive*.cxx -lmraa
+ * Usage : smartdrivetest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "smartdrive.h"
+#include "smartdrivebus.h"
+#include "smartdrivecommander.h"
+#include "smartdrivecoordinator.h"
+#include "smartdrivediscovery.h"
+#include "smartdriveestimator.h"
+#include "smartdrivelog.h"
+#include "smartdriveloop.h"
+#include "smartdrivepid.h"
+#include "smartdrivepower.h"
+#include "smartdriveprofile.h"
+#include "smartdrivesampler.h"
+#include "smartdrivesim.h"
+#include "smartdriveshm.h"
+#include "smartdrivetrace.h"
+
+using namespace upm;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __FUNCTION__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static const uint8_t Board1 = 0x1B;
+static const uint8_t Board2 = 0x1A;
+
+static uint32_t
+peekLong(SmartDriveSimulator& sim, uint8_t address, uint8_t reg) {
+    return sim.PeekRegister(address, reg) | (sim.PeekRegister(address, reg + 1) << 8) |
+           (sim.PeekRegister(address, reg + 2) << 16) | ((uint32_t) sim.PeekRegister(address, reg + 3) << 24);
+}
+
+static uint16_t
+peekWord(SmartDriveSimulator& sim, uint8_t address, uint8_t reg) {
+    return sim.PeekRegister(address, reg) | (sim.PeekRegister(address, reg + 1) << 8);
+}
+
+static void
+settle(SmartDriveSimulator& sim, uint32_t ms) {
+    sim.Advance(std::chrono::milliseconds(ms));
+}
+
+static void
+testSnapshotDecode() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    sim->SetBatteryVoltage(Board1, 9000.0f);
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+    SmartDrive drive(bus, Board1);
+
+    CHECK(drive.SetPerformanceParameters(11, 22, 33, 44, 55, 66, 7, 8) == mraa::SUCCESS);
+    drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 40);
+    drive.Run_Unlimited(Motor_ID_2, Dir_Reverse, 60);
+    settle(*sim, 500);
+    //braked motors hold still, the registers cannot move between the burst and the peeks
+    CHECK(drive.StopMotor(Motor_ID_BOTH, Action_Brake) == mraa::SUCCESS);
+    settle(*sim, 10);
+
+    SmartDrive::Snapshot snap = SmartDrive::Snapshot();
+    CHECK(drive.ReadSnapshot(snap));
+    CHECK(snap.valid);
+    for (int m = 0; m < 2; m++) {
+        CHECK(snap.position[m] == peekLong(*sim, Board1, SmartDrive_POSITION_M1 + 4 * m));
+        CHECK(snap.status[m] == sim->PeekRegister(Board1, SmartDrive_STATUS_M1 + m));
+        CHECK(snap.tasks[m] == sim->PeekRegister(Board1, SmartDrive_TASKS_M1 + m));
+        CHECK(snap.current[m] == peekWord(*sim, Board1, SmartDrive_CURRENT_M1 + 2 * m));
+    }
+    CHECK((int32_t) snap.position[0] > 0);
+    CHECK((int32_t) snap.position[1] < 0);
+    for (int i = 0; i < 6; i++)
+        CHECK(snap.pid[i] == 11 * (i + 1));
+    CHECK(snap.passcount == 7);
+    CHECK(snap.tolerance == 8);
+    CHECK(snap.battVoltage == sim->PeekRegister(Board1, SmartDrive_BATT_VOLTAGE));
+    CHECK(snap.resetStatus == sim->PeekRegister(Board1, SmartDrive_RESETSTATUS));
+
+    //the calibrated battery reading comes from the same raw register
+    float mv = drive.BatteryMillivolts(snap.battVoltage);
+    CHECK(mv > 8800.0f && mv < 9200.0f);
+}
+
+static void
+testSyncGo() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    SmartDriveBus bus(sim);
+
+    //load both command blocks without their GO bit : nothing may start
+    uint8_t blocks[1 + 2 * SmartDrive_MOTOR_BLOCK_SIZE] = {SmartDrive_SETPT_M1};
+    for (int m = 0; m < 2; m++) {
+        uint8_t* block = &blocks[1 + m * SmartDrive_MOTOR_BLOCK_SIZE];
+        block[SmartDrive_SPEED_M1 - SmartDrive_SETPT_M1] = 50;
+        block[SmartDrive_CMD_A_M1 - SmartDrive_SETPT_M1] = SmartDrive_CONTROL_SPEED | SmartDrive_CONTROL_BRK;
+    }
+    CHECK(bus.write(Board1, blocks, sizeof(blocks)) == mraa::SUCCESS);
+    settle(*sim, 100);
+    CHECK(!(sim->PeekRegister(Board1, SmartDrive_STATUS_M1) & SmartDrive_MOTOR_IS_POWERED));
+    CHECK(!(sim->PeekRegister(Board1, SmartDrive_STATUS_M2) & SmartDrive_MOTOR_IS_POWERED));
+    CHECK(peekLong(*sim, Board1, SmartDrive_POSITION_M1) == 0);
+
+    //0x53 starts both loaded blocks at once
+    CHECK(bus.writeReg(Board1, SmartDrive_COMMAND, SmartDrive_SYNC_GO) == mraa::SUCCESS);
+    settle(*sim, 100);
+    for (int m = 0; m < 2; m++) {
+        CHECK(sim->PeekRegister(Board1, SmartDrive_STATUS_M1 + m) & SmartDrive_MOTOR_IS_POWERED);
+        CHECK(!(sim->PeekRegister(Board1, SmartDrive_CMD_A_M1 + m * SmartDrive_MOTOR_BLOCK_SIZE) & SmartDrive_CONTROL_GO));
+    }
+    uint32_t p1 = peekLong(*sim, Board1, SmartDrive_POSITION_M1);
+    uint32_t p2 = peekLong(*sim, Board1, SmartDrive_POSITION_M2);
+    CHECK((int32_t) p1 > 0);
+    CHECK(p1 == p2);
+
+    //the driver sends the same frame for a move of both motors
+    std::shared_ptr<SmartDriveSimulator> sim2(new SmartDriveSimulator());
+    sim2->AddBoard(Board1);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim2)), Board1);
+    CHECK(drive.Run_Unlimited(Motor_ID_BOTH, Dir_Forward, 50) == mraa::SUCCESS);
+    settle(*sim2, 100);
+    CHECK(peekLong(*sim2, Board1, SmartDrive_POSITION_M1) == peekLong(*sim2, Board1, SmartDrive_POSITION_M2));
+    CHECK(sim2->PeekRegister(Board1, SmartDrive_STATUS_M2) & SmartDrive_MOTOR_IS_POWERED);
+}
+
+static void
+testStatusAndTacho() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    sim->SetMotorModel(1000.0f, 0.05f);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+
+    //speed control : ramping first, then steady at half of the model speed
+    drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 50);
+    settle(*sim, 20);
+    uint8_t status = sim->PeekRegister(Board1, SmartDrive_STATUS_M1);
+    CHECK(status & SmartDrive_MOTOR_IS_POWERED);
+    CHECK(status & SmartDrive_MOTOR_CONTROL_ON);
+    CHECK(status & SmartDrive_MOTOR_IS_RAMPING);
+    settle(*sim, 1980);
+    status = sim->PeekRegister(Board1, SmartDrive_STATUS_M1);
+    CHECK(!(status & SmartDrive_MOTOR_IS_RAMPING));
+    //500 counts/s for 2 s, minus the lag of the time constant
+    int32_t position = (int32_t) peekLong(*sim, Board1, SmartDrive_POSITION_M1);
+    CHECK(position > 940 && position < 1000);
+
+    drive.StopMotor(Motor_ID_1, Action_Brake);
+    settle(*sim, 10);
+    status = sim->PeekRegister(Board1, SmartDrive_STATUS_M1);
+    CHECK(status & SmartDrive_MOTOR_IN_BRAKE_MODE);
+    CHECK(!(status & SmartDrive_MOTOR_IS_POWERED));
+
+    //timed move ends on its own
+    drive.Run_Seconds(Motor_ID_2, Dir_Forward, 30, 1, false, Action_Float);
+    settle(*sim, 100);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_STATUS_M2) & SmartDrive_MOTOR_IN_TIME_MODE);
+    settle(*sim, 1000);
+    CHECK(!(sim->PeekRegister(Board1, SmartDrive_STATUS_M2) & SmartDrive_MOTOR_IS_POWERED));
+
+    //tacho move integrates up to its target and holds there
+    drive.Run_Tacho(Motor_ID_1, 50, 2000, false, Action_BrakeHold);
+    settle(*sim, 100);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_STATUS_M1) & SmartDrive_MOTOR_POS_CTRL_ON);
+    CHECK(!drive.IsTachoDone(Motor_ID_1));
+    for (int i = 0; i < 100 && !drive.IsTachoDone(Motor_ID_1); i++)
+        settle(*sim, 100);
+    CHECK(drive.IsTachoDone(Motor_ID_1));
+    position = (int32_t) drive.ReadTachometerPosition(Motor_ID_1);
+    CHECK(abs(position - 2000) <= 10);
+
+    //a stalled shaft stops counting and is reported
+    sim->SetStalled(Board1, Motor_ID_2, true);
+    drive.Run_Unlimited(Motor_ID_2, Dir_Forward, 80);
+    uint32_t before = peekLong(*sim, Board1, SmartDrive_POSITION_M2);
+    settle(*sim, 500);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_STATUS_M2) & SmartDrive_MOTOR_IS_STALLED);
+    CHECK(peekLong(*sim, Board1, SmartDrive_POSITION_M2) == before);
+}
+
+static void
+testBusRetry() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    SmartDriveBus bus(sim);
+    int battery = bus.readReg(Board1, SmartDrive_BATT_VOLTAGE);
+    CHECK(battery > 0);
+
+    //one error is absorbed by a retry
+    bus.ResetStats();
+    sim->InjectErrors(1);
+    CHECK(bus.readReg(Board1, SmartDrive_BATT_VOLTAGE) == battery);
+    SmartDriveBus::Stats stats = bus.GetStats();
+    CHECK(stats.retries == 1);
+    CHECK(stats.recovered == 1);
+    CHECK(stats.failed_calls == 0);
+
+    //more errors than attempts fail the call
+    bus.ResetStats();
+    sim->InjectErrors(SmartDriveBus_RETRY_ATTEMPTS);
+    CHECK(bus.readReg(Board1, SmartDrive_BATT_VOLTAGE) < 0);
+    stats = bus.GetStats();
+    CHECK(stats.retries == SmartDriveBus_RETRY_ATTEMPTS - 1);
+    CHECK(stats.failed_calls == 1);
+    CHECK(bus.readReg(Board1, SmartDrive_BATT_VOLTAGE) == battery);
+
+    //a write which must not be applied twice is not retried
+    bus.ResetStats();
+    sim->InjectErrors(1);
+    CHECK(bus.writeReg(Board1, SmartDrive_COMMAND, SmartDrive_SYNC_GO, false) != mraa::SUCCESS);
+    stats = bus.GetStats();
+    CHECK(stats.retries == 0);
+    CHECK(stats.failed_calls == 1);
+
+    //an absent board fails without holding the others back
+    uint8_t present[4], absent[4];
+    SmartDriveBus::BatchOp ops[2] = {
+        {0x19, SmartDrive_FIRMWARE_VERSION, 0, absent, 4, 0, {}, false},
+        {Board1, SmartDrive_FIRMWARE_VERSION, 0, present, 4, 0, {}, false}};
+    bus.batch(ops, 2);
+    CHECK(ops[0].result != 4);
+    CHECK(ops[1].result == 4);
+}
+
+static void
+testFailedMove() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+
+    //a go is tried once : the failed command is reported and never waited for
+    std::chrono::steady_clock::time_point start = sim->now();
+    sim->InjectErrors(1);
+    CHECK(drive.Run_Tacho(Motor_ID_1, 50, 2000, true, Action_Brake) != mraa::SUCCESS);
+    CHECK(sim->now() - start < std::chrono::milliseconds(10));
+    CHECK(!(sim->PeekRegister(Board1, SmartDrive_STATUS_M1) & SmartDrive_MOTOR_IS_POWERED));
+
+    sim->InjectErrors(1);
+    CHECK(drive.Run_Seconds(Motor_ID_2, Dir_Forward, 50, 1, true, Action_Brake) != mraa::SUCCESS);
+    CHECK(sim->now() - start < std::chrono::milliseconds(20));
+
+    sim->InjectErrors(1);
+    std::future<SmartDrive::WaitResult> move = drive.Run_Degrees_Async(Motor_ID_1, Dir_Forward, 50, 360, Action_Brake);
+    bool thrown = false;
+    try {
+        move.get();
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    //the same calls succeed once the bus is back
+    CHECK(drive.Run_Degrees(Motor_ID_1, Dir_Forward, 50, 360, true, Action_Brake) == mraa::SUCCESS);
+    CHECK(drive.GetLastWaitResult().completed);
+    CHECK(abs((int32_t) drive.ReadTachometerPosition(Motor_ID_1) - 360) <= 10);
+    CHECK(drive.Run_Rotations_Async(Motor_ID_1, Dir_Reverse, 50, 1, Action_Brake).get().completed);
+}
+
+static void
+testAdaptiveWait() {
+    //reference end of a tacho move : the busy bit watched 1 ms at a time
+    uint32_t reference_ms = 0;
+    {
+        std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+        sim->AddBoard(Board1);
+        sim->SetMotorModel(1000.0f, 0.05f);
+        SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+        CHECK(drive.Run_Tacho(Motor_ID_1, 50, 1500, false, Action_Brake) == mraa::SUCCESS);
+        //the status shows the move a little after the command
+        bool busy = false;
+        while (reference_ms < 10000 && (!busy || (sim->PeekRegister(Board1, SmartDrive_STATUS_M1) & SmartDrive_MOTOR_POS_CTRL_ON))) {
+            busy |= (sim->PeekRegister(Board1, SmartDrive_STATUS_M1) & SmartDrive_MOTOR_POS_CTRL_ON) != 0;
+            settle(*sim, 1);
+            reference_ms++;
+        }
+        CHECK(reference_ms > 2000 && reference_ms < 10000);
+    }
+
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    sim->SetMotorModel(1000.0f, 0.05f);
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+    SmartDrive drive(bus, Board1);
+
+    //the same move waited for : seen done within a few ms, without polling all along
+    CHECK(drive.Run_Tacho(Motor_ID_1, 50, 1500, true, Action_Brake) == mraa::SUCCESS);
+    SmartDrive::WaitResult wait = drive.GetLastWaitResult();
+    CHECK(wait.completed);
+    CHECK(wait.latency_us + 2000 >= reference_ms * 1000);
+    CHECK(wait.polls > 0 && wait.polls < 30);
+    CHECK(abs((int32_t) drive.ReadTachometerPosition(Motor_ID_1) - 1500) <= 10);
+
+    //a timed move ends on the board's own clock, no settle second on top
+    CHECK(drive.Run_Seconds(Motor_ID_2, Dir_Forward, 30, 1, true, Action_Float) == mraa::SUCCESS);
+    wait = drive.GetLastWaitResult();
+    CHECK(wait.completed);
+    CHECK(wait.polls > 0 && wait.polls < 20);
+
+    //nothing running : one read and back
+    std::chrono::steady_clock::time_point start = bus->now();
+    wait = drive.WaitUntilTimeDone(Motor_ID_BOTH);
+    CHECK(wait.completed && wait.polls == 1);
+    CHECK(bus->now() - start < std::chrono::milliseconds(5));
+
+    //a stalled move gives up at its timeout
+    sim->SetStalled(Board1, Motor_ID_1, true);
+    CHECK(drive.Run_Tacho(Motor_ID_1, 50, 5000, false, Action_Brake) == mraa::SUCCESS);
+    start = bus->now();
+    wait = drive.WaitUntilTachoDone(Motor_ID_1, 300);
+    CHECK(!wait.completed);
+    CHECK(bus->now() - start >= std::chrono::milliseconds(300));
+    CHECK(bus->now() - start < std::chrono::milliseconds(320));
+    drive.StopMotor(Motor_ID_1, Action_Float);
+}
+
+//counts the snapshot bursts, and holds the poller's sleeps while moves are
+//being issued : on a virtual clock they would move time under the caller
+class AsyncSimulator : public SmartDriveSimulator {
+public:
+    AsyncSimulator() : snapshots(0), hold(false) {}
+    int readBytesReg(uint8_t reg, uint8_t* data, int size) {
+        if (reg == SmartDrive_SNAPSHOT_START && size == SmartDrive_SNAPSHOT_SIZE)
+            snapshots++;
+        return SmartDriveSimulator::readBytesReg(reg, data, size);
+    }
+    void sleep(std::chrono::microseconds delay) {
+        while (hold)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        SmartDriveSimulator::sleep(delay);
+    }
+    std::atomic<unsigned> snapshots;
+    std::atomic<bool> hold;
+};
+
+static void
+testAsyncMoves() {
+    std::shared_ptr<AsyncSimulator> sim(new AsyncSimulator());
+    sim->AddBoard(Board1);
+    sim->SetMotorModel(1000.0f, 0.05f);
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+    SmartDrive drive(bus, Board1);
+
+    //two moves of one board are resolved from the same status reads
+    unsigned before = sim->snapshots;
+    sim->hold = true;
+    std::future<SmartDrive::WaitResult> timed = drive.Run_Seconds_Async(Motor_ID_1, Dir_Forward, 30, 2, Action_Brake);
+    std::future<SmartDrive::WaitResult> tacho = drive.Run_Tacho_Async(Motor_ID_2, 50, 300, Action_Brake);
+    sim->hold = false;
+    SmartDrive::WaitResult first = tacho.get();
+    SmartDrive::WaitResult second = timed.get();
+    unsigned reads = sim->snapshots - before;
+    CHECK(first.completed && second.completed);
+    CHECK(first.latency_us < second.latency_us);
+    CHECK(second.latency_us >= 1990000 && second.latency_us <= 2010000);
+    CHECK(reads == second.polls);
+    CHECK(reads < first.polls + second.polls);
+    CHECK(abs((int32_t) drive.ReadTachometerPosition(Motor_ID_2) - 300) <= 10);
+
+    //a stalled move resolves at its timeout, as not completed
+    sim->SetStalled(Board1, Motor_ID_1, true);
+    std::future<SmartDrive::WaitResult> stalled = drive.Run_Tacho_Async(Motor_ID_1, 50, 5000, Action_Brake, 200);
+    SmartDrive::WaitResult late = stalled.get();
+    CHECK(!late.completed);
+    CHECK(late.latency_us >= 200000 && late.latency_us < 220000);
+    drive.StopMotor(Motor_ID_1, Action_Float);
+    sim->SetStalled(Board1, Motor_ID_1, false);
+
+    //moves of another board on the same bus, each board polling its own
+    sim->AddBoard(Board2);
+    std::future<SmartDrive::WaitResult> outstanding;
+    {
+        SmartDrive other(bus, Board2);
+        sim->hold = true;
+        std::future<SmartDrive::WaitResult> a = drive.Run_Tacho_Async(Motor_ID_1, 50, 200, Action_Brake);
+        std::future<SmartDrive::WaitResult> b = other.Run_Tacho_Async(Motor_ID_BOTH, 50, 400, Action_Brake);
+        sim->hold = false;
+        CHECK(a.get().completed);
+        CHECK(b.get().completed);
+        CHECK(abs((int32_t) other.ReadTachometerPosition(Motor_ID_1) - 400) <= 10);
+        CHECK(abs((int32_t) other.ReadTachometerPosition(Motor_ID_2) - 400) <= 10);
+
+        //a move left outstanding resolves when its drive goes away
+        outstanding = other.Run_Seconds_Async(Motor_ID_1, Dir_Forward, 30, 10, Action_Float);
+    }
+    CHECK(outstanding.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    CHECK(!outstanding.get().completed);
+}
+
+//lets a thread pacing itself on the virtual clock sleep a given number of times
+//then holds it, so that it cannot run ahead of the test
+class PacedSimulator : public SmartDriveSimulator {
+public:
+    PacedSimulator() : allowed(0), open(false) {}
+    void sleep(std::chrono::microseconds delay) {
+        while (allowed <= 0 && !open)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        allowed--;
+        SmartDriveSimulator::sleep(delay);
+    }
+    std::atomic<int> allowed;
+    std::atomic<bool> open;
+};
+
+//runs the sampler for a number of ticks
+static void
+sampleTicks(PacedSimulator& sim, SmartDriveSampler& sampler, int ticks) {
+    SmartDriveSampler::Stats stats = sampler.GetStats();
+    uint64_t target = stats.samples + stats.overruns + ticks;
+    sim.open = false;
+    sim.allowed = ticks - 1;
+    sampler.Start();
+    for (int i = 0; i < 5000; i++) {
+        stats = sampler.GetStats();
+        if (stats.samples + stats.overruns >= target)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    sim.open = true;
+    sampler.Stop();
+}
+
+static void
+testSampler() {
+    std::shared_ptr<PacedSimulator> sim(new PacedSimulator());
+    sim->AddBoard(Board1);
+    sim->SetMotorModel(1000.0f, 0.05f);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+    CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 50) == mraa::SUCCESS);
+    settle(*sim, 10);
+
+    //200 Hz on the virtual clock : one record every 5 ms exactly, the position climbing
+    {
+        SmartDriveSampler sampler(drive, 200, 1024);
+        sampleTicks(*sim, sampler, 200);
+
+        SmartDriveSampler::Stats stats = sampler.GetStats();
+        CHECK(stats.samples >= 200 && stats.samples <= 202);
+        CHECK(stats.overruns == 0 && stats.read_errors == 0 && stats.late_ticks == 0);
+        SmartDriveSampler::Span span = sampler.Peek();
+        CHECK(span.size == stats.samples);
+        for (size_t i = 0; i < span.size; i++) {
+            CHECK(span.data[i].valid);
+            CHECK(span.data[i].status[0] & SmartDrive_MOTOR_IS_POWERED);
+            if (i > 0) {
+                CHECK(span.data[i].timestamp_ns - span.data[i - 1].timestamp_ns == 5000000);
+                CHECK(span.data[i].position[0] >= span.data[i - 1].position[0]);
+            }
+        }
+        CHECK(span.data[span.size - 1].position[0] > span.data[0].position[0]);
+        sampler.Release(span.size);
+        CHECK(sampler.Peek().size == 0);
+    }
+
+    //a consumer falling behind : the ring keeps the oldest samples, the rest is counted
+    SmartDriveSampler sampler(drive, 200, 8);
+    sampleTicks(*sim, sampler, 12);
+    SmartDriveSampler::Stats stats = sampler.GetStats();
+    CHECK(stats.samples == 8);
+    CHECK(stats.overruns >= 4);
+    SmartDriveSampler::Span span = sampler.Peek();
+    CHECK(span.size == 8);
+    uint64_t last = span.data[4].timestamp_ns;
+    sampler.Release(5);
+
+    //wrapping around : the samples are handed out in two runs, up to the end of the ring first
+    sampleTicks(*sim, sampler, 8);
+    CHECK(sampler.GetStats().samples == 13);
+    span = sampler.Peek();
+    CHECK(span.size == 3);
+    CHECK(span.data[0].timestamp_ns > last);
+    last = span.data[2].timestamp_ns;
+    sampler.Release(3);
+    span = sampler.Peek();
+    CHECK(span.size == 5);
+    CHECK(span.data[0].timestamp_ns > last);
+    for (size_t i = 1; i < span.size; i++)
+        CHECK(span.data[i].timestamp_ns - span.data[i - 1].timestamp_ns == 5000000);
+    sampler.Release(5);
+    CHECK(sampler.Peek().size == 0);
+    drive.StopMotor(Motor_ID_1, Action_Float);
+}
+
+static void
+testLogReplay() {
+    char path[] = "/tmp/smartdrivetest-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+    close(fd);
+
+    //100 records over several index blocks, one of them a failed read
+    std::shared_ptr<PacedSimulator> sim(new PacedSimulator());
+    sim->AddBoard(Board1);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+    drive.SetPowerCalibration(100.0f);
+    std::vector<SmartDriveSample> samples(100);
+    {
+        SmartDriveLogWriter writer(path, drive, 16);
+        for (size_t i = 0; i < samples.size(); i++) {
+            SmartDriveSample& sample = samples[i];
+            memset(&sample, 0, sizeof(sample));
+            sample.timestamp_ns = 1000 + i * 5000000ULL;
+            sample.position[0] = (int32_t) (i * 7);
+            sample.position[1] = -(int32_t) i;
+            sample.current[0] = (uint16_t) (100 + i);
+            sample.status[0] = (i < 50) ? SmartDrive_MOTOR_IN_TIME_MODE : 0;
+            sample.status[1] = (i < 80) ? SmartDrive_MOTOR_POS_CTRL_ON : 0;
+            sample.battVoltage = (uint8_t) (80 + i);
+            sample.valid = (i != 37);
+            writer.Append(sample);
+        }
+        CHECK(writer.GetRecordCount() == samples.size());
+    }
+
+    SmartDriveLogReader reader(path);
+    CHECK(reader.GetRecordCount() == samples.size());
+    CHECK(reader.GetHeader().records_per_block == 16);
+    CHECK(reader.GetHeader().voltage_multiplier == 100.0);
+    for (size_t i = 0; i < samples.size(); i++) {
+        CHECK(memcmp(&reader.GetRecord(i), &samples[i], sizeof(SmartDriveSample)) == 0);
+        //the index blocks find exact times and the record following a time in between
+        CHECK(reader.Seek(samples[i].timestamp_ns) == i);
+        CHECK(reader.Seek(samples[i].timestamp_ns + 1) == i + 1);
+    }
+    CHECK(reader.Seek(0) == 0);
+
+    //the getters answer from the records, like SmartDrive's from the registers
+    SmartDriveReplay replay(reader);
+    CHECK(replay.ReadTachometerPosition(Motor_ID_1) == (uint32_t) -1);
+    for (size_t i = 0; replay.Next(); i++) {
+        CHECK(replay.GetTimestamp() == samples[i].timestamp_ns);
+        if (i == 37) {
+            CHECK(replay.ReadTachometerPosition(Motor_ID_1) == (uint32_t) -1);
+            CHECK(replay.GetMotorStatus(Motor_ID_1) == 0xFF);
+            CHECK(replay.GetBattVoltage() < 0);
+            CHECK(!replay.IsTimeDone(Motor_ID_1) && !replay.IsTachoDone(Motor_ID_2));
+            continue;
+        }
+        CHECK(replay.ReadTachometerPosition(Motor_ID_1) == (uint32_t) samples[i].position[0]);
+        CHECK(replay.ReadTachometerPosition(Motor_ID_2) == (uint32_t) samples[i].position[1]);
+        CHECK(replay.GetMotorStatus(Motor_ID_2) == samples[i].status[1]);
+        CHECK(fabsf(replay.GetBattVoltage() - samples[i].battVoltage * 100.0f) < 0.01f);
+        CHECK(replay.IsTimeDone(Motor_ID_1) == (i >= 50));
+        CHECK(replay.IsTachoDone(Motor_ID_BOTH) == (i >= 80));
+    }
+    CHECK(replay.SeekTime(samples[60].timestamp_ns - 1));
+    CHECK(replay.ReadTachometerPosition(Motor_ID_1) == (uint32_t) samples[60].position[0]);
+    CHECK(replay.Next() && replay.GetTimestamp() == samples[61].timestamp_ns);
+    CHECK(!replay.SeekTime(samples[99].timestamp_ns + 1));
+
+    //straight from a sampler ring
+    {
+        CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 50) == mraa::SUCCESS);
+        settle(*sim, 10);
+        SmartDriveSampler sampler(drive, 200, 64);
+        sampleTicks(*sim, sampler, 20);
+        SmartDriveLogWriter writer(path, 8);
+        size_t appended = writer.AppendFrom(sampler);
+        CHECK(appended == sampler.GetStats().samples);
+        CHECK(sampler.Peek().size == 0);
+        writer.Close();
+
+        SmartDriveLogReader recorded(path);
+        CHECK(recorded.GetRecordCount() == appended);
+        for (uint64_t i = 1; i < recorded.GetRecordCount(); i++) {
+            CHECK(recorded.GetRecord(i).valid);
+            CHECK(recorded.GetRecord(i).timestamp_ns - recorded.GetRecord(i - 1).timestamp_ns == 5000000);
+            CHECK(recorded.GetRecord(i).position[0] >= recorded.GetRecord(i - 1).position[0]);
+        }
+        CHECK(appended >= 20 && recorded.GetRecord(appended - 1).position[0] > recorded.GetRecord(0).position[0]);
+        drive.StopMotor(Motor_ID_1, Action_Float);
+    }
+
+    //anything else is refused
+    fd = open(path, O_WRONLY | O_TRUNC);
+    char page[SmartDriveLog_HEADER_SIZE] = {0};
+    CHECK(fd >= 0 && write(fd, page, sizeof(page)) == (ssize_t) sizeof(page));
+    close(fd);
+    bool refused = false;
+    try {
+        SmartDriveLogReader garbage(path);
+    } catch (const std::invalid_argument&) {
+        refused = true;
+    }
+    CHECK(refused);
+    unlink(path);
+}
+
+static void
+testStreamer() {
+    for (int shape = Profile_Trapezoid; shape <= Profile_SCurve; shape++) {
+        std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+        sim->AddBoard(Board1);
+        sim->SetMotorModel(1000.0f, 0.05f);
+        std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+        SmartDrive drive(bus, Board1);
+
+        SmartDriveProfile profile((SmartDriveProfileShape) shape, -2000, 800.0f, 2000.0f);
+        CHECK(profile.GetPeakVelocity() <= 800.0f);
+        float position, velocity;
+        profile.Sample(profile.GetDuration(), position, velocity);
+        CHECK(fabsf(position + 2000.0f) < 0.5f);
+        CHECK(fabsf(velocity) < 0.5f);
+
+        SmartDriveStreamer streamer(drive, Motor_ID_1, 100, 10.0f);
+        std::chrono::steady_clock::time_point start = bus->now();
+        CHECK(streamer.Start(profile, Action_Brake) == mraa::SUCCESS);
+        CHECK(streamer.Start(profile, Action_Brake) == mraa::ERROR_INVALID_RESOURCE);
+        streamer.Wait();
+        CHECK(streamer.IsDone());
+        //one setpoint per 10 ms tick, and the stream takes the length of the profile
+        float elapsed = std::chrono::duration<float>(bus->now() - start).count();
+        CHECK(fabsf(elapsed - profile.GetDuration()) < 0.05f);
+        SmartDriveStreamer::Stats stats = streamer.GetStats();
+        CHECK(llabs((long long) stats.frames - (long long) (profile.GetDuration() * 100)) <= 2);
+        CHECK(stats.write_errors == 0);
+        CHECK(stats.late_ticks == 0);
+        CHECK(stats.underruns == 0);
+
+        CHECK(drive.WaitUntilTachoDone(Motor_ID_1, 5000).completed);
+        CHECK(abs((int32_t) drive.ReadTachometerPosition(Motor_ID_1) + 2000) <= 10);
+    }
+}
+
+//records the sleeps of the driver, a slow bus makes every setpoint write overrun its tick
+class SleepCheckSimulator : public SmartDriveSimulator {
+public:
+    SleepCheckSimulator(uint32_t bus_hz) : SmartDriveSimulator(true, bus_hz), nonPositive(0) {}
+    void sleep(std::chrono::microseconds delay) {
+        if (delay.count() <= 0)
+            nonPositive++;
+        SmartDriveSimulator::sleep(delay);
+    }
+    std::atomic<int> nonPositive;
+};
+
+static void
+testStreamerLate() {
+    //about 12 ms per setpoint write at 10 kHz, the period is 5 ms
+    std::shared_ptr<SleepCheckSimulator> sim(new SleepCheckSimulator(10000));
+    sim->AddBoard(Board1);
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+    SmartDrive drive(bus, Board1);
+
+    SmartDriveProfile profile(Profile_Trapezoid, 1000, 800.0f, 2000.0f);
+    SmartDriveStreamer streamer(drive, Motor_ID_1, 200, 10.0f);
+    std::chrono::steady_clock::time_point start = bus->now();
+    CHECK(streamer.Start(profile, Action_Brake) == mraa::SUCCESS);
+    streamer.Wait();
+    SmartDriveStreamer::Stats stats = streamer.GetStats();
+    CHECK(stats.late_ticks > 0);
+    CHECK(stats.frames > 0);
+    CHECK(sim->nonPositive == 0);
+    CHECK(bus->now() > start);
+}
+
+static void
+testCoordinator() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    for (uint8_t address = 0x10; address < 0x13; address++)
+        sim->AddBoard(address);
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+    SmartDrive d1(bus, 0x10), d2(bus, 0x11), d3(bus, 0x12);
+
+    SmartDriveCoordinator coordinator;
+    coordinator.AddTacho(d1, Motor_ID_BOTH, 50, 1000, false, Action_Brake);
+    coordinator.AddTacho(d2, Motor_ID_1, 80, -500, true, Action_Brake);
+    coordinator.AddTacho(d3, Motor_ID_2, 30, 300, true, Action_Brake);
+    coordinator.AddSeconds(d3, Motor_ID_1, Dir_Reverse, 40, 1, Action_Brake);
+    //preloading does not start anything
+    CHECK(coordinator.Start() == mraa::SUCCESS);
+    const SmartDriveCoordinator::Stats& stats = coordinator.GetStats();
+    CHECK(stats.boards == 3);
+    //three single byte go writes : two transactions between the first and the last board
+    CHECK(stats.start_skew_us > 0 && stats.start_skew_us < 1000);
+    CHECK(stats.transaction_us == stats.start_skew_us / 2);
+    CHECK(stats.preload_us > stats.start_skew_us);
+
+    CHECK(coordinator.WaitUntilDone(10000));
+    CHECK(stats.sweeps > 1);
+    //the slowest axis is the 1000 counts at speed 50
+    CHECK(stats.completion_us > 1800000 && stats.completion_us < 2600000);
+    CHECK(abs((int32_t) d1.ReadTachometerPosition(Motor_ID_1) - 1000) <= 10);
+    CHECK(abs((int32_t) d1.ReadTachometerPosition(Motor_ID_2) - 1000) <= 10);
+    CHECK(abs((int32_t) d2.ReadTachometerPosition(Motor_ID_1) + 500) <= 10);
+    CHECK(d2.ReadTachometerPosition(Motor_ID_2) == 0);
+    CHECK(abs((int32_t) d3.ReadTachometerPosition(Motor_ID_2) - 300) <= 10);
+    CHECK((int32_t) d3.ReadTachometerPosition(Motor_ID_1) < -300);
+
+    //a done sweep keeps reporting done without touching the bus
+    uint64_t transactions = bus->GetStats().transactions;
+    CHECK(coordinator.Sweep());
+    CHECK(bus->GetStats().transactions == transactions);
+}
+
+//logs the register writes which start or stop a motor
+class CommandLogSimulator : public SmartDriveSimulator {
+public:
+    CommandLogSimulator() : SmartDriveSimulator(false) {}
+    mraa::Result writeReg(uint8_t reg, uint8_t value) {
+        if (reg == SmartDrive_COMMAND || (reg == SmartDrive_CMD_A_M1 && (value & SmartDrive_CONTROL_GO)))
+            record(value == SmartDrive_SYNC_GO || reg == SmartDrive_CMD_A_M1 ? 'G' : 'S');
+        return SmartDriveSimulator::writeReg(reg, value);
+    }
+    mraa::Result write(const uint8_t* data, int size) {
+        //a motor block without its GO bit is a preload
+        if (data[0] == SmartDrive_SETPT_M1 && size > SmartDrive_CMD_A_M1 - SmartDrive_SETPT_M1)
+            record((data[1 + SmartDrive_CMD_A_M1 - SmartDrive_SETPT_M1] & SmartDrive_CONTROL_GO) ? 'G' : 'P');
+        return SmartDriveSimulator::write(data, size);
+    }
+    std::string log() {
+        std::lock_guard<std::mutex> lock(m_logLock);
+        return m_log;
+    }
+private:
+    void record(char c) {
+        std::lock_guard<std::mutex> lock(m_logLock);
+        m_log += c;
+    }
+    std::mutex m_logLock;
+    std::string m_log;
+};
+
+static void
+testCoordinatorStopRace() {
+    std::shared_ptr<CommandLogSimulator> sim(new CommandLogSimulator());
+    sim->AddBoard(Board1);
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+    SmartDrive drive(bus, Board1);
+
+    std::atomic<bool> stopping(true);
+    std::thread stopper([&] {
+        while (stopping)
+            drive.StopMotor(Motor_ID_BOTH, Action_Brake);
+    });
+    for (int i = 0; i < 200; i++) {
+        SmartDriveCoordinator coordinator;
+        coordinator.AddTacho(drive, Motor_ID_1, 50, 100, true, Action_Brake);
+        //leaves the stopper a real time window between the preload and the go
+        coordinator.Start(1000);
+    }
+    stopping = false;
+    stopper.join();
+
+    //every preload is directly followed by its go, never by a stop
+    std::string log = sim->log();
+    CHECK(log.find('P') != std::string::npos);
+    CHECK(log.find("PS") == std::string::npos);
+    size_t preloads = 0, gos = 0;
+    for (size_t i = 0; i < log.size(); i++) {
+        preloads += log[i] == 'P';
+        gos += log[i] == 'G';
+    }
+    CHECK(preloads == 200 && gos == 200);
+}
+
+static void
+testEstimator() {
+    //speed 50 of a 1000 counts/s model : 10 counts/s per speed unit
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    sim->SetMotorModel(1000.0f, 0.05f);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+    SmartDriveEstimator estimator(Motor_ID_1, 10.0f);
+
+    //spinning up and running steady at 500 counts/s raises nothing
+    CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 50) == mraa::SUCCESS);
+    estimator.SetCommand(50, Dir_Forward);
+    uint8_t events = 0;
+    for (int i = 0; i < 500; i++) {
+        settle(*sim, 2);
+        events |= estimator.Update(drive.ReadSnapshot());
+    }
+    SmartDriveEstimator::Estimate estimate = estimator.GetEstimate();
+    CHECK(events == 0);
+    CHECK(fabsf(estimate.velocity - 500.0f) < 15.0f);
+    CHECK(fabsf(estimate.acceleration) < 500.0f);
+    CHECK(estimate.expected_velocity == 500.0f);
+    CHECK(estimate.time_to_stall_ms < 0 || estimate.time_to_stall_ms > 1000);
+    CHECK(llabs(estimate.position - (int32_t) drive.ReadTachometerPosition(Motor_ID_1)) <= 2);
+
+    //a blocked shaft is predicted within a few samples, the firmware flag is reported too
+    sim->SetStalled(Board1, Motor_ID_1, true);
+    int predicted_ms = -1;
+    events = 0;
+    for (int ms = 2; ms <= 100 && predicted_ms < 0; ms += 2) {
+        settle(*sim, 2);
+        events |= estimator.Update(drive.ReadSnapshot());
+        if (events & Est_StallPredicted)
+            predicted_ms = ms;
+    }
+    CHECK(predicted_ms > 0 && predicted_ms <= 30);
+    CHECK(events & Est_Stalled);
+    CHECK(estimator.GetEstimate().time_to_stall_ms == 0);
+    drive.StopMotor(Motor_ID_1, Action_Float);
+
+    //a load building up over 200 ms : predicted ahead of the velocity actually
+    //dropping under the stall ratio (150 counts/s, 140 ms in)
+    SmartDriveEstimator gradual(Motor_ID_2, 10.0f);
+    gradual.SetCommand(50, Dir_Reverse);
+    uint64_t t = 1000000000ULL;
+    float position = 0;
+    for (int i = 0; i < 200; i++, t += 2000000) {
+        position -= 1.0f;
+        CHECK(gradual.Update(t, (uint32_t) (int32_t) lroundf(position), 300, SmartDrive_MOTOR_IS_POWERED) == 0);
+    }
+    CHECK(fabsf(gradual.GetEstimate().velocity + 500.0f) < 5.0f);
+    predicted_ms = -1;
+    for (int ms = 2; ms <= 200; ms += 2, t += 2000000) {
+        float velocity = 500.0f * (1.0f - ms / 200.0f);
+        position -= velocity * 0.002f;
+        uint16_t current = (uint16_t) (300 + 11 * ms);
+        uint8_t raised = gradual.Update(t, (uint32_t) (int32_t) lroundf(position), current,
+                                        SmartDrive_MOTOR_IS_POWERED | ((ms == 200) ? SmartDrive_MOTOR_IS_STALLED : 0));
+        if ((raised & Est_StallPredicted) && predicted_ms < 0)
+            predicted_ms = ms;
+        if (ms == 200)
+            CHECK(raised & Est_Stalled);
+    }
+    CHECK(predicted_ms > 0 && predicted_ms < 140);
+
+    //load gone : the prediction clears after the confirmation samples
+    for (int i = 0; i < 100; i++, t += 2000000) {
+        position -= 1.0f;
+        gradual.Update(t, (uint32_t) (int32_t) lroundf(position), 300, SmartDrive_MOTOR_IS_POWERED);
+    }
+    CHECK(gradual.GetEstimate().events == 0);
+
+    //the tacho wraps around, the estimate does not
+    SmartDriveEstimator wrap(Motor_ID_1, 10.0f);
+    wrap.SetCommand(50, Dir_Forward);
+    uint32_t raw = 0xFFFFFF00u;
+    for (int i = 0; i < 200; i++, t += 2000000, raw += 1)
+        wrap.Update(t, raw, 300, SmartDrive_MOTOR_IS_POWERED);
+    CHECK(fabsf(wrap.GetEstimate().velocity - 500.0f) < 5.0f);
+    CHECK(wrap.GetEstimate().position == (int64_t) (int32_t) 0xFFFFFF00u + 199);
+
+    //overload raised from the current trend, and cleared once it falls back
+    SmartDriveEstimator::Config config = SmartDriveEstimator::DefaultConfig();
+    config.overload_current = 2000;
+    wrap.SetConfig(config);
+    events = 0;
+    for (int i = 0; i < 100; i++, t += 2000000, raw += 1)
+        events |= wrap.Update(t, raw, (uint16_t) (300 + 30 * i), SmartDrive_MOTOR_IS_POWERED);
+    CHECK(events == Est_Overload);
+    CHECK(wrap.GetEstimate().events & Est_Overload);
+    for (int i = 0; i < 100; i++, t += 2000000, raw += 1)
+        wrap.Update(t, raw, 300, SmartDrive_MOTOR_IS_POWERED);
+    CHECK(!(wrap.GetEstimate().events & Est_Overload));
+
+    //one estimator per motor
+    bool refused = false;
+    try {
+        SmartDriveEstimator both(Motor_ID_BOTH, 10.0f);
+    } catch (const std::invalid_argument&) {
+        refused = true;
+    }
+    CHECK(refused);
+}
+
+//logs the register and size of every write, and can ignore one register like a
+//board refusing a value
+class WriteLogSimulator : public SmartDriveSimulator {
+public:
+    WriteLogSimulator() : drop(-1), reads(0) {}
+    mraa::Result writeReg(uint8_t reg, uint8_t value) {
+        writes.push_back(std::make_pair(reg, 1));
+        if (reg == drop)
+            return mraa::SUCCESS;
+        return SmartDriveSimulator::writeReg(reg, value);
+    }
+    mraa::Result write(const uint8_t* data, int size) {
+        writes.push_back(std::make_pair(data[0], size - 1));
+        if (drop >= data[0] && drop < data[0] + size - 1) {
+            uint8_t kept[64];
+            memcpy(kept, data, size);
+            kept[1 + drop - data[0]] = PeekRegister(Board1, drop);
+            return SmartDriveSimulator::write(kept, size);
+        }
+        return SmartDriveSimulator::write(data, size);
+    }
+    int readBytesReg(uint8_t reg, uint8_t* data, int size) {
+        reads++;
+        return SmartDriveSimulator::readBytesReg(reg, data, size);
+    }
+    std::vector<std::pair<uint8_t, int> > writes;
+    int drop;
+    int reads;
+};
+
+static void
+testPidDiff() {
+    std::shared_ptr<WriteLogSimulator> sim(new WriteLogSimulator());
+    sim->AddBoard(Board1);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+    SmartDrive::PerformanceParameters params = {1000, 200, 300, 4000, 500, 600, 7, 8};
+    CHECK(drive.SetPerformanceParameters(1000, 200, 300, 4000, 500, 600, 7, 8) == mraa::SUCCESS);
+
+    //the board already holds them : one burst read, nothing written
+    sim->writes.clear();
+    sim->reads = 0;
+    SmartDriveResult<uint8_t> written = drive.ApplyPerformanceParameters(params);
+    CHECK(written.ok() && written.value() == 0);
+    CHECK(sim->writes.empty());
+    CHECK(sim->reads == 1);
+
+    //one byte : written alone, then the block read back
+    params.tolerance = 9;
+    sim->writes.clear();
+    sim->reads = 0;
+    written = drive.ApplyPerformanceParameters(params);
+    CHECK(written.ok() && written.value() == 1);
+    CHECK(sim->writes.size() == 1 && sim->writes[0] == std::make_pair((uint8_t) SmartDrive_PASSTOLERANCE, 1));
+    CHECK(sim->reads == 2);
+
+    //changes far apart go out separately, close ones in one write with the bytes between
+    params.Kp_tacho = 1001;       //0x5E
+    params.Ki_tacho = 200 + 256;  //0x61, two unchanged bytes away
+    params.Kd_speed = 600 + 256;  //0x69
+    sim->writes.clear();
+    written = drive.ApplyPerformanceParameters(params);
+    CHECK(written.ok() && written.value() == 5);
+    CHECK(sim->writes.size() == 2);
+    CHECK(sim->writes.size() == 2 && sim->writes[0] == std::make_pair((uint8_t) SmartDrive_P_Kp, 4));
+    CHECK(sim->writes.size() == 2 && sim->writes[1] == std::make_pair((uint8_t) (SmartDrive_S_Kd + 1), 1));
+
+    //the typed read-back, and the registers themselves
+    SmartDriveResult<SmartDrive::PerformanceParameters> read = drive.ReadPerformanceParameters();
+    CHECK(read.ok());
+    if (read.ok()) {
+        SmartDrive::PerformanceParameters back = read.value();
+        CHECK(memcmp(&back, &params, sizeof(params)) == 0);
+    }
+    CHECK(peekWord(*sim, Board1, SmartDrive_P_Kp) == 1001);
+    CHECK(peekWord(*sim, Board1, SmartDrive_P_Ki) == 456);
+    CHECK(peekWord(*sim, Board1, SmartDrive_S_Kd) == 856);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_PASSTOLERANCE) == 9);
+
+    //a byte the board did not take fails the verification
+    sim->drop = SmartDrive_PASSCOUNT;
+    params.passcount = 3;
+    written = drive.ApplyPerformanceParameters(params);
+    CHECK(!written.ok() && written.error() == mraa::ERROR_UNSPECIFIED);
+    sim->drop = -1;
+
+    //profiles : saved and loaded back, applied by name, malformed files refused whole
+    char path[] = "/tmp/smartdrivetest-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+    close(fd);
+    SmartDrivePidProfiles profiles;
+    SmartDrive::PerformanceParameters soft = {100, 10, 5, 2000, 100, 50, 5, 20};
+    CHECK(profiles.Set("soft", soft) == mraa::SUCCESS);
+    CHECK(profiles.Set("stiff", params) == mraa::SUCCESS);
+    CHECK(profiles.Set("bad name", soft) == mraa::ERROR_INVALID_PARAMETER);
+    CHECK(profiles.Save(path) == mraa::SUCCESS);
+
+    SmartDrivePidProfiles loaded;
+    CHECK(loaded.Load(path) == mraa::SUCCESS);
+    CHECK(loaded.GetNames().size() == 2);
+    SmartDrive::PerformanceParameters got;
+    CHECK(loaded.Get("soft", got) && memcmp(&got, &soft, sizeof(got)) == 0);
+    CHECK(loaded.Get("stiff", got) && memcmp(&got, &params, sizeof(got)) == 0);
+
+    written = loaded.Apply(drive, "soft");
+    CHECK(written.ok() && written.value() > 0);
+    written = loaded.Apply(drive, "soft");
+    CHECK(written.ok() && written.value() == 0);
+    written = loaded.Apply(drive, "none");
+    CHECK(!written.ok() && written.error() == mraa::ERROR_INVALID_PARAMETER);
+
+    FILE* file = fopen(path, "w");
+    CHECK(file != NULL);
+    if (file != NULL) {
+        fprintf(file, "# comment\n\nfast 1 2 3 4 5 6 7 8\nbroken 1 2 3 4 5 6 7 256\n");
+        fclose(file);
+    }
+    SmartDrivePidProfiles refused;
+    CHECK(refused.Load(path) == mraa::ERROR_INVALID_PARAMETER);
+    CHECK(refused.GetNames().empty());
+    unlink(path);
+    CHECK(refused.Load(path) == mraa::ERROR_INVALID_RESOURCE);
+}
+
+static void
+testDiscovery() {
+    //two buses with their own clock : boards at the ends of the range, one low on battery
+    std::shared_ptr<SmartDriveSimulator> simA(new SmartDriveSimulator());
+    std::shared_ptr<SmartDriveSimulator> simB(new SmartDriveSimulator());
+    simA->AddBoard(SmartDriveDisc_LAST_ADDRESS);
+    simA->AddBoard(SmartDriveDisc_FIRST_ADDRESS);
+    simB->AddBoard(Board2);
+    simB->SetBatteryVoltage(Board2, 6000.0f);
+    simB->AddBoard(0x10);   //outside the probe range
+    std::vector<std::shared_ptr<SmartDriveBus> > buses;
+    buses.push_back(std::make_shared<SmartDriveBus>(simA));
+    buses.push_back(std::make_shared<SmartDriveBus>(simB));
+    SmartDriveBus::RetryPolicy policy = buses[1]->GetRetryPolicy();
+
+    SmartDriveDiscovery discovery(buses);
+    SmartDriveDiscovery::Options options = SmartDriveDiscovery::DefaultOptions();
+    options.min_battery_mv = 9000.0f;
+    options.apply_pid = true;
+    SmartDrive::PerformanceParameters pid = {111, 222, 333, 444, 555, 666, 7, 8};
+    options.pid = pid;
+    discovery.SetOptions(options);
+
+    std::vector<SmartDriveDiscovery::Board> boards = discovery.Run();
+    CHECK(boards.size() == 3);
+    if (boards.size() != 3)
+        return;
+    //by bus, then address
+    CHECK(boards[0].bus == 0 && boards[0].address == SmartDriveDisc_FIRST_ADDRESS);
+    CHECK(boards[1].bus == 0 && boards[1].address == SmartDriveDisc_LAST_ADDRESS);
+    CHECK(boards[2].bus == 1 && boards[2].address == Board2);
+    for (int i = 0; i < 2; i++) {
+        CHECK(boards[i].result == mraa::SUCCESS);
+        CHECK(boards[i].firmware == SmartDriveSim_FIRMWARE);
+        CHECK(boards[i].vendor == SmartDriveSim_VENDOR);
+        CHECK(boards[i].device == SmartDriveSim_DEVICE);
+        CHECK(fabsf(boards[i].battery_mv - SmartDriveSim_BATTERY_MV) < 250.0f);
+        CHECK(boards[i].pid_written > 0);
+        CHECK(boards[i].drive && boards[i].drive->GetAddress() == boards[i].address);
+        CHECK(peekWord(*simA, boards[i].address, SmartDrive_S_Kd) == 666);
+    }
+    //found but not ready, nothing written to it
+    CHECK(boards[2].result == mraa::ERROR_INVALID_RESOURCE);
+    CHECK(boards[2].battery_mv > 5500.0f && boards[2].battery_mv < 6500.0f);
+    CHECK(boards[2].pid_written == 0);
+    CHECK(peekWord(*simB, Board2, SmartDrive_S_Kd) != 666);
+
+    SmartDriveDiscovery::Stats stats = discovery.GetStats();
+    uint32_t range = SmartDriveDisc_LAST_ADDRESS - SmartDriveDisc_FIRST_ADDRESS + 1;
+    CHECK(stats.buses == 2 && stats.boards == 3 && stats.ready == 2);
+    CHECK(stats.bus.size() == 2);
+    if (stats.bus.size() != 2)
+        return;
+    CHECK(stats.bus[0].probed == range && stats.bus[0].found == 2);
+    CHECK(stats.bus[1].probed == range && stats.bus[1].found == 1);
+    uint32_t totalA = stats.bus[0].open_us + stats.bus[0].probe_us + stats.bus[0].init_us;
+    uint32_t totalB = stats.bus[1].open_us + stats.bus[1].probe_us + stats.bus[1].init_us;
+    CHECK(stats.elapsed_us == std::max(totalA, totalB));
+    CHECK(stats.serial_us == totalA + totalB);
+    //one identification read and one failed address byte per empty address, no retries
+    CHECK(stats.bus[1].probe_us < 3500);
+    CHECK(buses[1]->GetRetryPolicy().attempts == policy.attempts);
+
+    //a second start finds the PID in place
+    boards = discovery.Run();
+    CHECK(boards.size() == 3 && boards[0].pid_written == 0 && boards[1].pid_written == 0);
+}
+
+static void
+testCommanderOrdering() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+    SmartDriveCommander commander(drive);
+
+    //park the bus thread so that everything below is taken as one batch
+    std::promise<void> gate;
+    std::shared_future<void> open = gate.get_future().share();
+    commander.Execute([open](SmartDrive&) { open.wait(); return mraa::SUCCESS; });
+
+    for (uint8_t speed = 10; speed <= 30; speed += 10)
+        commander.Run_Unlimited(Motor_ID_1, Dir_Forward, speed);
+    commander.StopMotor(Motor_ID_2, Action_Float);
+    commander.Run_Unlimited(Motor_ID_2, Dir_Forward, 40);
+    int seen = -1;
+    std::future<mraa::Result> call = commander.Execute([&seen, sim](SmartDrive&) {
+        seen = (int8_t) sim->PeekRegister(Board1, SmartDrive_SPEED_M1);
+        return mraa::SUCCESS;
+    });
+    //posted after the call : must not move ahead of it
+    commander.StopMotor(Motor_ID_1, Action_Brake);
+    commander.Run_Unlimited(Motor_ID_2, Dir_Reverse, 60);
+    commander.StopMotor(Motor_ID_2, Action_Brake);
+    gate.set_value();
+    CHECK(call.get() == mraa::SUCCESS);
+    commander.Flush();
+
+    //the call saw the newest setpoint posted before it, and the later stop was not issued yet
+    CHECK(seen == 30);
+    settle(*sim, 100);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_STATUS_M1) & SmartDrive_MOTOR_IN_BRAKE_MODE);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_STATUS_M2) & SmartDrive_MOTOR_IN_BRAKE_MODE);
+    CHECK((int8_t) sim->PeekRegister(Board1, SmartDrive_SPEED_M2) == 40);
+
+    SmartDriveCommander::Stats stats = commander.GetStats();
+    CHECK(stats.coalesced == 2);   //speeds 10 and 20
+    CHECK(stats.cancelled == 1);   //reverse 60, stopped right after
+    CHECK(stats.errors == 0);
+}
+
+static void
+testCommanderProducers() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+    const int producers = 4, calls = 2000;
+    std::vector<int> order[producers];
+    {
+        SmartDriveCommander commander(drive);
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; p++) {
+            threads.push_back(std::thread([&commander, &order, p] {
+                for (int i = 0; i < calls; i++) {
+                    //the calls run on the bus thread only, the vectors need no lock
+                    commander.Execute([&order, p, i](SmartDrive&) { order[p].push_back(i); return mraa::SUCCESS; });
+                    commander.Run_Unlimited((MotorID_t) (1 + (i & 1)), Dir_Forward, (uint8_t) (i % 100));
+                }
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+        commander.Flush();
+        SmartDriveCommander::Stats stats = commander.GetStats();
+        CHECK(stats.posted == (uint64_t) producers * calls * 2 + 1);
+        CHECK(stats.errors == 0);
+    }
+    //every call of every producer ran once, in the order it was posted
+    for (int p = 0; p < producers; p++) {
+        bool ordered = (int) order[p].size() == calls;
+        for (int i = 0; ordered && i < calls; i++)
+            ordered = order[p][i] == i;
+        CHECK(ordered);
+    }
+}
+
+static void
+testWriteElision() {
+    std::shared_ptr<WriteLogSimulator> sim(new WriteLogSimulator());
+    sim->AddBoard(Board1);
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+    SmartDrive drive(bus, Board1);
+
+    //off by default : every call goes out
+    for (int i = 0; i < 3; i++)
+        CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 50) == mraa::SUCCESS);
+    CHECK(sim->writes.size() == 3);
+    CHECK(drive.GetElidedWrites() == 0);
+
+    //a controller repeating its speed only writes the changes
+    drive.SetWriteElision(true);
+    sim->writes.clear();
+    for (int i = 0; i < 10; i++)
+        CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 50) == mraa::SUCCESS);
+    CHECK(sim->writes.size() == 1);
+    CHECK(drive.GetElidedWrites() == 9);
+    CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 60) == mraa::SUCCESS);
+    CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Reverse, 60) == mraa::SUCCESS);
+    CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Reverse, 60) == mraa::SUCCESS);
+    CHECK(sim->writes.size() == 3);
+    settle(*sim, 100);
+    CHECK((int8_t) sim->PeekRegister(Board1, SmartDrive_SPEED_M1) == -60);
+
+    //a stop halts the motor behind the shadow : the same speed must go out again
+    CHECK(drive.StopMotor(Motor_ID_1, Action_Brake) == mraa::SUCCESS);
+    sim->writes.clear();
+    CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Reverse, 60) == mraa::SUCCESS);
+    CHECK(sim->writes.size() == 1);
+    settle(*sim, 100);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_STATUS_M1) & SmartDrive_MOTOR_IS_POWERED);
+
+    //timed and tacho moves start a new move each time
+    sim->writes.clear();
+    CHECK(drive.Run_Seconds(Motor_ID_2, Dir_Forward, 30, 1, false, Action_Float) == mraa::SUCCESS);
+    CHECK(drive.Run_Seconds(Motor_ID_2, Dir_Forward, 30, 1, false, Action_Float) == mraa::SUCCESS);
+    CHECK(drive.Run_Tacho(Motor_ID_2, 30, 100, false, Action_Brake) == mraa::SUCCESS);
+    CHECK(drive.Run_Tacho(Motor_ID_2, 30, 100, false, Action_Brake) == mraa::SUCCESS);
+    CHECK(sim->writes.size() == 4);
+
+    //PID values already written
+    CHECK(drive.SetPerformanceParameters(1, 2, 3, 4, 5, 6, 7, 8) == mraa::SUCCESS);
+    sim->writes.clear();
+    CHECK(drive.SetPerformanceParameters(1, 2, 3, 4, 5, 6, 7, 8) == mraa::SUCCESS);
+    CHECK(sim->writes.empty());
+
+    //the shadow is dropped by hand, by a failed transfer and by a board reset
+    drive.InvalidateShadow();
+    CHECK(drive.SetPerformanceParameters(1, 2, 3, 4, 5, 6, 7, 8) == mraa::SUCCESS);
+    CHECK(sim->writes.size() == 1);
+
+    SmartDriveBus::RetryPolicy policy = bus->GetRetryPolicy();
+    SmartDriveBus::RetryPolicy once = policy;
+    once.attempts = 1;
+    once.reopen_after = 0;
+    bus->SetRetryPolicy(once);
+    sim->InjectErrors(1);
+    CHECK(drive.GetBattVoltage() < 0);
+    bus->SetRetryPolicy(policy);
+    CHECK(drive.SetPerformanceParameters(1, 2, 3, 4, 5, 6, 7, 8) == mraa::SUCCESS);
+    CHECK(sim->writes.size() == 2);
+
+    //the board restarted with its defaults, behind the driver's back
+    CHECK(sim->PeekRegister(Board1, SmartDrive_PASSCOUNT) == 7);
+    sim->ResetBoard(Board1);
+    CHECK(drive.ReadSnapshot().resetStatus != 0);
+    CHECK(drive.SetPerformanceParameters(1, 2, 3, 4, 5, 6, 7, 8) == mraa::SUCCESS);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_PASSCOUNT) == 7);
+    drive.StopMotor(Motor_ID_BOTH, Action_Float);
+}
+
+static void
+testPowerGovernor() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+    SmartDrive drive(bus, Board1);
+    SmartDrivePowerMonitor monitor(drive);
+
+    CHECK(drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 80) == mraa::SUCCESS);
+    settle(*sim, 200);
+    CHECK(monitor.Update() == mraa::SUCCESS);
+    SmartDrivePowerMonitor::Stats stats = monitor.GetStats();
+    CHECK(stats.cap == 100 && stats.limited_samples == 0);
+    CHECK(drive.GetSpeedCap() == 100);
+
+    //a sag caps the running command at once, linearly down to the floor at brownout
+    sim->SetBatteryVoltage(Board1, 9750.0f);
+    CHECK(monitor.Update() == mraa::SUCCESS);
+    stats = monitor.GetStats();
+    uint8_t expected = (uint8_t) (SmartDrivePower_MIN_CAP + (stats.battery_mv - SmartDrivePower_BROWNOUT_MV) /
+                                  (SmartDrivePower_SAG_MV - SmartDrivePower_BROWNOUT_MV) * (100 - SmartDrivePower_MIN_CAP));
+    CHECK(expected > SmartDrivePower_MIN_CAP && expected < 80);
+    CHECK(stats.cap == expected && drive.GetSpeedCap() == expected);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_SPEED_M1) == expected);
+    sim->SetBatteryVoltage(Board1, 8000.0f);
+    CHECK(monitor.Update() == mraa::SUCCESS);
+    CHECK(drive.GetSpeedCap() == SmartDrivePower_MIN_CAP);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_SPEED_M1) == SmartDrivePower_MIN_CAP);
+    CHECK(monitor.GetStats().min_battery_mv < 8000.0f);
+
+    //the recovery is rate limited
+    sim->SetBatteryVoltage(Board1, SmartDriveSim_BATTERY_MV);
+    settle(*sim, 1000);
+    CHECK(monitor.Update() == mraa::SUCCESS);
+    uint8_t recovered = drive.GetSpeedCap();
+    CHECK(recovered >= SmartDrivePower_MIN_CAP + 24 && recovered <= SmartDrivePower_MIN_CAP + 26);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_SPEED_M1) == recovered);
+    settle(*sim, 4000);
+    CHECK(monitor.Update() == mraa::SUCCESS);
+    CHECK(drive.GetSpeedCap() == 100);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_SPEED_M1) == 80);
+    stats = monitor.GetStats();
+    CHECK(stats.limited_samples == 3 && stats.samples == 5 && stats.read_errors == 0);
+
+    //two stalled motors draw past the current limit
+    CHECK(drive.Run_Unlimited(Motor_ID_BOTH, Dir_Forward, 100) == mraa::SUCCESS);
+    settle(*sim, 200);
+    sim->SetStalled(Board1, Motor_ID_1, true);
+    sim->SetStalled(Board1, Motor_ID_2, true);
+    CHECK(monitor.Update() == mraa::SUCCESS);
+    stats = monitor.GetStats();
+    CHECK(stats.peak_total_ma >= 2 * SmartDriveSim_STALL_MA);
+    expected = (uint8_t) (100 * SmartDrivePower_CURRENT_LIMIT_MA / (2 * SmartDriveSim_STALL_MA));
+    CHECK(drive.GetSpeedCap() == expected);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_SPEED_M2) == expected);
+    CHECK(stats.energy_j > 0.0 && stats.mean_power_w > 0.0f);
+
+    //measuring only releases the cap
+    SmartDrivePowerMonitor::Config config = monitor.GetConfig();
+    config.govern = false;
+    monitor.SetConfig(config);
+    CHECK(drive.GetSpeedCap() == 100);
+    CHECK(sim->PeekRegister(Board1, SmartDrive_SPEED_M2) == 100);
+    CHECK(monitor.Update() == mraa::SUCCESS);
+    CHECK(monitor.GetStats().cap < 100 && drive.GetSpeedCap() == 100);
+    sim->SetStalled(Board1, Motor_ID_1, false);
+    sim->SetStalled(Board1, Motor_ID_2, false);
+    drive.StopMotor(Motor_ID_BOTH, Action_Float);
+
+    //a restarted board is counted, a failed read is not a sample
+    sim->ResetBoard(Board1);
+    CHECK(monitor.Update() == mraa::SUCCESS);
+    sim->InjectErrors(100);
+    CHECK(monitor.Update() != mraa::SUCCESS);
+    sim->InjectErrors(0);
+    stats = monitor.GetStats();
+    CHECK(stats.resets == 1 && stats.read_errors == 1 && stats.samples == 8);
+
+    //trapezoidal integration of fed readings : 12 W for 2 s
+    monitor.ResetStats();
+    SmartDrive::PowerReading reading = SmartDrive::PowerReading();
+    reading.battery_mv = 12000.0f;
+    reading.current_ma[0] = reading.current_ma[1] = 500.0f;
+    monitor.Update(reading);
+    reading.timestamp += std::chrono::seconds(2);
+    monitor.Update(reading);
+    stats = monitor.GetStats();
+    CHECK(fabs(stats.energy_j - 24.0) < 1e-6);
+    CHECK(fabs(stats.charge_mah - 1000.0 * 2 / 3600) < 1e-6);
+    CHECK(fabsf(stats.mean_power_w - 12.0f) < 1e-4f);
+}
+
+static void
+testStateSegment() {
+    char name[64];
+    snprintf(name, sizeof(name), "/smartdrive-test-%d", (int) getpid());
+    bool thrown = false;
+    try {
+        SmartDriveStateReader missing(name);
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    sim->AddBoard(Board2);
+    std::shared_ptr<SmartDriveBus> bus(new SmartDriveBus(sim));
+    std::shared_ptr<SmartDrive> drive(new SmartDrive(bus, Board1));
+    std::shared_ptr<SmartDrive> other(new SmartDrive(bus, Board2));
+
+    {
+        SmartDriveStatePublisher publisher(name);
+        CHECK(publisher.AddBoard(drive, 3) == 0);
+        CHECK(publisher.AddBoard(other, 3) == 1);
+        SmartDriveStateReader reader(name);
+        SmartDriveSharedState state;
+        CHECK(reader.GetBoardCount() == 2);
+        CHECK(!reader.Read(0, state) && reader.GetSequence(0) == 0);
+
+        //a published snapshot reads back decoded, in its own slot only
+        CHECK(drive->Run_Unlimited(Motor_ID_1, Dir_Forward, 50) == mraa::SUCCESS);
+        settle(*sim, 200);
+        SmartDrive::Snapshot snap = drive->ReadSnapshot();
+        CHECK(snap.valid && snap.position[0] > 0);
+        CHECK(publisher.Publish(0, snap));
+        CHECK(reader.GetSequence(0) == 1 && reader.Read(0, state));
+        CHECK(state.sequence == 1 && state.bus == 3 && state.address == (uint8_t) drive->GetAddress());
+        CHECK(state.position[0] == snap.position[0] && state.position[1] == snap.position[1]);
+        CHECK(state.status[0] == snap.status[0] && state.tasks[0] == snap.tasks[0]);
+        CHECK(state.battery_mv == drive->BatteryMillivolts(snap.battVoltage));
+        CHECK(state.current_ma[0] == drive->CurrentMilliamps(snap.current[0]));
+        CHECK(state.timestamp_ns == (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        snap.timestamp.time_since_epoch()).count());
+        CHECK(!reader.Read(1, state) && !reader.Read(2, state));
+        drive->StopMotor(Motor_ID_1, Action_Float);
+
+        snap.valid = false;
+        CHECK(!publisher.Publish(0, snap) && !publisher.Publish(2, snap));
+        CHECK(reader.GetSequence(0) == 1);
+
+        //a reader racing the writer only ever accepts whole publications
+        const uint32_t count = 200000;
+        std::atomic<bool> done(false);
+        std::thread writer([&] {
+            SmartDrive::Snapshot fed = SmartDrive::Snapshot();
+            fed.valid = true;
+            for (uint32_t k = 1; k <= count; k++) {
+                fed.position[0] = k;
+                fed.position[1] = ~k;
+                fed.status[0] = fed.tasks[1] = (uint8_t) k;
+                fed.current[1] = (uint16_t) k;
+                fed.timestamp = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(k));
+                publisher.Publish(1, fed);
+            }
+            done = true;
+        });
+        uint64_t reads = 0, torn = 0, last = 0, backwards = 0;
+        while (!done.load() || last < count) {
+            if (!reader.Read(1, state))
+                continue;
+            reads++;
+            uint32_t k = state.position[0];
+            if (state.position[1] != ~k || state.status[0] != (uint8_t) k || state.tasks[1] != (uint8_t) k ||
+                state.timestamp_ns != k || state.sequence != k)
+                torn++;
+            if (state.sequence < last)
+                backwards++;
+            last = state.sequence;
+        }
+        writer.join();
+        CHECK(reads > 0 && torn == 0 && backwards == 0);
+        CHECK(last == count && reader.GetSequence(1) == count);
+        CHECK(publisher.GetStats().publications == count + 1);
+
+        //the publisher thread reads and publishes every board
+        CHECK(publisher.Start(0) == mraa::ERROR_INVALID_PARAMETER);
+        CHECK(publisher.Start(100) == mraa::SUCCESS);
+        CHECK(publisher.Start(100) == mraa::ERROR_INVALID_RESOURCE);
+        CHECK(publisher.AddBoard(drive) == -1);
+        for (int i = 0; i < 500 && reader.GetSequence(0) < 4; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        publisher.Stop();
+        CHECK(reader.GetSequence(0) >= 4 && reader.GetSequence(1) > count);
+        CHECK(reader.Read(1, state) && state.address == (uint8_t) other->GetAddress());
+        CHECK(publisher.GetStats().read_errors == 0);
+    }
+
+    //the name is gone with the publisher
+    thrown = false;
+    try {
+        SmartDriveStateReader gone(name);
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+static void
+testLoopAccounting() {
+    std::shared_ptr<SmartDriveSimulator> sim(new SmartDriveSimulator());
+    sim->AddBoard(Board1);
+    SmartDrive drive(std::shared_ptr<SmartDriveBus>(new SmartDriveBus(sim)), Board1);
+    drive.Run_Unlimited(Motor_ID_1, Dir_Forward, 50);
+
+    //100 Hz, cycle 5 overruns by 35 ms of bus time
+    std::atomic<uint64_t> valid(0);
+    SmartDriveLoop loop(drive, 100, [&](const SmartDrive::Snapshot& snap, uint64_t cycle) {
+        if (snap.valid)
+            valid++;
+        if (cycle == 5)
+            sim->Advance(std::chrono::milliseconds(35));
+    });
+    loop.SetPriority(0);
+    std::chrono::steady_clock::time_point start = sim->now();
+    CHECK(loop.Start() == mraa::SUCCESS);
+    CHECK(loop.Start() == mraa::ERROR_INVALID_RESOURCE);
+    while (loop.GetStats().cycles < 20)
+        std::this_thread::yield();
+    loop.Stop();
+
+    SmartDriveLoop::Stats stats = loop.GetStats();
+    CHECK(!stats.memory_locked);   //process-wide, only on request
+    CHECK(!stats.realtime);
+    CHECK(stats.read_errors == 0);
+    CHECK(valid == stats.cycles);
+    //the slow cycle ends within its fourth period : one miss, three deadlines dropped
+    CHECK(stats.deadline_misses == 1);
+    CHECK(stats.skipped == 3);
+    CHECK(stats.latency.max_ns >= 35000000ULL);
+    CHECK(stats.jitter.max_ns == 0);
+    CHECK(stats.jitter.count == stats.cycles);
+    //cycles land on the bus clock, the dropped deadlines included
+    int64_t elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(sim->now() - start).count();
+    CHECK(elapsed_ms >= (int64_t) (stats.cycles + stats.skipped) * 10);
+    CHECK(elapsed_ms < (int64_t) (stats.cycles + stats.skipped + 1) * 10);
+
+    loop.ResetStats();
+    CHECK(loop.GetStats().cycles == 0);
+    CHECK(loop.GetStats().latency.count == 0);
+}
+
+static void
+testTraceExit() {
+    //a program leaving with the formatter running must still exit cleanly
+    fflush(NULL);
+    pid_t child = fork();
+    if (child == 0) {
+        FILE* out = fopen("/dev/null", "w");
+        SmartDriveTrace::StartFormatter(out, 1);
+        SMARTDRIVE_WARN("exiting with the formatter running, %lld", 1LL);
+        exit(0);
+    }
+    int status = 0;
+    CHECK(child > 0 && waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+//holds the bus inside its first read until released, so that callers queue up behind it
+class GatedSimulator : public SmartDriveSimulator {
+public:
+    GatedSimulator() : gate(true), entered(false) {}
+    int readReg(uint8_t reg) {
+        entered = true;
+        while (gate)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return SmartDriveSimulator::readReg(reg);
+    }
+    std::atomic<bool> gate;
+    std::atomic<bool> entered;
+};
+
+static void
+waitQueued(SmartDriveBus& bus, uint32_t depth) {
+    for (int i = 0; i < 1000 && bus.GetStats().max_queue_depth < depth; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static void
+testBusReorder() {
+    std::shared_ptr<GatedSimulator> sim(new GatedSimulator());
+    sim->AddBoard(Board1);
+    sim->AddBoard(Board2);
+    SmartDriveBus bus(sim);
+    uint8_t id[4];
+    bus.readBytesReg(Board2, SmartDrive_FIRMWARE_VERSION, id, 4);
+
+    //Board1 is selected while the other board's call waits ahead of Board1's second one
+    int results[3] = {0, 0, 0};
+    std::thread first([&] { results[0] = bus.readReg(Board1, SmartDrive_BATT_VOLTAGE); });
+    while (!sim->entered)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    //the first call left the queue, the depths below count the waiting ones only
+    bus.ResetStats();
+    std::thread other([&] { results[1] = bus.readBytesReg(Board2, SmartDrive_FIRMWARE_VERSION, id, 4); });
+    waitQueued(bus, 1);
+    std::thread second([&] { results[2] = bus.readBytesReg(Board1, SmartDrive_FIRMWARE_VERSION, id, 4); });
+    waitQueued(bus, 2);
+    sim->gate = false;
+    first.join();
+    other.join();
+    second.join();
+
+    SmartDriveBus::Stats stats = bus.GetStats();
+    CHECK(results[0] > 0);
+    CHECK(results[1] == 4);
+    CHECK(results[2] == 4);
+    CHECK(stats.reordered == 1);
+    //Board1 once, counted when the first call returned, Board2 once : the reordered call did not switch back
+    CHECK(stats.address_switches == 2);
+    CHECK(stats.address_skipped >= 1);
+}
+
+int
+main() {
+    testSnapshotDecode();
+    testSyncGo();
+    testStatusAndTacho();
+    testBusRetry();
+    testFailedMove();
+    testAdaptiveWait();
+    testAsyncMoves();
+    testSampler();
+    testLogReplay();
+    testBusReorder();
+    testStreamer();
+    testStreamerLate();
+    testCoordinator();
+    testCoordinatorStopRace();
+    testEstimator();
+    testPidDiff();
+    testDiscovery();
+    testCommanderOrdering();
+    testCommanderProducers();
+    testWriteElision();
+    testPowerGovernor();
+    testStateSegment();
+    testLoopAccounting();
+    testTraceExit();
+    if (failures == 0)
+        printf("all tests passed\n");
+    else
+        printf("%d checks failed\n", failures);
+    return failures;
+}